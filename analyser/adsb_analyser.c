@@ -3,31 +3,102 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <math.h>
 #include <mosquitto.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
+#include <brotli/encode.h>
 #include <cjson/cJSON.h>
+#include <inttypes.h>
 
+#include "adsb_shm.h"
+
+#define MIN(a, b)                        ((a) < (b) ? (a) : (b))
 #define MAX(a, b)                        ((a) > (b) ? (a) : (b))
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+// USDT (sys/sdt.h) static probes, provider "adsb_analyser": each is a nop behind a semaphore test, and compiles away entirely
+// without systemtap-sdt-dev (or with -DADSB_NO_PROBES); list with 'bpftrace -l "usdt:./adsb_analyser:*"', for example
+//   bpftrace -e 'usdt:./adsb_analyser:adsb_analyser:publish_start { @s = nsecs; }
+//                usdt:./adsb_analyser:adsb_analyser:publish_end { @us = hist((nsecs - @s) / 1000); @bytes = hist(arg0); }'
+//
+//   message_parsed(line, type)                            every framed line, type=1..8 for a decoded MSG, 0 otherwise
+//   position_accepted(icao, lat_e6, lon_e6, altitude_ft)  position passed validation
+//   position_rejected(icao, lat_e6, lon_e6, altitude_ft)  position failed validation (range, altitude, coordinates or track)
+//   aircraft_created(icao, count)                         new hash table entry
+//   aircraft_prune_start(count), aircraft_prune_end(count, removed), aircraft_pruned(icao)
+//   voxel_created(x, y, z)                                first hit in a voxel cell
+//   publish_start(aircraft), publish_end(bytes, ok)       aircraft_publish_mqtt encode and send
+//   persist_start(index), persist_end(index, ok)          each persist function (0 = voxel map, 1 = stats)
+//   adsb_disconnect(reason), adsb_connect(fd)             reason: 0 = idle timeout, 1 = closed by remote, 2 = recv errors
+
+//
+// each probe has a semaphore that the tracer increments while attached, and arguments are only evaluated when it is non zero, so
+// an unattached probe is a load and a predicted branch around the nop (PROBE_E6 conversions, strlen and the like included)
+
+#if defined(__has_include) && !defined(ADSB_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define ADSB_PROBES
+#endif
+#endif
+#ifdef ADSB_PROBES
+#define PROBE_SEMAPHORE(name)            __extension__ unsigned short adsb_analyser_##name##_semaphore __attribute__((unused, section(".probes")))
+PROBE_SEMAPHORE(message_parsed);
+PROBE_SEMAPHORE(position_accepted);
+PROBE_SEMAPHORE(position_rejected);
+PROBE_SEMAPHORE(aircraft_created);
+PROBE_SEMAPHORE(aircraft_prune_start);
+PROBE_SEMAPHORE(aircraft_prune_end);
+PROBE_SEMAPHORE(aircraft_pruned);
+PROBE_SEMAPHORE(voxel_created);
+PROBE_SEMAPHORE(publish_start);
+PROBE_SEMAPHORE(publish_end);
+PROBE_SEMAPHORE(persist_start);
+PROBE_SEMAPHORE(persist_end);
+PROBE_SEMAPHORE(adsb_disconnect);
+PROBE_SEMAPHORE(adsb_connect);
+#define PROBE_ENABLED(name)              __builtin_expect(adsb_analyser_##name##_semaphore != 0, 0)
+#define PROBE1(name, a)                  do { if (PROBE_ENABLED(name)) DTRACE_PROBE1(adsb_analyser, name, a); } while (0)
+#define PROBE2(name, a, b)               do { if (PROBE_ENABLED(name)) DTRACE_PROBE2(adsb_analyser, name, a, b); } while (0)
+#define PROBE3(name, a, b, c)            do { if (PROBE_ENABLED(name)) DTRACE_PROBE3(adsb_analyser, name, a, b, c); } while (0)
+#define PROBE4(name, a, b, c, d)         do { if (PROBE_ENABLED(name)) DTRACE_PROBE4(adsb_analyser, name, a, b, c, d); } while (0)
+#else
+#define PROBE1(name, a)                  ((void)sizeof(a))
+#define PROBE2(name, a, b)               ((void)sizeof(a), (void)sizeof(b))
+#define PROBE3(name, a, b, c)            ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define PROBE4(name, a, b, c, d)         ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+#endif
+#define PROBE_E6(v)                      ((long)((v) * 1e6))
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
 #define DEFAULT_DIRECTORY                "/opt/tracking-adsb/analyser"
 #define DEFAULT_ADSB_HOST                "127.0.0.1"
 #define DEFAULT_ADSB_PORT                30003
+#define DEFAULT_ADSB_PORT_AVR            30002
 #define DEFAULT_MQTT_HOST                "127.0.0.1"
 #define DEFAULT_MQTT_PORT                1883
 #define DEFAULT_MQTT_TOPIC               "adsb/analyser"
@@ -41,6 +112,18 @@
 #define DEFAULT_ALTITUDE_MIN_FT          -1500
 #define DEFAULT_VOXEL_SIZE_HORIZONTAL_NM 2.0
 #define DEFAULT_VOXEL_SIZE_VERTICAL_FT   2000.0
+#define DEFAULT_TIMING_SAMPLE            100
+#define DEFAULT_LOG_SAMPLE               1
+#define DEFAULT_LOG_RATE                 100
+#define DEFAULT_AIRPROX_HORIZONTAL_NM    1.0
+#define DEFAULT_AIRPROX_VERTICAL_FT      1000
+#define DEFAULT_LOITER_SCORE             0.7
+#define DEFAULT_VICINITY_RADIUS_NM       5.0
+#define DEFAULT_VICINITY_ALTITUDE_FT     10000
+#define DEFAULT_ANOMALY_WINDOW           30
+#define DEFAULT_TRACK_GATE               5.0
+#define DEFAULT_AIRPORT_RANGE_NM         10.0
+#define DEFAULT_AIRPORT_RANGE_FT         5000
 //
 #define DEFAULT_VOXEL_SAVE_NAME          "adsb_voxel_map.dat"
 #define DEFAULT_STATS_SAVE_NAME          "adsb_stats.json"
@@ -51,6 +134,8 @@
 
 #define MAX_NAME_LENGTH                  256
 #define MAX_LINE_LENGTH                  512
+#define RECV_BUFFER_LENGTH               8192
+#define SINKS_MAX                        8
 
 #define MAX_AIRCRAFT                     32768
 #define HASH_MASK                        (MAX_AIRCRAFT - 1)
@@ -70,10 +155,18 @@
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+typedef enum {
+    ADSB_FORMAT_SBS = 0,
+    ADSB_FORMAT_AVR,
+    ADSB_FORMAT_COUNT
+} adsb_format_t;
+
 typedef struct {
     char directory[MAX_NAME_LENGTH];
     char adsb_host[MAX_NAME_LENGTH];
     unsigned short adsb_port;
+    adsb_format_t adsb_format;
+    bool adsb_correct;
     char mqtt_host[MAX_NAME_LENGTH];
     unsigned short mqtt_port;
     char mqtt_topic[MAX_NAME_LENGTH];
@@ -86,6 +179,29 @@ typedef struct {
     double voxel_size_vertical_ft;
     double position_lat;
     double position_lon;
+    int station_altitude_ft;
+    unsigned int timing_sample;
+    char log_categories[MAX_NAME_LENGTH];
+    unsigned int log_sample;
+    unsigned int log_rate;
+    char shm_name[MAX_NAME_LENGTH];
+    double airprox_horizontal_nm;
+    int airprox_vertical_ft;
+    double loiter_score;
+    double vicinity_radius_nm;
+    int vicinity_altitude_ft;
+    int anomaly_window;
+    double track_gate;
+    char icaodb_path[MAX_NAME_LENGTH];
+    char icao_blocks_path[MAX_NAME_LENGTH];
+    char airports_path[MAX_NAME_LENGTH];
+    double airport_range_nm;
+    int airport_range_ft;
+    char airspace_path[MAX_NAME_LENGTH];
+    char sinks[SINKS_MAX][MAX_NAME_LENGTH];
+    int sinks_count;
+    char serve[MAX_NAME_LENGTH];
+    char http[MAX_NAME_LENGTH];
     bool debug;
 } config_t;
 
@@ -100,12 +216,50 @@ typedef struct {
     time_t timestamp;
 } aircraft_posn_t;
 
+// the latest of every SBS field other than position, packed: callsign is space padded and not terminated, track is in tenths of a
+// degree, squawk is the four octal digits as binary, and valid marks which fields have been seen at all
+#define AIRCRAFT_STATE_CALLSIGN      0x0001
+#define AIRCRAFT_STATE_ALTITUDE      0x0002
+#define AIRCRAFT_STATE_SPEED         0x0004
+#define AIRCRAFT_STATE_TRACK         0x0008
+#define AIRCRAFT_STATE_VERTICAL_RATE 0x0010
+#define AIRCRAFT_STATE_SQUAWK        0x0020
+#define AIRCRAFT_STATE_ALERT         0x0040
+#define AIRCRAFT_STATE_EMERGENCY     0x0080
+#define AIRCRAFT_STATE_SPI           0x0100
+#define AIRCRAFT_STATE_GROUND        0x0200
+#define AIRCRAFT_STATE_POSITION      0x0400
+
+#define AIRCRAFT_FLAG_ALERT          0x01
+#define AIRCRAFT_FLAG_EMERGENCY      0x02
+#define AIRCRAFT_FLAG_SPI            0x04
+#define AIRCRAFT_FLAG_GROUND         0x08
+
+typedef struct {
+    char callsign[8];
+    int32_t altitude_ft;
+    int16_t ground_speed;
+    int16_t track;
+    int16_t vertical_rate;
+    uint16_t squawk;
+    uint16_t valid;
+    uint8_t flags;
+    uint8_t type;
+    uint32_t messages;
+    time_t seen, velocity_seen;
+} aircraft_state_t;
+
 typedef struct {
     char icao[7];
     aircraft_posn_t pos, pos_first;
     aircraft_posn_t min_lat_pos, max_lat_pos, min_lon_pos, max_lon_pos, min_alt_pos, max_alt_pos, min_dist_pos, max_dist_pos;
     bool bounds_initialised;
+    uint16_t origin;  // ICAO_BLOCKS_* country and military, from the address
+    uint32_t airport; // nearest airports record while low and near one, AIRPORTS_NONE otherwise
+    float airport_distance_nm, airport_bearing_deg;
     time_t published;
+    unsigned long long updated_ns;
+    aircraft_state_t state;
 } aircraft_data_t;
 
 typedef struct {
@@ -126,17 +280,34 @@ typedef struct {
     unsigned long position_invalid;
     unsigned long published_mqtt;
     unsigned long aircraft_seen;
+    unsigned long military_seen;
     aircraft_stat_posn_t distance_max;
     aircraft_stat_posn_t altitude_max;
 } aircraft_stat_t;
 
+// one decoded SBS line, present uses the AIRCRAFT_STATE_* bits and flags the AIRCRAFT_FLAG_* bits
+typedef struct {
+    int type;
+    char icao[7];
+    unsigned int present;
+    char callsign[8];
+    int altitude_ft;
+    double ground_speed, track;
+    double lat, lon;
+    int vertical_rate;
+    unsigned int squawk;
+    unsigned char flags;
+} adsb_message_t;
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
 config_t g_config = {
     .directory                = DEFAULT_DIRECTORY,
     .adsb_host                = DEFAULT_ADSB_HOST,
-    .adsb_port                = DEFAULT_ADSB_PORT,
+    .adsb_port                = 0,
+    .adsb_format              = ADSB_FORMAT_SBS,
+    .adsb_correct             = false,
     .mqtt_host                = DEFAULT_MQTT_HOST,
     .mqtt_port                = DEFAULT_MQTT_PORT,
     .mqtt_topic               = DEFAULT_MQTT_TOPIC,
@@ -149,8 +320,37 @@ config_t g_config = {
     .voxel_size_vertical_ft   = DEFAULT_VOXEL_SIZE_VERTICAL_FT,
     .position_lat             = DEFAULT_POSITION_LAT,
     .position_lon             = DEFAULT_POSITION_LON,
+    .station_altitude_ft      = 0,
+    .timing_sample            = DEFAULT_TIMING_SAMPLE,
+    .log_categories           = "",
+    .log_sample               = DEFAULT_LOG_SAMPLE,
+    .log_rate                 = DEFAULT_LOG_RATE,
+    .shm_name                 = "",
+    .airprox_horizontal_nm    = DEFAULT_AIRPROX_HORIZONTAL_NM,
+    .airprox_vertical_ft      = DEFAULT_AIRPROX_VERTICAL_FT,
+    .loiter_score             = DEFAULT_LOITER_SCORE,
+    .vicinity_radius_nm       = DEFAULT_VICINITY_RADIUS_NM,
+    .vicinity_altitude_ft     = DEFAULT_VICINITY_ALTITUDE_FT,
+    .anomaly_window           = DEFAULT_ANOMALY_WINDOW,
+    .track_gate               = DEFAULT_TRACK_GATE,
+    .icaodb_path              = "",
+    .icao_blocks_path         = "",
+    .airports_path            = "",
+    .airport_range_nm         = DEFAULT_AIRPORT_RANGE_NM,
+    .airport_range_ft         = DEFAULT_AIRPORT_RANGE_FT,
+    .airspace_path            = "",
+    .sinks_count              = 0,
+    .serve                    = "",
     .debug                    = false,
 };
+// the port is 0 until options are parsed, then the format's default unless one was given
+const struct {
+    const char *name;
+    unsigned short port;
+} adsb_formats[ADSB_FORMAT_COUNT] = {
+    { "sbs", DEFAULT_ADSB_PORT },
+    { "avr", DEFAULT_ADSB_PORT_AVR },
+};
 aircraft_list_t g_aircraft_list   = { 0 };
 aircraft_stat_t g_aircraft_stat   = { 0 };
 aircraft_stat_t g_aircraft_global = { 0 };
@@ -207,6 +407,12 @@ double calculate_distance_nm(const double lat1, const double lon1, const double
     return 3440.065 * c;
 }
 
+double calculate_bearing_deg(const double lat1, const double lon1, const double lat2, const double lon2) {
+    const double lat1_rad = lat1 * M_PI / 180.0, lat2_rad = lat2 * M_PI / 180.0, dlon_rad = (lon2 - lon1) * M_PI / 180.0;
+    const double bearing = atan2(sin(dlon_rad) * cos(lat2_rad), cos(lat1_rad) * sin(lat2_rad) - sin(lat1_rad) * cos(lat2_rad) * cos(dlon_rad));
+    return fmod(bearing * 180.0 / M_PI + 360.0, 360.0);
+}
+
 unsigned int hash_icao(const char *const icao) {
     unsigned int hash = 0;
     for (int i = 0; i < 6 && icao[i]; i++)
@@ -241,13 +447,468 @@ static bool interval_wait(time_t *const last, const time_t interval, volatile bo
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+// log-bucketed (HDR style) histograms: values below 2*SUB_COUNT are exact, above that each power of two is split into SUB_COUNT
+// linear sub-buckets, so relative error is bounded at 1/SUB_COUNT (~6%) across the full 64 bit nanosecond range
+
+#define TIMING_HISTOGRAM_SUB_BITS  4
+#define TIMING_HISTOGRAM_SUB_COUNT (1 << TIMING_HISTOGRAM_SUB_BITS)
+#define TIMING_HISTOGRAM_BUCKETS   ((64 - TIMING_HISTOGRAM_SUB_BITS + 1) * TIMING_HISTOGRAM_SUB_COUNT)
+
+typedef enum {
+    TIMING_STAGE_RECV = 0,
+    TIMING_STAGE_FRAME,
+    TIMING_STAGE_PARSE,
+    TIMING_STAGE_UPDATE,
+    TIMING_STAGE_VOXEL,
+    TIMING_STAGE_ENCODE,
+    TIMING_STAGE_PUBLISH,
+    TIMING_STAGE_AGE,
+    TIMING_STAGE_COUNT
+} timing_stage_t;
+
+const char *const timing_stage_names[TIMING_STAGE_COUNT] = { "recv", "frame", "parse", "update", "voxel", "encode", "publish", "age" };
+
+typedef struct {
+    unsigned long count;
+    unsigned long long sum, max;
+    unsigned long buckets[TIMING_HISTOGRAM_BUCKETS];
+} timing_histogram_t;
+
+typedef struct {
+    timing_histogram_t histograms[TIMING_STAGE_COUNT];
+    timing_histogram_t previous[TIMING_STAGE_COUNT], interval[TIMING_STAGE_COUNT];
+    volatile bool enabled;
+    unsigned int sample_rate, sample_counter;
+    bool sampled;
+    unsigned long long recv_ns;
+} timing_t;
+
+timing_t g_timing = { .enabled = true, .sample_rate = DEFAULT_TIMING_SAMPLE };
+
+static inline unsigned long long timing_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static inline unsigned int timing_histogram_index(const unsigned long long value) {
+    if (value < 2 * TIMING_HISTOGRAM_SUB_COUNT)
+        return (unsigned int)value;
+    const unsigned int msb = 63 - (unsigned int)__builtin_clzll(value);
+    return (msb - TIMING_HISTOGRAM_SUB_BITS + 1) * TIMING_HISTOGRAM_SUB_COUNT +
+           (unsigned int)((value >> (msb - TIMING_HISTOGRAM_SUB_BITS)) & (TIMING_HISTOGRAM_SUB_COUNT - 1));
+}
+
+static unsigned long long timing_histogram_value(const unsigned int index) {
+    if (index < 2 * TIMING_HISTOGRAM_SUB_COUNT)
+        return index;
+    const unsigned int msb = index / TIMING_HISTOGRAM_SUB_COUNT + TIMING_HISTOGRAM_SUB_BITS - 1, sub = index % TIMING_HISTOGRAM_SUB_COUNT;
+    return ((unsigned long long)(TIMING_HISTOGRAM_SUB_COUNT + sub + 1) << (msb - TIMING_HISTOGRAM_SUB_BITS)) - 1;
+}
+
+static inline void timing_histogram_record(timing_histogram_t *const h, const unsigned long long value) {
+    h->buckets[timing_histogram_index(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+unsigned long long timing_histogram_percentile(const timing_histogram_t *const h, const double percentile) {
+    if (h->count == 0)
+        return 0;
+    const unsigned long target = (unsigned long)ceil((double)h->count * percentile / 100.0);
+    unsigned long total        = 0;
+    for (unsigned int i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++)
+        if ((total += h->buckets[i]) >= target) {
+            const unsigned long long value = timing_histogram_value(i);
+            return value < h->max ? value : h->max;
+        }
+    return h->max;
+}
+
+// the processing thread only ever adds to the cumulative histograms, so each status interval is reported as the difference from
+// the previous snapshot rather than by clearing them under the writer; the interval max is the top of the highest bucket hit
+static void timing_histogram_rotate(timing_histogram_t *const interval, const timing_histogram_t *const current, timing_histogram_t *const previous) {
+    const unsigned long long sum = current->sum, max = current->max;
+    interval->count = 0;
+    interval->max   = 0;
+    for (unsigned int i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++) {
+        const unsigned long bucket = current->buckets[i];
+        interval->buckets[i]       = bucket - previous->buckets[i];
+        previous->buckets[i]       = bucket;
+        if (interval->buckets[i] > 0) {
+            interval->count += interval->buckets[i];
+            interval->max = timing_histogram_value(i);
+        }
+    }
+    if (interval->max > max)
+        interval->max = max;
+    interval->sum = sum - previous->sum;
+    previous->sum = sum;
+}
+
+void timing_rotate(void) {
+    for (int stage = 0; stage < TIMING_STAGE_COUNT; stage++)
+        timing_histogram_rotate(&g_timing.interval[stage], &g_timing.histograms[stage], &g_timing.previous[stage]);
+}
+
+// the sampling decision is made once per unit of work (recv, line, publish cycle) by the processing thread, then the stages within
+// that unit either all measure or all skip, so an unsampled stage costs one predictable branch
+static inline bool timing_sample(void) {
+    if (!g_timing.enabled || g_timing.sample_rate == 0)
+        return (g_timing.sampled = false);
+    if (++g_timing.sample_counter >= g_timing.sample_rate)
+        g_timing.sample_counter = 0;
+    return (g_timing.sampled = (g_timing.sample_counter == 0));
+}
+
+static inline bool timing_sample_always(void) { return (g_timing.sampled = (g_timing.enabled && g_timing.sample_rate > 0)); }
+
+static inline unsigned long long timing_start(void) { return g_timing.sampled ? timing_now_ns() : 0; }
+
+static inline void timing_stop(const timing_stage_t stage, const unsigned long long start) {
+    if (start)
+        timing_histogram_record(&g_timing.histograms[stage], timing_now_ns() - start);
+}
+
+static inline void timing_record(const timing_stage_t stage, const unsigned long long value) { timing_histogram_record(&g_timing.histograms[stage], value); }
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// hot path logging: LOG() costs one relaxed load and a branch while its category is below the level; when enabled the record is
+// sampled (1 in N) and rate limited (per second window), formatted by the caller into a slot of a bounded lock-free MPSC ring
+// (sequence numbered slots, producers claim with a CAS on the tail) and written out by a background thread, so a slow stdout or
+// journal never stalls the processing thread, and when the ring is full records are counted as dropped rather than waited for
+
+#define LOG_RING_SIZE      1024
+#define LOG_TEXT_LENGTH    256
+#define LOG_WRITER_IDLE_MS 10
+
+typedef enum {
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_TRACE,
+    LOG_LEVEL_COUNT
+} log_level_t;
+
+typedef enum {
+    LOG_CATEGORY_ADSB = 0,
+    LOG_CATEGORY_POSITION,
+    LOG_CATEGORY_AIRCRAFT,
+    LOG_CATEGORY_VOXEL,
+    LOG_CATEGORY_AIRPROX,
+    LOG_CATEGORY_LOITERING,
+    LOG_CATEGORY_VICINITY,
+    LOG_CATEGORY_AIRSPACE,
+    LOG_CATEGORY_ANOMALY,
+    LOG_CATEGORY_COUNT
+} log_category_t;
+
+const char *const log_level_names[LOG_LEVEL_COUNT]       = { "off", "info", "debug", "trace" };
+const char *const log_category_names[LOG_CATEGORY_COUNT] = { "adsb",     "position", "aircraft", "voxel",  "airprox",
+                                                              "loitering", "vicinity", "airspace", "anomaly" };
+
+typedef struct {
+    int level, level_saved;
+    unsigned int sample_rate, rate_limit;
+    unsigned long sample_counter;
+    time_t rate_window;
+    unsigned int rate_count;
+    unsigned long written, sampled_out, rate_limited, dropped;
+} log_category_state_t;
+
+typedef struct {
+    unsigned long sequence;
+    unsigned char category, level;
+    char text[LOG_TEXT_LENGTH];
+} log_record_t;
+
+typedef struct {
+    log_category_state_t categories[LOG_CATEGORY_COUNT];
+    log_record_t ring[LOG_RING_SIZE];
+    unsigned long head, tail;
+    bool running, started;
+    pthread_t writer;
+} log_t;
+
+log_t g_log;
+
+static inline bool log_check(const log_category_t category, const log_level_t level) {
+    log_category_state_t *const c = &g_log.categories[category];
+    if (__atomic_load_n(&c->level, __ATOMIC_RELAXED) < (int)level)
+        return false;
+    const unsigned int sample_rate = __atomic_load_n(&c->sample_rate, __ATOMIC_RELAXED);
+    if (sample_rate > 1 && __atomic_fetch_add(&c->sample_counter, 1, __ATOMIC_RELAXED) % sample_rate != 0) {
+        __atomic_fetch_add(&c->sampled_out, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    const unsigned int rate_limit = __atomic_load_n(&c->rate_limit, __ATOMIC_RELAXED);
+    if (rate_limit > 0) {
+        // the window reset races between producers, which at worst lets a few extra records through at the boundary
+        const time_t now = time(NULL);
+        if (__atomic_load_n(&c->rate_window, __ATOMIC_RELAXED) != now) {
+            __atomic_store_n(&c->rate_window, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->rate_count, 0, __ATOMIC_RELAXED);
+        }
+        if (__atomic_fetch_add(&c->rate_count, 1, __ATOMIC_RELAXED) >= rate_limit) {
+            __atomic_fetch_add(&c->rate_limited, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+    return true;
+}
+
+__attribute__((format(printf, 3, 4))) void log_write(const log_category_t category, const log_level_t level, const char *const format, ...) {
+    unsigned long tail = __atomic_load_n(&g_log.tail, __ATOMIC_RELAXED);
+    log_record_t *record;
+    while (true) {
+        record                       = &g_log.ring[tail & (LOG_RING_SIZE - 1)];
+        const unsigned long sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+        const long difference        = (long)(sequence - tail);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&g_log.tail, &tail, tail + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (difference < 0) {
+            __atomic_fetch_add(&g_log.categories[category].dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else
+            tail = __atomic_load_n(&g_log.tail, __ATOMIC_RELAXED);
+    }
+    record->category = (unsigned char)category;
+    record->level    = (unsigned char)level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->text, sizeof(record->text), format, args);
+    va_end(args);
+    __atomic_store_n(&record->sequence, tail + 1, __ATOMIC_RELEASE);
+}
+
+#define LOG(category, level, ...)                                                                                                                              \
+    do {                                                                                                                                                       \
+        if (log_check(category, level))                                                                                                                        \
+            log_write(category, level, __VA_ARGS__);                                                                                                           \
+    } while (0)
+
+static int log_drain(void) {
+    int drained = 0;
+    while (true) {
+        log_record_t *const record = &g_log.ring[g_log.head & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != g_log.head + 1)
+            break;
+        printf("%s: %s: %s\n", log_level_names[record->level], log_category_names[record->category], record->text);
+        __atomic_fetch_add(&g_log.categories[record->category].written, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&record->sequence, g_log.head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        g_log.head++;
+        drained++;
+    }
+    return drained;
+}
+
+static void *log_writer_thread(void *arg __attribute__((unused))) {
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = LOG_WRITER_IDLE_MS * 1000000L };
+    while (true) {
+        const bool running = __atomic_load_n(&g_log.running, __ATOMIC_ACQUIRE);
+        if (log_drain() > 0)
+            fflush(stdout);
+        else if (!running)
+            break;
+        else
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+bool log_level_parse(const char *const name, log_level_t *const level) {
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++)
+        if (strcmp(name, log_level_names[i]) == 0) {
+            *level = (log_level_t)i;
+            return true;
+        }
+    return false;
+}
+
+// "all" applies to every category, returns false for an unknown name
+bool log_category_set(const char *const name, const log_level_t level) {
+    bool found = false;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        if (strcmp(name, "all") == 0 || strcmp(name, log_category_names[i]) == 0) {
+            __atomic_store_n(&g_log.categories[i].level, (int)level, __ATOMIC_RELAXED);
+            found = true;
+        }
+    return found;
+}
+
+// "CATEGORY[:LEVEL],...", level defaults to debug
+bool log_categories_parse(const char *const spec) {
+    char buffer[MAX_NAME_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    char *saveptr = NULL;
+    for (char *item = strtok_r(buffer, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        log_level_t level = LOG_LEVEL_DEBUG;
+        char *const colon = strchr(item, ':');
+        if (colon) {
+            *colon = '\0';
+            if (!log_level_parse(colon + 1, &level))
+                return false;
+        }
+        if (!log_category_set(item, level))
+            return false;
+    }
+    return true;
+}
+
+void log_configure(const unsigned int sample_rate, const unsigned int rate_limit) {
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        g_log.categories[i].sample_rate = sample_rate;
+        g_log.categories[i].rate_limit  = rate_limit;
+    }
+}
+
+// async signal safe: turns every category off saving its level, or restores the saved levels (all at debug if nothing was saved)
+void log_toggle(void) {
+    bool enabled = false, saved = false;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        if (__atomic_load_n(&g_log.categories[i].level, __ATOMIC_RELAXED) != LOG_LEVEL_OFF)
+            enabled = true;
+        if (g_log.categories[i].level_saved != LOG_LEVEL_OFF)
+            saved = true;
+    }
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        log_category_state_t *const c = &g_log.categories[i];
+        if (enabled) {
+            c->level_saved = __atomic_load_n(&c->level, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->level, LOG_LEVEL_OFF, __ATOMIC_RELAXED);
+        } else
+            __atomic_store_n(&c->level, saved ? c->level_saved : LOG_LEVEL_DEBUG, __ATOMIC_RELAXED);
+    }
+}
+
+// {"command":"log","category":"voxel|...|all","level":"off|info|debug|trace","sample":N,"rate":N}, absent fields are unchanged
+bool log_command(const cJSON *const command) {
+    const cJSON *const category = cJSON_GetObjectItem(command, "category");
+    const cJSON *const level    = cJSON_GetObjectItem(command, "level");
+    const cJSON *const sample   = cJSON_GetObjectItem(command, "sample");
+    const cJSON *const rate     = cJSON_GetObjectItem(command, "rate");
+    const char *const name      = cJSON_IsString(category) ? category->valuestring : "all";
+    log_level_t level_value     = LOG_LEVEL_OFF;
+    if (cJSON_IsString(level) && !log_level_parse(level->valuestring, &level_value))
+        return false;
+    if ((cJSON_IsNumber(sample) && sample->valuedouble < 1) || (cJSON_IsNumber(rate) && rate->valuedouble < 0))
+        return false;
+    bool found = false;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        if (strcmp(name, "all") == 0 || strcmp(name, log_category_names[i]) == 0) {
+            log_category_state_t *const c = &g_log.categories[i];
+            if (cJSON_IsString(level))
+                __atomic_store_n(&c->level, (int)level_value, __ATOMIC_RELAXED);
+            if (cJSON_IsNumber(sample))
+                __atomic_store_n(&c->sample_rate, (unsigned int)sample->valuedouble, __ATOMIC_RELAXED);
+            if (cJSON_IsNumber(rate))
+                __atomic_store_n(&c->rate_limit, (unsigned int)rate->valuedouble, __ATOMIC_RELAXED);
+            printf("log: %s: level=%s, sample=1/%u, rate=%u/s\n", log_category_names[i], log_level_names[c->level], c->sample_rate, c->rate_limit);
+            found = true;
+        }
+    return found;
+}
+
+bool log_begin(void) {
+    log_configure(g_config.log_sample, g_config.log_rate);
+    if (g_config.debug)
+        log_category_set("all", LOG_LEVEL_TRACE);
+    if (g_config.log_categories[0] != '\0' && !log_categories_parse(g_config.log_categories))
+        return false;
+    for (unsigned long i = 0; i < LOG_RING_SIZE; i++)
+        g_log.ring[i].sequence = i;
+    g_log.head    = 0;
+    g_log.tail    = 0;
+    g_log.running = true;
+    if (pthread_create(&g_log.writer, NULL, log_writer_thread, NULL) != 0) {
+        perror("pthread_create log writer thread");
+        g_log.running = false;
+        return false;
+    }
+    g_log.started = true;
+    return true;
+}
+
+void log_end(void) {
+    if (g_log.started) {
+        __atomic_store_n(&g_log.running, false, __ATOMIC_RELEASE);
+        pthread_join(g_log.writer, NULL);
+        g_log.started = false;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define MQTT_COMMANDS_MAX 8
+
+typedef bool (*mqtt_command_fn)(const cJSON *const command);
+typedef void (*mqtt_query_fn)(const char *const payload, const size_t length);
+
+typedef struct {
+    const char *name;
+    mqtt_command_fn fn;
+} mqtt_command_t;
+
 const char *mqtt_host;
 unsigned short mqtt_port;
 char mqtt_host_resolved[MAX_NAME_LENGTH];
+char mqtt_command_topic[MAX_NAME_LENGTH + 16];
+mqtt_command_t mqtt_commands[MQTT_COMMANDS_MAX];
+size_t mqtt_commands_count = 0;
+char mqtt_query_topic[MAX_NAME_LENGTH + 16];
+mqtt_query_fn mqtt_query = NULL;
+
+bool mqtt_command_register(const char *const name, const mqtt_command_fn fn) {
+    if (mqtt_commands_count >= MQTT_COMMANDS_MAX)
+        return false;
+    mqtt_commands[mqtt_commands_count].name = name;
+    mqtt_commands[mqtt_commands_count].fn   = fn;
+    mqtt_commands_count++;
+    return true;
+}
+
+// queries arrive on <topic>/query, and are handed over raw for their own thread to parse and answer
+void mqtt_query_register(const mqtt_query_fn fn) { mqtt_query = fn; }
+
+// commands arrive on <topic>/command as {"command":"NAME",...}, and are run on the mosquitto network thread
+void mqtt_on_message(struct mosquitto *mosq __attribute__((unused)), void *obj __attribute__((unused)), const struct mosquitto_message *message) {
+    if (mqtt_query && strcmp(message->topic, mqtt_query_topic) == 0) {
+        if (message->payloadlen > 0)
+            mqtt_query((const char *)message->payload, (size_t)message->payloadlen);
+        return;
+    }
+    if (strcmp(message->topic, mqtt_command_topic) != 0 || message->payloadlen <= 0)
+        return;
+    cJSON *const json = cJSON_ParseWithLength((const char *)message->payload, (size_t)message->payloadlen);
+    if (!json) {
+        printf("mqtt: command invalid (not json)\n");
+        return;
+    }
+    const cJSON *const name = cJSON_GetObjectItem(json, "command");
+    if (!cJSON_IsString(name))
+        printf("mqtt: command invalid (no 'command')\n");
+    else {
+        size_t i = 0;
+        while (i < mqtt_commands_count && strcmp(mqtt_commands[i].name, name->valuestring) != 0)
+            i++;
+        if (i == mqtt_commands_count)
+            printf("mqtt: command unknown: %s\n", name->valuestring);
+        else if (!mqtt_commands[i].fn(json))
+            printf("mqtt: command failed: %s\n", name->valuestring);
+    }
+    cJSON_Delete(json);
+}
 
-bool mqtt_publish(const char *const topic, const unsigned char *const data, const size_t length) {
+// queued by mosquitto for its network thread, so neither QoS waits on the broker here
+bool mqtt_publish_qos(const char *const topic, const unsigned char *const data, const size_t length, const int qos) {
     if (g_mosq) {
-        const int rc = mosquitto_publish(g_mosq, NULL, topic, (int)length, data, 0, false);
+        const int rc = mosquitto_publish(g_mosq, NULL, topic, (int)length, data, qos, false);
         if (rc == MOSQ_ERR_SUCCESS)
             return true;
         printf("mqtt: publish failed: %s\n", mosquitto_strerror(rc));
@@ -255,16 +916,26 @@ bool mqtt_publish(const char *const topic, const unsigned char *const data, cons
     return false;
 }
 
-void mqtt_on_connect(struct mosquitto *mosq __attribute__((unused)), void *obj __attribute__((unused)), int rc) {
-    if (rc == 0)
+void mqtt_on_connect(struct mosquitto *mosq, void *obj __attribute__((unused)), int rc) {
+    if (rc == 0) {
         printf("mqtt: connection succeeded to %s[%s]:%d\n", mqtt_host, mqtt_host_resolved, mqtt_port);
-    else
+        const int rc_subscribe = mosquitto_subscribe(mosq, NULL, mqtt_command_topic, 0);
+        if (rc_subscribe != MOSQ_ERR_SUCCESS)
+            printf("mqtt: subscribe failed to %s: %s\n", mqtt_command_topic, mosquitto_strerror(rc_subscribe));
+        if (mqtt_query) {
+            const int rc_query = mosquitto_subscribe(mosq, NULL, mqtt_query_topic, 0);
+            if (rc_query != MOSQ_ERR_SUCCESS)
+                printf("mqtt: subscribe failed to %s: %s\n", mqtt_query_topic, mosquitto_strerror(rc_query));
+        }
+    } else
         printf("mqtt: connection failed to %s[%s]:%d (mosquitto_connect): %s\n", mqtt_host, mqtt_host_resolved, mqtt_port, mosquitto_strerror(rc));
 }
 
 bool mqtt_begin(const char *host, const unsigned short port) {
     mqtt_host = host;
     mqtt_port = port;
+    snprintf(mqtt_command_topic, sizeof(mqtt_command_topic), "%s/command", g_config.mqtt_topic);
+    snprintf(mqtt_query_topic, sizeof(mqtt_query_topic), "%s/query", g_config.mqtt_topic);
     if (!host_resolve(host, mqtt_host_resolved, sizeof(mqtt_host_resolved)))
         return false;
     mosquitto_lib_init();
@@ -275,6 +946,7 @@ bool mqtt_begin(const char *host, const unsigned short port) {
         return false;
     }
     mosquitto_connect_callback_set(g_mosq, mqtt_on_connect);
+    mosquitto_message_callback_set(g_mosq, mqtt_on_message);
     const int rc = mosquitto_connect(g_mosq, mqtt_host_resolved, mqtt_port, 60);
     if (rc != MOSQ_ERR_SUCCESS) {
         mosquitto_destroy(g_mosq);
@@ -300,6 +972,382 @@ void mqtt_end(void) {
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
+// sinks: each aircraft and event publish is encoded once, as "TOPIC PAYLOAD\n" in a refcounted buffer, and handed to MQTT (whose queue
+// is mosquitto's own, drained by its network thread) and to each configured sink (query replies, subscriptions and timing are for MQTT
+// clients and go there only): a Unix stream socket that any number of local clients can connect to, a UDP (multicast) address that gets
+// one datagram per publish, or a file of one line per publish rotated to FILE.1 at a size; each sink has its own bounded queue, drop
+// policy (the oldest queued or the newest publish) and writer thread, so the publisher only ever takes a sink's lock to queue a
+// reference and a slow or broken sink loses its own updates without stalling the others or ingest
+
+#define SINK_QUEUE_MAX        256 // power of two
+#define SINK_QUEUE_DEFAULT    64
+#define SINK_CLIENTS_MAX      16
+#define SINK_SEND_TIMEOUT     1
+#define SINK_DATAGRAM_MAX     65507
+#define SINK_FILE_SIZE_MB     64
+#define SINK_RETRY_PERIOD     5
+
+typedef enum { SINK_UNIX = 0, SINK_UDP, SINK_FILE } sink_type_t;
+const char *const sink_type_names[] = { "unix", "udp", "file" };
+
+typedef struct {
+    unsigned int refs;
+    size_t length, topic_length;
+    char data[];
+} sink_buffer_t;
+
+typedef struct {
+    sink_type_t type;
+    char spec[MAX_NAME_LENGTH], path[MAX_NAME_LENGTH];
+    bool drop_oldest;
+    unsigned int queue_max, head, count;
+    sink_buffer_t *queue[SINK_QUEUE_MAX];
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running, started;
+    int fd, ttl, clients[SINK_CLIENTS_MAX], clients_count;
+    struct sockaddr_in address;
+    size_t file_size, file_size_max;
+    time_t failed_at;
+    unsigned long queued, written, dropped, failed, bytes;
+} sink_t;
+
+typedef struct {
+    sink_t sinks[SINKS_MAX];
+    int count;
+    unsigned long buffers;
+} sinks_t;
+
+sinks_t g_sinks = { 0 };
+
+static sink_buffer_t *sink_buffer_create(const char *const topic, const unsigned char *const data, const size_t length) {
+    const size_t topic_length = strlen(topic);
+    sink_buffer_t *const b    = (sink_buffer_t *)malloc(sizeof(sink_buffer_t) + topic_length + 1 + length + 1);
+    if (!b)
+        return NULL;
+    b->refs         = 1;
+    b->topic_length = topic_length;
+    b->length       = topic_length + 1 + length + 1;
+    memcpy(b->data, topic, topic_length);
+    b->data[topic_length] = ' ';
+    memcpy(b->data + topic_length + 1, data, length);
+    b->data[b->length - 1] = '\n';
+    g_sinks.buffers++;
+    return b;
+}
+
+static inline void sink_buffer_retain(sink_buffer_t *const b) { __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED); }
+
+static inline void sink_buffer_release(sink_buffer_t *const b) {
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(b);
+}
+
+// never blocks: a full queue drops by the sink's policy
+static void sink_enqueue(sink_t *const s, sink_buffer_t *const b) {
+    sink_buffer_t *dropped = NULL;
+    pthread_mutex_lock(&s->mutex);
+    if (s->count == s->queue_max) {
+        s->dropped++;
+        if (!s->drop_oldest) {
+            pthread_mutex_unlock(&s->mutex);
+            return;
+        }
+        dropped = s->queue[s->head];
+        s->head = (s->head + 1) & (SINK_QUEUE_MAX - 1);
+        s->count--;
+    }
+    sink_buffer_retain(b);
+    s->queue[(s->head + s->count) & (SINK_QUEUE_MAX - 1)] = b;
+    s->count++;
+    s->queued++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    if (dropped)
+        sink_buffer_release(dropped);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static bool sink_unix_open(sink_t *const s) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%.*s", (int)sizeof(address.sun_path) - 1, s->path);
+    unlink(address.sun_path);
+    if ((s->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || fcntl(s->fd, F_SETFL, O_NONBLOCK) < 0 ||
+        bind(s->fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(s->fd, SINK_CLIENTS_MAX) < 0) {
+        printf("sink: %s failed: %s\n", s->spec, strerror(errno));
+        if (s->fd >= 0)
+            close(s->fd);
+        s->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// clients are accepted as publishes arrive and receive from the next one; a client that does not take a whole line within
+// SINK_SEND_TIMEOUT is dropped, as a partial line would break the framing for it
+static void sink_unix_write(sink_t *const s, const sink_buffer_t *const b) {
+    int client;
+    while (s->clients_count < SINK_CLIENTS_MAX && (client = accept(s->fd, NULL, NULL)) >= 0) {
+        const struct timeval timeout = { .tv_sec = SINK_SEND_TIMEOUT, .tv_usec = 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        s->clients[s->clients_count++] = client;
+        printf("sink: %s client connected (%d)\n", s->spec, s->clients_count);
+    }
+    for (int i = s->clients_count; i > 0; i--) {
+        const ssize_t sent = send(s->clients[i - 1], b->data, b->length, MSG_NOSIGNAL);
+        if (sent == (ssize_t)b->length) {
+            s->bytes += b->length;
+            continue;
+        }
+        close(s->clients[i - 1]);
+        s->clients[i - 1] = s->clients[--s->clients_count];
+        s->failed++;
+        printf("sink: %s client disconnected (%d)\n", s->spec, s->clients_count);
+    }
+}
+
+static bool sink_udp_open(sink_t *const s) {
+    char host[MAX_NAME_LENGTH];
+    unsigned short port;
+    if (!host_parse(s->path, host, sizeof(host), &port, 0) || port == 0 || inet_pton(AF_INET, host, &s->address.sin_addr) != 1) {
+        printf("sink: %s failed: expected IPV4:PORT\n", s->spec);
+        return false;
+    }
+    s->address.sin_family = AF_INET;
+    s->address.sin_port   = htons(port);
+    if ((s->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        printf("sink: %s failed: %s\n", s->spec, strerror(errno));
+        return false;
+    }
+    if (IN_MULTICAST(ntohl(s->address.sin_addr.s_addr))) {
+        const unsigned char ttl = (unsigned char)s->ttl;
+        setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+    return true;
+}
+
+// a publish larger than a datagram can carry is counted as failed rather than split
+static void sink_udp_write(sink_t *const s, const sink_buffer_t *const b) {
+    if (b->length > SINK_DATAGRAM_MAX || sendto(s->fd, b->data, b->length, 0, (const struct sockaddr *)&s->address, sizeof(s->address)) < 0)
+        s->failed++;
+    else
+        s->bytes += b->length;
+}
+
+static bool sink_file_open(sink_t *const s) {
+    if ((s->fd = open(s->path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+        printf("sink: %s failed: %s\n", s->spec, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    s->file_size = fstat(s->fd, &st) == 0 ? (size_t)st.st_size : 0;
+    return true;
+}
+
+static void sink_file_write(sink_t *const s, const sink_buffer_t *const b) {
+    if (s->file_size > 0 && s->file_size + b->length > s->file_size_max) {
+        char rotated[MAX_NAME_LENGTH + 2];
+        snprintf(rotated, sizeof(rotated), "%s.1", s->path);
+        close(s->fd);
+        s->fd = -1;
+        if (rename(s->path, rotated) < 0)
+            printf("sink: %s rotate failed: %s\n", s->spec, strerror(errno));
+        if (!sink_file_open(s)) {
+            s->failed++;
+            return;
+        }
+    }
+    const ssize_t written = write(s->fd, b->data, b->length);
+    if (written < 0)
+        s->failed++;
+    else {
+        s->file_size += (size_t)written;
+        s->bytes += (size_t)written;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static bool sink_open(sink_t *const s) {
+    switch (s->type) {
+    case SINK_UNIX:
+        return sink_unix_open(s);
+    case SINK_UDP:
+        return sink_udp_open(s);
+    case SINK_FILE:
+        return sink_file_open(s);
+    default:
+        return false;
+    }
+}
+
+static void sink_close(sink_t *const s) {
+    for (int i = 0; i < s->clients_count; i++)
+        close(s->clients[i]);
+    s->clients_count = 0;
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+    if (s->type == SINK_UNIX)
+        unlink(s->path);
+}
+
+// a sink that could not be opened, or lost its file, is retried at most every SINK_RETRY_PERIOD while its queue is drained
+static void sink_write(sink_t *const s, const sink_buffer_t *const b) {
+    if (s->fd < 0) {
+        const time_t now = time(NULL);
+        if (now - s->failed_at < SINK_RETRY_PERIOD || !sink_open(s)) {
+            s->failed_at = now;
+            s->failed++;
+            return;
+        }
+    }
+    switch (s->type) {
+    case SINK_UNIX:
+        sink_unix_write(s, b);
+        break;
+    case SINK_UDP:
+        sink_udp_write(s, b);
+        break;
+    case SINK_FILE:
+        sink_file_write(s, b);
+        break;
+    default:
+        break;
+    }
+    s->written++;
+}
+
+static void *sink_thread(void *arg) {
+    sink_t *const s = (sink_t *)arg;
+    pthread_mutex_lock(&s->mutex);
+    while (s->running || s->count > 0) {
+        if (s->count == 0) {
+            pthread_cond_wait(&s->cond, &s->mutex);
+            continue;
+        }
+        sink_buffer_t *const b = s->queue[s->head];
+        s->head                = (s->head + 1) & (SINK_QUEUE_MAX - 1);
+        s->count--;
+        pthread_mutex_unlock(&s->mutex);
+        sink_write(s, b);
+        sink_buffer_release(b);
+        pthread_mutex_lock(&s->mutex);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+// TYPE:TARGET[,queue=N][,drop=oldest|newest][,size=MB][,ttl=N]
+static bool sink_parse(sink_t *const s, const char *const spec) {
+    char buffer[MAX_NAME_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    snprintf(s->spec, sizeof(s->spec), "%s", spec);
+    char *const colon = strchr(buffer, ':');
+    if (!colon)
+        return false;
+    *colon   = '\0';
+    int type = 0;
+    while (type < (int)(sizeof(sink_type_names) / sizeof(sink_type_names[0])) && strcmp(sink_type_names[type], buffer) != 0)
+        type++;
+    if (type == (int)(sizeof(sink_type_names) / sizeof(sink_type_names[0])))
+        return false;
+    s->type          = (sink_type_t)type;
+    s->queue_max     = SINK_QUEUE_DEFAULT;
+    s->drop_oldest   = true;
+    s->file_size_max = (size_t)SINK_FILE_SIZE_MB * 1024 * 1024;
+    s->ttl           = 1;
+    s->fd            = -1;
+    char *option     = strchr(colon + 1, ',');
+    if (option)
+        *option++ = '\0';
+    snprintf(s->path, sizeof(s->path), "%s", colon + 1);
+    if (s->path[0] == '\0')
+        return false;
+    while (option) {
+        char *const next = strchr(option, ',');
+        if (next)
+            *next = '\0';
+        if (strncmp(option, "queue=", 6) == 0 && atoi(option + 6) > 0 && atoi(option + 6) <= SINK_QUEUE_MAX)
+            s->queue_max = (unsigned int)atoi(option + 6);
+        else if (strcmp(option, "drop=oldest") == 0 || strcmp(option, "drop=newest") == 0)
+            s->drop_oldest = strcmp(option, "drop=oldest") == 0;
+        else if (strncmp(option, "size=", 5) == 0 && atoi(option + 5) > 0)
+            s->file_size_max = (size_t)atoi(option + 5) * 1024 * 1024;
+        else if (strncmp(option, "ttl=", 4) == 0 && atoi(option + 4) > 0 && atoi(option + 4) < 256)
+            s->ttl = atoi(option + 4);
+        else
+            return false;
+        option = next ? next + 1 : NULL;
+    }
+    return true;
+}
+
+// true if MQTT took it, or without MQTT once the sinks have been handed it
+bool sink_publish_qos(const char *const topic, const unsigned char *const data, const size_t length, const int qos) {
+    const bool published = mqtt_publish_qos(topic, data, length, qos);
+    if (g_sinks.count == 0)
+        return published;
+    sink_buffer_t *const b = sink_buffer_create(topic, data, length);
+    if (!b)
+        return published;
+    for (int i = 0; i < g_sinks.count; i++)
+        sink_enqueue(&g_sinks.sinks[i], b);
+    sink_buffer_release(b);
+    return published || !g_mosq;
+}
+
+bool sink_publish(const char *const topic, const unsigned char *const data, const size_t length) { return sink_publish_qos(topic, data, length, 0); }
+
+void sink_end(void) {
+    for (int i = 0; i < g_sinks.count; i++) {
+        sink_t *const s = &g_sinks.sinks[i];
+        if (s->started) {
+            pthread_mutex_lock(&s->mutex);
+            s->running = false;
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+            pthread_join(s->thread, NULL);
+            s->started = false;
+        }
+        sink_close(s);
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mutex);
+    }
+    g_sinks.count = 0;
+}
+
+bool sink_begin(void) {
+    for (int i = 0; i < g_config.sinks_count; i++) {
+        sink_t *const s = &g_sinks.sinks[g_sinks.count];
+        if (!sink_parse(s, g_config.sinks[i])) {
+            printf("sink: invalid: %s\n", g_config.sinks[i]);
+            sink_end();
+            return false;
+        }
+        pthread_mutex_init(&s->mutex, NULL);
+        pthread_cond_init(&s->cond, NULL);
+        g_sinks.count++;
+        if (!sink_open(s))
+            s->failed_at = time(NULL);
+        s->running = true;
+        if (pthread_create(&s->thread, NULL, sink_thread, s) != 0) {
+            perror("pthread_create sink thread");
+            s->running = false;
+            sink_end();
+            return false;
+        }
+        s->started = true;
+        printf("sink: %s (queue=%u, drop=%s)\n", s->spec, s->queue_max, s->drop_oldest ? "oldest" : "newest");
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
 typedef unsigned short voxel_data_t;
 
 typedef struct {
@@ -350,10 +1398,12 @@ void voxel_map_update(const double lat, const double lon, const double altitude_
     int x, y, z;
     voxel_coords_to_indices(lat, lon, altitude_ft, &x, &y, &z);
     const size_t i = voxel_indices_to_index(x, y, z);
-    if (g_voxel_map.data[i] < VOXEL_MAX_COUNT)
-        if (g_voxel_map.data[i]++ == 0 && g_voxel_map.debug)
-            printf("debug: voxel: created [%d,%d,%d] (%.1fnm, %.1fnm, %.0fft)\n", x, y, z, (x - g_voxel_map.size_x / 2) * g_voxel_map.horizontal_size_nm,
-                   (y - g_voxel_map.size_y / 2) * g_voxel_map.horizontal_size_nm, z * g_voxel_map.vertical_size_ft);
+    if (g_voxel_map.data[i] < VOXEL_MAX_COUNT && g_voxel_map.data[i]++ == 0) {
+        PROBE3(voxel_created, x, y, z);
+        LOG(LOG_CATEGORY_VOXEL, LOG_LEVEL_DEBUG, "created [%d,%d,%d] (%.1fnm, %.1fnm, %.0fft)", x, y, z,
+            (x - g_voxel_map.size_x / 2) * g_voxel_map.horizontal_size_nm, (y - g_voxel_map.size_y / 2) * g_voxel_map.horizontal_size_nm,
+            z * g_voxel_map.vertical_size_ft);
+    }
 }
 
 bool voxel_map_save(void) {
@@ -462,7 +1512,8 @@ bool voxel_map_begin(void) {
     printf("voxel: initialised using %.0fnm/%.0fft boxes to %.0fnm radius and %.0fft altitude at %d bits = %.0fK voxels (%.1f MB)\n",
            g_voxel_map.horizontal_size_nm, g_voxel_map.vertical_size_ft, g_voxel_map.distance_max_nm, g_voxel_map.altitude_max_ft, g_voxel_map.bits,
            (double)g_voxel_map.total_voxels / (double)(1024 * 1024), voxel_get_memorysize());
-    voxel_map_load();
+    if (g_config.directory[0] != '\0')
+        voxel_map_load();
     return true;
 }
 
@@ -487,6 +1538,30 @@ bool voxel_get_stats(size_t *occupied, size_t *total, double *occupancy) {
     return true;
 }
 
+// the farthest occupied voxel along the bearing in each altitude layer z_min..z_max (zero for none) into envelope if given, and the
+// farthest of all, walked in half voxel steps out from the station as the voxels are indexed from its distance and bearing
+double voxel_coverage(const double bearing_deg, const int z_min, const int z_max, double *const envelope) {
+    const double step_nm = g_voxel_map.horizontal_size_nm / 2.0, s = sin(bearing_deg * M_PI / 180.0), c = cos(bearing_deg * M_PI / 180.0);
+    const unsigned int layers = (unsigned int)(z_max - z_min) + 1;
+    double distance_max_nm    = 0.0;
+    if (envelope)
+        for (unsigned int k = 0; k < layers; k++)
+            envelope[z_min + (int)k] = 0.0;
+    for (double r = 0.0; r <= g_voxel_map.distance_max_nm; r += step_nm) {
+        const int x = (int)((r * s / g_voxel_map.horizontal_size_nm) + (g_voxel_map.size_x / 2));
+        const int y = (int)((r * c / g_voxel_map.horizontal_size_nm) + (g_voxel_map.size_y / 2));
+        if (x < 0 || x >= g_voxel_map.size_x || y < 0 || y >= g_voxel_map.size_y)
+            break;
+        for (unsigned int k = 0; k < layers; k++)
+            if (g_voxel_map.data[voxel_indices_to_index(x, y, z_min + (int)k)] > 0) {
+                distance_max_nm = r;
+                if (envelope)
+                    envelope[z_min + (int)k] = r;
+            }
+    }
+    return distance_max_nm;
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
@@ -535,6 +1610,7 @@ static cJSON *aircraft_stats_encode_stat(const aircraft_stat_t *const stat) {
     cJSON_AddNumberToObject(obj, "position_invalid", (double)stat->position_invalid);
     cJSON_AddNumberToObject(obj, "published_mqtt", (double)stat->published_mqtt);
     cJSON_AddNumberToObject(obj, "aircraft_seen", (double)stat->aircraft_seen);
+    cJSON_AddNumberToObject(obj, "military_seen", (double)stat->military_seen);
     cJSON *distance_max = aircraft_stats_encode_stat_position(&stat->distance_max);
     if (distance_max)
         cJSON_AddItemToObject(obj, "distance_max", distance_max);
@@ -588,6 +1664,7 @@ static bool aircraft_stats_decode_stat(const cJSON *const obj, aircraft_stat_t *
     const cJSON *position_invalid  = cJSON_GetObjectItem(obj, "position_invalid");
     const cJSON *published_mqtt    = cJSON_GetObjectItem(obj, "published_mqtt");
     const cJSON *aircraft_seen     = cJSON_GetObjectItem(obj, "aircraft_seen");
+    const cJSON *military_seen     = cJSON_GetObjectItem(obj, "military_seen");
     const cJSON *distance_max      = cJSON_GetObjectItem(obj, "distance_max");
     const cJSON *altitude_max      = cJSON_GetObjectItem(obj, "altitude_max");
     if (messages_total && cJSON_IsNumber(messages_total))
@@ -602,6 +1679,8 @@ static bool aircraft_stats_decode_stat(const cJSON *const obj, aircraft_stat_t *
         stat->published_mqtt = (unsigned long)published_mqtt->valuedouble;
     if (aircraft_seen && cJSON_IsNumber(aircraft_seen))
         stat->aircraft_seen = (unsigned long)aircraft_seen->valuedouble;
+    if (military_seen && cJSON_IsNumber(military_seen))
+        stat->military_seen = (unsigned long)military_seen->valuedouble;
     if (distance_max)
         aircraft_stats_decode_stat_position(distance_max, &stat->distance_max);
     if (altitude_max)
@@ -696,7 +1775,8 @@ bool aircraft_begin(void) {
         perror("pthread_mutex_init");
         return false;
     }
-    aircraft_stats_load();
+    if (g_config.directory[0] != '\0')
+        aircraft_stats_load();
     return true;
 }
 
@@ -705,292 +1785,6360 @@ void aircraft_end(void) { pthread_mutex_destroy(&g_aircraft_list.mutex); }
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-void position_record_set(aircraft_posn_t *const r, const double lat, const double lon, const int altitude_ft, const double distance_nm,
-                         const time_t timestamp) {
-    r->lat         = lat;
-    r->lon         = lon;
-    r->altitude_ft = altitude_ft;
-    r->distance_nm = distance_nm;
-    r->timestamp   = timestamp;
+// the shm records mirror the aircraft table slot for slot and are written only by the processing thread (layout in adsb_shm.h)
+
+typedef struct {
+    adsb_shm_header_t *header;
+    adsb_shm_record_t *records;
+    size_t size;
+    char path[MAX_NAME_LENGTH + 1];
+    time_t stats_updated;
+} shm_export_t;
+
+shm_export_t g_shm = { 0 };
+
+static inline void shm_posn_set(adsb_shm_posn_t *const r, const aircraft_posn_t *const pos) {
+    r->lat_e6       = (int32_t)lround(pos->lat * 1e6);
+    r->lon_e6       = (int32_t)lround(pos->lon * 1e6);
+    r->altitude_ft  = (int32_t)pos->altitude_ft;
+    r->distance_cnm = (uint32_t)lround(pos->distance_nm * 100.0);
+    r->timestamp    = (int64_t)pos->timestamp;
 }
 
-void position_stat_record_set(aircraft_stat_posn_t *const r, const double lat, const double lon, const int altitude_ft, const double distance_nm,
-                              const time_t timestamp, const char *const icao) {
-    position_record_set(&r->pos, lat, lon, altitude_ft, distance_nm, timestamp);
-    strncpy(r->icao, icao, 6);
-    r->icao[6] = '\0';
+static void shm_stat_posn_set(adsb_shm_stat_posn_t *const r, const aircraft_stat_posn_t *const stat) {
+    memcpy(r->icao, stat->icao, sizeof(stat->icao));
+    r->icao[sizeof(stat->icao)] = '\0';
+    shm_posn_set(&r->pos, &stat->pos);
 }
 
-aircraft_data_t *aircraft_find_or_create(const char *const icao) {
-    unsigned int index = hash_icao(icao), index_original = index;
+static void shm_counters_set(adsb_shm_counters_t *const r, const aircraft_stat_t *const stat) {
+    r->messages_total    = stat->messages_total;
+    r->messages_position = stat->messages_position;
+    r->position_valid    = stat->position_valid;
+    r->position_invalid  = stat->position_invalid;
+    r->published_mqtt    = stat->published_mqtt;
+    r->aircraft_seen     = stat->aircraft_seen;
+    shm_stat_posn_set(&r->distance_max, &stat->distance_max);
+    shm_stat_posn_set(&r->altitude_max, &stat->altitude_max);
+}
 
-    while (g_aircraft_list.entries[index].icao[0] != '\0') {
-        if (strcmp(g_aircraft_list.entries[index].icao, icao) == 0)
-            return &g_aircraft_list.entries[index];
-        if ((index = (index + 1) & HASH_MASK) == index_original)
-            return NULL;
+static inline void shm_generation_advance(void) {
+    __atomic_store_n(&g_shm.header->generation, g_shm.header->generation + 1, __ATOMIC_RELEASE);
+}
+
+void shm_record_update(const int index, const aircraft_data_t *const aircraft) {
+    if (!g_shm.header)
+        return;
+    adsb_shm_record_t *const r = &g_shm.records[index];
+    adsb_shm_write_begin(&r->sequence);
+    r->flags = aircraft->bounds_initialised ? ADSB_SHM_FLAG_BOUNDS : 0;
+    memcpy(r->icao, aircraft->icao, sizeof(aircraft->icao));
+    r->icao[sizeof(aircraft->icao)] = '\0';
+    shm_posn_set(&r->pos, &aircraft->pos);
+    shm_posn_set(&r->pos_first, &aircraft->pos_first);
+    shm_posn_set(&r->min_lat_pos, &aircraft->min_lat_pos);
+    shm_posn_set(&r->max_lat_pos, &aircraft->max_lat_pos);
+    shm_posn_set(&r->min_lon_pos, &aircraft->min_lon_pos);
+    shm_posn_set(&r->max_lon_pos, &aircraft->max_lon_pos);
+    shm_posn_set(&r->min_alt_pos, &aircraft->min_alt_pos);
+    shm_posn_set(&r->max_alt_pos, &aircraft->max_alt_pos);
+    shm_posn_set(&r->min_dist_pos, &aircraft->min_dist_pos);
+    shm_posn_set(&r->max_dist_pos, &aircraft->max_dist_pos);
+    adsb_shm_write_end(&r->sequence);
+    shm_generation_advance();
+}
+
+void shm_record_clear(const int index) {
+    if (!g_shm.header)
+        return;
+    adsb_shm_record_t *const r = &g_shm.records[index];
+    adsb_shm_write_begin(&r->sequence);
+    r->icao[0] = '\0';
+    r->flags   = 0;
+    adsb_shm_write_end(&r->sequence);
+    shm_generation_advance();
+}
+
+// counters move on every message, so they are copied out at most once a second (and on shutdown)
+void shm_stats_update(const bool force) {
+    if (!g_shm.header)
+        return;
+    const time_t now = time(NULL);
+    if (!force && now == g_shm.stats_updated)
+        return;
+    g_shm.stats_updated       = now;
+    adsb_shm_stats_t *const r = &g_shm.header->stats;
+    adsb_shm_write_begin(&r->sequence);
+    r->aircraft_count = (uint32_t)g_aircraft_list.count;
+    r->updated        = (int64_t)now;
+    shm_counters_set(&r->session, &g_aircraft_stat);
+    shm_counters_set(&r->global, &g_aircraft_global);
+    adsb_shm_write_end(&r->sequence);
+}
+
+bool shm_begin(void) {
+    if (g_config.shm_name[0] == '\0')
+        return true;
+    snprintf(g_shm.path, sizeof(g_shm.path), "%s%s", g_config.shm_name[0] == '/' ? "" : "/", g_config.shm_name);
+    g_shm.size   = adsb_shm_size(MAX_AIRCRAFT);
+    const int fd = shm_open(g_shm.path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("shm: create failed (shm_open): %s: %s\n", g_shm.path, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, (off_t)g_shm.size) < 0) {
+        printf("shm: create failed (ftruncate): %s: %s\n", g_shm.path, strerror(errno));
+        close(fd);
+        shm_unlink(g_shm.path);
+        return false;
+    }
+    void *const base = mmap(NULL, g_shm.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("shm: create failed (mmap): %s: %s\n", g_shm.path, strerror(errno));
+        shm_unlink(g_shm.path);
+        return false;
     }
+    g_shm.header                  = (adsb_shm_header_t *)base;
+    g_shm.records                 = adsb_shm_records(g_shm.header);
+    g_shm.header->version         = ADSB_SHM_VERSION;
+    g_shm.header->header_size     = sizeof(adsb_shm_header_t);
+    g_shm.header->record_size     = sizeof(adsb_shm_record_t);
+    g_shm.header->capacity        = MAX_AIRCRAFT;
+    g_shm.header->pid             = (uint32_t)getpid();
+    g_shm.header->started         = (int64_t)time(NULL);
+    g_shm.header->position_lat_e6 = (int32_t)lround(g_config.position_lat * 1e6);
+    g_shm.header->position_lon_e6 = (int32_t)lround(g_config.position_lon * 1e6);
+    shm_stats_update(true);
+    __atomic_store_n(&g_shm.header->magic, ADSB_SHM_MAGIC, __ATOMIC_RELEASE);
+    printf("shm: exporting %d records of %zu bytes to %s (%.1f MB)\n", MAX_AIRCRAFT, sizeof(adsb_shm_record_t), g_shm.path,
+           (double)g_shm.size / (1024.0 * 1024.0));
+    return true;
+}
 
-    if (g_aircraft_list.count >= (int)(MAX_AIRCRAFT * PRUNE_THRESHOLD)) {
-        int to_remove      = (int)(MAX_AIRCRAFT * PRUNE_RATIO);
-        time_t oldest_time = time(NULL);
-        if (g_config.debug)
-            printf("debug: aircraft map: pruning %d oldest entries\n", to_remove);
-        while (to_remove > 0) {
-            int oldest_idx = -1;
-            oldest_time    = time(NULL);
-            for (int i = 0; i < MAX_AIRCRAFT; i++)
-                if (g_aircraft_list.entries[i].icao[0] != '\0' && g_aircraft_list.entries[i].pos.timestamp < oldest_time) {
-                    oldest_time = g_aircraft_list.entries[i].pos.timestamp;
-                    oldest_idx  = i;
-                }
-            if (oldest_idx >= 0) {
-                g_aircraft_list.entries[oldest_idx].icao[0] = '\0';
-                g_aircraft_list.count--;
-                to_remove--;
-            } else
-                break;
-        }
+void shm_end(void) {
+    if (g_shm.header) {
+        munmap(g_shm.header, g_shm.size);
+        shm_unlink(g_shm.path);
+        g_shm.header = NULL;
     }
+}
 
-    strncpy(g_aircraft_list.entries[index].icao, icao, 6);
-    g_aircraft_list.entries[index].icao[6]            = '\0';
-    g_aircraft_list.entries[index].bounds_initialised = false;
-    g_aircraft_list.count++;
-    g_aircraft_stat.aircraft_seen++;
-    g_aircraft_global.aircraft_seen++;
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
 
-    return &g_aircraft_list.entries[index];
-}
+// events: airprox, loitering, vicinity, anomaly and airspace are detected by hooks running with the table locked, so rather than encode
+// and publish there each hook queues the values its message needs and aircraft_list_unlock, which every path that runs the hooks uses
+// to release the lock, copies the queue out, unlocks and then encodes and publishes them in the order raised; the queue is bounded, loops
+// raising many events at once (expiry, prune) release and flush in chunks, and an event raised with the queue full is dropped and counted
 
-void aircraft_position_update(const char *const icao, const double lat, const double lon, const int altitude_ft, const time_t timestamp) {
-    const double distance_nm = calculate_distance_nm(g_config.position_lat, g_config.position_lon, lat, lon);
+#define EVENT_QUEUE_MAX 128
+#define EVENT_DATA_MAX  208
 
-    if (!position_is_valid(lat, lon, altitude_ft, distance_nm, g_config.altitude_max_ft, g_config.distance_max_nm)) {
-        g_aircraft_stat.position_invalid++;
-        g_aircraft_global.position_invalid++;
-        if (g_config.debug)
-            printf("debug: aircraft position: invalid (icao=%s, lat=%.6f, lon=%.6f, alt=%d, dist=%.1f)\n", icao, lat, lon, altitude_ft, distance_nm);
+typedef void (*event_send_fn)(const void *event);
+
+typedef struct {
+    event_send_fn send;
+    union {
+        unsigned char bytes[EVENT_DATA_MAX];
+        double align_double;
+        long long align_long;
+        void *align_pointer;
+    } data;
+} event_t;
+
+typedef struct {
+    event_t queue[EVENT_QUEUE_MAX];
+    unsigned int count, peak;
+    unsigned long queued, dropped;
+} events_t;
+
+events_t g_events = { 0 };
+
+#define EVENT_QUEUE(send, event)                                                                                                                               \
+    do {                                                                                                                                                       \
+        _Static_assert(sizeof(event) <= EVENT_DATA_MAX, "event larger than EVENT_DATA_MAX");                                                                   \
+        event_queue(send, &(event), sizeof(event));                                                                                                            \
+    } while (0)
+
+// called with the table locked
+static void event_queue(const event_send_fn send, const void *const data, const size_t size) {
+    if (g_events.count == EVENT_QUEUE_MAX) {
+        g_events.dropped++;
         return;
     }
+    event_t *const event = &g_events.queue[g_events.count++];
+    event->send          = send;
+    memcpy(event->data.bytes, data, size);
+    g_events.queued++;
+    if (g_events.count > g_events.peak)
+        g_events.peak = g_events.count;
+}
 
-    g_aircraft_stat.position_valid++;
-    g_aircraft_global.position_valid++;
-
-    voxel_map_update(lat, lon, altitude_ft);
+static inline unsigned int event_queue_space(void) { return EVENT_QUEUE_MAX - g_events.count; }
 
-    pthread_mutex_lock(&g_aircraft_list.mutex);
-    aircraft_data_t *const aircraft = aircraft_find_or_create(icao);
-    if (!aircraft) {
+void aircraft_list_unlock(void) {
+    const unsigned int count = g_events.count;
+    if (count == 0) {
         pthread_mutex_unlock(&g_aircraft_list.mutex);
-        printf("error: hash table full, cannot add %s\n", icao);
         return;
     }
-    position_record_set(&aircraft->pos, lat, lon, altitude_ft, distance_nm, timestamp);
-    if (!aircraft->bounds_initialised) {
-        position_record_set(&aircraft->pos_first, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->min_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->max_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->min_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->max_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->min_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->max_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->min_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        position_record_set(&aircraft->max_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        aircraft->bounds_initialised = true;
-        if (g_config.debug)
-            printf("debug: aircraft first seen: %s at %.6f,%.6f alt=%d dist=%.1fnm\n", icao, lat, lon, altitude_ft, distance_nm);
-    } else {
-        if (lat < aircraft->min_lat_pos.lat)
-            position_record_set(&aircraft->min_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (lat > aircraft->max_lat_pos.lat)
-            position_record_set(&aircraft->max_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (lon < aircraft->min_lon_pos.lon)
-            position_record_set(&aircraft->min_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (lon > aircraft->max_lon_pos.lon)
-            position_record_set(&aircraft->max_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (altitude_ft < aircraft->min_alt_pos.altitude_ft)
-            position_record_set(&aircraft->min_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (altitude_ft > aircraft->max_alt_pos.altitude_ft)
-            position_record_set(&aircraft->max_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (distance_nm < aircraft->min_dist_pos.distance_nm)
-            position_record_set(&aircraft->min_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-        if (distance_nm > aircraft->max_dist_pos.distance_nm)
-            position_record_set(&aircraft->max_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
-    }
+    event_t events[EVENT_QUEUE_MAX];
+    memcpy(events, g_events.queue, count * sizeof(event_t));
+    g_events.count = 0;
     pthread_mutex_unlock(&g_aircraft_list.mutex);
-
-    if (distance_nm > g_aircraft_stat.distance_max.pos.distance_nm)
-        position_stat_record_set(&g_aircraft_stat.distance_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
-    if (distance_nm > g_aircraft_global.distance_max.pos.distance_nm)
-        position_stat_record_set(&g_aircraft_global.distance_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
-
-    if (altitude_ft > g_aircraft_stat.altitude_max.pos.altitude_ft)
-        position_stat_record_set(&g_aircraft_stat.altitude_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
-    if (altitude_ft > g_aircraft_global.altitude_max.pos.altitude_ft)
-        position_stat_record_set(&g_aircraft_global.altitude_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
+    for (unsigned int i = 0; i < count; i++)
+        events[i].send(events[i].data.bytes);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-static cJSON *aircraft_publish_encode_position(const aircraft_posn_t *const pos) {
-    cJSON *obj = cJSON_CreateObject();
-    if (!obj)
-        return NULL;
-    cJSON_AddNumberToObject(obj, "lat", pos->lat);
-    cJSON_AddNumberToObject(obj, "lon", pos->lon);
-    cJSON_AddNumberToObject(obj, "alt", pos->altitude_ft);
-    cJSON_AddNumberToObject(obj, "dist", pos->distance_nm);
-    cJSON_AddNumberToObject(obj, "time", (double)pos->timestamp);
-    return obj;
-}
+// airprox: close pairs are found as positions arrive rather than by scanning all pairs; each aircraft sits in a uniform spatial hash of
+// cells one horizontal threshold wide over a local projection (x east, y north, nautical miles from the station), so any pair inside
+// the threshold shares or neighbours a cell and an update only visits the 3x3 cells around it; cells hash into a fixed bucket array
+// with aircraft doubly linked by table slot, so insert, move and remove are O(1), and the grid is maintained by
+// aircraft_position_update under the table lock
+//
+// a pair alerts when both positions are fresh and inside both thresholds, categorised as monitor/filter-airprox.js does (A..D from
+// separation, one worse for a high closure rate); closure comes from the decoded ground speed and track, or from velocities estimated
+// over successive positions where those are stale; aircraft reporting on ground are left out; a pair alerts again only when its
+// category worsens or AIRPROX_REPEAT_PERIOD has passed, and alerts are published to TOPIC/airprox immediately
+
+#define AIRPROX_GRID_BUCKETS        4096
+#define AIRPROX_GRID_MASK           (AIRPROX_GRID_BUCKETS - 1)
+#define AIRPROX_PAIRS               1024
+#define AIRPROX_PAIRS_MASK          (AIRPROX_PAIRS - 1)
+#define AIRPROX_PAIRS_PROBE         16
+#define AIRPROX_NONE                -1
+#define AIRPROX_POSITION_AGE        30
+#define AIRPROX_VELOCITY_PERIOD     2
+#define AIRPROX_VELOCITY_PERIOD_MAX 30
+#define AIRPROX_REPEAT_PERIOD       60
+#define AIRPROX_CLOSURE_RATE_HIGH   400.0
+#define AIRPROX_CLOSURE_TIME_MAX    600.0
 
-static cJSON *aircraft_publish_encode_aircraft(const aircraft_data_t *const ac) {
-    cJSON *obj = cJSON_CreateObject();
-    if (!obj)
-        return NULL;
+typedef struct {
+    const char *name;
+    double horizontal_nm;
+    int vertical_ft;
+} airprox_category_t;
+
+const airprox_category_t airprox_categories[] = {
+    { "A", 0.25, 500 },
+    { "B", 0.5, 500 },
+    { "C", 1.0, 1000 },
+    { "D", 5.0, 2000 },
+};
+#define AIRPROX_CATEGORY_COUNT (int)(sizeof(airprox_categories) / sizeof(airprox_categories[0]))
 
-    cJSON_AddStringToObject(obj, "icao", ac->icao);
+typedef struct {
+    int grid_prev, grid_next;
+    int cell_x, cell_y;
+    unsigned int bucket;
+    bool linked, velocity_valid;
+    double x, y, vx, vy;
+    double sample_x, sample_y;
+    time_t sample_time;
+} airprox_track_t;
 
-    cJSON *current = aircraft_publish_encode_position(&ac->pos);
-    if (current)
-        cJSON_AddItemToObject(obj, "current", current);
+typedef struct {
+    unsigned int key;
+    char icao_a[7], icao_b[7];
+    int category;
+    time_t alerted;
+} airprox_pair_t;
 
-    cJSON *first = aircraft_publish_encode_position(&ac->pos_first);
-    if (first)
-        cJSON_AddItemToObject(obj, "first", first);
+typedef struct {
+    bool enabled;
+    double cell_nm;
+    char topic[MAX_NAME_LENGTH + 16];
+    int buckets[AIRPROX_GRID_BUCKETS];
+    airprox_track_t tracks[MAX_AIRCRAFT];
+    airprox_pair_t pairs[AIRPROX_PAIRS];
+    unsigned long candidates, checks, alerts, alerts_category[AIRPROX_CATEGORY_COUNT], published;
+} airprox_t;
 
-    cJSON *bounds = cJSON_CreateObject();
-    if (bounds) {
-        cJSON *min_lat = aircraft_publish_encode_position(&ac->min_lat_pos);
-        if (min_lat)
-            cJSON_AddItemToObject(bounds, "min_lat", min_lat);
-        cJSON *max_lat = aircraft_publish_encode_position(&ac->max_lat_pos);
-        if (max_lat)
-            cJSON_AddItemToObject(bounds, "max_lat", max_lat);
-        cJSON *min_lon = aircraft_publish_encode_position(&ac->min_lon_pos);
-        if (min_lon)
-            cJSON_AddItemToObject(bounds, "min_lon", min_lon);
-        cJSON *max_lon = aircraft_publish_encode_position(&ac->max_lon_pos);
-        if (max_lon)
-            cJSON_AddItemToObject(bounds, "max_lon", max_lon);
-        cJSON *min_alt = aircraft_publish_encode_position(&ac->min_alt_pos);
-        if (min_alt)
-            cJSON_AddItemToObject(bounds, "min_alt", min_alt);
-        cJSON *max_alt = aircraft_publish_encode_position(&ac->max_alt_pos);
-        if (max_alt)
-            cJSON_AddItemToObject(bounds, "max_alt", max_alt);
-        cJSON *min_dist = aircraft_publish_encode_position(&ac->min_dist_pos);
-        if (min_dist)
-            cJSON_AddItemToObject(bounds, "min_dist", min_dist);
-        cJSON *max_dist = aircraft_publish_encode_position(&ac->max_dist_pos);
-        if (max_dist)
-            cJSON_AddItemToObject(bounds, "max_dist", max_dist);
-        cJSON_AddItemToObject(obj, "bounds", bounds);
+airprox_t g_airprox = { 0 };
+
+typedef struct {
+    char icao[7];
+    int altitude_ft;
+    double lat, lon, distance_nm;
+    time_t timestamp;
+} airprox_event_aircraft_t;
+
+typedef struct {
+    time_t timestamp;
+    int category, vertical_ft;
+    bool closure_valid;
+    double horizontal_nm, closure_kt, closure_time, closest_nm;
+    airprox_event_aircraft_t aircraft[2];
+} airprox_event_t;
+
+static inline void airprox_project(const double lat, const double lon, double *const x, double *const y) {
+    double dlon = lon - g_config.position_lon;
+    if (dlon > 180.0)
+        dlon -= 360.0;
+    else if (dlon < -180.0)
+        dlon += 360.0;
+    *x = dlon * 60.0 * cos(lat * M_PI / 180.0);
+    *y = (lat - g_config.position_lat) * 60.0;
+}
+
+static inline unsigned int airprox_bucket(const int cell_x, const int cell_y) {
+    return (((unsigned int)cell_x * 73856093U) ^ ((unsigned int)cell_y * 19349663U)) & AIRPROX_GRID_MASK;
+}
+
+static void airprox_grid_unlink(const int index) {
+    airprox_track_t *const t = &g_airprox.tracks[index];
+    if (t->grid_prev != AIRPROX_NONE)
+        g_airprox.tracks[t->grid_prev].grid_next = t->grid_next;
+    else
+        g_airprox.buckets[t->bucket] = t->grid_next;
+    if (t->grid_next != AIRPROX_NONE)
+        g_airprox.tracks[t->grid_next].grid_prev = t->grid_prev;
+}
+
+static void airprox_grid_link(const int index) {
+    airprox_track_t *const t = &g_airprox.tracks[index];
+    t->bucket                = airprox_bucket(t->cell_x, t->cell_y);
+    t->grid_prev             = AIRPROX_NONE;
+    t->grid_next             = g_airprox.buckets[t->bucket];
+    if (t->grid_next != AIRPROX_NONE)
+        g_airprox.tracks[t->grid_next].grid_prev = index;
+    g_airprox.buckets[t->bucket] = index;
+}
+
+// false if the pair was already alerted at this or a worse category within the repeat period; slots are keyed by table slot pair and
+// checked against the icaos, as slots are reused after pruning
+static bool airprox_pair_due(const int index_a, const int index_b, const int category, const time_t now) {
+    const int low                  = MIN(index_a, index_b);
+    const int high                 = MAX(index_a, index_b);
+    const aircraft_data_t *const a = &g_aircraft_list.entries[low];
+    const aircraft_data_t *const b = &g_aircraft_list.entries[high];
+    const unsigned int key         = (unsigned int)low * MAX_AIRCRAFT + (unsigned int)high + 1;
+    const unsigned int hash        = key * 2654435761U;
+    airprox_pair_t *slot           = NULL;
+    for (unsigned int probe = 0; probe < AIRPROX_PAIRS_PROBE; probe++) {
+        airprox_pair_t *const p = &g_airprox.pairs[(hash + probe) & AIRPROX_PAIRS_MASK];
+        const bool expired      = p->key == 0 || now - p->alerted >= AIRPROX_REPEAT_PERIOD;
+        if (p->key == key && !expired && strcmp(p->icao_a, a->icao) == 0 && strcmp(p->icao_b, b->icao) == 0) {
+            if (category >= p->category)
+                return false;
+            slot = p;
+            break;
+        }
+        if (!slot && expired)
+            slot = p;
     }
+    if (slot) {
+        slot->key      = key;
+        slot->category = category;
+        slot->alerted  = now;
+        memcpy(slot->icao_a, a->icao, sizeof(slot->icao_a));
+        memcpy(slot->icao_b, b->icao, sizeof(slot->icao_b));
+    }
+    return true;
+}
 
-    return obj;
+static void airprox_event_aircraft_set(airprox_event_aircraft_t *const e, const aircraft_data_t *const aircraft) {
+    memcpy(e->icao, aircraft->icao, sizeof(e->icao));
+    e->lat         = aircraft->pos.lat;
+    e->lon         = aircraft->pos.lon;
+    e->altitude_ft = aircraft->pos.altitude_ft;
+    e->distance_nm = aircraft->pos.distance_nm;
+    e->timestamp   = aircraft->pos.timestamp;
 }
 
-void aircraft_publish_mqtt(void) {
-    const time_t now                          = time(NULL);
-    unsigned long published_cnt               = 0;
-    unsigned char published_set[MAX_AIRCRAFT] = { 0 };
+static cJSON *airprox_encode_aircraft(const airprox_event_aircraft_t *const aircraft) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddStringToObject(obj, "icao", aircraft->icao);
+    cJSON_AddNumberToObject(obj, "lat", aircraft->lat);
+    cJSON_AddNumberToObject(obj, "lon", aircraft->lon);
+    cJSON_AddNumberToObject(obj, "alt", aircraft->altitude_ft);
+    cJSON_AddNumberToObject(obj, "dist", aircraft->distance_nm);
+    cJSON_AddNumberToObject(obj, "time", (double)aircraft->timestamp);
+    return obj;
+}
 
-    cJSON *root = cJSON_CreateObject();
+static void airprox_send(const void *const data) {
+    const airprox_event_t *const e = data;
+    cJSON *root                    = cJSON_CreateObject();
     if (!root)
         return;
+    cJSON_AddNumberToObject(root, "timestamp", (double)e->timestamp);
+    cJSON_AddStringToObject(root, "category", airprox_categories[e->category].name);
+    cJSON_AddNumberToObject(root, "horizontal_nm", e->horizontal_nm);
+    cJSON_AddNumberToObject(root, "vertical_ft", e->vertical_ft);
+    if (e->closure_valid) {
+        cJSON_AddNumberToObject(root, "closure_kt", e->closure_kt);
+        if (e->closure_time >= 0.0) {
+            cJSON_AddNumberToObject(root, "closure_time", e->closure_time);
+            cJSON_AddNumberToObject(root, "closest_nm", e->closest_nm);
+        }
+    }
+    cJSON *aircraft_array = cJSON_AddArrayToObject(root, "aircraft");
+    if (aircraft_array) {
+        cJSON *const ja = airprox_encode_aircraft(&e->aircraft[0]), *const jb = airprox_encode_aircraft(&e->aircraft[1]);
+        if (ja)
+            cJSON_AddItemToArray(aircraft_array, ja);
+        if (jb)
+            cJSON_AddItemToArray(aircraft_array, jb);
+    }
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str) {
+        if (sink_publish(g_airprox.topic, (const unsigned char *)json_str, strlen(json_str)))
+            g_airprox.published++;
+        free(json_str);
+    }
+}
 
-    cJSON_AddNumberToObject(root, "timestamp", (double)now);
-    cJSON_AddNumberToObject(root, "position_lat", g_config.position_lat);
-    cJSON_AddNumberToObject(root, "position_lon", g_config.position_lon);
+static void airprox_alert(const int index_a, const int index_b, const double horizontal_nm, const int vertical_ft, const time_t now) {
+    const airprox_track_t *const ta = &g_airprox.tracks[index_a], *const tb = &g_airprox.tracks[index_b];
+    const aircraft_data_t *const a = &g_aircraft_list.entries[index_a], *const b = &g_aircraft_list.entries[index_b];
+
+    // closure: the rate the separation shrinks, and the time to and miss distance of the closest point of approach if converging
+    const double rx = tb->x - ta->x, ry = tb->y - ta->y, rvx = tb->vx - ta->vx, rvy = tb->vy - ta->vy;
+    const double range = hypot(rx, ry), rate = rx * rvx + ry * rvy, speed_sq = rvx * rvx + rvy * rvy;
+    const bool closure_valid = ta->velocity_valid && tb->velocity_valid;
+    double closure_kt        = 0.0;
+    double closure_time      = -1.0;
+    double closest_nm        = horizontal_nm;
+    if (closure_valid) {
+        closure_kt = range > 0.0 ? -rate / range * 3600.0 : sqrt(speed_sq) * 3600.0;
+        if (rate < 0.0 && speed_sq > 0.0 && -rate / speed_sq <= AIRPROX_CLOSURE_TIME_MAX) {
+            closure_time = -rate / speed_sq;
+            closest_nm   = hypot(rx + rvx * closure_time, ry + rvy * closure_time);
+        }
+    }
 
-    cJSON *aircraft_array = cJSON_CreateArray();
-    if (!aircraft_array) {
-        cJSON_Delete(root);
+    int category = AIRPROX_CATEGORY_COUNT - 1;
+    for (int i = 0; i < AIRPROX_CATEGORY_COUNT; i++)
+        if (horizontal_nm < airprox_categories[i].horizontal_nm && vertical_ft < airprox_categories[i].vertical_ft) {
+            category = i;
+            break;
+        }
+    if (closure_valid && closure_kt > AIRPROX_CLOSURE_RATE_HIGH && category > 0)
+        category--;
+
+    if (!airprox_pair_due(index_a, index_b, category, now))
         return;
-    }
+    g_airprox.alerts++;
+    g_airprox.alerts_category[category]++;
+    LOG(LOG_CATEGORY_AIRPROX, LOG_LEVEL_INFO, "%s: %s/%s at %.2fnm/%dft, closure=%.0fkt", airprox_categories[category].name, a->icao, b->icao,
+        horizontal_nm, vertical_ft, closure_kt);
+
+    airprox_event_t event = { .timestamp     = now,
+                              .category      = category,
+                              .vertical_ft   = vertical_ft,
+                              .closure_valid = closure_valid,
+                              .horizontal_nm = horizontal_nm,
+                              .closure_kt    = closure_kt,
+                              .closure_time  = closure_time,
+                              .closest_nm    = closest_nm };
+    airprox_event_aircraft_set(&event.aircraft[0], a);
+    airprox_event_aircraft_set(&event.aircraft[1], b);
+    EVENT_QUEUE(airprox_send, event);
+}
 
-    pthread_mutex_lock(&g_aircraft_list.mutex);
-    for (int i = 0; i < MAX_AIRCRAFT; i++) {
-        if (g_aircraft_list.entries[i].icao[0] != '\0')
-            if (g_aircraft_list.entries[i].published < g_aircraft_list.entries[i].pos.timestamp && g_aircraft_list.entries[i].bounds_initialised) {
-                cJSON *ac_json = aircraft_publish_encode_aircraft(&g_aircraft_list.entries[i]);
-                if (ac_json) {
-                    cJSON_AddItemToArray(aircraft_array, ac_json);
-                    published_cnt++;
-                    published_set[i]++;
-                }
+static void airprox_check(const int index, const aircraft_data_t *const aircraft) {
+    const airprox_track_t *const t = &g_airprox.tracks[index];
+    const time_t now               = aircraft->pos.timestamp;
+    for (int cell_y = t->cell_y - 1; cell_y <= t->cell_y + 1; cell_y++)
+        for (int cell_x = t->cell_x - 1; cell_x <= t->cell_x + 1; cell_x++)
+            for (int other = g_airprox.buckets[airprox_bucket(cell_x, cell_y)]; other != AIRPROX_NONE; other = g_airprox.tracks[other].grid_next) {
+                const airprox_track_t *const o = &g_airprox.tracks[other];
+                if (other == index || o->cell_x != cell_x || o->cell_y != cell_y)
+                    continue;
+                g_airprox.candidates++;
+                const aircraft_data_t *const a = &g_aircraft_list.entries[other];
+                const int vertical_ft          = abs(aircraft->pos.altitude_ft - a->pos.altitude_ft);
+                if (now - a->pos.timestamp > AIRPROX_POSITION_AGE || vertical_ft >= g_config.airprox_vertical_ft)
+                    continue;
+                g_airprox.checks++;
+                const double horizontal_nm = calculate_distance_nm(aircraft->pos.lat, aircraft->pos.lon, a->pos.lat, a->pos.lon);
+                if (horizontal_nm < g_config.airprox_horizontal_nm)
+                    airprox_alert(index, other, horizontal_nm, vertical_ft, now);
             }
+}
+
+void airprox_remove(const int index) {
+    if (!g_airprox.enabled || !g_airprox.tracks[index].linked)
+        return;
+    airprox_grid_unlink(index);
+    g_airprox.tracks[index].linked = false;
+}
+
+// called with the table locked after the aircraft's position has been set
+void airprox_update(const int index, const aircraft_data_t *const aircraft) {
+    if (!g_airprox.enabled)
+        return;
+    airprox_track_t *const t = &g_airprox.tracks[index];
+    if (aircraft->state.flags & AIRCRAFT_FLAG_GROUND) {
+        airprox_remove(index);
+        return;
     }
-    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    airprox_project(aircraft->pos.lat, aircraft->pos.lon, &t->x, &t->y);
+    const time_t elapsed    = aircraft->pos.timestamp - t->sample_time;
+    const uint16_t velocity = AIRCRAFT_STATE_SPEED | AIRCRAFT_STATE_TRACK;
+    if ((aircraft->state.valid & velocity) == velocity && aircraft->pos.timestamp - aircraft->state.velocity_seen <= AIRPROX_POSITION_AGE) {
+        const double track_rad = aircraft->state.track / 10.0 * M_PI / 180.0;
+        t->vx                  = aircraft->state.ground_speed * sin(track_rad) / 3600.0;
+        t->vy                  = aircraft->state.ground_speed * cos(track_rad) / 3600.0;
+        t->velocity_valid      = true;
+    } else if (!t->linked || elapsed > AIRPROX_VELOCITY_PERIOD_MAX) {
+        t->velocity_valid = false;
+        t->sample_x       = t->x;
+        t->sample_y       = t->y;
+        t->sample_time    = aircraft->pos.timestamp;
+    } else if (elapsed >= AIRPROX_VELOCITY_PERIOD) {
+        t->vx             = (t->x - t->sample_x) / (double)elapsed;
+        t->vy             = (t->y - t->sample_y) / (double)elapsed;
+        t->velocity_valid = true;
+        t->sample_x       = t->x;
+        t->sample_y       = t->y;
+        t->sample_time    = aircraft->pos.timestamp;
+    }
+    const int cell_x = (int)floor(t->x / g_airprox.cell_nm), cell_y = (int)floor(t->y / g_airprox.cell_nm);
+    if (!t->linked || cell_x != t->cell_x || cell_y != t->cell_y) {
+        if (t->linked)
+            airprox_grid_unlink(index);
+        t->cell_x = cell_x;
+        t->cell_y = cell_y;
+        t->linked = true;
+        airprox_grid_link(index);
+    }
+    airprox_check(index, aircraft);
+}
 
-    cJSON_AddItemToObject(root, "aircraft", aircraft_array);
+bool airprox_begin(void) {
+    g_airprox.enabled = g_config.airprox_horizontal_nm > 0.0 && g_config.airprox_vertical_ft > 0;
+    if (!g_airprox.enabled)
+        return true;
+    g_airprox.cell_nm = g_config.airprox_horizontal_nm;
+    for (int i = 0; i < AIRPROX_GRID_BUCKETS; i++)
+        g_airprox.buckets[i] = AIRPROX_NONE;
+    snprintf(g_airprox.topic, sizeof(g_airprox.topic), "%s/airprox", g_config.mqtt_topic);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// loitering: each aircraft carries a running episode (its track since it last outgrew a box of LOITER_DIAGONAL_MAX_NM, climbed out of
+// LOITER_ALTITUDE_MAX or went unseen) holding the box, altitude range, path flown, displacement, cumulative signed turn and track
+// reversals, all updated O(1) per position in a local projection anchored at the episode's first position, so no position history
+// is kept or rescanned; a long enough episode is scored with the weights of monitor/filter-loitering.js (confinement, pattern and
+// altitude stability; aircraft category is not decoded so its weight is unused), where confinement is the box against the path flown
+// and the pattern is the strongest of circling (cumulative turn), reversing (track reversals) and confined (path against
+// displacement); loitering is published to TOPIC/loitering when it starts, every LOITER_REPEAT_PERIOD while it lasts and when it ends
+
+#define LOITER_ALTITUDE_MAX    5000
+#define LOITER_SPEED_MIN       10.0
+#define LOITER_SPEED_MAX       150.0
+#define LOITER_POSITIONS_MIN   10
+#define LOITER_DURATION_MIN    (3 * 60)
+#define LOITER_GAP_MAX         60
+#define LOITER_PATH_MIN_NM     0.27
+#define LOITER_DIAGONAL_MIN_NM 0.11
+#define LOITER_DIAGONAL_MAX_NM 5.4
+#define LOITER_SEGMENT_MIN_NM  0.05
+#define LOITER_TURN_CIRCLING   540.0
+#define LOITER_TURN_FULL       720.0
+#define LOITER_REVERSAL_ANGLE  150.0
+#define LOITER_REVERSALS_MIN   2
+#define LOITER_REVERSALS_FULL  4
+#define LOITER_ALTITUDE_RANGE  1000.0
+#define LOITER_WEIGHT_BOX      0.3
+#define LOITER_WEIGHT_PATTERN  0.4
+#define LOITER_WEIGHT_ALTITUDE 0.2
+#define LOITER_REPEAT_PERIOD   300
+
+typedef struct {
+    bool active, loitering, track_valid;
+    time_t started, updated, published;
+    double origin_lat, origin_lon, origin_cos;
+    double x, y, sample_x, sample_y;
+    double x_min, x_max, y_min, y_max;
+    int altitude_min, altitude_max;
+    double path_nm, turn_deg, track_deg;
+    unsigned int positions, reversals;
+    double score;
+    const char *pattern;
+} loiter_track_t;
+
+typedef struct {
+    bool enabled;
+    char topic[MAX_NAME_LENGTH + 16];
+    loiter_track_t tracks[MAX_AIRCRAFT];
+    unsigned long episodes, detected, active, published;
+} loiter_t;
+
+loiter_t g_loiter = { 0 };
 
+static inline double loiter_diagonal_nm(const loiter_track_t *const t) { return hypot(t->x_max - t->x_min, t->y_max - t->y_min); }
+
+typedef struct {
+    char icao[7];
+    int altitude_ft;
+    const char *event;
+    loiter_track_t track;
+} loiter_event_t;
+
+static void loiter_send(const void *const data) {
+    const loiter_event_t *const e = data;
+    const loiter_track_t *const t = &e->track;
+    const double diagonal_nm = loiter_diagonal_nm(t), duration = (double)(t->updated - t->started);
+    cJSON *root = cJSON_CreateObject();
+    if (!root)
+        return;
+    cJSON_AddNumberToObject(root, "timestamp", (double)t->updated);
+    cJSON_AddStringToObject(root, "icao", e->icao);
+    cJSON_AddStringToObject(root, "event", e->event);
+    cJSON_AddNumberToObject(root, "score", t->score);
+    cJSON_AddStringToObject(root, "pattern", t->pattern);
+    cJSON_AddNumberToObject(root, "started", (double)t->started);
+    cJSON_AddNumberToObject(root, "duration", duration);
+    cJSON_AddNumberToObject(root, "lat", t->origin_lat + (t->y_min + t->y_max) / 2.0 / 60.0);
+    cJSON_AddNumberToObject(root, "lon", t->origin_lon + (t->x_min + t->x_max) / 2.0 / (60.0 * t->origin_cos));
+    cJSON_AddNumberToObject(root, "diagonal_nm", diagonal_nm);
+    cJSON_AddNumberToObject(root, "area_nm2", (t->x_max - t->x_min) * (t->y_max - t->y_min));
+    cJSON_AddNumberToObject(root, "path_nm", t->path_nm);
+    cJSON_AddNumberToObject(root, "displacement_nm", hypot(t->x, t->y));
+    cJSON_AddNumberToObject(root, "turn_deg", t->turn_deg);
+    cJSON_AddNumberToObject(root, "reversals", t->reversals);
+    cJSON_AddNumberToObject(root, "speed_kt", duration > 0.0 ? t->path_nm / duration * 3600.0 : 0.0);
+    cJSON_AddNumberToObject(root, "alt_min", t->altitude_min);
+    cJSON_AddNumberToObject(root, "alt_max", t->altitude_max);
+    cJSON_AddNumberToObject(root, "alt", e->altitude_ft);
     char *json_str = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
+    if (json_str) {
+        if (sink_publish(g_loiter.topic, (const unsigned char *)json_str, strlen(json_str)))
+            g_loiter.published++;
+        free(json_str);
+    }
+}
 
-    if (json_str && published_cnt > 0) {
-        if (mqtt_publish(g_config.mqtt_topic, (const unsigned char *)json_str, strlen(json_str))) {
-            g_aircraft_stat.published_mqtt += published_cnt;
+static void loiter_publish(const aircraft_data_t *const aircraft, const loiter_track_t *const t, const char *const event) {
+    loiter_event_t e = { .altitude_ft = aircraft->pos.altitude_ft, .event = event, .track = *t };
+    memcpy(e.icao, aircraft->icao, sizeof(e.icao));
+    EVENT_QUEUE(loiter_send, e);
+}
+
+static void loiter_episode_start(loiter_track_t *const t, const aircraft_posn_t *const pos) {
+    memset(t, 0, sizeof(*t));
+    t->active       = true;
+    t->started      = pos->timestamp;
+    t->updated      = pos->timestamp;
+    t->origin_lat   = pos->lat;
+    t->origin_lon   = pos->lon;
+    t->origin_cos   = MAX(cos(pos->lat * M_PI / 180.0), 0.01);
+    t->altitude_min = pos->altitude_ft;
+    t->altitude_max = pos->altitude_ft;
+    t->positions    = 1;
+    t->pattern      = "none";
+    g_loiter.episodes++;
+}
+
+static void loiter_episode_end(const aircraft_data_t *const aircraft, loiter_track_t *const t) {
+    if (t->loitering) {
+        LOG(LOG_CATEGORY_LOITERING, LOG_LEVEL_INFO, "%s: ended after %lds (score=%.2f, pattern=%s)", aircraft->icao, t->updated - t->started, t->score,
+            t->pattern);
+        loiter_publish(aircraft, t, "end");
+        g_loiter.active--;
+    }
+    t->active    = false;
+    t->loitering = false;
+}
+
+// zero unless the episode is long, slow and confined enough to judge, as the stage 1 and 2 filters of filter-loitering.js
+static double loiter_score(loiter_track_t *const t) {
+    const double duration = (double)(t->updated - t->started), diagonal_nm = loiter_diagonal_nm(t);
+    if (t->positions < LOITER_POSITIONS_MIN || duration < LOITER_DURATION_MIN || diagonal_nm < LOITER_DIAGONAL_MIN_NM || t->path_nm < LOITER_PATH_MIN_NM)
+        return 0.0;
+    const double speed_kt = t->path_nm / duration * 3600.0;
+    if (speed_kt < LOITER_SPEED_MIN || speed_kt > LOITER_SPEED_MAX)
+        return 0.0;
+    const double circling  = fabs(t->turn_deg) >= LOITER_TURN_CIRCLING ? MIN(1.0, fabs(t->turn_deg) / LOITER_TURN_FULL) : 0.0;
+    const double reversing = t->reversals >= LOITER_REVERSALS_MIN ? MIN(1.0, (double)t->reversals / LOITER_REVERSALS_FULL) : 0.0;
+    const double confined  = MAX(0.0, 1.0 - hypot(t->x, t->y) / t->path_nm);
+    double pattern         = circling;
+    t->pattern             = "circling";
+    if (reversing > pattern) {
+        pattern    = reversing;
+        t->pattern = "reversing";
+    }
+    if (confined > pattern) {
+        pattern    = confined;
+        t->pattern = "confined";
+    }
+    const double box      = MAX(0.0, 1.0 - diagonal_nm / t->path_nm);
+    const double altitude = MAX(0.0, 1.0 - (double)(t->altitude_max - t->altitude_min) / LOITER_ALTITUDE_RANGE);
+    return box * LOITER_WEIGHT_BOX + pattern * LOITER_WEIGHT_PATTERN + altitude * LOITER_WEIGHT_ALTITUDE;
+}
+
+// called with the table locked after the aircraft's position has been set
+void loiter_update(const int index, const aircraft_data_t *const aircraft) {
+    if (!g_loiter.enabled)
+        return;
+    loiter_track_t *const t          = &g_loiter.tracks[index];
+    const aircraft_posn_t *const pos = &aircraft->pos;
+    if (t->active && (pos->altitude_ft > LOITER_ALTITUDE_MAX || pos->timestamp - t->updated > LOITER_GAP_MAX))
+        loiter_episode_end(aircraft, t);
+    if (pos->altitude_ft > LOITER_ALTITUDE_MAX)
+        return;
+    if (!t->active) {
+        loiter_episode_start(t, pos);
+        return;
+    }
+
+    double dlon = pos->lon - t->origin_lon;
+    if (dlon > 180.0)
+        dlon -= 360.0;
+    else if (dlon < -180.0)
+        dlon += 360.0;
+    const double x = dlon * 60.0 * t->origin_cos, y = (pos->lat - t->origin_lat) * 60.0;
+    if (hypot(MAX(t->x_max, x) - MIN(t->x_min, x), MAX(t->y_max, y) - MIN(t->y_min, y)) > LOITER_DIAGONAL_MAX_NM) {
+        loiter_episode_end(aircraft, t);
+        loiter_episode_start(t, pos);
+        return;
+    }
+    t->x            = x;
+    t->y            = y;
+    t->x_min        = MIN(t->x_min, x);
+    t->x_max        = MAX(t->x_max, x);
+    t->y_min        = MIN(t->y_min, y);
+    t->y_max        = MAX(t->y_max, y);
+    t->altitude_min = MIN(t->altitude_min, pos->altitude_ft);
+    t->altitude_max = MAX(t->altitude_max, pos->altitude_ft);
+    t->updated      = pos->timestamp;
+    t->positions++;
+
+    // the track is taken over segments of at least LOITER_SEGMENT_MIN_NM so position jitter neither turns nor lengthens the path
+    const double segment_nm = hypot(x - t->sample_x, y - t->sample_y);
+    if (segment_nm >= LOITER_SEGMENT_MIN_NM) {
+        const double track_deg = atan2(x - t->sample_x, y - t->sample_y) * 180.0 / M_PI;
+        if (t->track_valid) {
+            double turn_deg = track_deg - t->track_deg;
+            if (turn_deg > 180.0)
+                turn_deg -= 360.0;
+            else if (turn_deg < -180.0)
+                turn_deg += 360.0;
+            t->turn_deg += turn_deg;
+            if (fabs(turn_deg) > LOITER_REVERSAL_ANGLE)
+                t->reversals++;
+        }
+        t->track_deg   = track_deg;
+        t->track_valid = true;
+        t->path_nm += segment_nm;
+        t->sample_x = x;
+        t->sample_y = y;
+    }
+
+    t->score = loiter_score(t);
+    if (!t->loitering && t->score >= g_config.loiter_score) {
+        t->loitering = true;
+        t->published = pos->timestamp;
+        g_loiter.detected++;
+        g_loiter.active++;
+        LOG(LOG_CATEGORY_LOITERING, LOG_LEVEL_INFO, "%s: started (score=%.2f, pattern=%s, path=%.1fnm, box=%.1fnm, turn=%.0f)", aircraft->icao, t->score,
+            t->pattern, t->path_nm, loiter_diagonal_nm(t), t->turn_deg);
+        loiter_publish(aircraft, t, "start");
+    } else if (t->loitering && pos->timestamp - t->published >= LOITER_REPEAT_PERIOD) {
+        t->published = pos->timestamp;
+        loiter_publish(aircraft, t, "update");
+    }
+}
+
+void loiter_remove(const int index) {
+    if (!g_loiter.enabled)
+        return;
+    if (g_loiter.tracks[index].loitering)
+        g_loiter.active--;
+    g_loiter.tracks[index].active    = false;
+    g_loiter.tracks[index].loitering = false;
+}
+
+bool loiter_begin(void) {
+    g_loiter.enabled = g_config.loiter_score > 0.0;
+    if (g_loiter.enabled)
+        snprintf(g_loiter.topic, sizeof(g_loiter.topic), "%s/loitering", g_config.mqtt_topic);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// vicinity: a visit opens when an aircraft comes inside the station radius below the altitude ceiling and closes when it leaves either
+// (with VICINITY_MARGIN_NM / VICINITY_MARGIN_FT of hysteresis so a track on the boundary does not flap) or goes unseen; the closest
+// point of approach is kept per visit from the distance the position update already has, and is reported as overhead as soon as the
+// distance opens past it, so entering, overhead and leaving are each published to TOPIC/vicinity on the position that decides them;
+// elevation is above the station's horizon allowing for earth curvature, slant range is the straight line distance
+
+#define VICINITY_MARGIN_NM  0.1
+#define VICINITY_MARGIN_FT  200
+#define VICINITY_CPA_MARGIN 0.05
+#define VICINITY_GAP_MAX    60
+#define VICINITY_FT_PER_NM  6076.12
+#define VICINITY_EARTH_NM   3440.065
+
+typedef struct {
+    double lat, lon;
+    int altitude_ft;
+    double distance_nm, elevation_deg, slant_nm;
+    time_t timestamp;
+} vicinity_posn_t;
+
+typedef struct {
+    bool active, overhead;
+    time_t entered, updated;
+    vicinity_posn_t cpa;
+} vicinity_track_t;
+
+typedef struct {
+    bool enabled;
+    char topic[MAX_NAME_LENGTH + 16];
+    vicinity_track_t tracks[MAX_AIRCRAFT];
+    time_t expired;
+    unsigned long active, entered, overhead, left, published;
+} vicinity_t;
+
+vicinity_t g_vicinity = { 0 };
+
+static void vicinity_posn_set(vicinity_posn_t *const r, const aircraft_posn_t *const pos) {
+    const double height_nm = (double)(pos->altitude_ft - g_config.station_altitude_ft) / VICINITY_FT_PER_NM;
+    r->lat                 = pos->lat;
+    r->lon                 = pos->lon;
+    r->altitude_ft         = pos->altitude_ft;
+    r->distance_nm         = pos->distance_nm;
+    r->elevation_deg       = atan2(height_nm - pos->distance_nm * pos->distance_nm / (2.0 * VICINITY_EARTH_NM), pos->distance_nm) * 180.0 / M_PI;
+    r->slant_nm            = hypot(pos->distance_nm, height_nm);
+    r->timestamp           = pos->timestamp;
+}
+
+static cJSON *vicinity_encode_position(const vicinity_posn_t *const pos) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddNumberToObject(obj, "lat", pos->lat);
+    cJSON_AddNumberToObject(obj, "lon", pos->lon);
+    cJSON_AddNumberToObject(obj, "alt", pos->altitude_ft);
+    cJSON_AddNumberToObject(obj, "dist", pos->distance_nm);
+    cJSON_AddNumberToObject(obj, "bearing", calculate_bearing_deg(g_config.position_lat, g_config.position_lon, pos->lat, pos->lon));
+    cJSON_AddNumberToObject(obj, "elevation", pos->elevation_deg);
+    cJSON_AddNumberToObject(obj, "slant", pos->slant_nm);
+    cJSON_AddNumberToObject(obj, "time", (double)pos->timestamp);
+    return obj;
+}
+
+typedef struct {
+    char icao[7];
+    bool current_valid;
+    const char *event;
+    vicinity_track_t track;
+    vicinity_posn_t current;
+} vicinity_event_t;
+
+static void vicinity_send(const void *const data) {
+    const vicinity_event_t *const e = data;
+    const vicinity_track_t *const t = &e->track;
+    const char *const event         = e->event;
+    cJSON *root                     = cJSON_CreateObject();
+    if (!root)
+        return;
+    cJSON_AddNumberToObject(root, "timestamp", (double)t->updated);
+    cJSON_AddStringToObject(root, "icao", e->icao);
+    cJSON_AddStringToObject(root, "event", event);
+    cJSON_AddNumberToObject(root, "entered", (double)t->entered);
+    if (e->current_valid) {
+        cJSON *const current = vicinity_encode_position(&e->current);
+        if (current)
+            cJSON_AddItemToObject(root, "current", current);
+    }
+    if (t->overhead || strcmp(event, "leaving") == 0) {
+        cJSON *const cpa = vicinity_encode_position(&t->cpa);
+        if (cpa)
+            cJSON_AddItemToObject(root, "cpa", cpa);
+    }
+    if (strcmp(event, "leaving") == 0)
+        cJSON_AddNumberToObject(root, "duration", (double)(t->updated - t->entered));
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str) {
+        if (sink_publish(g_vicinity.topic, (const unsigned char *)json_str, strlen(json_str)))
+            g_vicinity.published++;
+        free(json_str);
+    }
+}
+
+static void vicinity_publish(const char *const icao, const vicinity_track_t *const t, const vicinity_posn_t *const pos, const char *const event) {
+    vicinity_event_t e = { .current_valid = pos != NULL, .event = event, .track = *t };
+    memcpy(e.icao, icao, sizeof(e.icao));
+    if (pos)
+        e.current = *pos;
+    EVENT_QUEUE(vicinity_send, e);
+}
+
+static void vicinity_leave(const char *const icao, vicinity_track_t *const t, const vicinity_posn_t *const pos) {
+    LOG(LOG_CATEGORY_VICINITY, LOG_LEVEL_INFO, "%s: leaving after %lds (cpa=%.2fnm at %dft, elevation=%.1f)", icao, t->updated - t->entered,
+        t->cpa.distance_nm, t->cpa.altitude_ft, t->cpa.elevation_deg);
+    vicinity_publish(icao, t, pos, "leaving");
+    t->active = false;
+    g_vicinity.active--;
+    g_vicinity.left++;
+}
+
+// called with the table locked after the aircraft's position has been set
+void vicinity_update(const int index, const aircraft_data_t *const aircraft) {
+    if (!g_vicinity.enabled)
+        return;
+    vicinity_track_t *const t        = &g_vicinity.tracks[index];
+    const aircraft_posn_t *const pos = &aircraft->pos;
+    if (!t->active) {
+        if (pos->distance_nm > g_config.vicinity_radius_nm || pos->altitude_ft > g_config.vicinity_altitude_ft)
+            return;
+        t->active   = true;
+        t->overhead = false;
+        t->entered  = pos->timestamp;
+        t->updated  = pos->timestamp;
+        vicinity_posn_set(&t->cpa, pos);
+        g_vicinity.active++;
+        g_vicinity.entered++;
+        LOG(LOG_CATEGORY_VICINITY, LOG_LEVEL_INFO, "%s: entering at %.2fnm, %dft", aircraft->icao, pos->distance_nm, pos->altitude_ft);
+        vicinity_publish(aircraft->icao, t, &t->cpa, "entering");
+        return;
+    }
+
+    vicinity_posn_t current;
+    vicinity_posn_set(&current, pos);
+    t->updated = pos->timestamp;
+    if (pos->distance_nm > g_config.vicinity_radius_nm + VICINITY_MARGIN_NM || pos->altitude_ft > g_config.vicinity_altitude_ft + VICINITY_MARGIN_FT) {
+        vicinity_leave(aircraft->icao, t, &current);
+        return;
+    }
+    if (pos->distance_nm < t->cpa.distance_nm) {
+        t->cpa      = current;
+        t->overhead = false;
+    } else if (!t->overhead && pos->distance_nm > t->cpa.distance_nm + VICINITY_CPA_MARGIN) {
+        t->overhead = true;
+        g_vicinity.overhead++;
+        LOG(LOG_CATEGORY_VICINITY, LOG_LEVEL_INFO, "%s: overhead at %.2fnm, %dft (elevation=%.1f, slant=%.2fnm)", aircraft->icao, t->cpa.distance_nm,
+            t->cpa.altitude_ft, t->cpa.elevation_deg, t->cpa.slant_nm);
+        vicinity_publish(aircraft->icao, t, &current, "overhead");
+    }
+}
+
+// closes visits of aircraft that went unseen, at most once a second and only while any are open
+void vicinity_expire(void) {
+    if (!g_vicinity.enabled || g_vicinity.active == 0)
+        return;
+    const time_t now = time(NULL);
+    if (now == g_vicinity.expired)
+        return;
+    g_vicinity.expired = now;
+    for (int i = 0; i < MAX_AIRCRAFT;) {
+        pthread_mutex_lock(&g_aircraft_list.mutex);
+        for (; i < MAX_AIRCRAFT && event_queue_space() > 0; i++)
+            if (g_vicinity.tracks[i].active && now - g_vicinity.tracks[i].updated > VICINITY_GAP_MAX)
+                vicinity_leave(g_aircraft_list.entries[i].icao, &g_vicinity.tracks[i], NULL);
+        aircraft_list_unlock();
+    }
+}
+
+void vicinity_remove(const int index) {
+    if (g_vicinity.enabled && g_vicinity.tracks[index].active)
+        vicinity_leave(g_aircraft_list.entries[index].icao, &g_vicinity.tracks[index], NULL);
+}
+
+bool vicinity_begin(void) {
+    g_vicinity.enabled = g_config.vicinity_radius_nm > 0.0 && g_config.vicinity_altitude_ft > 0;
+    if (g_vicinity.enabled)
+        snprintf(g_vicinity.topic, sizeof(g_vicinity.topic), "%s/vicinity", g_config.mqtt_topic);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// anomaly: the kinematic detectors of monitor/filter-anomaly.js (high speed at low altitude, extreme vertical rate, altitude oscillation,
+// rapid speed change) run on every message that changes an aircraft's state rather than on each monitor cycle, from O(1) rolling
+// statistics per aircraft table slot: an EWMA of ground speed and vertical rate so one bad sample cannot raise an alert, the min and max
+// of altitude and ground speed over the last window seconds in monotonic deques, and the altitude direction changes (with
+// ANOMALY_DIRECTION_FT of hysteresis) in a ring of their times; an anomaly is published to TOPIC/anomaly when it is raised and when its
+// severity rises, and is cleared once its condition has been absent for ANOMALY_CLEAR_PERIOD
+
+#define ANOMALY_DEQUE_MAX       32 // power of two, above the longest window as a deque holds at most one sample per second
+#define ANOMALY_WINDOW_MAX      (ANOMALY_DEQUE_MAX - 2)
+#define ANOMALY_ALTITUDE_UNIT   10 // feet per deque step, so altitudes fit in 16 bits
+#define ANOMALY_EWMA_ALPHA      0.3
+#define ANOMALY_DIRECTION_FT    300
+#define ANOMALY_CHANGES_MAX     8
+#define ANOMALY_CLEAR_PERIOD    10
+
+typedef enum { ANOMALY_SEVERITY_NONE = 0, ANOMALY_SEVERITY_LOW, ANOMALY_SEVERITY_MEDIUM, ANOMALY_SEVERITY_HIGH } anomaly_severity_t;
+const char *const anomaly_severity_names[] = { "none", "low", "medium", "high" };
+
+typedef enum {
+    ANOMALY_HIGH_SPEED_LOW_ALTITUDE = 0,
+    ANOMALY_EXTREME_VERTICAL_RATE,
+    ANOMALY_ALTITUDE_OSCILLATION,
+    ANOMALY_RAPID_SPEED_CHANGE,
+    ANOMALY_TYPE_COUNT
+} anomaly_type_t;
+const char *const anomaly_type_names[ANOMALY_TYPE_COUNT] = { "high-speed-low-altitude", "extreme-vertical-rate", "altitude-oscillation",
+                                                             "rapid-speed-change" };
+
+// the thresholds of filter-anomaly.js, most severe first so the first match is taken: limit is the altitude ceiling, the direction
+// changes at least or the seconds at most, value the speed above, vertical rate, altitude range or speed change at least; the update
+// counts of the speed change become seconds
+typedef struct {
+    int limit, value;
+    anomaly_severity_t severity;
+    const char *description;
+} anomaly_threshold_t;
+
+const anomaly_threshold_t anomaly_high_speed_low_altitude[] = {
+    { 10000, 350, ANOMALY_SEVERITY_HIGH, "very low altitude" },
+    { 15000, 400, ANOMALY_SEVERITY_MEDIUM, "low altitude" },
+    { 20000, 450, ANOMALY_SEVERITY_LOW, "medium altitude" },
+};
+const anomaly_threshold_t anomaly_extreme_vertical_rate[] = {
+    { 0, 10000, ANOMALY_SEVERITY_HIGH, "exceptional vertical rate" },
+    { 0, 8000, ANOMALY_SEVERITY_HIGH, "very extreme vertical rate" },
+    { 0, 6000, ANOMALY_SEVERITY_MEDIUM, "extreme vertical rate" },
+};
+const anomaly_threshold_t anomaly_altitude_oscillation[] = {
+    { 4, 3000, ANOMALY_SEVERITY_HIGH, "severe altitude oscillation" },
+    { 2, 2000, ANOMALY_SEVERITY_MEDIUM, "altitude oscillation" },
+};
+const anomaly_threshold_t anomaly_rapid_speed_change[] = {
+    { 5, 200, ANOMALY_SEVERITY_HIGH, "extreme speed change" },
+    { 10, 150, ANOMALY_SEVERITY_MEDIUM, "very rapid speed change" },
+    { 20, 100, ANOMALY_SEVERITY_LOW, "rapid speed change" },
+};
+#define ANOMALY_THRESHOLDS(t) (t), (int)(sizeof(t) / sizeof((t)[0]))
+
+// times are the low 16 bits of the timestamp, compared by wrapping difference, which is safe as a track is reset after a gap of a window
+typedef struct {
+    int16_t value;
+    uint16_t time;
+} anomaly_sample_t;
+
+typedef struct {
+    anomaly_sample_t samples[ANOMALY_DEQUE_MAX];
+    uint8_t head, count;
+} anomaly_deque_t;
+
+typedef struct {
+    anomaly_severity_t severity;
+    const char *description;
+    time_t raised, absent;
+} anomaly_state_t;
+
+typedef struct {
+    bool active, speed_valid, vertical_valid, altitude_valid;
+    time_t updated;
+    double speed_kt, vertical_fpm;
+    int altitude_ft, extreme_ft, direction;
+    anomaly_deque_t altitude_min, altitude_max, speed_min, speed_max;
+    uint16_t changes[ANOMALY_CHANGES_MAX];
+    uint8_t changes_head, changes_count;
+    anomaly_state_t states[ANOMALY_TYPE_COUNT];
+} anomaly_track_t;
+
+typedef struct {
+    bool enabled;
+    char topic[MAX_NAME_LENGTH + 16];
+    uint16_t window;
+    anomaly_track_t tracks[MAX_AIRCRAFT];
+    unsigned long active, raised[ANOMALY_TYPE_COUNT], escalated, cleared, published;
+} anomaly_t;
+
+anomaly_t g_anomaly = { 0 };
+
+static inline anomaly_sample_t *anomaly_deque_at(anomaly_deque_t *const d, const unsigned int offset) {
+    return &d->samples[(d->head + offset) & (ANOMALY_DEQUE_MAX - 1)];
+}
+
+// drops samples that have left the window, so the front is the extreme of the window
+static const anomaly_sample_t *anomaly_deque_front(anomaly_deque_t *const d, const uint16_t time) {
+    while (d->count > 0 && (uint16_t)(time - anomaly_deque_at(d, 0)->time) > g_anomaly.window) {
+        d->head = (uint8_t)((d->head + 1) & (ANOMALY_DEQUE_MAX - 1));
+        d->count--;
+    }
+    return d->count > 0 ? anomaly_deque_at(d, 0) : NULL;
+}
+
+// values stay strictly decreasing (maximum) or increasing (minimum) from the front: a sample removes those behind it that it beats, and
+// is itself dropped if it does not beat a sample from the same second, which would leave the window with it
+static void anomaly_deque_push(anomaly_deque_t *const d, const bool maximum, const int16_t value, const uint16_t time) {
+    while (d->count > 0) {
+        const anomaly_sample_t *const back = anomaly_deque_at(d, d->count - 1U);
+        if (maximum ? back->value > value : back->value < value) {
+            if (back->time == time)
+                return;
+            break;
+        }
+        d->count--;
+    }
+    anomaly_deque_front(d, time);
+    if (d->count == ANOMALY_DEQUE_MAX) {
+        d->head = (uint8_t)((d->head + 1) & (ANOMALY_DEQUE_MAX - 1));
+        d->count--;
+    }
+    anomaly_sample_t *const sample = anomaly_deque_at(d, d->count++);
+    sample->value                  = value;
+    sample->time                   = time;
+}
+
+static const anomaly_threshold_t *anomaly_threshold_find(const anomaly_threshold_t *const thresholds, const int count, const bool limit_below,
+                                                         const int limit, const int value) {
+    for (int i = 0; i < count; i++)
+        if ((limit_below ? limit <= thresholds[i].limit : limit >= thresholds[i].limit) && value >= thresholds[i].value)
+            return &thresholds[i];
+    return NULL;
+}
+
+static int anomaly_changes(const anomaly_track_t *const t, const uint16_t time) {
+    int changes = 0;
+    for (unsigned int i = 0; i < t->changes_count; i++)
+        if ((uint16_t)(time - t->changes[(t->changes_head + i) % ANOMALY_CHANGES_MAX]) <= g_anomaly.window)
+            changes++;
+    return changes;
+}
+
+typedef struct {
+    char icao[7];
+    bool altitude_valid, speed_valid, vertical_valid, position_valid;
+    anomaly_type_t type;
+    int altitude_ft;
+    const char *event;
+    anomaly_state_t state;
+    time_t timestamp;
+    double speed_kt, vertical_fpm, lat, lon;
+} anomaly_event_t;
+
+static void anomaly_send(const void *const data) {
+    const anomaly_event_t *const e = data;
+    const anomaly_state_t *const s = &e->state;
+    cJSON *root                    = cJSON_CreateObject();
+    if (!root)
+        return;
+    cJSON_AddNumberToObject(root, "timestamp", (double)e->timestamp);
+    cJSON_AddStringToObject(root, "icao", e->icao);
+    cJSON_AddStringToObject(root, "event", e->event);
+    cJSON_AddStringToObject(root, "type", anomaly_type_names[e->type]);
+    cJSON_AddStringToObject(root, "severity", anomaly_severity_names[s->severity]);
+    if (s->description)
+        cJSON_AddStringToObject(root, "description", s->description);
+    cJSON_AddNumberToObject(root, "raised", (double)s->raised);
+    if (strcmp(e->event, "cleared") == 0)
+        cJSON_AddNumberToObject(root, "duration", (double)(e->timestamp - s->raised));
+    if (e->altitude_valid)
+        cJSON_AddNumberToObject(root, "altitude", e->altitude_ft);
+    if (e->speed_valid)
+        cJSON_AddNumberToObject(root, "speed", round(e->speed_kt));
+    if (e->vertical_valid)
+        cJSON_AddNumberToObject(root, "vertical_rate", round(e->vertical_fpm));
+    if (e->position_valid) {
+        cJSON_AddNumberToObject(root, "lat", e->lat);
+        cJSON_AddNumberToObject(root, "lon", e->lon);
+    }
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str) {
+        if (sink_publish(g_anomaly.topic, (const unsigned char *)json_str, strlen(json_str)))
+            g_anomaly.published++;
+        free(json_str);
+    }
+}
+
+static void anomaly_publish(const aircraft_data_t *const aircraft, const anomaly_track_t *const t, const anomaly_type_t type, const char *const event,
+                            const time_t timestamp) {
+    anomaly_event_t e = { .altitude_valid = t->altitude_valid,
+                          .speed_valid    = t->speed_valid,
+                          .vertical_valid = t->vertical_valid,
+                          .position_valid = aircraft->bounds_initialised,
+                          .type           = type,
+                          .altitude_ft    = t->altitude_ft,
+                          .event          = event,
+                          .state          = t->states[type],
+                          .timestamp      = timestamp,
+                          .speed_kt       = t->speed_kt,
+                          .vertical_fpm   = t->vertical_fpm,
+                          .lat            = aircraft->pos.lat,
+                          .lon            = aircraft->pos.lon };
+    memcpy(e.icao, aircraft->icao, sizeof(e.icao));
+    EVENT_QUEUE(anomaly_send, e);
+}
+
+// raised, or escalated if more severe than when raised; a lesser severity only keeps the anomaly open
+static void anomaly_detected(const aircraft_data_t *const aircraft, anomaly_track_t *const t, const anomaly_type_t type,
+                             const anomaly_threshold_t *const threshold, const time_t timestamp) {
+    anomaly_state_t *const s = &t->states[type];
+    if (!threshold) {
+        if (s->severity == ANOMALY_SEVERITY_NONE)
+            return;
+        if (s->absent == 0)
+            s->absent = timestamp;
+        else if (timestamp - s->absent >= ANOMALY_CLEAR_PERIOD) {
+            LOG(LOG_CATEGORY_ANOMALY, LOG_LEVEL_INFO, "%s: %s cleared after %lds", aircraft->icao, anomaly_type_names[type], timestamp - s->raised);
+            anomaly_publish(aircraft, t, type, "cleared", timestamp);
+            s->severity = ANOMALY_SEVERITY_NONE;
+            g_anomaly.active--;
+            g_anomaly.cleared++;
+        }
+        return;
+    }
+    s->absent = 0;
+    if (threshold->severity <= s->severity)
+        return;
+    const bool raised = s->severity == ANOMALY_SEVERITY_NONE;
+    s->severity       = threshold->severity;
+    s->description    = threshold->description;
+    if (raised) {
+        s->raised = timestamp;
+        g_anomaly.active++;
+        g_anomaly.raised[type]++;
+    } else
+        g_anomaly.escalated++;
+    LOG(LOG_CATEGORY_ANOMALY, LOG_LEVEL_INFO, "%s: %s %s (%s, alt=%dft, speed=%.0fkt, rate=%.0ffpm)", aircraft->icao, anomaly_type_names[type],
+        raised ? "raised" : "escalated", threshold->description, t->altitude_ft, t->speed_kt, t->vertical_fpm);
+    anomaly_publish(aircraft, t, type, raised ? "raised" : "escalated", timestamp);
+}
+
+static void anomaly_reset(const aircraft_data_t *const aircraft, anomaly_track_t *const t, const time_t timestamp) {
+    for (int type = 0; type < ANOMALY_TYPE_COUNT; type++)
+        if (t->states[type].severity != ANOMALY_SEVERITY_NONE) {
+            if (aircraft)
+                anomaly_publish(aircraft, t, (anomaly_type_t)type, "cleared", timestamp);
+            g_anomaly.active--;
+            g_anomaly.cleared++;
+        }
+    memset(t, 0, sizeof(*t));
+}
+
+static void anomaly_altitude(anomaly_track_t *const t, const int altitude_ft, const uint16_t time) {
+    const int16_t value = (int16_t)MAX(MIN(altitude_ft / ANOMALY_ALTITUDE_UNIT, INT16_MAX), INT16_MIN);
+    anomaly_deque_push(&t->altitude_min, false, value, time);
+    anomaly_deque_push(&t->altitude_max, true, value, time);
+    t->altitude_ft = altitude_ft;
+    if (!t->altitude_valid) {
+        t->altitude_valid = true;
+        t->extreme_ft     = altitude_ft;
+        return;
+    }
+    // the extreme follows the climb or descent and a move of ANOMALY_DIRECTION_FT back from it is a change of direction
+    const int moved_ft  = altitude_ft - t->extreme_ft;
+    const int direction = moved_ft >= ANOMALY_DIRECTION_FT ? 1 : moved_ft <= -ANOMALY_DIRECTION_FT ? -1 : 0;
+    if ((t->direction > 0 && altitude_ft > t->extreme_ft) || (t->direction < 0 && altitude_ft < t->extreme_ft))
+        t->extreme_ft = altitude_ft;
+    if (direction != 0 && direction != t->direction) {
+        if (t->direction != 0) {
+            if (t->changes_count == ANOMALY_CHANGES_MAX)
+                t->changes_head = (uint8_t)((t->changes_head + 1) % ANOMALY_CHANGES_MAX);
+            else
+                t->changes_count++;
+            t->changes[(t->changes_head + t->changes_count - 1U) % ANOMALY_CHANGES_MAX] = time;
+        }
+        t->direction  = direction;
+        t->extreme_ft = altitude_ft;
+    }
+}
+
+static const anomaly_threshold_t *anomaly_detect_high_speed_low_altitude(const anomaly_track_t *const t) {
+    if (!t->speed_valid || !t->altitude_valid || t->altitude_ft <= 0)
+        return NULL;
+    for (size_t i = 0; i < sizeof(anomaly_high_speed_low_altitude) / sizeof(anomaly_high_speed_low_altitude[0]); i++)
+        if (t->altitude_ft <= anomaly_high_speed_low_altitude[i].limit && t->speed_kt > anomaly_high_speed_low_altitude[i].value)
+            return &anomaly_high_speed_low_altitude[i];
+    return NULL;
+}
+
+static const anomaly_threshold_t *anomaly_detect_extreme_vertical_rate(const anomaly_track_t *const t) {
+    if (!t->vertical_valid)
+        return NULL;
+    return anomaly_threshold_find(ANOMALY_THRESHOLDS(anomaly_extreme_vertical_rate), false, 0, (int)lround(fabs(t->vertical_fpm)));
+}
+
+static const anomaly_threshold_t *anomaly_detect_altitude_oscillation(anomaly_track_t *const t, const uint16_t time) {
+    const anomaly_sample_t *const minimum = anomaly_deque_front(&t->altitude_min, time), *const maximum = anomaly_deque_front(&t->altitude_max, time);
+    if (!minimum || !maximum)
+        return NULL;
+    return anomaly_threshold_find(ANOMALY_THRESHOLDS(anomaly_altitude_oscillation), false, anomaly_changes(t, time),
+                                  (maximum->value - minimum->value) * ANOMALY_ALTITUDE_UNIT);
+}
+
+// the window's slowest and fastest, and the seconds between them whichever came first
+static const anomaly_threshold_t *anomaly_detect_rapid_speed_change(anomaly_track_t *const t, const uint16_t time) {
+    const anomaly_sample_t *const minimum = anomaly_deque_front(&t->speed_min, time), *const maximum = anomaly_deque_front(&t->speed_max, time);
+    if (!minimum || !maximum)
+        return NULL;
+    const uint16_t accelerating = (uint16_t)(maximum->time - minimum->time), decelerating = (uint16_t)(minimum->time - maximum->time);
+    return anomaly_threshold_find(ANOMALY_THRESHOLDS(anomaly_rapid_speed_change), true, MIN(accelerating, decelerating),
+                                  maximum->value - minimum->value);
+}
+
+// called with the table locked after the message has been applied to the aircraft's state
+void anomaly_update(const int index, const aircraft_data_t *const aircraft, const adsb_message_t *const msg, time_t timestamp) {
+    if (!g_anomaly.enabled || !(msg->present & (AIRCRAFT_STATE_ALTITUDE | AIRCRAFT_STATE_SPEED | AIRCRAFT_STATE_VERTICAL_RATE)))
+        return;
+    anomaly_track_t *const t = &g_anomaly.tracks[index];
+    if (t->active && timestamp < t->updated)
+        timestamp = t->updated;
+    if (t->active && timestamp - t->updated > g_anomaly.window)
+        anomaly_reset(aircraft, t, timestamp);
+    t->active           = true;
+    t->updated          = timestamp;
+    const uint16_t time = (uint16_t)timestamp;
+
+    if (msg->present & AIRCRAFT_STATE_ALTITUDE)
+        anomaly_altitude(t, msg->altitude_ft, time);
+    if (msg->present & AIRCRAFT_STATE_SPEED) {
+        t->speed_kt    = t->speed_valid ? t->speed_kt + ANOMALY_EWMA_ALPHA * (msg->ground_speed - t->speed_kt) : msg->ground_speed;
+        t->speed_valid = true;
+        anomaly_deque_push(&t->speed_min, false, aircraft->state.ground_speed, time);
+        anomaly_deque_push(&t->speed_max, true, aircraft->state.ground_speed, time);
+    }
+    if (msg->present & AIRCRAFT_STATE_VERTICAL_RATE) {
+        t->vertical_fpm   = t->vertical_valid ? t->vertical_fpm + ANOMALY_EWMA_ALPHA * ((double)msg->vertical_rate - t->vertical_fpm) : msg->vertical_rate;
+        t->vertical_valid = true;
+    }
+    // nothing is detected on the ground, so anything raised in the air clears after landing
+    const bool airborne = !(aircraft->state.flags & AIRCRAFT_FLAG_GROUND);
+    anomaly_detected(aircraft, t, ANOMALY_HIGH_SPEED_LOW_ALTITUDE, airborne ? anomaly_detect_high_speed_low_altitude(t) : NULL, timestamp);
+    anomaly_detected(aircraft, t, ANOMALY_EXTREME_VERTICAL_RATE, airborne ? anomaly_detect_extreme_vertical_rate(t) : NULL, timestamp);
+    anomaly_detected(aircraft, t, ANOMALY_ALTITUDE_OSCILLATION, airborne ? anomaly_detect_altitude_oscillation(t, time) : NULL, timestamp);
+    anomaly_detected(aircraft, t, ANOMALY_RAPID_SPEED_CHANGE, airborne ? anomaly_detect_rapid_speed_change(t, time) : NULL, timestamp);
+}
+
+void anomaly_remove(const int index) {
+    if (g_anomaly.enabled && g_anomaly.tracks[index].active)
+        anomaly_reset(NULL, &g_anomaly.tracks[index], 0);
+}
+
+bool anomaly_begin(void) {
+    g_anomaly.enabled = g_config.anomaly_window > 0;
+    g_anomaly.window  = (uint16_t)g_config.anomaly_window;
+    if (g_anomaly.enabled)
+        snprintf(g_anomaly.topic, sizeof(g_anomaly.topic), "%s/anomaly", g_config.mqtt_topic);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// kinematic tracker: a constant velocity Kalman filter per aircraft table slot, run on each axis separately (east and north in
+// nautical miles on a plane tangent at the last estimate, which is recentred after every update, and altitude in feet), so an update
+// is O(1); a position is rejected before it reaches the bounds or the voxel map if it implies a speed no aircraft flies or falls
+// outside the filter's gate, and after TRACK_REJECT_MAX rejections in a row the track restarts from the next position, so a bad first
+// fix cannot lock out the good ones; publishing carries the state predicted to publish time with its covariance, which subscribers
+// can extrapolate themselves between less frequent publishes
+
+#define TRACK_SPEED_MAX_KT          1500.0
+#define TRACK_POSITION_NOISE_NM     0.1 // decoded position plus one second of timestamp quantisation
+#define TRACK_ALTITUDE_NOISE_FT     50.0
+#define TRACK_ACCEL_NM_S2           0.002 // about 0.4g, a rate one turn at 140kt
+#define TRACK_VERTICAL_ACCEL_FT_S2  3.0
+#define TRACK_VELOCITY_INIT_KT      600.0
+#define TRACK_VELOCITY_DECODED_KT   20.0
+#define TRACK_VELOCITY_DECODED_AGE  30
+#define TRACK_VERTICAL_INIT_FPM     6000.0
+#define TRACK_VERTICAL_DECODED_FPM  500.0
+#define TRACK_STALE                 60
+#define TRACK_REJECT_MAX            3
+
+// position p, velocity v (per second) and covariance [p00 p01; p01 p11]
+typedef struct {
+    double p, v;
+    double p00, p01, p11;
+} track_axis_t;
+
+typedef struct {
+    bool active;
+    unsigned char rejects;
+    double lat, lon;
+    track_axis_t east, north, up;
+    time_t updated;
+} track_t;
+
+typedef struct {
+    bool enabled;
+    track_t tracks[MAX_AIRCRAFT];
+    unsigned long updates, starts, rejected_speed, rejected_gate;
+} track_state_t;
+
+track_state_t g_track = { 0 };
+
+static void track_axis_start(track_axis_t *const a, const double p, const double p_sigma, const double v, const double v_sigma) {
+    a->p   = p;
+    a->v   = v;
+    a->p00 = p_sigma * p_sigma;
+    a->p01 = 0.0;
+    a->p11 = v_sigma * v_sigma;
+}
+
+// white noise acceleration of standard deviation accel over dt
+static void track_axis_predict(track_axis_t *const a, const double dt, const double accel) {
+    if (dt <= 0.0)
+        return;
+    const double q = accel * accel, dt2 = dt * dt;
+    a->p += a->v * dt;
+    a->p00 += dt * (2.0 * a->p01 + dt * a->p11) + q * dt2 * dt2 / 4.0;
+    a->p01 += dt * a->p11 + q * dt2 * dt / 2.0;
+    a->p11 += q * dt2;
+}
+
+static void track_axis_correct(track_axis_t *const a, const double z, const double noise) {
+    const double s = a->p00 + noise * noise, k0 = a->p00 / s, k1 = a->p01 / s, innovation = z - a->p;
+    a->p += k0 * innovation;
+    a->v += k1 * innovation;
+    a->p11 -= k1 * a->p01;
+    a->p00 *= 1.0 - k0;
+    a->p01 *= 1.0 - k0;
+}
+
+// squared innovation over its variance
+static inline double track_axis_distance2(const track_axis_t *const a, const double z, const double noise) {
+    return (z - a->p) * (z - a->p) / (a->p00 + noise * noise);
+}
+
+static inline void track_offset(const double lat, const double lon, const double to_lat, const double to_lon, double *const east, double *const north) {
+    double dlon = to_lon - lon;
+    if (dlon > 180.0)
+        dlon -= 360.0;
+    else if (dlon < -180.0)
+        dlon += 360.0;
+    *east  = dlon * 60.0 * cos(lat * M_PI / 180.0);
+    *north = (to_lat - lat) * 60.0;
+}
+
+static void track_position(const track_t *const t, const double east, const double north, double *const lat, double *const lon) {
+    *lat = t->lat + north / 60.0;
+    *lon = t->lon + east / (60.0 * cos(t->lat * M_PI / 180.0));
+    if (*lon > 180.0)
+        *lon -= 360.0;
+    else if (*lon < -180.0)
+        *lon += 360.0;
+}
+
+// velocity from the decoded ground speed, track and vertical rate when they are recent, otherwise unknown
+static void track_start(track_t *const t, const aircraft_state_t *const state, const adsb_message_t *const msg, const time_t timestamp) {
+    const uint16_t decoded = AIRCRAFT_STATE_SPEED | AIRCRAFT_STATE_TRACK;
+    const bool velocity    = (state->valid & decoded) == decoded && timestamp - state->velocity_seen <= TRACK_VELOCITY_DECODED_AGE;
+    const bool vertical    = (state->valid & AIRCRAFT_STATE_VERTICAL_RATE) && velocity;
+    const double speed = velocity ? state->ground_speed / 3600.0 : 0.0, track = state->track / 10.0 * M_PI / 180.0;
+    const double sigma = (velocity ? TRACK_VELOCITY_DECODED_KT : TRACK_VELOCITY_INIT_KT) / 3600.0;
+    t->lat             = msg->lat;
+    t->lon             = msg->lon;
+    track_axis_start(&t->east, 0.0, TRACK_POSITION_NOISE_NM, speed * sin(track), sigma);
+    track_axis_start(&t->north, 0.0, TRACK_POSITION_NOISE_NM, speed * cos(track), sigma);
+    track_axis_start(&t->up, msg->altitude_ft, TRACK_ALTITUDE_NOISE_FT, vertical ? state->vertical_rate / 60.0 : 0.0,
+                     (vertical ? TRACK_VERTICAL_DECODED_FPM : TRACK_VERTICAL_INIT_FPM) / 60.0);
+    t->updated = timestamp;
+    t->rejects = 0;
+    t->active  = true;
+    g_track.starts++;
+}
+
+// called with the table locked for a position within bounds, false if it is rejected (and counted as an invalid position)
+bool track_update(const int index, const aircraft_data_t *const aircraft, const adsb_message_t *const msg, const time_t timestamp) {
+    if (!g_track.enabled)
+        return true;
+    track_t *const t = &g_track.tracks[index];
+    g_track.updates++;
+    // a slot without an accepted position is a new aircraft, whatever was tracked there before
+    if (!aircraft->bounds_initialised || !t->active || timestamp - t->updated > TRACK_STALE || t->rejects >= TRACK_REJECT_MAX) {
+        track_start(t, &aircraft->state, msg, timestamp);
+        return true;
+    }
+
+    const double dt = (double)(timestamp - t->updated);
+    double east, north;
+    track_offset(t->lat, t->lon, msg->lat, msg->lon, &east, &north);
+    const char *reason = NULL;
+    if (sqrt(east * east + north * north) * 3600.0 / MAX(dt, 1.0) > TRACK_SPEED_MAX_KT) {
+        g_track.rejected_speed++;
+        reason = "speed";
+    } else {
+        track_t predicted = *t;
+        track_axis_predict(&predicted.east, dt, TRACK_ACCEL_NM_S2);
+        track_axis_predict(&predicted.north, dt, TRACK_ACCEL_NM_S2);
+        track_axis_predict(&predicted.up, dt, TRACK_VERTICAL_ACCEL_FT_S2);
+        const double distance2 = track_axis_distance2(&predicted.east, east, TRACK_POSITION_NOISE_NM) +
+                                 track_axis_distance2(&predicted.north, north, TRACK_POSITION_NOISE_NM) +
+                                 track_axis_distance2(&predicted.up, msg->altitude_ft, TRACK_ALTITUDE_NOISE_FT);
+        if (distance2 > g_config.track_gate * g_config.track_gate) {
+            g_track.rejected_gate++;
+            reason = "gate";
+        } else {
+            track_axis_correct(&predicted.east, east, TRACK_POSITION_NOISE_NM);
+            track_axis_correct(&predicted.north, north, TRACK_POSITION_NOISE_NM);
+            track_axis_correct(&predicted.up, msg->altitude_ft, TRACK_ALTITUDE_NOISE_FT);
+            track_position(&predicted, predicted.east.p, predicted.north.p, &predicted.lat, &predicted.lon);
+            predicted.east.p  = 0.0;
+            predicted.north.p = 0.0;
+            predicted.updated = timestamp;
+            predicted.rejects = 0;
+            *t                = predicted;
+            return true;
+        }
+    }
+
+    t->rejects++;
+    g_aircraft_stat.position_invalid++;
+    g_aircraft_global.position_invalid++;
+    PROBE4(position_rejected, msg->icao, PROBE_E6(msg->lat), PROBE_E6(msg->lon), msg->altitude_ft);
+    LOG(LOG_CATEGORY_POSITION, LOG_LEVEL_DEBUG, "rejected by %s (icao=%s, lat=%.6f, lon=%.6f, alt=%d, jump=%.1fnm in %.0fs)", reason, msg->icao, msg->lat,
+        msg->lon, msg->altitude_ft, sqrt(east * east + north * north), dt);
+    return false;
+}
+
+// the track predicted to now, with velocities in knots and feet per minute and each axis' covariance in those units
+cJSON *track_encode(const int index, const time_t now) {
+    if (!g_track.enabled || index < 0 || index >= MAX_AIRCRAFT || !g_track.tracks[index].active)
+        return NULL;
+    const track_t *const t = &g_track.tracks[index];
+    track_t predicted      = *t;
+    const double dt        = (double)(now - t->updated);
+    track_axis_predict(&predicted.east, dt, TRACK_ACCEL_NM_S2);
+    track_axis_predict(&predicted.north, dt, TRACK_ACCEL_NM_S2);
+    track_axis_predict(&predicted.up, dt, TRACK_VERTICAL_ACCEL_FT_S2);
+    double lat, lon;
+    track_position(t, predicted.east.p, predicted.north.p, &lat, &lon);
+
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddNumberToObject(obj, "time", (double)now);
+    cJSON_AddNumberToObject(obj, "age", dt);
+    cJSON_AddNumberToObject(obj, "lat", lat);
+    cJSON_AddNumberToObject(obj, "lon", lon);
+    cJSON_AddNumberToObject(obj, "alt", predicted.up.p);
+    const double ve = predicted.east.v * 3600.0, vn = predicted.north.v * 3600.0;
+    cJSON_AddNumberToObject(obj, "gs", sqrt(ve * ve + vn * vn));
+    cJSON_AddNumberToObject(obj, "track", fmod(atan2(ve, vn) * 180.0 / M_PI + 360.0, 360.0));
+    const struct {
+        const char *name;
+        const track_axis_t *axis;
+        double scale;
+    } axes[] = { { "east", &predicted.east, 3600.0 }, { "north", &predicted.north, 3600.0 }, { "up", &predicted.up, 60.0 } };
+    cJSON *velocity = cJSON_CreateObject(), *covariance = cJSON_CreateObject();
+    for (size_t i = 0; i < sizeof(axes) / sizeof(axes[0]); i++) {
+        const track_axis_t *const a = axes[i].axis;
+        if (velocity)
+            cJSON_AddNumberToObject(velocity, axes[i].name, a->v * axes[i].scale);
+        cJSON *array = covariance ? cJSON_CreateArray() : NULL;
+        if (array) {
+            cJSON_AddItemToArray(array, cJSON_CreateNumber(a->p00));
+            cJSON_AddItemToArray(array, cJSON_CreateNumber(a->p01 * axes[i].scale));
+            cJSON_AddItemToArray(array, cJSON_CreateNumber(a->p11 * axes[i].scale * axes[i].scale));
+            cJSON_AddItemToObject(covariance, axes[i].name, array);
+        }
+    }
+    if (velocity)
+        cJSON_AddItemToObject(obj, "velocity", velocity);
+    if (covariance)
+        cJSON_AddItemToObject(obj, "covariance", covariance);
+    // the process noise, for growing the covariance by dt: q*dt^4/4, q*dt^3/2, q*dt^2 with q the square of these (kt/s, fpm/s)
+    cJSON *accel = cJSON_CreateObject();
+    if (accel) {
+        cJSON_AddNumberToObject(accel, "horizontal", TRACK_ACCEL_NM_S2 * 3600.0);
+        cJSON_AddNumberToObject(accel, "vertical", TRACK_VERTICAL_ACCEL_FT_S2 * 60.0);
+        cJSON_AddItemToObject(obj, "accel", accel);
+    }
+    return obj;
+}
+
+bool track_begin(void) {
+    g_track.enabled = g_config.track_gate > 0.0;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// ICAO address block attribution (--icao-blocks=FILE, content/D008.dat): each line is CODE,NAME,PATTERN with PATTERN the 24 address
+// bits, most significant first, as 0/1 up to the block's prefix length and '-' after; codes are two letters for a country, with a
+// trailing M (or " Mil" in the name) for a military sub-block, which is a longer prefix inside its country's block
+//
+// the file is compiled at startup into a fixed depth trie over the address bytes: a node is 256 entries, each either a leaf (country
+// index + 1 and the military bit, 0 for unallocated) or a child node, so attribution is at most three loads; prefixes are inserted
+// shortest first, so a longer block overrides the one it sits in, and a leaf that a longer prefix splits is pushed down to its child
+
+#define ICAO_BLOCKS_COUNTRIES_MAX 512
+#define ICAO_BLOCKS_NODES_MAX     2048
+#define ICAO_BLOCKS_MILITARY      0x4000
+#define ICAO_BLOCKS_CHILD         0x8000
+#define ICAO_BLOCKS_COUNTRY       0x3FFF
+
+typedef struct {
+    char code[4];
+    char name[32];
+} icao_blocks_country_t;
+
+typedef struct {
+    uint16_t (*nodes)[256];
+    int nodes_count;
+    icao_blocks_country_t countries[ICAO_BLOCKS_COUNTRIES_MAX];
+    int countries_count;
+    int blocks;
+} icao_blocks_t;
+
+icao_blocks_t g_icao_blocks = { 0 };
+
+// six hex digits, anything else is not an address
+static bool icao_address(const char *const icao, uint32_t *const address) {
+    uint32_t a = 0;
+    int i      = 0;
+    for (; i < 6 && icao[i] != '\0'; i++) {
+        const char c = icao[i];
+        if (c >= '0' && c <= '9')
+            a = (a << 4) | (uint32_t)(c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            a = (a << 4) | (uint32_t)((c | 0x20) - 'a' + 10);
+        else
+            return false;
+    }
+    *address = a;
+    return i == 6 && icao[6] == '\0';
+}
+
+// the leaf for an address, 0 if unallocated or no blocks are loaded
+static inline uint16_t icao_blocks_lookup(const uint32_t address) {
+    if (!g_icao_blocks.nodes)
+        return 0;
+    uint16_t entry = g_icao_blocks.nodes[0][(address >> 16) & 0xFF];
+    if (entry & ICAO_BLOCKS_CHILD)
+        entry = g_icao_blocks.nodes[entry & ~ICAO_BLOCKS_CHILD][(address >> 8) & 0xFF];
+    if (entry & ICAO_BLOCKS_CHILD)
+        entry = g_icao_blocks.nodes[entry & ~ICAO_BLOCKS_CHILD][address & 0xFF];
+    return entry;
+}
+
+static inline const icao_blocks_country_t *icao_blocks_country(const uint16_t origin) {
+    return (origin & ICAO_BLOCKS_COUNTRY) ? &g_icao_blocks.countries[(origin & ICAO_BLOCKS_COUNTRY) - 1] : NULL;
+}
+
+static int icao_blocks_node(const uint16_t fill) {
+    if (g_icao_blocks.nodes_count == ICAO_BLOCKS_NODES_MAX)
+        return -1;
+    for (int i = 0; i < 256; i++)
+        g_icao_blocks.nodes[g_icao_blocks.nodes_count][i] = fill;
+    return g_icao_blocks.nodes_count++;
+}
+
+static bool icao_blocks_insert(const uint32_t prefix, const int length, const uint16_t leaf) {
+    int node = 0;
+    for (int level = 0; level < 3; level++) {
+        const int shift       = 16 - level * 8;
+        const unsigned int at = (prefix >> shift) & 0xFF;
+        if (length <= (level + 1) * 8) {
+            // every entry in range is a leaf, as only a longer (later) prefix makes a child
+            const unsigned int span = 1U << ((level + 1) * 8 - length);
+            for (unsigned int i = at; i < at + span; i++)
+                g_icao_blocks.nodes[node][i] = leaf;
+            return true;
+        }
+        uint16_t entry = g_icao_blocks.nodes[node][at];
+        if (!(entry & ICAO_BLOCKS_CHILD)) {
+            const int child = icao_blocks_node(entry);
+            if (child < 0)
+                return false;
+            entry = g_icao_blocks.nodes[node][at] = (uint16_t)(ICAO_BLOCKS_CHILD | child);
+        }
+        node = entry & ~ICAO_BLOCKS_CHILD;
+    }
+    return true;
+}
+
+// the two letter country, created from the first line naming it (or from a military line before it, without the " Mil" suffix)
+static int icao_blocks_country_index(const char *const code, const char *const name, const bool military) {
+    for (int i = 0; i < g_icao_blocks.countries_count; i++)
+        if (strncmp(g_icao_blocks.countries[i].code, code, 2) == 0) {
+            if (!military && strcmp(g_icao_blocks.countries[i].name, name) != 0)
+                snprintf(g_icao_blocks.countries[i].name, sizeof(g_icao_blocks.countries[i].name), "%s", name);
+            return i;
+        }
+    if (g_icao_blocks.countries_count == ICAO_BLOCKS_COUNTRIES_MAX)
+        return -1;
+    icao_blocks_country_t *const country = &g_icao_blocks.countries[g_icao_blocks.countries_count];
+    snprintf(country->code, sizeof(country->code), "%.2s", code);
+    const char *const suffix = military ? strstr(name, " Mil") : NULL;
+    snprintf(country->name, sizeof(country->name), "%.*s", suffix ? (int)(suffix - name) : (int)strlen(name), name);
+    return g_icao_blocks.countries_count++;
+}
+
+typedef struct {
+    uint32_t prefix;
+    int length;
+    uint16_t leaf;
+    size_t order;
+} icao_blocks_block_t;
+
+// shortest first, and of the same length the later line
+static int icao_blocks_block_compare(const void *const a, const void *const b) {
+    const icao_blocks_block_t *const ba = (const icao_blocks_block_t *)a, *const bb = (const icao_blocks_block_t *)b;
+    if (ba->length != bb->length)
+        return ba->length < bb->length ? -1 : 1;
+    return ba->order < bb->order ? -1 : 1;
+}
+
+bool icao_blocks_begin(void) {
+    if (g_config.icao_blocks_path[0] == '\0')
+        return true;
+    FILE *fp = fopen(g_config.icao_blocks_path, "r");
+    if (!fp) {
+        printf("icao-blocks: open failed: %s: %s\n", g_config.icao_blocks_path, strerror(errno));
+        return false;
+    }
+    icao_blocks_block_t *blocks = NULL;
+    size_t blocks_count = 0, blocks_capacity = 0;
+    unsigned long skipped = 0;
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        char *const name = strchr(line, ','), *const pattern = name ? strchr(name + 1, ',') : NULL;
+        if (!pattern || name - line < 2 || name - line > 3) {
+            skipped += line[strspn(line, " \t\r\n")] != '\0';
+            continue;
+        }
+        *name = *pattern = '\0';
+        uint32_t prefix = 0;
+        int bits = 0, length = -1;
+        for (const char *p = pattern + 1; *p != '\0' && *p != '\r' && *p != '\n'; p++) {
+            if (*p == ' ' || *p == '\t')
+                continue;
+            if ((*p != '0' && *p != '1' && *p != '-') || (*p != '-' && length >= 0) || bits == 24) {
+                bits = -1;
+                break;
+            }
+            if (*p == '-' && length < 0)
+                length = bits;
+            prefix = (prefix << 1) | (*p == '1');
+            bits++;
+        }
+        if (bits != 24) {
+            skipped++;
+            continue;
+        }
+        // "Not Allocated" lines (the halves of the address space, and holes) are inserted as 0 like the rest of the trie
+        const bool unallocated = strcmp(name + 1, "Not Allocated") == 0;
+        const bool military    = (name - line == 3 && line[2] == 'M') || strstr(name + 1, " Mil") != NULL;
+        const int country      = unallocated ? -1 : icao_blocks_country_index(line, name + 1, military);
+        if (country < 0 && !unallocated) {
+            printf("icao-blocks: too many countries\n");
+            ok = false;
+            break;
+        }
+        if (blocks_count == blocks_capacity) {
+            blocks_capacity                  = blocks_capacity ? blocks_capacity * 2 : 1024;
+            icao_blocks_block_t *const grown = (icao_blocks_block_t *)realloc(blocks, blocks_capacity * sizeof(icao_blocks_block_t));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            blocks = grown;
+        }
+        blocks[blocks_count] = (icao_blocks_block_t) { .prefix = prefix,
+                                                        .length = length < 0 ? 24 : length,
+                                                        .leaf   = (uint16_t)(unallocated ? 0 : (country + 1) | (military ? ICAO_BLOCKS_MILITARY : 0)),
+                                                        .order  = blocks_count };
+        blocks_count++;
+    }
+    fclose(fp);
+
+    if (ok)
+        ok = (g_icao_blocks.nodes = (uint16_t (*)[256])malloc(ICAO_BLOCKS_NODES_MAX * sizeof(*g_icao_blocks.nodes))) != NULL;
+    if (ok) {
+        icao_blocks_node(0);
+        qsort(blocks, blocks_count, sizeof(icao_blocks_block_t), icao_blocks_block_compare);
+        for (size_t i = 0; i < blocks_count && ok; i++)
+            if (!(ok = icao_blocks_insert(blocks[i].prefix, blocks[i].length, blocks[i].leaf)))
+                printf("icao-blocks: too many nodes\n");
+    }
+    free(blocks);
+    if (!ok) {
+        printf("icao-blocks: load failed: %s\n", g_config.icao_blocks_path);
+        free(g_icao_blocks.nodes);
+        g_icao_blocks.nodes = NULL;
+        return false;
+    }
+    g_icao_blocks.blocks = (int)blocks_count;
+    printf("icao-blocks: loaded %d blocks of %d countries from %s (%d nodes, %.1f KB), %lu lines skipped\n", g_icao_blocks.blocks,
+           g_icao_blocks.countries_count, g_config.icao_blocks_path, g_icao_blocks.nodes_count,
+           (double)((size_t)g_icao_blocks.nodes_count * sizeof(*g_icao_blocks.nodes)) / 1024.0, skipped);
+    return true;
+}
+
+void icao_blocks_end(void) {
+    free(g_icao_blocks.nodes);
+    g_icao_blocks.nodes = NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// nearest aerodrome attribution (--airports=FILE): a blob compiled by 'adsb_analyser airports-build SOURCE FILE' from the airports/
+// generator output (airports-data.HOST.js, or airports-data.json) and mapped read only; airports are bucketed into a uniform grid of
+// AIRPORTS_CELL_NM cells in an equirectangular projection about the blob's origin (the centre of its airports), stored cell by cell
+// with a cell offset table, so the nearest airport to a position is found by visiting rings of cells outward from its own and stopping
+// once the ring is further than the best so far; an accepted position at or below --airport-range FT is attributed the nearest airport
+// within NM, with its distance and the bearing from the airport
+//
+// layout: airports_header_t, uint32 cells[cells_x * cells_y + 1] (first record of each cell), airports_record_t records[count], strings
+
+#define AIRPORTS_MAGIC           0x53545041 // "APTS" in hex
+#define AIRPORTS_VERSION         1
+#define AIRPORTS_CELL_NM         5.0
+#define AIRPORTS_CELLS_MAX       (1024 * 1024)
+#define AIRPORTS_NONE            UINT32_MAX
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t cells_x, cells_y;
+    uint32_t strings_size;
+    double origin_lat, origin_lon;
+    double x_min, y_min, cell_nm;
+    int64_t built;
+} airports_header_t;
+
+typedef struct {
+    double lat, lon;
+    int32_t elevation_ft;
+    uint32_t ident, iata, name, type; // string offsets, 0 is the empty string
+    uint32_t reserved;
+} airports_record_t;
+
+typedef struct {
+    const airports_header_t *header;
+    const uint32_t *cells;
+    const airports_record_t *records;
+    const char *strings;
+    size_t size;
+    unsigned long lookups, attributed, cells_visited;
+} airports_t;
+
+airports_t g_airports = { 0 };
+
+static inline void airports_project(const double origin_lat, const double origin_lon, const double lat, const double lon, double *const x,
+                                    double *const y) {
+    double dlon = lon - origin_lon;
+    if (dlon > 180.0)
+        dlon -= 360.0;
+    else if (dlon < -180.0)
+        dlon += 360.0;
+    *x = dlon * 60.0 * cos(origin_lat * M_PI / 180.0);
+    *y = (lat - origin_lat) * 60.0;
+}
+
+// the nearest record within range_nm, AIRPORTS_NONE if none; distances are flat at the position's latitude, fine within range
+uint32_t airports_nearest(const double lat, const double lon, const double range_nm, double *const distance_nm) {
+    const airports_header_t *const h = g_airports.header;
+    if (!h)
+        return AIRPORTS_NONE;
+    g_airports.lookups++;
+    double x, y;
+    airports_project(h->origin_lat, h->origin_lon, lat, lon, &x, &y);
+    const int cx = (int)floor((x - h->x_min) / h->cell_nm), cy = (int)floor((y - h->y_min) / h->cell_nm);
+    const double scale = cos(lat * M_PI / 180.0);
+    // a cell is narrower east-west where the position is further from the equator than the origin
+    const double cell_nm = h->cell_nm * MAX(MIN(1.0, scale / cos(h->origin_lat * M_PI / 180.0)), 1.0 / 64.0);
+    uint32_t best        = AIRPORTS_NONE;
+    double best_nm2      = range_nm * range_nm;
+    const int rings      = (int)ceil(range_nm / cell_nm + 1.0);
+    for (int r = 0; r <= rings; r++) {
+        // every cell in ring r is at least r - 1 cells away
+        const double inner_nm = (double)r * cell_nm - cell_nm;
+        if (inner_nm > 0.0 && inner_nm * inner_nm > best_nm2)
+            break;
+        for (int ry = -r; ry <= r; ry++) {
+            const unsigned int j = (unsigned int)cy + (unsigned int)ry;
+            if (j >= h->cells_y)
+                continue;
+            const bool row = ry == -r || ry == r;
+            for (int rx = -r; rx <= r; rx++) {
+                const unsigned int i = (unsigned int)cx + (unsigned int)rx;
+                if ((!row && rx != -r && rx != r) || i >= h->cells_x)
+                    continue;
+                const uint32_t cell = j * h->cells_x + i;
+                g_airports.cells_visited++;
+                for (uint32_t k = g_airports.cells[cell]; k < g_airports.cells[cell + 1]; k++) {
+                    const airports_record_t *const a = &g_airports.records[k];
+                    double dlon                      = a->lon - lon;
+                    if (dlon > 180.0)
+                        dlon -= 360.0;
+                    else if (dlon < -180.0)
+                        dlon += 360.0;
+                    const double dx = dlon * 60.0 * scale, dy = (a->lat - lat) * 60.0, d2 = dx * dx + dy * dy;
+                    if (d2 < best_nm2) {
+                        best_nm2 = d2;
+                        best     = k;
+                    }
+                }
+            }
+        }
+    }
+    *distance_nm = sqrt(best_nm2);
+    return best;
+}
+
+// called with the table locked for each accepted position
+static void airports_attribute(aircraft_data_t *const aircraft) {
+    if (!g_airports.header)
+        return;
+    const aircraft_posn_t *const pos = &aircraft->pos;
+    double distance_nm               = 0.0;
+    const uint32_t airport           = pos->altitude_ft <= g_config.airport_range_ft
+                                           ? airports_nearest(pos->lat, pos->lon, g_config.airport_range_nm, &distance_nm)
+                                           : AIRPORTS_NONE;
+    aircraft->airport                = airport;
+    if (airport == AIRPORTS_NONE)
+        return;
+    const airports_record_t *const a = &g_airports.records[airport];
+    aircraft->airport_distance_nm    = (float)distance_nm;
+    aircraft->airport_bearing_deg    = (float)calculate_bearing_deg(a->lat, a->lon, pos->lat, pos->lon);
+    g_airports.attributed++;
+}
+
+bool airports_begin(void) {
+    if (g_config.airports_path[0] == '\0')
+        return true;
+    const int fd = open(g_config.airports_path, O_RDONLY);
+    if (fd < 0) {
+        printf("airports: open failed: %s: %s\n", g_config.airports_path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(airports_header_t)) {
+        printf("airports: file too short: %s\n", g_config.airports_path);
+        close(fd);
+        return false;
+    }
+    const size_t size = (size_t)st.st_size;
+    void *const base  = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("airports: mmap failed: %s: %s\n", g_config.airports_path, strerror(errno));
+        return false;
+    }
+    const airports_header_t *const h = (const airports_header_t *)base;
+    const size_t cells               = (size_t)h->cells_x * h->cells_y;
+    const size_t tables              = (cells + 1) * sizeof(uint32_t) + (size_t)h->count * sizeof(airports_record_t);
+    if (h->magic != AIRPORTS_MAGIC || h->version != AIRPORTS_VERSION || h->count == 0 || cells == 0 || cells > AIRPORTS_CELLS_MAX || h->strings_size == 0 ||
+        !(h->cell_nm > 0.0) || sizeof(airports_header_t) + tables + h->strings_size != size) {
+        printf("airports: invalid or unsupported file: %s\n", g_config.airports_path);
+        munmap(base, size);
+        return false;
+    }
+    g_airports.header  = h;
+    g_airports.cells   = (const uint32_t *)(h + 1);
+    g_airports.records = (const airports_record_t *)(g_airports.cells + cells + 1);
+    g_airports.strings = (const char *)(g_airports.records + h->count);
+    g_airports.size    = size;
+    if (g_airports.cells[cells] != h->count) {
+        printf("airports: invalid cell table: %s\n", g_config.airports_path);
+        munmap(base, size);
+        g_airports.header = NULL;
+        return false;
+    }
+    printf("airports: mapped %u airports in %ux%u cells of %.0fnm around %.4f,%.4f from %s (%.1f MB)\n", h->count, h->cells_x, h->cells_y, h->cell_nm,
+           h->origin_lat, h->origin_lon, g_config.airports_path, (double)size / (1024.0 * 1024.0));
+    return true;
+}
+
+void airports_end(void) {
+    if (g_airports.header) {
+        munmap((void *)(uintptr_t)g_airports.header, g_airports.size);
+        g_airports.header = NULL;
+    }
+}
+
+#ifndef ADSB_ANALYSER_NO_MAIN
+
+typedef struct {
+    double lat, lon, x, y;
+    int32_t elevation_ft;
+    uint32_t ident, iata, name, type;
+    uint32_t cell;
+} airports_build_entry_t;
+
+typedef struct {
+    char *data;
+    size_t size, capacity;
+} airports_build_strings_t;
+
+// appended as is (names are nearly all distinct), UINT32_MAX when out of memory
+static uint32_t airports_build_string(airports_build_strings_t *const s, const char *const value) {
+    const size_t length = value ? strlen(value) : 0;
+    if (length == 0)
+        return 0;
+    if (s->size + length + 1 > s->capacity) {
+        const size_t capacity = MAX(s->capacity * 2, s->size + length + 1);
+        char *const data      = (char *)realloc(s->data, capacity);
+        if (!data)
+            return UINT32_MAX;
+        s->data     = data;
+        s->capacity = capacity;
+    }
+    const uint32_t offset = (uint32_t)s->size;
+    memcpy(s->data + offset, value, length + 1);
+    s->size += length + 1;
+    return offset;
+}
+
+static bool airports_build_number(const cJSON *const obj, const char *const name, double *const value) {
+    const cJSON *const item = cJSON_GetObjectItem(obj, name);
+    if (cJSON_IsNumber(item)) {
+        *value = item->valuedouble;
+        return true;
+    }
+    if (cJSON_IsString(item) && item->valuestring && item->valuestring[0] != '\0') {
+        char *end;
+        *value = strtod(item->valuestring, &end);
+        return *end == '\0';
+    }
+    return false;
+}
+
+static const char *airports_build_text(const cJSON *const obj, const char *const name) {
+    const cJSON *const item = cJSON_GetObjectItem(obj, name);
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+static int airports_build_entry_compare(const void *const a, const void *const b) {
+    const airports_build_entry_t *const ea = (const airports_build_entry_t *)a, *const eb = (const airports_build_entry_t *)b;
+    return (ea->cell > eb->cell) - (ea->cell < eb->cell);
+}
+
+// adsb_analyser airports-build SOURCE FILE: SOURCE is an object of airports keyed by code, as JSON or as the generator's module
+// (everything from the first '{' to the last '}'), closed airports are left out; written to FILE.tmp and renamed over FILE
+int airports_build_main(const int argc, char *const argv[]) {
+    if (argc != 3) {
+        printf("usage: adsb_analyser airports-build airports-data.HOST.js|airports-data.json FILE\n");
+        return EXIT_FAILURE;
+    }
+    const char *const source = argv[1], *const path = argv[2];
+    FILE *const fp = fopen(source, "rb");
+    if (!fp) {
+        printf("airports: source open failed: %s: %s\n", source, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long length = ftell(fp);
+    rewind(fp);
+    char *const text  = length > 0 ? (char *)malloc((size_t)length + 1) : NULL;
+    const bool loaded = text && fread(text, 1, (size_t)length, fp) == (size_t)length;
+    fclose(fp);
+    if (!loaded) {
+        printf("airports: source read failed: %s\n", source);
+        free(text);
+        return EXIT_FAILURE;
+    }
+    text[length]            = '\0';
+    const char *const first = strchr(text, '{'), *const last = strrchr(text, '}');
+    cJSON *const json = first && last > first ? cJSON_ParseWithLength(first, (size_t)(last - first + 1)) : NULL;
+    free(text);
+    if (!cJSON_IsObject(json)) {
+        printf("airports: source has no JSON object of airports: %s\n", source);
+        cJSON_Delete(json);
+        return EXIT_FAILURE;
+    }
+
+    const int total                  = cJSON_GetArraySize(json);
+    airports_build_entry_t *entries  = (airports_build_entry_t *)calloc((size_t)MAX(total, 1), sizeof(airports_build_entry_t));
+    airports_build_strings_t strings = { .data = (char *)calloc(1, 1), .size = 1, .capacity = 1 };
+    uint32_t count                   = 0;
+    unsigned long skipped            = 0;
+    double lat_min = 90.0, lat_max = -90.0, lon_min = 180.0, lon_max = -180.0;
+    bool ok = entries && strings.data;
+    const cJSON *airport;
+    cJSON_ArrayForEach(airport, json) {
+        if (!ok)
+            break;
+        double lat, lon, elevation = 0.0;
+        const char *const type     = airports_build_text(airport, "type");
+        if (!cJSON_IsObject(airport) || !airports_build_number(airport, "latitude_deg", &lat) || !airports_build_number(airport, "longitude_deg", &lon) ||
+            fabs(lat) > 90.0 || fabs(lon) > 180.0 || (type && strcmp(type, "closed") == 0)) {
+            skipped++;
+            continue;
+        }
+        airports_build_number(airport, "elevation_ft", &elevation);
+        const char *ident = airports_build_text(airport, "icao_code");
+        if (!ident || ident[0] == '\0')
+            ident = airports_build_text(airport, "ident");
+        if (!ident || ident[0] == '\0')
+            ident = airport->string;
+        airports_build_entry_t *const e = &entries[count];
+        e->lat                          = lat;
+        e->lon                          = lon;
+        e->elevation_ft                 = (int32_t)lround(elevation);
+        e->ident                        = airports_build_string(&strings, ident);
+        e->iata                         = airports_build_string(&strings, airports_build_text(airport, "iata_code"));
+        e->name                         = airports_build_string(&strings, airports_build_text(airport, "name"));
+        e->type                         = airports_build_string(&strings, type);
+        if (!(ok = e->ident != UINT32_MAX && e->iata != UINT32_MAX && e->name != UINT32_MAX && e->type != UINT32_MAX))
+            continue;
+        lat_min = MIN(lat_min, lat);
+        lat_max = MAX(lat_max, lat);
+        lon_min = MIN(lon_min, lon);
+        lon_max = MAX(lon_max, lon);
+        count++;
+    }
+    cJSON_Delete(json);
+    if (ok && count == 0) {
+        printf("airports: source has no airports with coordinates\n");
+        ok = false;
+    }
+
+    airports_header_t header = { .magic = AIRPORTS_MAGIC, .version = AIRPORTS_VERSION, .count = count, .cell_nm = AIRPORTS_CELL_NM };
+    uint32_t *cells          = NULL;
+    size_t cells_count       = 0;
+    if (ok) {
+        header.origin_lat = (lat_min + lat_max) / 2.0;
+        header.origin_lon = (lon_min + lon_max) / 2.0;
+        double x_max = -1e9, y_max = -1e9;
+        header.x_min = header.y_min = 1e9;
+        for (uint32_t i = 0; i < count; i++) {
+            airports_project(header.origin_lat, header.origin_lon, entries[i].lat, entries[i].lon, &entries[i].x, &entries[i].y);
+            header.x_min = MIN(header.x_min, entries[i].x);
+            header.y_min = MIN(header.y_min, entries[i].y);
+            x_max        = MAX(x_max, entries[i].x);
+            y_max        = MAX(y_max, entries[i].y);
+        }
+        header.cells_x = (uint32_t)floor((x_max - header.x_min) / header.cell_nm) + 1;
+        header.cells_y = (uint32_t)floor((y_max - header.y_min) / header.cell_nm) + 1;
+        cells_count    = (size_t)header.cells_x * header.cells_y;
+        if (cells_count > AIRPORTS_CELLS_MAX) {
+            printf("airports: source spans %ux%u cells, more than %d: use the generator's radius\n", header.cells_x, header.cells_y, AIRPORTS_CELLS_MAX);
+            ok = false;
+        } else if (!(cells = (uint32_t *)calloc(cells_count + 1, sizeof(uint32_t))))
+            ok = false;
+    }
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t cx = MIN((uint32_t)((entries[i].x - header.x_min) / header.cell_nm), header.cells_x - 1);
+            const uint32_t cy = MIN((uint32_t)((entries[i].y - header.y_min) / header.cell_nm), header.cells_y - 1);
+            entries[i].cell   = cy * header.cells_x + cx;
+            cells[entries[i].cell + 1]++;
+        }
+        for (size_t c = 0; c < cells_count; c++)
+            cells[c + 1] += cells[c];
+        qsort(entries, count, sizeof(airports_build_entry_t), airports_build_entry_compare);
+        header.strings_size = (uint32_t)strings.size;
+        header.built        = (int64_t)time(NULL);
+    }
+
+    if (ok) {
+        char path_tmp[MAX_NAME_LENGTH + 8];
+        snprintf(path_tmp, sizeof(path_tmp), "%s.tmp", path);
+        FILE *const out = fopen(path_tmp, "wb");
+        if (!out) {
+            printf("airports: open file for write failed: %s: %s\n", path_tmp, strerror(errno));
+            ok = false;
+        } else {
+            ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(cells, sizeof(uint32_t), cells_count + 1, out) == cells_count + 1;
+            for (uint32_t i = 0; i < count && ok; i++) {
+                const airports_record_t record = { .lat          = entries[i].lat,
+                                                   .lon          = entries[i].lon,
+                                                   .elevation_ft = entries[i].elevation_ft,
+                                                   .ident        = entries[i].ident,
+                                                   .iata         = entries[i].iata,
+                                                   .name         = entries[i].name,
+                                                   .type         = entries[i].type };
+                ok = fwrite(&record, sizeof(record), 1, out) == 1;
+            }
+            ok = ok && fwrite(strings.data, 1, strings.size, out) == strings.size;
+            ok = fclose(out) == 0 && ok;
+            if (!ok || rename(path_tmp, path) < 0) {
+                printf("airports: write file failed: %s: %s\n", path, strerror(errno));
+                unlink(path_tmp);
+                ok = false;
+            } else
+                printf("airports: wrote %u airports (%lu skipped) in %ux%u cells of %.0fnm around %.4f,%.4f to %s\n", count, skipped, header.cells_x,
+                       header.cells_y, header.cell_nm, header.origin_lat, header.origin_lon, path);
+        }
+    }
+
+    free(cells);
+    free(entries);
+    free(strings.data);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// airspace entry and exit (--airspace=FILE): areas are read from an OpenAir file at startup (AC class, AN name, AL/AH limits, DP points,
+// DC circles and DA/DB arcs about V X=, which are flattened to AIRSPACE_ARC_STEP_DEG segments) into polygons in the analyser's local
+// projection, and indexed by a uniform grid over their extent where each cell lists the areas that touch it, flagged if the cell lies
+// wholly inside; an accepted position then tests only the areas of its cell, needing the point in polygon test only where the cell
+// straddles a boundary, and the areas each aircraft is inside are kept so entering and leaving are published to TOPIC/airspace on the
+// position that decides them (or leaving when the aircraft goes unseen); limits in feet or flight levels are compared with the
+// reported altitude as is, AGL limits as if AMSL
+
+#define AIRSPACE_CELL_NM        2.0
+#define AIRSPACE_CELLS_MAX      (1024 * 1024)
+#define AIRSPACE_INSIDE_MAX     8
+#define AIRSPACE_CELL_INSIDE    0x80000000U
+#define AIRSPACE_ARC_STEP_DEG   5.0
+#define AIRSPACE_UNLIMITED_FT   999999
+#define AIRSPACE_GAP_MAX        60
+#define AIRSPACE_LINE_MAX       512
+
+typedef struct {
+    char name[64];
+    char class_[8];
+    int lower_ft, upper_ft;
+    uint32_t vertex_first, vertex_count;
+    double x_min, y_min, x_max, y_max;
+} airspace_area_t;
+
+typedef struct {
+    double x, y;
+} airspace_vertex_t;
+
+typedef struct {
+    uint16_t inside[AIRSPACE_INSIDE_MAX];
+    uint8_t count;
+    time_t updated;
+} airspace_track_t;
+
+typedef struct {
+    bool enabled;
+    char topic[MAX_NAME_LENGTH + 16];
+    airspace_area_t *areas;
+    airspace_vertex_t *vertices;
+    uint32_t areas_count, vertices_count;
+    uint32_t *cells;   // cells_x * cells_y + 1 offsets into entries
+    uint32_t *entries; // area index, AIRSPACE_CELL_INSIDE if the cell is wholly inside it
+    uint32_t cells_x, cells_y, entries_count;
+    double x_min, y_min, cell_nm;
+    airspace_track_t tracks[MAX_AIRCRAFT];
+    time_t expired;
+    unsigned long checks, tests, active, entered, left, published;
+} airspace_t;
+
+airspace_t g_airspace = { 0 };
+
+// ray casting over the area's vertices, the ring being implicitly closed
+static bool airspace_contains(const airspace_area_t *const area, const double x, const double y) {
+    const airspace_vertex_t *const v = &g_airspace.vertices[area->vertex_first];
+    bool inside                      = false;
+    for (uint32_t i = 0, j = area->vertex_count - 1; i < area->vertex_count; j = i++)
+        if ((v[i].y > y) != (v[j].y > y) && x < (v[j].x - v[i].x) * (y - v[i].y) / (v[j].y - v[i].y) + v[i].x)
+            inside = !inside;
+    return inside;
+}
+
+static cJSON *airspace_encode_area(const airspace_area_t *const area) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddStringToObject(obj, "name", area->name);
+    cJSON_AddStringToObject(obj, "class", area->class_);
+    cJSON_AddNumberToObject(obj, "lower", area->lower_ft);
+    cJSON_AddNumberToObject(obj, "upper", area->upper_ft);
+    return obj;
+}
+
+typedef struct {
+    char icao[7];
+    bool current_valid;
+    int altitude_ft;
+    const airspace_area_t *area;
+    const char *event;
+    time_t timestamp;
+    double lat, lon;
+} airspace_event_t;
+
+static void airspace_send(const void *const data) {
+    const airspace_event_t *const e = data;
+    cJSON *root                     = cJSON_CreateObject();
+    if (!root)
+        return;
+    cJSON_AddNumberToObject(root, "timestamp", (double)e->timestamp);
+    cJSON_AddStringToObject(root, "icao", e->icao);
+    cJSON_AddStringToObject(root, "event", e->event);
+    cJSON *const airspace = airspace_encode_area(e->area);
+    if (airspace)
+        cJSON_AddItemToObject(root, "airspace", airspace);
+    if (e->current_valid) {
+        cJSON *const current = cJSON_CreateObject();
+        if (current) {
+            cJSON_AddNumberToObject(current, "lat", e->lat);
+            cJSON_AddNumberToObject(current, "lon", e->lon);
+            cJSON_AddNumberToObject(current, "alt", e->altitude_ft);
+            cJSON_AddItemToObject(root, "current", current);
+        }
+    }
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str) {
+        if (sink_publish(g_airspace.topic, (const unsigned char *)json_str, strlen(json_str)))
+            g_airspace.published++;
+        free(json_str);
+    }
+}
+
+static void airspace_publish(const char *const icao, const airspace_area_t *const area, const aircraft_posn_t *const pos, const time_t timestamp,
+                             const char *const event) {
+    airspace_event_t e = { .current_valid = pos != NULL, .area = area, .event = event, .timestamp = timestamp };
+    memcpy(e.icao, icao, sizeof(e.icao));
+    if (pos) {
+        e.lat         = pos->lat;
+        e.lon         = pos->lon;
+        e.altitude_ft = pos->altitude_ft;
+    }
+    EVENT_QUEUE(airspace_send, e);
+}
+
+static void airspace_leave(const char *const icao, airspace_track_t *const t, const int slot, const aircraft_posn_t *const pos) {
+    const airspace_area_t *const area = &g_airspace.areas[t->inside[slot]];
+    LOG(LOG_CATEGORY_AIRSPACE, LOG_LEVEL_INFO, "%s: leaving %s (%s)", icao, area->name, area->class_);
+    airspace_publish(icao, area, pos, pos ? pos->timestamp : t->updated, "leaving");
+    t->inside[slot] = t->inside[--t->count];
+    g_airspace.active--;
+    g_airspace.left++;
+}
+
+// called with the table locked after the aircraft's position has been set
+void airspace_update(const int index, const aircraft_data_t *const aircraft) {
+    if (!g_airspace.enabled)
+        return;
+    airspace_track_t *const t        = &g_airspace.tracks[index];
+    const aircraft_posn_t *const pos = &aircraft->pos;
+    t->updated                       = pos->timestamp;
+    g_airspace.checks++;
+
+    uint16_t inside[AIRSPACE_INSIDE_MAX];
+    int count = 0;
+    double x, y;
+    airprox_project(pos->lat, pos->lon, &x, &y);
+    const double cx = floor((x - g_airspace.x_min) / g_airspace.cell_nm), cy = floor((y - g_airspace.y_min) / g_airspace.cell_nm);
+    if (cx >= 0.0 && cy >= 0.0 && cx < (double)g_airspace.cells_x && cy < (double)g_airspace.cells_y) {
+        const uint32_t cell = (uint32_t)cy * g_airspace.cells_x + (uint32_t)cx;
+        for (uint32_t e = g_airspace.cells[cell]; e < g_airspace.cells[cell + 1] && count < AIRSPACE_INSIDE_MAX; e++) {
+            const uint32_t entry              = g_airspace.entries[e];
+            const airspace_area_t *const area = &g_airspace.areas[entry & ~AIRSPACE_CELL_INSIDE];
+            if (pos->altitude_ft < area->lower_ft || pos->altitude_ft > area->upper_ft)
+                continue;
+            if (!(entry & AIRSPACE_CELL_INSIDE)) {
+                g_airspace.tests++;
+                if (!airspace_contains(area, x, y))
+                    continue;
+            }
+            inside[count++] = (uint16_t)(entry & ~AIRSPACE_CELL_INSIDE);
+        }
+    }
+
+    for (int slot = t->count; slot > 0; slot--) {
+        bool still = false;
+        for (int i = 0; i < count && !still; i++)
+            still = inside[i] == t->inside[slot - 1];
+        if (!still)
+            airspace_leave(aircraft->icao, t, slot - 1, pos);
+    }
+    for (int i = 0; i < count; i++) {
+        bool already = false;
+        for (int slot = 0; slot < t->count && !already; slot++)
+            already = t->inside[slot] == inside[i];
+        if (already)
+            continue;
+        const airspace_area_t *const area = &g_airspace.areas[inside[i]];
+        t->inside[t->count++]             = inside[i];
+        g_airspace.active++;
+        g_airspace.entered++;
+        LOG(LOG_CATEGORY_AIRSPACE, LOG_LEVEL_INFO, "%s: entering %s (%s) at %dft", aircraft->icao, area->name, area->class_, pos->altitude_ft);
+        airspace_publish(aircraft->icao, area, pos, pos->timestamp, "entering");
+    }
+}
+
+// leaves every area for aircraft that went unseen, at most once a second and only while any are occupied
+void airspace_expire(void) {
+    if (!g_airspace.enabled || g_airspace.active == 0)
+        return;
+    const time_t now = time(NULL);
+    if (now == g_airspace.expired)
+        return;
+    g_airspace.expired = now;
+    for (int i = 0; i < MAX_AIRCRAFT;) {
+        pthread_mutex_lock(&g_aircraft_list.mutex);
+        for (; i < MAX_AIRCRAFT && event_queue_space() >= AIRSPACE_INSIDE_MAX; i++)
+            if (g_airspace.tracks[i].count > 0 && now - g_airspace.tracks[i].updated > AIRSPACE_GAP_MAX)
+                while (g_airspace.tracks[i].count > 0)
+                    airspace_leave(g_aircraft_list.entries[i].icao, &g_airspace.tracks[i], g_airspace.tracks[i].count - 1, NULL);
+        aircraft_list_unlock();
+    }
+}
+
+void airspace_remove(const int index) {
+    if (!g_airspace.enabled)
+        return;
+    while (g_airspace.tracks[index].count > 0)
+        airspace_leave(g_aircraft_list.entries[index].icao, &g_airspace.tracks[index], g_airspace.tracks[index].count - 1, NULL);
+}
+
+// "SFC", "GND", "UNL", "FL95", "FL 95", "2500ft", "2500 FT AMSL", "1500ft AGL", "2500 ALT" or a bare number of feet
+static bool airspace_parse_limit(const char *text, int *const altitude_ft) {
+    while (*text == ' ' || *text == '\t')
+        text++;
+    if (strncasecmp(text, "SFC", 3) == 0 || strncasecmp(text, "GND", 3) == 0) {
+        *altitude_ft = 0;
+        return true;
+    }
+    if (strncasecmp(text, "UNL", 3) == 0) {
+        *altitude_ft = AIRSPACE_UNLIMITED_FT;
+        return true;
+    }
+    const bool level = strncasecmp(text, "FL", 2) == 0;
+    if (level)
+        text += 2;
+    char *end;
+    const double value = strtod(text, &end);
+    if (end == text)
+        return false;
+    *altitude_ft = (int)lround(level ? value * 100.0 : value);
+    return true;
+}
+
+// "51:30:00 N 001:20:00 W", "51:30.5N 1:20.25W" or "51.5 N 1.33 W", advancing *text past it
+static bool airspace_parse_coordinate(const char **const text, double *const value, const char positive, const char negative) {
+    const char *p   = *text;
+    double parts[3] = { 0.0, 0.0, 0.0 };
+    int count       = 0;
+    while (count < 3) {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        char *end;
+        parts[count] = strtod(p, &end);
+        if (end == p)
+            return false;
+        count++;
+        p = end;
+        if (*p != ':')
+            break;
+        p++;
+    }
+    while (*p == ' ' || *p == '\t')
+        p++;
+    const char hemisphere = (*p >= 'a' && *p <= 'z') ? (char)(*p - 'a' + 'A') : *p;
+    if (hemisphere != positive && hemisphere != negative)
+        return false;
+    *value = (parts[0] + parts[1] / 60.0 + parts[2] / 3600.0) * (hemisphere == negative ? -1.0 : 1.0);
+    *text  = p + 1;
+    return true;
+}
+
+static bool airspace_parse_point(const char **const text, double *const lat, double *const lon) {
+    return airspace_parse_coordinate(text, lat, 'N', 'S') && airspace_parse_coordinate(text, lon, 'E', 'W');
+}
+
+typedef struct {
+    airspace_area_t area;
+    bool open, clockwise, failed;
+    double centre_lat, centre_lon;
+    size_t vertices_capacity, areas_capacity;
+} airspace_load_t;
+
+static bool airspace_vertex_add(airspace_load_t *const l, const double lat, const double lon) {
+    if (g_airspace.vertices_count == l->vertices_capacity) {
+        const size_t capacity             = MAX(l->vertices_capacity * 2, (size_t)4096);
+        airspace_vertex_t *const vertices = (airspace_vertex_t *)realloc(g_airspace.vertices, capacity * sizeof(airspace_vertex_t));
+        if (!vertices) {
+            l->failed = true;
+            return false;
+        }
+        g_airspace.vertices  = vertices;
+        l->vertices_capacity = capacity;
+    }
+    airspace_vertex_t *const v = &g_airspace.vertices[g_airspace.vertices_count++];
+    airprox_project(lat, lon, &v->x, &v->y);
+    l->area.vertex_count++;
+    return true;
+}
+
+// points on the arc of radius_nm about the centre from one bearing to another in the current direction, both ends included
+static bool airspace_arc_add(airspace_load_t *const l, const double radius_nm, const double from_deg, double to_deg) {
+    if (l->clockwise && to_deg <= from_deg)
+        to_deg += 360.0;
+    else if (!l->clockwise && to_deg >= from_deg)
+        to_deg -= 360.0;
+    const int steps = MAX((int)ceil(fabs(to_deg - from_deg) / AIRSPACE_ARC_STEP_DEG), 1);
+    for (int i = 0; i <= steps; i++) {
+        const double bearing = (from_deg + (to_deg - from_deg) * (double)i / (double)steps) * M_PI / 180.0;
+        const double lat     = l->centre_lat + radius_nm * cos(bearing) / 60.0;
+        const double lon     = l->centre_lon + radius_nm * sin(bearing) / (60.0 * cos(l->centre_lat * M_PI / 180.0));
+        if (!airspace_vertex_add(l, lat, lon))
+            return false;
+    }
+    return true;
+}
+
+// closes the area being read, dropping it if it has too few points to enclose anything
+static bool airspace_area_close(airspace_load_t *const l) {
+    if (!l->open)
+        return true;
+    l->open                  = false;
+    airspace_area_t *const a = &l->area;
+    if (a->vertex_count < 3 || a->upper_ft <= a->lower_ft) {
+        g_airspace.vertices_count = a->vertex_first;
+        return true;
+    }
+    if (g_airspace.areas_count == UINT16_MAX) {
+        printf("airspace: too many areas\n");
+        l->failed = true;
+        return false;
+    }
+    if (g_airspace.areas_count == l->areas_capacity) {
+        const size_t capacity        = MAX(l->areas_capacity * 2, (size_t)256);
+        airspace_area_t *const areas = (airspace_area_t *)realloc(g_airspace.areas, capacity * sizeof(airspace_area_t));
+        if (!areas) {
+            l->failed = true;
+            return false;
+        }
+        g_airspace.areas  = areas;
+        l->areas_capacity = capacity;
+    }
+    a->x_min = a->y_min = INFINITY;
+    a->x_max = a->y_max = -INFINITY;
+    for (uint32_t i = a->vertex_first; i < a->vertex_first + a->vertex_count; i++) {
+        a->x_min = MIN(a->x_min, g_airspace.vertices[i].x);
+        a->y_min = MIN(a->y_min, g_airspace.vertices[i].y);
+        a->x_max = MAX(a->x_max, g_airspace.vertices[i].x);
+        a->y_max = MAX(a->y_max, g_airspace.vertices[i].y);
+    }
+    g_airspace.areas[g_airspace.areas_count++] = *a;
+    return true;
+}
+
+// false if the line is malformed, which only skips the line, or on running out of memory, which sets failed
+static bool airspace_parse_line(airspace_load_t *const l, const char *const line) {
+    const char *p = line + 2;
+    if (strncasecmp(line, "AC", 2) == 0) {
+        if (!airspace_area_close(l))
+            return false;
+        while (*p == ' ')
+            p++;
+        memset(&l->area, 0, sizeof(l->area));
+        snprintf(l->area.class_, sizeof(l->area.class_), "%.*s", (int)strcspn(p, " \t"), p);
+        l->area.vertex_first = g_airspace.vertices_count;
+        l->area.upper_ft     = AIRSPACE_UNLIMITED_FT;
+        l->open              = true;
+        l->clockwise         = true;
+        return true;
+    }
+    if (!l->open)
+        return true;
+    if (strncasecmp(line, "AN", 2) == 0) {
+        while (*p == ' ')
+            p++;
+        snprintf(l->area.name, sizeof(l->area.name), "%.*s", (int)sizeof(l->area.name) - 1, p);
+        return true;
+    }
+    if (strncasecmp(line, "AL", 2) == 0)
+        return airspace_parse_limit(p, &l->area.lower_ft);
+    if (strncasecmp(line, "AH", 2) == 0)
+        return airspace_parse_limit(p, &l->area.upper_ft);
+    if (strncasecmp(line, "V ", 2) == 0) {
+        while (*p == ' ')
+            p++;
+        if (strncasecmp(p, "D=", 2) == 0) {
+            l->clockwise = p[2] != '-';
+            return true;
+        }
+        if (strncasecmp(p, "X=", 2) == 0) {
+            p += 2;
+            return airspace_parse_point(&p, &l->centre_lat, &l->centre_lon);
+        }
+        return true;
+    }
+    double lat, lon;
+    if (strncasecmp(line, "DP", 2) == 0)
+        return airspace_parse_point(&p, &lat, &lon) && airspace_vertex_add(l, lat, lon);
+    if (strncasecmp(line, "DC", 2) == 0) {
+        const double radius_nm = atof(p);
+        return radius_nm > 0.0 && airspace_arc_add(l, radius_nm, 0.0, l->clockwise ? 360.0 : -360.0);
+    }
+    if (strncasecmp(line, "DA", 2) == 0) {
+        double radius_nm, from_deg, to_deg;
+        return sscanf(p, "%lf , %lf , %lf", &radius_nm, &from_deg, &to_deg) == 3 && radius_nm > 0.0 && airspace_arc_add(l, radius_nm, from_deg, to_deg);
+    }
+    if (strncasecmp(line, "DB", 2) == 0) {
+        double lat2, lon2;
+        if (!airspace_parse_point(&p, &lat, &lon))
+            return false;
+        while (*p == ' ' || *p == ',')
+            p++;
+        if (!airspace_parse_point(&p, &lat2, &lon2))
+            return false;
+        const double radius_nm = calculate_distance_nm(l->centre_lat, l->centre_lon, lat, lon);
+        return airspace_arc_add(l, radius_nm, calculate_bearing_deg(l->centre_lat, l->centre_lon, lat, lon),
+                                calculate_bearing_deg(l->centre_lat, l->centre_lon, lat2, lon2));
+    }
+    return true;
+}
+
+// Liang-Barsky: whether the segment from (x0, y0) to (x1, y1) passes through the rectangle
+static bool airspace_segment_crosses(const double x0, const double y0, const double x1, const double y1, const double left, const double bottom,
+                                     const double right, const double top) {
+    const double dx = x1 - x0, dy = y1 - y0;
+    const double p[4] = { -dx, dx, -dy, dy }, q[4] = { x0 - left, right - x0, y0 - bottom, top - y0 };
+    double t0 = 0.0, t1 = 1.0;
+    for (int i = 0; i < 4; i++) {
+        if (fabs(p[i]) < 1e-12) {
+            if (q[i] < 0.0)
+                return false;
+            continue;
+        }
+        const double t = q[i] / p[i];
+        if (p[i] < 0.0)
+            t0 = MAX(t0, t);
+        else
+            t1 = MIN(t1, t);
+        if (t0 > t1)
+            return false;
+    }
+    return true;
+}
+
+typedef struct {
+    uint32_t cell, entry;
+} airspace_pair_t;
+
+// each area is listed in the cells its bounding box covers unless the cell is wholly outside it: a cell no edge passes through is
+// either wholly inside or wholly outside, which its centre decides
+static bool airspace_grid_build(void) {
+    double x_max = -INFINITY, y_max = -INFINITY;
+    g_airspace.x_min = g_airspace.y_min = INFINITY;
+    for (uint32_t a = 0; a < g_airspace.areas_count; a++) {
+        g_airspace.x_min = MIN(g_airspace.x_min, g_airspace.areas[a].x_min);
+        g_airspace.y_min = MIN(g_airspace.y_min, g_airspace.areas[a].y_min);
+        x_max            = MAX(x_max, g_airspace.areas[a].x_max);
+        y_max            = MAX(y_max, g_airspace.areas[a].y_max);
+    }
+    // coarser cells if the areas are spread too wide for the cell limit
+    const double extent    = (x_max - g_airspace.x_min) * (y_max - g_airspace.y_min);
+    g_airspace.cell_nm     = MAX(AIRSPACE_CELL_NM, sqrt(extent / (double)AIRSPACE_CELLS_MAX) * 1.01);
+    g_airspace.cells_x     = (uint32_t)floor((x_max - g_airspace.x_min) / g_airspace.cell_nm) + 1;
+    g_airspace.cells_y     = (uint32_t)floor((y_max - g_airspace.y_min) / g_airspace.cell_nm) + 1;
+    const size_t cells     = (size_t)g_airspace.cells_x * g_airspace.cells_y;
+    airspace_pair_t *pairs = NULL;
+    size_t pairs_count = 0, pairs_capacity = 0;
+    bool ok = (g_airspace.cells = (uint32_t *)calloc(cells + 1, sizeof(uint32_t))) != NULL;
+    for (uint32_t a = 0; a < g_airspace.areas_count && ok; a++) {
+        const airspace_area_t *const area = &g_airspace.areas[a];
+        const airspace_vertex_t *const v  = &g_airspace.vertices[area->vertex_first];
+        const uint32_t cx0                = (uint32_t)((area->x_min - g_airspace.x_min) / g_airspace.cell_nm);
+        const uint32_t cx1                = MIN((uint32_t)((area->x_max - g_airspace.x_min) / g_airspace.cell_nm), g_airspace.cells_x - 1);
+        const uint32_t cy0                = (uint32_t)((area->y_min - g_airspace.y_min) / g_airspace.cell_nm);
+        const uint32_t cy1                = MIN((uint32_t)((area->y_max - g_airspace.y_min) / g_airspace.cell_nm), g_airspace.cells_y - 1);
+        for (uint32_t cy = cy0; cy <= cy1 && ok; cy++)
+            for (uint32_t cx = cx0; cx <= cx1 && ok; cx++) {
+                const double left = g_airspace.x_min + (double)cx * g_airspace.cell_nm, bottom = g_airspace.y_min + (double)cy * g_airspace.cell_nm;
+                const double right = left + g_airspace.cell_nm, top = bottom + g_airspace.cell_nm;
+                bool boundary = false;
+                for (uint32_t i = 0, j = area->vertex_count - 1; i < area->vertex_count && !boundary; j = i++)
+                    boundary = airspace_segment_crosses(v[j].x, v[j].y, v[i].x, v[i].y, left, bottom, right, top);
+                uint32_t entry = a;
+                if (!boundary) {
+                    if (!airspace_contains(area, left + g_airspace.cell_nm / 2.0, bottom + g_airspace.cell_nm / 2.0))
+                        continue;
+                    entry |= AIRSPACE_CELL_INSIDE;
+                }
+                if (pairs_count == pairs_capacity) {
+                    pairs_capacity               = MAX(pairs_capacity * 2, (size_t)4096);
+                    airspace_pair_t *const grown = (airspace_pair_t *)realloc(pairs, pairs_capacity * sizeof(airspace_pair_t));
+                    if (!(ok = grown != NULL))
+                        break;
+                    pairs = grown;
+                }
+                pairs[pairs_count++] = (airspace_pair_t) { .cell = cy * g_airspace.cells_x + cx, .entry = entry };
+                g_airspace.cells[cy * g_airspace.cells_x + cx + 1]++;
+            }
+    }
+    ok = ok && (g_airspace.entries = (uint32_t *)malloc(MAX(pairs_count, (size_t)1) * sizeof(uint32_t))) != NULL;
+    if (ok) {
+        for (size_t c = 0; c < cells; c++)
+            g_airspace.cells[c + 1] += g_airspace.cells[c];
+        // pairs are in area order, so each cell's areas stay in file order
+        uint32_t *const fill = (uint32_t *)malloc(cells * sizeof(uint32_t));
+        if ((ok = fill != NULL)) {
+            memcpy(fill, g_airspace.cells, cells * sizeof(uint32_t));
+            for (size_t i = 0; i < pairs_count; i++)
+                g_airspace.entries[fill[pairs[i].cell]++] = pairs[i].entry;
+            free(fill);
+        }
+        g_airspace.entries_count = (uint32_t)pairs_count;
+    }
+    free(pairs);
+    return ok;
+}
+
+void airspace_end(void) {
+    g_airspace.enabled = false;
+    free(g_airspace.areas);
+    free(g_airspace.vertices);
+    free(g_airspace.cells);
+    free(g_airspace.entries);
+    g_airspace.areas    = NULL;
+    g_airspace.vertices = NULL;
+    g_airspace.cells    = NULL;
+    g_airspace.entries  = NULL;
+}
+
+bool airspace_begin(void) {
+    if (g_config.airspace_path[0] == '\0')
+        return true;
+    FILE *const fp = fopen(g_config.airspace_path, "r");
+    if (!fp) {
+        printf("airspace: open failed: %s: %s\n", g_config.airspace_path, strerror(errno));
+        return false;
+    }
+    airspace_load_t load = { 0 };
+    char line[AIRSPACE_LINE_MAX];
+    unsigned long malformed = 0;
+    bool ok                 = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "*\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+        if (!airspace_parse_line(&load, line)) {
+            if (load.failed)
+                ok = false;
+            else if (malformed++ < 10)
+                printf("airspace: malformed line: %s\n", line);
+        }
+    }
+    fclose(fp);
+    ok = ok && airspace_area_close(&load) && g_airspace.areas_count > 0 && airspace_grid_build();
+    if (!ok) {
+        printf("airspace: load failed: %s\n", g_config.airspace_path);
+        airspace_end();
+        return false;
+    }
+    g_airspace.enabled = true;
+    snprintf(g_airspace.topic, sizeof(g_airspace.topic), "%s/airspace", g_config.mqtt_topic);
+    printf("airspace: loaded %u areas (%u points) from %s, %lu malformed lines, %ux%u cells of %.1fnm (%u entries, %.1f MB)\n", g_airspace.areas_count,
+           g_airspace.vertices_count, g_config.airspace_path, malformed, g_airspace.cells_x, g_airspace.cells_y, g_airspace.cell_nm, g_airspace.entries_count,
+           (double)(((size_t)g_airspace.cells_x * g_airspace.cells_y + 1 + g_airspace.entries_count) * sizeof(uint32_t)) / (1024.0 * 1024.0));
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void position_record_set(aircraft_posn_t *const r, const double lat, const double lon, const int altitude_ft, const double distance_nm,
+                         const time_t timestamp) {
+    r->lat         = lat;
+    r->lon         = lon;
+    r->altitude_ft = altitude_ft;
+    r->distance_nm = distance_nm;
+    r->timestamp   = timestamp;
+}
+
+void position_stat_record_set(aircraft_stat_posn_t *const r, const double lat, const double lon, const int altitude_ft, const double distance_nm,
+                              const time_t timestamp, const char *const icao) {
+    position_record_set(&r->pos, lat, lon, altitude_ft, distance_nm, timestamp);
+    strncpy(r->icao, icao, 6);
+    r->icao[6] = '\0';
+}
+
+aircraft_data_t *aircraft_find(const char *const icao) {
+    unsigned int index = hash_icao(icao), index_original = index;
+
+    while (g_aircraft_list.entries[index].icao[0] != '\0') {
+        if (strcmp(g_aircraft_list.entries[index].icao, icao) == 0)
+            return &g_aircraft_list.entries[index];
+        if ((index = (index + 1) & HASH_MASK) == index_original)
+            return NULL;
+    }
+    return NULL;
+}
+
+// evicts the oldest PRUNE_RATIO of the table, called with it locked; each eviction can raise a vicinity leave and an airspace leave per
+// area occupied, so the event queue is flushed whenever it could not hold one more eviction's, true if the lock was released to do so
+static bool aircraft_prune(void) {
+    int to_remove      = (int)(MAX_AIRCRAFT * PRUNE_RATIO);
+    time_t oldest_time = time(NULL);
+    bool released      = false;
+    LOG(LOG_CATEGORY_AIRCRAFT, LOG_LEVEL_INFO, "map pruning %d oldest entries", to_remove);
+    PROBE1(aircraft_prune_start, g_aircraft_list.count);
+    const int to_remove_original = to_remove;
+    while (to_remove > 0) {
+        if (event_queue_space() < 1 + AIRSPACE_INSIDE_MAX) {
+            aircraft_list_unlock();
+            pthread_mutex_lock(&g_aircraft_list.mutex);
+            released = true;
+        }
+        int oldest_idx = -1;
+        oldest_time    = time(NULL);
+        for (int i = 0; i < MAX_AIRCRAFT; i++)
+            if (g_aircraft_list.entries[i].icao[0] != '\0' && g_aircraft_list.entries[i].pos.timestamp < oldest_time) {
+                oldest_time = g_aircraft_list.entries[i].pos.timestamp;
+                oldest_idx  = i;
+            }
+        if (oldest_idx >= 0) {
+            PROBE1(aircraft_pruned, g_aircraft_list.entries[oldest_idx].icao);
+            vicinity_remove(oldest_idx);
+            anomaly_remove(oldest_idx);
+            airspace_remove(oldest_idx);
+            g_aircraft_list.entries[oldest_idx].icao[0] = '\0';
+            shm_record_clear(oldest_idx);
+            airprox_remove(oldest_idx);
+            loiter_remove(oldest_idx);
+            g_aircraft_list.count--;
+            to_remove--;
+        } else
+            break;
+    }
+    PROBE2(aircraft_prune_end, g_aircraft_list.count, to_remove_original - to_remove);
+    return released;
+}
+
+aircraft_data_t *aircraft_find_or_create(const char *const icao) {
+    const unsigned int index_original = hash_icao(icao);
+    unsigned int index;
+
+    // a prune that released the lock may have let another ingest take the slot or create the aircraft, so the probe is taken again
+    for (int attempt = 0;; attempt++) {
+        index = index_original;
+        while (g_aircraft_list.entries[index].icao[0] != '\0') {
+            if (strcmp(g_aircraft_list.entries[index].icao, icao) == 0)
+                return &g_aircraft_list.entries[index];
+            if ((index = (index + 1) & HASH_MASK) == index_original)
+                return NULL;
+        }
+        if (attempt > 0 || g_aircraft_list.count < (int)(MAX_AIRCRAFT * PRUNE_THRESHOLD) || !aircraft_prune())
+            break;
+    }
+
+    strncpy(g_aircraft_list.entries[index].icao, icao, 6);
+    g_aircraft_list.entries[index].icao[6]            = '\0';
+    g_aircraft_list.entries[index].bounds_initialised = false;
+    memset(&g_aircraft_list.entries[index].state, 0, sizeof(aircraft_state_t));
+    uint32_t address;
+    g_aircraft_list.entries[index].origin  = icao_address(icao, &address) ? icao_blocks_lookup(address) : 0;
+    g_aircraft_list.entries[index].airport = AIRPORTS_NONE;
+    g_aircraft_list.count++;
+    g_aircraft_stat.aircraft_seen++;
+    g_aircraft_global.aircraft_seen++;
+    if (g_aircraft_list.entries[index].origin & ICAO_BLOCKS_MILITARY) {
+        g_aircraft_stat.military_seen++;
+        g_aircraft_global.military_seen++;
+    }
+    PROBE2(aircraft_created, g_aircraft_list.entries[index].icao, g_aircraft_list.count);
+
+    return &g_aircraft_list.entries[index];
+}
+
+static inline int16_t aircraft_state_int16(const double value) { return (int16_t)lround(MAX(MIN(value, INT16_MAX), INT16_MIN)); }
+
+// fields absent from the message keep their last value, flags are only replaced where the message carries them
+static void aircraft_state_update(aircraft_state_t *const state, const adsb_message_t *const msg, const time_t timestamp) {
+    if (msg->present & AIRCRAFT_STATE_CALLSIGN)
+        memcpy(state->callsign, msg->callsign, sizeof(state->callsign));
+    if (msg->present & AIRCRAFT_STATE_ALTITUDE)
+        state->altitude_ft = (int32_t)msg->altitude_ft;
+    if (msg->present & AIRCRAFT_STATE_SPEED)
+        state->ground_speed = aircraft_state_int16(msg->ground_speed);
+    if (msg->present & AIRCRAFT_STATE_TRACK)
+        state->track = aircraft_state_int16(fmod(msg->track + 360.0, 360.0) * 10.0);
+    if (msg->present & (AIRCRAFT_STATE_SPEED | AIRCRAFT_STATE_TRACK))
+        state->velocity_seen = timestamp;
+    if (msg->present & AIRCRAFT_STATE_VERTICAL_RATE)
+        state->vertical_rate = aircraft_state_int16(msg->vertical_rate);
+    if (msg->present & AIRCRAFT_STATE_SQUAWK)
+        state->squawk = (uint16_t)msg->squawk;
+    // the four flag presence bits are in the same order as the flags, from AIRCRAFT_STATE_ALERT up
+    const uint8_t flags_present = (uint8_t)((msg->present / AIRCRAFT_STATE_ALERT) & 0x0F);
+    state->flags                = (uint8_t)((state->flags & ~flags_present) | (msg->flags & flags_present));
+    state->valid |= (uint16_t)msg->present;
+    state->type = (uint8_t)msg->type;
+    state->seen = timestamp;
+    state->messages++;
+}
+
+// called with the table locked
+static void aircraft_position_set(aircraft_data_t *const aircraft, const double lat, const double lon, const int altitude_ft, const double distance_nm,
+                                  const time_t timestamp) {
+    position_record_set(&aircraft->pos, lat, lon, altitude_ft, distance_nm, timestamp);
+    aircraft->updated_ns = g_timing.recv_ns;
+    if (!aircraft->bounds_initialised) {
+        position_record_set(&aircraft->pos_first, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->min_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->max_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->min_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->max_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->min_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->max_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->min_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        position_record_set(&aircraft->max_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        aircraft->bounds_initialised = true;
+        LOG(LOG_CATEGORY_AIRCRAFT, LOG_LEVEL_DEBUG, "first seen: %s at %.6f,%.6f alt=%d dist=%.1fnm", aircraft->icao, lat, lon, altitude_ft, distance_nm);
+    } else {
+        if (lat < aircraft->min_lat_pos.lat)
+            position_record_set(&aircraft->min_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (lat > aircraft->max_lat_pos.lat)
+            position_record_set(&aircraft->max_lat_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (lon < aircraft->min_lon_pos.lon)
+            position_record_set(&aircraft->min_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (lon > aircraft->max_lon_pos.lon)
+            position_record_set(&aircraft->max_lon_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (altitude_ft < aircraft->min_alt_pos.altitude_ft)
+            position_record_set(&aircraft->min_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (altitude_ft > aircraft->max_alt_pos.altitude_ft)
+            position_record_set(&aircraft->max_alt_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (distance_nm < aircraft->min_dist_pos.distance_nm)
+            position_record_set(&aircraft->min_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+        if (distance_nm > aircraft->max_dist_pos.distance_nm)
+            position_record_set(&aircraft->max_dist_pos, lat, lon, altitude_ft, distance_nm, timestamp);
+    }
+    airports_attribute(aircraft);
+    const int index = (int)(aircraft - g_aircraft_list.entries);
+    shm_record_update(index, aircraft);
+    airprox_update(index, aircraft);
+    loiter_update(index, aircraft);
+    vicinity_update(index, aircraft);
+    airspace_update(index, aircraft);
+}
+
+static inline bool adsb_message_is_position(const adsb_message_t *const msg) { return msg->type == 3 && (msg->present & AIRCRAFT_STATE_POSITION); }
+
+// an airborne position (MSG,3) checked against the configured bounds and counted if invalid, false for anything else; one within bounds
+// is counted by aircraft_message_position_accepted once the tracker has accepted it too
+static bool aircraft_message_position_valid(const adsb_message_t *const msg, double *const distance_nm) {
+    if (!adsb_message_is_position(msg))
+        return false;
+    *distance_nm = calculate_distance_nm(g_config.position_lat, g_config.position_lon, msg->lat, msg->lon);
+    if (!position_is_valid(msg->lat, msg->lon, msg->altitude_ft, *distance_nm, g_config.altitude_max_ft, g_config.distance_max_nm)) {
+        g_aircraft_stat.position_invalid++;
+        g_aircraft_global.position_invalid++;
+        PROBE4(position_rejected, msg->icao, PROBE_E6(msg->lat), PROBE_E6(msg->lon), msg->altitude_ft);
+        LOG(LOG_CATEGORY_POSITION, LOG_LEVEL_DEBUG, "invalid (icao=%s, lat=%.6f, lon=%.6f, alt=%d, dist=%.1f)", msg->icao, msg->lat, msg->lon,
+            msg->altitude_ft, *distance_nm);
+        return false;
+    }
+    return true;
+}
+
+static void aircraft_message_position_accepted(const adsb_message_t *const msg) {
+    g_aircraft_stat.position_valid++;
+    g_aircraft_global.position_valid++;
+    PROBE4(position_accepted, msg->icao, PROBE_E6(msg->lat), PROBE_E6(msg->lon), msg->altitude_ft);
+}
+
+static void aircraft_message_stat_update(const adsb_message_t *const msg, const double distance_nm, const time_t timestamp) {
+    const char *const icao = msg->icao;
+    const double lat = msg->lat, lon = msg->lon;
+    const int altitude_ft = msg->altitude_ft;
+
+    if (distance_nm > g_aircraft_stat.distance_max.pos.distance_nm)
+        position_stat_record_set(&g_aircraft_stat.distance_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
+    if (distance_nm > g_aircraft_global.distance_max.pos.distance_nm)
+        position_stat_record_set(&g_aircraft_global.distance_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
+
+    if (altitude_ft > g_aircraft_stat.altitude_max.pos.altitude_ft)
+        position_stat_record_set(&g_aircraft_stat.altitude_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
+    if (altitude_ft > g_aircraft_global.altitude_max.pos.altitude_ft)
+        position_stat_record_set(&g_aircraft_global.altitude_max, lat, lon, altitude_ft, distance_nm, timestamp, icao);
+}
+
+// emergency squawks: every message carrying a squawk (MSG,6 and the others that repeat it, or DF17/18 identity) is checked as it is
+// applied, whether or not the aircraft has a position yet, so a change into 7500, 7600 or 7700, between them or out of them is
+// published to TOPIC/emergency at QoS 1 straight away rather than with the next aircraft_publish_mqtt cycle; the few aircraft
+// squawking an emergency are kept in a small table of their own, so the common case costs one comparison; latency is from the recv
+// that carried the message to the publish, aircraft unseen for EMERGENCY_GAP_MAX are dropped without an event
+
+#define EMERGENCY_QOS         1
+#define EMERGENCY_TRACKED_MAX 64
+#define EMERGENCY_GAP_MAX     300
+
+typedef struct {
+    char icao[7];
+    uint16_t squawk;
+    time_t started, seen;
+} emergency_entry_t;
+
+typedef struct {
+    char topic[MAX_NAME_LENGTH + 16];
+    emergency_entry_t entries[EMERGENCY_TRACKED_MAX];
+    int count;
+    time_t expired;
+    unsigned long declared, changed, cleared, dropped, published;
+} emergency_t;
+
+emergency_t g_emergency = { 0 };
+
+static inline bool emergency_squawk(const unsigned int squawk) { return squawk == 07500 || squawk == 07600 || squawk == 07700; }
+
+static const char *emergency_meaning(const unsigned int squawk) {
+    switch (squawk) {
+    case 07500:
+        return "unlawful interference";
+    case 07600:
+        return "radio failure";
+    case 07700:
+        return "emergency";
+    default:
+        return "none";
+    }
+}
+
+static void emergency_publish(const adsb_message_t *const msg, const emergency_entry_t *const entry, const char *const event, const time_t timestamp,
+                              const unsigned int previous) {
+    cJSON *root = cJSON_CreateObject();
+    if (!root)
+        return;
+    char squawk[8];
+    cJSON_AddNumberToObject(root, "timestamp", (double)timestamp);
+    cJSON_AddStringToObject(root, "icao", msg->icao);
+    cJSON_AddStringToObject(root, "event", event);
+    snprintf(squawk, sizeof(squawk), "%04o", msg->squawk);
+    cJSON_AddStringToObject(root, "squawk", squawk);
+    cJSON_AddStringToObject(root, "meaning", emergency_meaning(msg->squawk));
+    if (previous) {
+        snprintf(squawk, sizeof(squawk), "%04o", previous);
+        cJSON_AddStringToObject(root, "previous", squawk);
+    }
+    cJSON_AddNumberToObject(root, "started", (double)entry->started);
+    if (strcmp(event, "cleared") == 0)
+        cJSON_AddNumberToObject(root, "duration", (double)(timestamp - entry->started));
+
+    // what the table knows of the aircraft, which may be nothing if it has not reported a position yet
+    aircraft_state_t state = { 0 };
+    aircraft_posn_t pos    = { 0 };
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    const aircraft_data_t *const aircraft = aircraft_find(msg->icao);
+    if (aircraft) {
+        state = aircraft->state;
+        pos   = aircraft->pos;
+    }
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    if (msg->present & AIRCRAFT_STATE_CALLSIGN)
+        memcpy(state.callsign, msg->callsign, sizeof(state.callsign));
+    if ((msg->present | state.valid) & AIRCRAFT_STATE_CALLSIGN) {
+        char callsign[sizeof(state.callsign) + 1];
+        int length = (int)sizeof(state.callsign);
+        while (length > 0 && state.callsign[length - 1] == ' ')
+            length--;
+        snprintf(callsign, sizeof(callsign), "%.*s", length, state.callsign);
+        cJSON_AddStringToObject(root, "callsign", callsign);
+    }
+    if (aircraft && pos.timestamp > 0) {
+        cJSON *const current = cJSON_CreateObject();
+        if (current) {
+            cJSON_AddNumberToObject(current, "lat", pos.lat);
+            cJSON_AddNumberToObject(current, "lon", pos.lon);
+            cJSON_AddNumberToObject(current, "alt", pos.altitude_ft);
+            cJSON_AddNumberToObject(current, "dist", pos.distance_nm);
+            cJSON_AddNumberToObject(current, "time", (double)pos.timestamp);
+            cJSON_AddItemToObject(root, "current", current);
+        }
+    }
+
+    // from the recv that carried the message to just before the publish
+    if (g_timing.recv_ns)
+        cJSON_AddNumberToObject(root, "latency_us", (double)((timing_now_ns() - g_timing.recv_ns) / 1000ULL));
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str) {
+        if (sink_publish_qos(g_emergency.topic, (const unsigned char *)json_str, strlen(json_str), EMERGENCY_QOS))
+            g_emergency.published++;
+        free(json_str);
+    }
+}
+
+static emergency_entry_t *emergency_find(const char *const icao) {
+    for (int i = 0; i < g_emergency.count; i++)
+        if (strcmp(g_emergency.entries[i].icao, icao) == 0)
+            return &g_emergency.entries[i];
+    return NULL;
+}
+
+static void emergency_remove(emergency_entry_t *const entry) { *entry = g_emergency.entries[--g_emergency.count]; }
+
+// called for every decoded message before it is applied, without the table locked
+void emergency_update(const adsb_message_t *const msg, const time_t timestamp) {
+    if (!(msg->present & AIRCRAFT_STATE_SQUAWK))
+        return;
+    const bool emergency = emergency_squawk(msg->squawk);
+    if (!emergency && g_emergency.count == 0)
+        return;
+    emergency_entry_t *entry = emergency_find(msg->icao);
+    if (!emergency) {
+        if (entry) {
+            g_emergency.cleared++;
+            LOG(LOG_CATEGORY_AIRCRAFT, LOG_LEVEL_INFO, "%s: emergency cleared (%04o to %04o)", msg->icao, entry->squawk, msg->squawk);
+            emergency_publish(msg, entry, "cleared", timestamp, entry->squawk);
+            emergency_remove(entry);
+        }
+        return;
+    }
+    if (entry) {
+        entry->seen = timestamp;
+        if (entry->squawk == msg->squawk)
+            return;
+        const unsigned int previous = entry->squawk;
+        entry->squawk               = (uint16_t)msg->squawk;
+        g_emergency.changed++;
+        LOG(LOG_CATEGORY_AIRCRAFT, LOG_LEVEL_INFO, "%s: emergency changed (%04o to %04o)", msg->icao, previous, msg->squawk);
+        emergency_publish(msg, entry, "changed", timestamp, previous);
+        return;
+    }
+    if (g_emergency.count == EMERGENCY_TRACKED_MAX) {
+        emergency_entry_t *oldest = &g_emergency.entries[0];
+        for (int i = 1; i < g_emergency.count; i++)
+            if (g_emergency.entries[i].seen < oldest->seen)
+                oldest = &g_emergency.entries[i];
+        emergency_remove(oldest);
+        g_emergency.dropped++;
+    }
+    entry = &g_emergency.entries[g_emergency.count++];
+    snprintf(entry->icao, sizeof(entry->icao), "%s", msg->icao);
+    entry->squawk  = (uint16_t)msg->squawk;
+    entry->started = timestamp;
+    entry->seen    = timestamp;
+    g_emergency.declared++;
+    LOG(LOG_CATEGORY_AIRCRAFT, LOG_LEVEL_INFO, "%s: emergency declared (%04o, %s)", msg->icao, msg->squawk, emergency_meaning(msg->squawk));
+    emergency_publish(msg, entry, "declared", timestamp, 0);
+}
+
+// forgets aircraft that went unseen while squawking an emergency, at most once a second and only while there are any
+void emergency_expire(void) {
+    if (g_emergency.count == 0)
+        return;
+    const time_t now = time(NULL);
+    if (now == g_emergency.expired)
+        return;
+    g_emergency.expired = now;
+    for (int i = g_emergency.count; i > 0; i--)
+        if (now - g_emergency.entries[i - 1].seen > EMERGENCY_GAP_MAX) {
+            emergency_remove(&g_emergency.entries[i - 1]);
+            g_emergency.dropped++;
+        }
+}
+
+bool emergency_begin(void) {
+    snprintf(g_emergency.topic, sizeof(g_emergency.topic), "%s/emergency", g_config.mqtt_topic);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// serve: the decoded messages re-served as SBS (BaseStation, as dump1090 serves on port 30003) to any number of TCP clients, whatever
+// the input format, optionally only accepted positions, positions within a radius of the station (and other messages of aircraft last
+// seen within it) or certain message types; a message identical to one the same aircraft sent within the second is served once; each
+// line is formatted once into a shared ring and every client sends from its own cursor into the ring with writev, so serving another
+// client costs no copy; a client that falls a whole ring behind is disconnected rather than buffered for; the mutex covers only the
+// ring's writes and head, the clients belong to the serve thread, so the processing thread never waits on a client's send
+
+#define SERVE_RING_SIZE      (1U << 22) // power of two
+#define SERVE_CLIENTS_MAX    32
+#define SERVE_DEDUP_SLOTS    4096 // power of two
+#define SERVE_LINE_MAX       192
+
+typedef struct {
+    uint64_t hash;
+    time_t seen;
+} serve_dedup_t;
+
+typedef struct {
+    int fd;
+    uint64_t cursor, sent_from;
+    bool blocked;
+    char address[INET_ADDRSTRLEN + 8];
+} serve_client_t;
+
+typedef struct {
+    bool enabled, accepted_only, running, started;
+    unsigned int types;
+    double radius_nm;
+    unsigned short port;
+    struct in_addr bind_address;
+    int listen_fd, wake[2];
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    char ring[SERVE_RING_SIZE];
+    uint64_t head, woken;
+    serve_client_t clients[SERVE_CLIENTS_MAX];
+    int clients_count;
+    serve_dedup_t dedup[SERVE_DEDUP_SLOTS];
+    unsigned long lines, duplicates, bytes, connected, disconnected, lagged;
+} serve_t;
+
+serve_t g_serve = { .listen_fd = -1, .wake = { -1, -1 } };
+
+// called with the table locked, aircraft is NULL if it is not in the table
+bool serve_wanted(const adsb_message_t *const msg, const aircraft_data_t *const aircraft, const bool accepted) {
+    if (!g_serve.enabled || !(g_serve.types & (1U << msg->type)))
+        return false;
+    if (g_serve.accepted_only && adsb_message_is_position(msg) && !accepted)
+        return false;
+    if (g_serve.radius_nm > 0.0 && (!aircraft || !aircraft->bounds_initialised || aircraft->pos.distance_nm > g_serve.radius_nm))
+        return false;
+    return true;
+}
+
+static size_t serve_format_flag(char *const out, const size_t size, const adsb_message_t *const msg, const unsigned int present,
+                                const unsigned char flag) {
+    return (size_t)snprintf(out, size, ",%s", (msg->present & present) ? ((msg->flags & flag) ? "-1" : "0") : "");
+}
+
+// the fields after the generated and logged times, from the callsign on
+static size_t serve_format_fields(char *const out, const size_t size, const adsb_message_t *const msg) {
+    size_t n = 0;
+    if (msg->present & AIRCRAFT_STATE_CALLSIGN)
+        n += (size_t)snprintf(out + n, size - n, "%.*s", (int)sizeof(msg->callsign), msg->callsign);
+    n += (size_t)snprintf(out + n, size - n, ",");
+    if (msg->present & AIRCRAFT_STATE_ALTITUDE)
+        n += (size_t)snprintf(out + n, size - n, "%d", msg->altitude_ft);
+    n += (size_t)snprintf(out + n, size - n, ",");
+    if (msg->present & AIRCRAFT_STATE_SPEED)
+        n += (size_t)snprintf(out + n, size - n, "%.0f", msg->ground_speed);
+    n += (size_t)snprintf(out + n, size - n, ",");
+    if (msg->present & AIRCRAFT_STATE_TRACK)
+        n += (size_t)snprintf(out + n, size - n, "%.0f", msg->track);
+    n += (size_t)snprintf(out + n, size - n, ",");
+    if (msg->present & AIRCRAFT_STATE_POSITION)
+        n += (size_t)snprintf(out + n, size - n, "%.5f,%.5f", msg->lat, msg->lon);
+    else
+        n += (size_t)snprintf(out + n, size - n, ",");
+    n += (size_t)snprintf(out + n, size - n, ",");
+    if (msg->present & AIRCRAFT_STATE_VERTICAL_RATE)
+        n += (size_t)snprintf(out + n, size - n, "%d", msg->vertical_rate);
+    n += (size_t)snprintf(out + n, size - n, ",");
+    if (msg->present & AIRCRAFT_STATE_SQUAWK)
+        n += (size_t)snprintf(out + n, size - n, "%04o", msg->squawk);
+    n += serve_format_flag(out + n, size - n, msg, AIRCRAFT_STATE_ALERT, AIRCRAFT_FLAG_ALERT);
+    n += serve_format_flag(out + n, size - n, msg, AIRCRAFT_STATE_EMERGENCY, AIRCRAFT_FLAG_EMERGENCY);
+    n += serve_format_flag(out + n, size - n, msg, AIRCRAFT_STATE_SPI, AIRCRAFT_FLAG_SPI);
+    n += serve_format_flag(out + n, size - n, msg, AIRCRAFT_STATE_GROUND, AIRCRAFT_FLAG_GROUND);
+    return MIN(n, size - 1);
+}
+
+// called from the processing thread, without the table locked, for each message serve_wanted() passed
+void serve_message(const adsb_message_t *const msg, const time_t timestamp) {
+    char fields[SERVE_LINE_MAX], line[SERVE_LINE_MAX + 96];
+    const size_t fields_length = serve_format_fields(fields, sizeof(fields), msg);
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = msg->icao; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    hash = (hash ^ (unsigned int)msg->type) * 1099511628211ULL;
+    for (size_t i = 0; i < fields_length; i++)
+        hash = (hash ^ (unsigned char)fields[i]) * 1099511628211ULL;
+    serve_dedup_t *const dedup = &g_serve.dedup[hash & (SERVE_DEDUP_SLOTS - 1)];
+    if (dedup->hash == hash && dedup->seen == timestamp) {
+        g_serve.duplicates++;
+        return;
+    }
+    dedup->hash = hash;
+    dedup->seen = timestamp;
+
+    struct tm tm;
+    char when[32];
+    gmtime_r(&timestamp, &tm);
+    strftime(when, sizeof(when), "%Y/%m/%d,%H:%M:%S.000", &tm);
+    const int length = snprintf(line, sizeof(line), "MSG,%d,1,1,%s,1,%s,%s,%.*s\r\n", msg->type, msg->icao, when, when, (int)fields_length, fields);
+    if (length <= 0 || (size_t)length >= sizeof(line))
+        return;
+
+    pthread_mutex_lock(&g_serve.mutex);
+    const size_t offset = (size_t)(g_serve.head & (SERVE_RING_SIZE - 1)), first = MIN((size_t)length, SERVE_RING_SIZE - offset);
+    memcpy(g_serve.ring + offset, line, first);
+    memcpy(g_serve.ring, line + first, (size_t)length - first);
+    g_serve.head += (uint64_t)length;
+    pthread_mutex_unlock(&g_serve.mutex);
+    g_serve.lines++;
+    g_serve.bytes += (unsigned long)length;
+}
+
+// called from the processing thread after each recv, so the clients are woken once for all the lines it brought
+void serve_wake(void) {
+    if (!g_serve.started || g_serve.woken == g_serve.head)
+        return;
+    g_serve.woken    = g_serve.head;
+    const char token = 0;
+    if (write(g_serve.wake[1], &token, 1) < 0 && errno != EAGAIN)
+        printf("serve: wake failed: %s\n", strerror(errno));
+}
+
+static void serve_disconnect(const int index, const char *const reason) {
+    serve_client_t *const c = &g_serve.clients[index];
+    printf("serve: client %s disconnected (%s)\n", c->address, reason);
+    close(c->fd);
+    g_serve.clients[index] = g_serve.clients[--g_serve.clients_count];
+    g_serve.disconnected++;
+}
+
+static void serve_accept(void) {
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    int fd;
+    while ((fd = accept(g_serve.listen_fd, (struct sockaddr *)&address, &address_length)) >= 0) {
+        if (g_serve.clients_count == SERVE_CLIENTS_MAX || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+            close(fd);
+            continue;
+        }
+        serve_client_t *const c = &g_serve.clients[g_serve.clients_count++];
+        c->fd                   = fd;
+        pthread_mutex_lock(&g_serve.mutex);
+        c->cursor = g_serve.head;
+        pthread_mutex_unlock(&g_serve.mutex);
+        c->blocked = false;
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        snprintf(c->address, sizeof(c->address), "%s:%u", host, ntohs(address.sin_port));
+        g_serve.connected++;
+        printf("serve: client %s connected (%d)\n", c->address, g_serve.clients_count);
+        address_length = sizeof(address);
+    }
+}
+
+static inline uint64_t serve_head(void) {
+    pthread_mutex_lock(&g_serve.mutex);
+    const uint64_t head = g_serve.head;
+    pthread_mutex_unlock(&g_serve.mutex);
+    return head;
+}
+
+// without the ring locked, so the processing thread may overwrite what is being sent: once the sends are made the head is taken again
+// and a client that sent from a cursor it has since left more than a ring behind is disconnected, as what it sent may have been lapped;
+// sends never block
+static void serve_send(void) {
+    const uint64_t head = serve_head();
+    for (int i = g_serve.clients_count; i > 0; i--) {
+        serve_client_t *const c = &g_serve.clients[i - 1];
+        const uint64_t pending  = head - c->cursor;
+        c->sent_from            = c->cursor;
+        if (pending > SERVE_RING_SIZE) {
+            g_serve.lagged++;
+            serve_disconnect(i - 1, "too far behind");
+            continue;
+        }
+        if (pending == 0)
+            continue;
+        const size_t offset = (size_t)(c->cursor & (SERVE_RING_SIZE - 1)), first = MIN((size_t)pending, SERVE_RING_SIZE - offset);
+        struct iovec iov[2] = {
+            { .iov_base = g_serve.ring + offset, .iov_len = first },
+            { .iov_base = g_serve.ring, .iov_len = (size_t)pending - first },
+        };
+        const ssize_t sent = writev(c->fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            serve_disconnect(i - 1, strerror(errno));
+            continue;
+        }
+        if (sent > 0)
+            c->cursor += (uint64_t)sent;
+        c->blocked = c->cursor != head;
+    }
+    const uint64_t head_after = serve_head();
+    for (int i = g_serve.clients_count; i > 0; i--) {
+        const serve_client_t *const c = &g_serve.clients[i - 1];
+        if (c->cursor != c->sent_from && head_after - c->sent_from > SERVE_RING_SIZE) {
+            g_serve.lagged++;
+            serve_disconnect(i - 1, "lapped while sending");
+        }
+    }
+}
+
+static void *serve_thread(void *arg __attribute__((unused))) {
+    struct pollfd fds[2 + SERVE_CLIENTS_MAX];
+    while (g_serve.running) {
+        fds[0]          = (struct pollfd) { .fd = g_serve.listen_fd, .events = POLLIN };
+        fds[1]          = (struct pollfd) { .fd = g_serve.wake[0], .events = POLLIN };
+        const int count = g_serve.clients_count;
+        for (int i = 0; i < count; i++)
+            fds[2 + i] = (struct pollfd) { .fd = g_serve.clients[i].fd, .events = (short)(POLLIN | (g_serve.clients[i].blocked ? POLLOUT : 0)) };
+        if (poll(fds, (nfds_t)(2 + count), 1000) < 0 && errno != EINTR) {
+            printf("serve: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        char discard[256];
+        if (fds[1].revents & POLLIN)
+            while (read(g_serve.wake[0], discard, sizeof(discard)) > 0)
+                ;
+        // clients are not expected to send, anything they do is read and dropped, and end of stream is a disconnect
+        for (int i = count; i > 0; i--)
+            if ((fds[2 + i - 1].revents & (POLLIN | POLLHUP | POLLERR)) && recv(fds[2 + i - 1].fd, discard, sizeof(discard), 0) <= 0)
+                for (int j = 0; j < g_serve.clients_count; j++)
+                    if (g_serve.clients[j].fd == fds[2 + i - 1].fd) {
+                        serve_disconnect(j, "closed");
+                        break;
+                    }
+        serve_send();
+        if (fds[0].revents & POLLIN)
+            serve_accept();
+    }
+    return NULL;
+}
+
+// [IPV4:]PORT[,accepted][,radius=NM][,types=DIGITS]
+static bool serve_parse(const char *const spec) {
+    char buffer[MAX_NAME_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    g_serve.types = 0x1FE;
+    char *option  = strchr(buffer, ',');
+    if (option)
+        *option++ = '\0';
+    char *const colon           = strrchr(buffer, ':');
+    const int port              = atoi(colon ? colon + 1 : buffer);
+    g_serve.bind_address.s_addr = htonl(INADDR_ANY);
+    if (port <= 0 || port > 65535)
+        return false;
+    g_serve.port = (unsigned short)port;
+    if (colon) {
+        *colon = '\0';
+        if (inet_pton(AF_INET, buffer, &g_serve.bind_address) != 1)
+            return false;
+    }
+    while (option) {
+        char *const next = strchr(option, ',');
+        if (next)
+            *next = '\0';
+        if (strcmp(option, "accepted") == 0)
+            g_serve.accepted_only = true;
+        else if (strncmp(option, "radius=", 7) == 0 && atof(option + 7) > 0.0)
+            g_serve.radius_nm = atof(option + 7);
+        else if (strncmp(option, "types=", 6) == 0 && option[6] != '\0') {
+            g_serve.types = 0;
+            for (const char *t = option + 6; *t; t++) {
+                if (*t < '1' || *t > '8')
+                    return false;
+                g_serve.types |= 1U << (*t - '0');
+            }
+        } else
+            return false;
+        option = next ? next + 1 : NULL;
+    }
+    return true;
+}
+
+void serve_end(void) {
+    if (g_serve.started) {
+        g_serve.running = false;
+        pthread_join(g_serve.thread, NULL);
+        g_serve.started = false;
+    }
+    while (g_serve.clients_count > 0)
+        serve_disconnect(g_serve.clients_count - 1, "shutdown");
+    for (int i = 0; i < 2; i++)
+        if (g_serve.wake[i] >= 0) {
+            close(g_serve.wake[i]);
+            g_serve.wake[i] = -1;
+        }
+    if (g_serve.listen_fd >= 0) {
+        close(g_serve.listen_fd);
+        g_serve.listen_fd = -1;
+    }
+    g_serve.enabled = false;
+}
+
+bool serve_begin(void) {
+    if (g_config.serve[0] == '\0')
+        return true;
+    if (!serve_parse(g_config.serve)) {
+        printf("serve: invalid: %s\n", g_config.serve);
+        return false;
+    }
+    const int reuse            = 1;
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(g_serve.port), .sin_addr = g_serve.bind_address };
+    if ((g_serve.listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || setsockopt(g_serve.listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        fcntl(g_serve.listen_fd, F_SETFL, O_NONBLOCK) < 0 || bind(g_serve.listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(g_serve.listen_fd, SERVE_CLIENTS_MAX) < 0 || pipe(g_serve.wake) < 0 || fcntl(g_serve.wake[0], F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(g_serve.wake[1], F_SETFL, O_NONBLOCK) < 0) {
+        printf("serve: listen failed on port %u: %s\n", g_serve.port, strerror(errno));
+        serve_end();
+        return false;
+    }
+    pthread_mutex_init(&g_serve.mutex, NULL);
+    g_serve.enabled = true;
+    g_serve.running = true;
+    if (pthread_create(&g_serve.thread, NULL, serve_thread, NULL) != 0) {
+        perror("pthread_create serve thread");
+        g_serve.running = false;
+        serve_end();
+        return false;
+    }
+    g_serve.started = true;
+    printf("serve: listening on port %u (accepted-only=%s, radius=%.1fnm, types=0x%03x)\n", g_serve.port, g_serve.accepted_only ? "yes" : "no",
+           g_serve.radius_nm, g_serve.types);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// every decoded message costs one table lookup: an airborne position (MSG,3) within bounds finds or creates the aircraft and, if the
+// tracker accepts it, updates its state and position together and then counts it in the voxel map and stats, anything else only
+// updates the state of an aircraft already being tracked; true if the message was a position and it was accepted
+bool aircraft_message_update(const adsb_message_t *const msg, const time_t timestamp) {
+    const char *const icao = msg->icao;
+    double distance_nm     = 0.0;
+
+    emergency_update(msg, timestamp);
+    const bool position_valid = aircraft_message_position_valid(msg, &distance_nm);
+
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    aircraft_data_t *const aircraft = position_valid ? aircraft_find_or_create(icao) : aircraft_find(icao);
+    if (!aircraft) {
+        const bool serve = !position_valid && serve_wanted(msg, NULL, false);
+        aircraft_list_unlock();
+        if (position_valid)
+            printf("error: hash table full, cannot add %s\n", icao);
+        else if (serve)
+            serve_message(msg, timestamp);
+        return false;
+    }
+    aircraft_state_update(&aircraft->state, msg, timestamp);
+    anomaly_update((int)(aircraft - g_aircraft_list.entries), aircraft, msg, timestamp);
+    const bool position_accepted = position_valid && track_update((int)(aircraft - g_aircraft_list.entries), aircraft, msg, timestamp);
+    if (position_accepted)
+        aircraft_position_set(aircraft, msg->lat, msg->lon, msg->altitude_ft, distance_nm, timestamp);
+    const bool serve = serve_wanted(msg, aircraft, position_accepted);
+    aircraft_list_unlock();
+    if (serve)
+        serve_message(msg, timestamp);
+    if (position_accepted) {
+        aircraft_message_position_accepted(msg);
+        const unsigned long long t_voxel = timing_start();
+        voxel_map_update(msg->lat, msg->lon, msg->altitude_ft);
+        timing_stop(TIMING_STAGE_VOXEL, t_voxel);
+        aircraft_message_stat_update(msg, distance_nm, timestamp);
+    }
+    return position_accepted;
+}
+
+void aircraft_position_update(const char *const icao, const double lat, const double lon, const int altitude_ft, const time_t timestamp) {
+    adsb_message_t msg = { .type = 3, .present = AIRCRAFT_STATE_POSITION | AIRCRAFT_STATE_ALTITUDE, .altitude_ft = altitude_ft, .lat = lat, .lon = lon };
+    snprintf(msg.icao, sizeof(msg.icao), "%s", icao);
+    aircraft_message_update(&msg, timestamp);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// aircraft identity database (--icaodb=FILE): registration, ICAO type code and operator by 24-bit address, compiled by the subcommand
+// 'adsb_analyser icaodb-build SOURCE FILE' from a CSV with a header row (icao24/hex/icao, registration, typecode, operator/owner
+// columns, as in the OpenSky aircraft database) or the monitor's hexcode JSON cache; the file is mapped read only and used in place,
+// so opening it costs a validation of the header, and a lookup is two hashes and a key compare with strings returned into the mapping
+//
+// the hash is minimal and perfect (CHD style hash and displace): a key hashes to one of count/ICAODB_BUCKET_SIZE buckets, and each
+// bucket's stored displacement picks the hash that sends all of its keys to otherwise empty slots, built largest bucket first; records
+// hold their key, so an address that is not in the database is rejected by the compare
+//
+// layout: icaodb_header_t, uint32 displacements[buckets], icaodb_record_t records[count], strings (offset 0 is the empty string)
+
+#define ICAODB_MAGIC            0x42444349 // "ICDB" in hex
+#define ICAODB_VERSION          1
+#define ICAODB_BUCKET_SIZE      4
+#define ICAODB_DISPLACEMENT_MAX 0x7FFFFFFFU
+#define ICAODB_SEED_ATTEMPTS    8
+#define ICAODB_STRING_MAX       64
+#define ICAODB_LINE_MAX         4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t buckets;
+    uint64_t seed;
+    uint32_t strings_size;
+    uint32_t reserved;
+    int64_t built;
+} icaodb_header_t;
+
+typedef struct {
+    uint32_t icao;
+    uint32_t registration;
+    uint32_t type;
+    uint32_t operator;
+} icaodb_record_t;
+
+typedef struct {
+    const icaodb_header_t *header;
+    const uint32_t *displacements;
+    const icaodb_record_t *records;
+    const char *strings;
+    size_t size;
+    unsigned long hits, misses;
+} icaodb_state_t;
+
+icaodb_state_t g_icaodb = { 0 };
+
+typedef struct {
+    const char *registration;
+    const char *type;
+    const char *operator;
+} icaodb_entry_t;
+
+static inline uint64_t icaodb_hash(const uint32_t key, const uint64_t seed) {
+    uint64_t x = (key | ((uint64_t)key << 32)) ^ seed;
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint32_t icaodb_bucket(const uint32_t key, const uint64_t seed, const uint32_t buckets) { return (uint32_t)(icaodb_hash(key, seed) % buckets); }
+
+static inline uint32_t icaodb_slot(const uint32_t key, const uint64_t seed, const uint32_t displacement, const uint32_t count) {
+    return (uint32_t)(icaodb_hash(key, seed + 0x9E3779B97F4A7C15ULL * (displacement + 1ULL)) % count);
+}
+
+// pointers into the mapping, valid until icaodb_end; no allocation or locking
+bool icaodb_lookup(const char *const icao, icaodb_entry_t *const entry) {
+    const icaodb_header_t *const header = g_icaodb.header;
+    uint32_t key;
+    if (!header || !icao_address(icao, &key))
+        return false;
+    const uint32_t slot           = icaodb_slot(key, header->seed, g_icaodb.displacements[icaodb_bucket(key, header->seed, header->buckets)], header->count);
+    const icaodb_record_t *record = &g_icaodb.records[slot];
+    if (record->icao != key) {
+        g_icaodb.misses++;
+        return false;
+    }
+    g_icaodb.hits++;
+    entry->registration = g_icaodb.strings + record->registration;
+    entry->type         = g_icaodb.strings + record->type;
+    entry->operator     = g_icaodb.strings + record->operator;
+    return true;
+}
+
+bool icaodb_begin(void) {
+    if (g_config.icaodb_path[0] == '\0')
+        return true;
+    const int fd = open(g_config.icaodb_path, O_RDONLY);
+    if (fd < 0) {
+        printf("icaodb: open failed: %s: %s\n", g_config.icaodb_path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(icaodb_header_t)) {
+        printf("icaodb: file too short: %s\n", g_config.icaodb_path);
+        close(fd);
+        return false;
+    }
+    const size_t size = (size_t)st.st_size;
+    void *const base  = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("icaodb: mmap failed: %s: %s\n", g_config.icaodb_path, strerror(errno));
+        return false;
+    }
+    const icaodb_header_t *const header = (const icaodb_header_t *)base;
+    const size_t tables                 = (size_t)header->buckets * sizeof(uint32_t) + (size_t)header->count * sizeof(icaodb_record_t);
+    const size_t expected               = sizeof(icaodb_header_t) + tables + header->strings_size;
+    if (header->magic != ICAODB_MAGIC || header->version != ICAODB_VERSION || header->count == 0 || header->buckets == 0 || header->strings_size == 0 ||
+        expected != size) {
+        printf("icaodb: invalid or unsupported file: %s\n", g_config.icaodb_path);
+        munmap(base, size);
+        return false;
+    }
+    // lookups land anywhere in the tables
+    madvise(base, size, MADV_RANDOM);
+    g_icaodb.header        = header;
+    g_icaodb.displacements = (const uint32_t *)(header + 1);
+    g_icaodb.records       = (const icaodb_record_t *)(g_icaodb.displacements + header->buckets);
+    g_icaodb.strings       = (const char *)(g_icaodb.records + header->count);
+    g_icaodb.size          = size;
+    printf("icaodb: mapped %u aircraft from %s (%.1f MB, built %" PRId64 ")\n", header->count, g_config.icaodb_path, (double)size / (1024.0 * 1024.0),
+           header->built);
+    return true;
+}
+
+void icaodb_end(void) {
+    if (g_icaodb.header) {
+        munmap((void *)(uintptr_t)g_icaodb.header, g_icaodb.size);
+        g_icaodb.header = NULL;
+    }
+}
+
+#ifndef ADSB_ANALYSER_NO_MAIN
+
+// build side: entries are collected, sorted by key with the last of any duplicates kept, their strings interned, and the hash searched
+
+typedef struct {
+    uint32_t icao;
+    uint32_t registration, type, operator;
+    uint32_t order;
+} icaodb_build_entry_t;
+
+typedef struct {
+    icaodb_build_entry_t *entries;
+    size_t count, capacity;
+    char *strings;
+    size_t strings_size, strings_capacity;
+    uint32_t *intern; // open addressed string offsets, 0 is empty
+    size_t intern_capacity, intern_count;
+} icaodb_build_t;
+
+// spaces, quotes and line endings around a field
+static void icaodb_build_trim(const char **const s, size_t *const length) {
+    while (*length > 0 && strchr(" \t\"'\r\n", **s))
+        (*s)++, (*length)--;
+    while (*length > 0 && strchr(" \t\"'\r\n", (*s)[*length - 1]))
+        (*length)--;
+}
+
+static uint32_t icaodb_build_string_hash(const char *const s, const size_t length) {
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619U;
+    return h;
+}
+
+static bool icaodb_build_intern_grow(icaodb_build_t *const b) {
+    const size_t capacity  = b->intern_capacity ? b->intern_capacity * 2 : 4096;
+    uint32_t *const intern = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    if (!intern)
+        return false;
+    for (size_t i = 0; i < b->intern_capacity; i++)
+        if (b->intern[i]) {
+            const char *const s = b->strings + b->intern[i];
+            size_t j            = icaodb_build_string_hash(s, strlen(s)) & (capacity - 1);
+            while (intern[j])
+                j = (j + 1) & (capacity - 1);
+            intern[j] = b->intern[i];
+        }
+    free(b->intern);
+    b->intern          = intern;
+    b->intern_capacity = capacity;
+    return true;
+}
+
+// trimmed and capped at ICAODB_STRING_MAX, returns the offset or UINT32_MAX when out of memory
+static uint32_t icaodb_build_intern(icaodb_build_t *const b, const char *s, size_t length) {
+    icaodb_build_trim(&s, &length);
+    length = MIN(length, ICAODB_STRING_MAX);
+    if (length == 0)
+        return 0;
+    if ((b->intern_count + 1) * 2 > b->intern_capacity && !icaodb_build_intern_grow(b))
+        return UINT32_MAX;
+    size_t j = icaodb_build_string_hash(s, length) & (b->intern_capacity - 1);
+    for (; b->intern[j]; j = (j + 1) & (b->intern_capacity - 1)) {
+        const char *const existing = b->strings + b->intern[j];
+        if (strncmp(existing, s, length) == 0 && existing[length] == '\0')
+            return b->intern[j];
+    }
+    if (b->strings_size + length + 1 > b->strings_capacity) {
+        const size_t capacity = MAX(b->strings_capacity * 2, b->strings_size + length + 1);
+        char *const strings   = (char *)realloc(b->strings, capacity);
+        if (!strings)
+            return UINT32_MAX;
+        b->strings          = strings;
+        b->strings_capacity = capacity;
+    }
+    const uint32_t offset = (uint32_t)b->strings_size;
+    memcpy(b->strings + offset, s, length);
+    b->strings[offset + length] = '\0';
+    b->strings_size += length + 1;
+    b->intern[j] = offset;
+    b->intern_count++;
+    return offset;
+}
+
+// false only when out of memory, an entry without a valid address or any identity is skipped
+static bool icaodb_build_add(icaodb_build_t *const b, const char *icao, size_t icao_length, const char *const registration,
+                             const size_t registration_length, const char *const type, const size_t type_length, const char *const operator,
+                             const size_t operator_length) {
+    char hex[7];
+    uint32_t key;
+    icaodb_build_trim(&icao, &icao_length);
+    if (icao_length != 6)
+        return true;
+    memcpy(hex, icao, 6);
+    hex[6] = '\0';
+    if (!icao_address(hex, &key))
+        return true;
+    if (b->count == b->capacity) {
+        const size_t capacity               = b->capacity ? b->capacity * 2 : 65536;
+        icaodb_build_entry_t *const entries = (icaodb_build_entry_t *)realloc(b->entries, capacity * sizeof(icaodb_build_entry_t));
+        if (!entries)
+            return false;
+        b->entries  = entries;
+        b->capacity = capacity;
+    }
+    icaodb_build_entry_t *const e = &b->entries[b->count];
+    e->icao                       = key;
+    e->registration               = icaodb_build_intern(b, registration, registration_length);
+    e->type                       = icaodb_build_intern(b, type, type_length);
+    e->operator                   = icaodb_build_intern(b, operator, operator_length);
+    e->order                      = (uint32_t)b->count;
+    if (e->registration == UINT32_MAX || e->type == UINT32_MAX || e->operator == UINT32_MAX)
+        return false;
+    if (e->registration || e->type || e->operator)
+        b->count++;
+    return true;
+}
+
+// one CSV field, quoted fields (double or, as OpenSky writes them, single) may contain commas and doubled quotes (kept, and trimmed
+// with the outer quotes)
+static const char *icaodb_csv_field(const char *p, const char **const start, size_t *const length) {
+    *start = p;
+    if (*p == '"' || *p == '\'') {
+        const char quote = *p;
+        for (p++; *p != '\0'; p++)
+            if (*p == quote) {
+                if (p[1] != quote)
+                    break;
+                p++;
+            }
+        if (*p == quote)
+            p++;
+    }
+    while (*p != '\0' && *p != ',' && *p != '\r' && *p != '\n')
+        p++;
+    *length = (size_t)(p - *start);
+    return *p == ',' ? p + 1 : NULL;
+}
+
+static int icaodb_csv_column(const char *name, size_t length, const char *const *const candidates) {
+    icaodb_build_trim(&name, &length);
+    for (int c = 0; candidates[c]; c++)
+        if (strlen(candidates[c]) == length && strncasecmp(name, candidates[c], length) == 0)
+            return c;
+    return -1;
+}
+
+static bool icaodb_build_csv(icaodb_build_t *const b, FILE *const fp) {
+    static const char *const names_icao[]         = { "icao24", "hex", "icao", NULL };
+    static const char *const names_registration[] = { "registration", "reg", NULL };
+    static const char *const names_type[]         = { "typecode", "icaotypecode", "icaotype", "type", NULL };
+    static const char *const names_operator[]     = { "operator", "registeredowners", "owner", NULL };
+    char line[ICAODB_LINE_MAX];
+    if (!fgets(line, sizeof(line), fp)) {
+        printf("icaodb: source is empty\n");
+        return false;
+    }
+    // the earliest candidate name wins for each column, so "operator" is preferred to "owner"
+    int columns[4] = { -1, -1, -1, -1 }, ranks[4] = { 99, 99, 99, 99 }, column = 0;
+    const char *const *const names[4] = { names_icao, names_registration, names_type, names_operator };
+    for (const char *p = line; p; column++) {
+        const char *start;
+        size_t length;
+        p = icaodb_csv_field(p, &start, &length);
+        for (int n = 0; n < 4; n++) {
+            const int rank = icaodb_csv_column(start, length, names[n]);
+            if (rank >= 0 && rank < ranks[n]) {
+                ranks[n]   = rank;
+                columns[n] = column;
+            }
+        }
+    }
+    if (columns[0] < 0) {
+        printf("icaodb: source header has no icao24/hex/icao column\n");
+        return false;
+    }
+    unsigned long lines = 0, skipped = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        const char *fields[4] = { "", "", "", "" };
+        size_t lengths[4]     = { 0 };
+        column                = 0;
+        for (const char *p = line; p; column++) {
+            const char *start;
+            size_t length;
+            p = icaodb_csv_field(p, &start, &length);
+            for (int n = 0; n < 4; n++)
+                if (columns[n] == column) {
+                    fields[n]  = start;
+                    lengths[n] = length;
+                }
+        }
+        const size_t count = b->count;
+        if (!icaodb_build_add(b, fields[0], lengths[0], fields[1], lengths[1], fields[2], lengths[2], fields[3], lengths[3])) {
+            printf("icaodb: out of memory at line %lu\n", lines + 2);
+            return false;
+        }
+        skipped += b->count == count;
+        lines++;
+    }
+    printf("icaodb: read %lu lines, %lu without a valid address or any identity\n", lines, skipped);
+    return true;
+}
+
+static const char *icaodb_json_string(const cJSON *const obj, const char *const *const names) {
+    for (int n = 0; names[n]; n++) {
+        const cJSON *const item = cJSON_GetObjectItem(obj, names[n]);
+        if (cJSON_IsString(item) && item->valuestring)
+            return item->valuestring;
+    }
+    return "";
+}
+
+// the monitor's cache (additionalData keyed by hex, fields as hexdb.io names them) or a plain object keyed by hex
+static bool icaodb_build_json(icaodb_build_t *const b, FILE *const fp) {
+    static const char *const names_registration[] = { "Registration", "registration", NULL };
+    static const char *const names_type[]         = { "ICAOTypeCode", "typecode", "type", NULL };
+    static const char *const names_operator[]     = { "RegisteredOwners", "operator", "owner", NULL };
+    if (fseek(fp, 0, SEEK_END) < 0) {
+        printf("icaodb: source is not seekable\n");
+        return false;
+    }
+    const long size = ftell(fp);
+    rewind(fp);
+    char *const text = (char *)malloc((size_t)size + 1);
+    if (!text || size < 0 || fread(text, 1, (size_t)size, fp) != (size_t)size) {
+        printf("icaodb: source read failed\n");
+        free(text);
+        return false;
+    }
+    text[size]        = '\0';
+    cJSON *const json = cJSON_ParseWithLength(text, (size_t)size);
+    free(text);
+    if (!json) {
+        printf("icaodb: source JSON parse failed\n");
+        return false;
+    }
+    const cJSON *const additional = cJSON_GetObjectItem(json, "additionalData");
+    const cJSON *const map        = cJSON_IsObject(additional) ? additional : json;
+    const cJSON *item;
+    bool ok = true;
+    cJSON_ArrayForEach(item, map) {
+        if (!cJSON_IsObject(item) || !item->string)
+            continue;
+        const char *const registration = icaodb_json_string(item, names_registration), *const type = icaodb_json_string(item, names_type);
+        const char *const operator = icaodb_json_string(item, names_operator);
+        if (!(ok = icaodb_build_add(b, item->string, strlen(item->string), registration, strlen(registration), type, strlen(type), operator,
+                                    strlen(operator)))) {
+            printf("icaodb: out of memory\n");
+            break;
+        }
+    }
+    cJSON_Delete(json);
+    return ok;
+}
+
+static int icaodb_build_entry_compare(const void *const a, const void *const b) {
+    const icaodb_build_entry_t *const ea = (const icaodb_build_entry_t *)a, *const eb = (const icaodb_build_entry_t *)b;
+    if (ea->icao != eb->icao)
+        return ea->icao < eb->icao ? -1 : 1;
+    return ea->order < eb->order ? -1 : 1;
+}
+
+typedef struct {
+    uint32_t bucket, size, first;
+} icaodb_build_bucket_t;
+
+static int icaodb_build_bucket_compare(const void *const a, const void *const b) {
+    const icaodb_build_bucket_t *const ba = (const icaodb_build_bucket_t *)a, *const bb = (const icaodb_build_bucket_t *)b;
+    if (ba->size != bb->size)
+        return ba->size > bb->size ? -1 : 1;
+    return ba->bucket < bb->bucket ? -1 : 1;
+}
+
+static uint32_t icaodb_build_bucket_of(const icaodb_build_entry_t *const e, const uint64_t seed, const uint32_t buckets) {
+    return icaodb_bucket(e->icao, seed, buckets);
+}
+
+// displacements for every bucket and the slot of every entry (in entries[].order), false if some bucket could not be placed
+static bool icaodb_build_hash(icaodb_build_entry_t *const entries, const uint32_t count, const uint64_t seed, const uint32_t buckets,
+                              uint32_t *const displacements, uint32_t *const slots) {
+    icaodb_build_bucket_t *const order = (icaodb_build_bucket_t *)calloc(buckets, sizeof(icaodb_build_bucket_t));
+    uint32_t *const members            = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *const next               = (uint32_t *)malloc(count * sizeof(uint32_t));
+    bool *const taken                  = (bool *)calloc(count, sizeof(bool));
+    bool ok                            = order && members && next && taken;
+    if (ok) {
+        for (uint32_t b = 0; b < buckets; b++) {
+            order[b].bucket = b;
+            order[b].first  = UINT32_MAX;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t b = icaodb_build_bucket_of(&entries[i], seed, buckets);
+            next[i]          = order[b].first;
+            order[b].first   = i;
+            order[b].size++;
+        }
+        qsort(order, buckets, sizeof(icaodb_build_bucket_t), icaodb_build_bucket_compare);
+        for (uint32_t o = 0; o < buckets && ok; o++) {
+            uint32_t size = 0;
+            for (uint32_t i = order[o].first; i != UINT32_MAX; i = next[i])
+                members[size++] = i;
+            displacements[order[o].bucket] = 0;
+            if (size == 0)
+                continue;
+            uint32_t d = 0;
+            for (;; d++) {
+                if (d > ICAODB_DISPLACEMENT_MAX) {
+                    ok = false;
+                    break;
+                }
+                uint32_t placed = 0;
+                for (; placed < size; placed++) {
+                    const uint32_t slot = icaodb_slot(entries[members[placed]].icao, seed, d, count);
+                    if (taken[slot])
+                        break;
+                    taken[slot]            = true;
+                    slots[members[placed]] = slot;
+                }
+                if (placed == size)
+                    break;
+                while (placed-- > 0)
+                    taken[slots[members[placed]]] = false;
+            }
+            displacements[order[o].bucket] = d;
+        }
+    }
+    free(order);
+    free(members);
+    free(next);
+    free(taken);
+    return ok;
+}
+
+// adsb_analyser icaodb-build SOURCE FILE: written to FILE.tmp and renamed over FILE, so an analyser with FILE mapped keeps its copy
+int icaodb_build_main(const int argc, char *const argv[]) {
+    if (argc != 3) {
+        printf("usage: adsb_analyser icaodb-build SOURCE.csv|SOURCE.json FILE\n");
+        return EXIT_FAILURE;
+    }
+    const char *const source = argv[1], *const path = argv[2];
+    FILE *const fp = fopen(source, "rb");
+    if (!fp) {
+        printf("icaodb: source open failed: %s: %s\n", source, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    icaodb_build_t b = { 0 };
+    int c;
+    while ((c = fgetc(fp)) != EOF && (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+        ;
+    const bool json = c == '{';
+    rewind(fp);
+    // offset 0 is the empty string
+    b.strings = (char *)calloc(1, 1);
+    bool ok   = b.strings != NULL;
+    if (ok) {
+        b.strings_size = b.strings_capacity = 1;
+        ok = json ? icaodb_build_json(&b, fp) : icaodb_build_csv(&b, fp);
+    }
+    fclose(fp);
+
+    uint32_t count = 0;
+    if (ok) {
+        qsort(b.entries, b.count, sizeof(icaodb_build_entry_t), icaodb_build_entry_compare);
+        for (size_t i = 0; i < b.count; i++)
+            if (i + 1 == b.count || b.entries[i + 1].icao != b.entries[i].icao) {
+                b.entries[count]       = b.entries[i];
+                b.entries[count].order = count;
+                count++;
+            }
+        if (count == 0) {
+            printf("icaodb: source has no aircraft\n");
+            ok = false;
+        }
+    }
+
+    const uint32_t buckets   = (count + ICAODB_BUCKET_SIZE - 1) / ICAODB_BUCKET_SIZE;
+    uint32_t *displacements  = ok ? (uint32_t *)calloc(MAX(buckets, 1), sizeof(uint32_t)) : NULL;
+    uint32_t *slots          = ok ? (uint32_t *)calloc(MAX(count, 1), sizeof(uint32_t)) : NULL;
+    icaodb_record_t *records = ok ? (icaodb_record_t *)calloc(MAX(count, 1), sizeof(icaodb_record_t)) : NULL;
+    uint64_t seed            = 0;
+    if (ok && (!displacements || !slots || !records)) {
+        printf("icaodb: out of memory\n");
+        ok = false;
+    }
+    if (ok) {
+        const unsigned long long t_start = timing_now_ns();
+        int attempt                      = 0;
+        for (; attempt < ICAODB_SEED_ATTEMPTS; attempt++) {
+            seed = icaodb_hash((uint32_t)attempt, 0x243F6A8885A308D3ULL);
+            if (icaodb_build_hash(b.entries, count, seed, buckets, displacements, slots))
+                break;
+        }
+        if (attempt == ICAODB_SEED_ATTEMPTS) {
+            printf("icaodb: no perfect hash found after %d seeds\n", attempt);
+            ok = false;
+        } else
+            printf("icaodb: hashed %u aircraft into %u buckets in %.1f ms\n", count, buckets, (double)(timing_now_ns() - t_start) / 1e6);
+    }
+    if (ok)
+        for (uint32_t i = 0; i < count; i++)
+            records[slots[i]] = (icaodb_record_t) { .icao = b.entries[i].icao, .registration = b.entries[i].registration, .type = b.entries[i].type,
+                                                     .operator = b.entries[i].operator };
+
+    if (ok) {
+        char path_tmp[MAX_NAME_LENGTH + 8];
+        snprintf(path_tmp, sizeof(path_tmp), "%s.tmp", path);
+        const icaodb_header_t header = { .magic        = ICAODB_MAGIC,
+                                         .version      = ICAODB_VERSION,
+                                         .count        = count,
+                                         .buckets      = buckets,
+                                         .seed         = seed,
+                                         .strings_size = (uint32_t)b.strings_size,
+                                         .built        = (int64_t)time(NULL) };
+        FILE *const out = fopen(path_tmp, "wb");
+        if (!out) {
+            printf("icaodb: open file for write failed: %s: %s\n", path_tmp, strerror(errno));
+            ok = false;
+        } else {
+            ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(displacements, sizeof(uint32_t), buckets, out) == buckets &&
+                 fwrite(records, sizeof(icaodb_record_t), count, out) == count && fwrite(b.strings, 1, b.strings_size, out) == b.strings_size;
+            ok = fclose(out) == 0 && ok;
+            if (!ok || rename(path_tmp, path) < 0) {
+                printf("icaodb: write file failed: %s: %s\n", path, strerror(errno));
+                unlink(path_tmp);
+                ok = false;
+            } else
+                printf("icaodb: wrote %u aircraft, %zu bytes of strings to %s (%.1f MB)\n", count, b.strings_size, path,
+                       (double)(sizeof(header) + buckets * sizeof(uint32_t) + count * sizeof(icaodb_record_t) + b.strings_size) / (1024.0 * 1024.0));
+        }
+    }
+
+    free(displacements);
+    free(slots);
+    free(records);
+    free(b.entries);
+    free(b.strings);
+    free(b.intern);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static cJSON *aircraft_publish_encode_position(const aircraft_posn_t *const pos) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddNumberToObject(obj, "lat", pos->lat);
+    cJSON_AddNumberToObject(obj, "lon", pos->lon);
+    cJSON_AddNumberToObject(obj, "alt", pos->altitude_ft);
+    cJSON_AddNumberToObject(obj, "dist", pos->distance_nm);
+    cJSON_AddNumberToObject(obj, "time", (double)pos->timestamp);
+    return obj;
+}
+
+// named as in dump1090's aircraft.json, and only once seen
+static void aircraft_publish_encode_state(cJSON *const obj, const aircraft_state_t *const state) {
+    if (state->valid & AIRCRAFT_STATE_CALLSIGN) {
+        char callsign[sizeof(state->callsign) + 1];
+        size_t length = sizeof(state->callsign);
+        while (length > 0 && state->callsign[length - 1] == ' ')
+            length--;
+        memcpy(callsign, state->callsign, length);
+        callsign[length] = '\0';
+        if (length > 0)
+            cJSON_AddStringToObject(obj, "flight", callsign);
+    }
+    if (state->valid & AIRCRAFT_STATE_ALTITUDE)
+        cJSON_AddNumberToObject(obj, "alt_baro", state->altitude_ft);
+    if (state->valid & AIRCRAFT_STATE_SPEED)
+        cJSON_AddNumberToObject(obj, "gs", state->ground_speed);
+    if (state->valid & AIRCRAFT_STATE_TRACK)
+        cJSON_AddNumberToObject(obj, "track", state->track / 10.0);
+    if (state->valid & AIRCRAFT_STATE_VERTICAL_RATE)
+        cJSON_AddNumberToObject(obj, "baro_rate", state->vertical_rate);
+    if (state->valid & AIRCRAFT_STATE_SQUAWK) {
+        char squawk[8];
+        snprintf(squawk, sizeof(squawk), "%04o", state->squawk);
+        cJSON_AddStringToObject(obj, "squawk", squawk);
+    }
+    if (state->valid & AIRCRAFT_STATE_ALERT)
+        cJSON_AddBoolToObject(obj, "alert", (state->flags & AIRCRAFT_FLAG_ALERT) != 0);
+    if (state->valid & AIRCRAFT_STATE_EMERGENCY)
+        cJSON_AddBoolToObject(obj, "emergency", (state->flags & AIRCRAFT_FLAG_EMERGENCY) != 0);
+    if (state->valid & AIRCRAFT_STATE_SPI)
+        cJSON_AddBoolToObject(obj, "spi", (state->flags & AIRCRAFT_FLAG_SPI) != 0);
+    if (state->valid & AIRCRAFT_STATE_GROUND)
+        cJSON_AddBoolToObject(obj, "ground", (state->flags & AIRCRAFT_FLAG_GROUND) != 0);
+    if (state->messages > 0) {
+        cJSON_AddNumberToObject(obj, "messages", state->messages);
+        cJSON_AddNumberToObject(obj, "seen", (double)state->seen);
+    }
+}
+
+// named as readsb does (r, t, ownOp) like the state fields, the strings referenced in the database mapping or country table rather
+// than copied
+static void aircraft_publish_encode_identity(cJSON *const obj, const aircraft_data_t *const ac) {
+    const icao_blocks_country_t *const country = icao_blocks_country(ac->origin);
+    if (country)
+        cJSON_AddItemToObject(obj, "country", cJSON_CreateStringReference(country->code));
+    if (ac->origin & ICAO_BLOCKS_MILITARY)
+        cJSON_AddBoolToObject(obj, "military", true);
+    icaodb_entry_t entry;
+    if (!icaodb_lookup(ac->icao, &entry))
+        return;
+    if (entry.registration[0] != '\0')
+        cJSON_AddItemToObject(obj, "r", cJSON_CreateStringReference(entry.registration));
+    if (entry.type[0] != '\0')
+        cJSON_AddItemToObject(obj, "t", cJSON_CreateStringReference(entry.type));
+    if (entry.operator[0] != '\0')
+        cJSON_AddItemToObject(obj, "ownOp", cJSON_CreateStringReference(entry.operator));
+}
+
+// the strings are referenced in the airports mapping
+static cJSON *aircraft_publish_encode_airport(const aircraft_data_t *const ac) {
+    if (ac->airport == AIRPORTS_NONE || !g_airports.header)
+        return NULL;
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    const airports_record_t *const a = &g_airports.records[ac->airport];
+    cJSON_AddItemToObject(obj, "ident", cJSON_CreateStringReference(&g_airports.strings[a->ident]));
+    if (a->iata != 0)
+        cJSON_AddItemToObject(obj, "iata", cJSON_CreateStringReference(&g_airports.strings[a->iata]));
+    if (a->name != 0)
+        cJSON_AddItemToObject(obj, "name", cJSON_CreateStringReference(&g_airports.strings[a->name]));
+    cJSON_AddNumberToObject(obj, "distance_nm", round(ac->airport_distance_nm * 10.0) / 10.0);
+    cJSON_AddNumberToObject(obj, "bearing", round(ac->airport_bearing_deg));
+    return obj;
+}
+
+static cJSON *aircraft_publish_encode_aircraft(const aircraft_data_t *const ac, const time_t now) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+
+    cJSON_AddStringToObject(obj, "icao", ac->icao);
+    aircraft_publish_encode_state(obj, &ac->state);
+    aircraft_publish_encode_identity(obj, ac);
+
+    cJSON *current = aircraft_publish_encode_position(&ac->pos);
+    if (current)
+        cJSON_AddItemToObject(obj, "current", current);
+
+    cJSON *first = aircraft_publish_encode_position(&ac->pos_first);
+    if (first)
+        cJSON_AddItemToObject(obj, "first", first);
+
+    cJSON *bounds = cJSON_CreateObject();
+    if (bounds) {
+        cJSON *min_lat = aircraft_publish_encode_position(&ac->min_lat_pos);
+        if (min_lat)
+            cJSON_AddItemToObject(bounds, "min_lat", min_lat);
+        cJSON *max_lat = aircraft_publish_encode_position(&ac->max_lat_pos);
+        if (max_lat)
+            cJSON_AddItemToObject(bounds, "max_lat", max_lat);
+        cJSON *min_lon = aircraft_publish_encode_position(&ac->min_lon_pos);
+        if (min_lon)
+            cJSON_AddItemToObject(bounds, "min_lon", min_lon);
+        cJSON *max_lon = aircraft_publish_encode_position(&ac->max_lon_pos);
+        if (max_lon)
+            cJSON_AddItemToObject(bounds, "max_lon", max_lon);
+        cJSON *min_alt = aircraft_publish_encode_position(&ac->min_alt_pos);
+        if (min_alt)
+            cJSON_AddItemToObject(bounds, "min_alt", min_alt);
+        cJSON *max_alt = aircraft_publish_encode_position(&ac->max_alt_pos);
+        if (max_alt)
+            cJSON_AddItemToObject(bounds, "max_alt", max_alt);
+        cJSON *min_dist = aircraft_publish_encode_position(&ac->min_dist_pos);
+        if (min_dist)
+            cJSON_AddItemToObject(bounds, "min_dist", min_dist);
+        cJSON *max_dist = aircraft_publish_encode_position(&ac->max_dist_pos);
+        if (max_dist)
+            cJSON_AddItemToObject(bounds, "max_dist", max_dist);
+        cJSON_AddItemToObject(obj, "bounds", bounds);
+    }
+
+    cJSON *airport = aircraft_publish_encode_airport(ac);
+    if (airport)
+        cJSON_AddItemToObject(obj, "airport", airport);
+
+    cJSON *predicted = track_encode((int)(ac - g_aircraft_list.entries), now);
+    if (predicted)
+        cJSON_AddItemToObject(obj, "predicted", predicted);
+
+    return obj;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// subscriptions: a client publishes {"command":"subscribe","id":ID,...} to TOPIC/command with a circle ({"lat","lon","radius"} in
+// nautical miles), a polygon ([[lat,lon],...]) and/or an altitude band ([min,max] feet), and from then on each publish cycle also
+// sends TOPIC/subscription/ID with only the updated aircraft inside it; the cycle's aircraft are put in a grid of SUBSCRIBE_CELL_NM
+// cells on the station's plane, so a subscription only visits the cells its bounds cover, and each matched aircraft is encoded once
+// however many subscriptions match it, so bytes and work scale with interest; a subscription lapses unless renewed (by subscribing
+// again with the same id) within SUBSCRIBE_LEASE, and {"command":"unsubscribe","id":ID} ends it
+
+#define SUBSCRIBE_MAX          32
+#define SUBSCRIBE_ID_MAX       32
+#define SUBSCRIBE_POLYGON_MAX  64
+#define SUBSCRIBE_LEASE        600
+#define SUBSCRIBE_CELL_NM      10.0
+#define SUBSCRIBE_GRID_BUCKETS 4096 // power of two
+
+typedef struct {
+    char id[SUBSCRIBE_ID_MAX];
+    char topic[MAX_NAME_LENGTH + 16 + SUBSCRIBE_ID_MAX];
+    bool circle, bounded;
+    double lat, lon, radius_nm;
+    double polygon_x[SUBSCRIBE_POLYGON_MAX], polygon_y[SUBSCRIBE_POLYGON_MAX];
+    int polygon_count;
+    int altitude_min, altitude_max;
+    double x_min, x_max, y_min, y_max;
+    time_t expires;
+    unsigned long published, aircraft, bytes;
+} subscription_t;
+
+typedef struct {
+    double lat, lon, x, y;
+    int altitude_ft, cell_x, cell_y, next;
+} subscribe_entry_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    subscription_t subscriptions[SUBSCRIBE_MAX];
+    int count;
+    char topic[MAX_NAME_LENGTH + 16];
+    subscribe_entry_t entries[MAX_AIRCRAFT];
+    char *encoded[MAX_AIRCRAFT];
+    int buckets[SUBSCRIBE_GRID_BUCKETS];
+    unsigned long subscribed, unsubscribed, lapsed, cells_visited;
+} subscribe_t;
+
+subscribe_t g_subscribe = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static inline int subscribe_cell(const double v) { return (int)floor(v / SUBSCRIBE_CELL_NM); }
+
+static inline unsigned int subscribe_bucket(const int cell_x, const int cell_y) {
+    return (((unsigned int)cell_x * 73856093U) ^ ((unsigned int)cell_y * 19349663U)) & (SUBSCRIBE_GRID_BUCKETS - 1);
+}
+
+static bool subscribe_inside(const subscription_t *const s, const subscribe_entry_t *const e) {
+    if (e->altitude_ft < s->altitude_min || e->altitude_ft > s->altitude_max)
+        return false;
+    if (s->circle && calculate_distance_nm(s->lat, s->lon, e->lat, e->lon) > s->radius_nm)
+        return false;
+    if (s->polygon_count > 0) {
+        bool inside = false;
+        for (int i = 0, j = s->polygon_count - 1; i < s->polygon_count; j = i++)
+            if ((s->polygon_y[i] > e->y) != (s->polygon_y[j] > e->y) &&
+                e->x < (s->polygon_x[j] - s->polygon_x[i]) * (e->y - s->polygon_y[i]) / (s->polygon_y[j] - s->polygon_y[i]) + s->polygon_x[i])
+                inside = !inside;
+        if (!inside)
+            return false;
+    }
+    return true;
+}
+
+static void subscribe_bound(subscription_t *const s, const double lat, const double lon) {
+    double x, y;
+    airprox_project(lat, lon, &x, &y);
+    s->x_min = MIN(s->x_min, x);
+    s->x_max = MAX(s->x_max, x);
+    s->y_min = MIN(s->y_min, y);
+    s->y_max = MAX(s->y_max, y);
+}
+
+// the circle is tested by great circle distance, so its bounds on the plane are those of the enclosing latitude/longitude box, whose
+// widest points are on its corners or, nearer the equator, on its sides at the centre's latitude
+static void subscribe_bound_circle(subscription_t *const s) {
+    const double dlat = s->radius_nm / 60.0;
+    const double dlon = s->radius_nm / (60.0 * MAX(cos((fabs(s->lat) + dlat) * M_PI / 180.0), 0.01));
+    for (int i = -1; i <= 1; i++)
+        for (int j = -1; j <= 1; j += 2)
+            subscribe_bound(s, s->lat + dlat * i, s->lon + dlon * j);
+}
+
+static subscription_t *subscribe_find(const char *const id) {
+    for (int i = 0; i < g_subscribe.count; i++)
+        if (strcmp(g_subscribe.subscriptions[i].id, id) == 0)
+            return &g_subscribe.subscriptions[i];
+    return NULL;
+}
+
+static void subscribe_remove(subscription_t *const s) { *s = g_subscribe.subscriptions[--g_subscribe.count]; }
+
+static bool subscribe_parse(subscription_t *const s, const cJSON *const command) {
+    const cJSON *const circle = cJSON_GetObjectItem(command, "circle"), *const polygon = cJSON_GetObjectItem(command, "polygon");
+    const cJSON *const altitude = cJSON_GetObjectItem(command, "altitude");
+    s->altitude_min             = INT32_MIN;
+    s->altitude_max             = INT32_MAX;
+    s->x_min = s->y_min = HUGE_VAL;
+    s->x_max = s->y_max = -HUGE_VAL;
+    if (circle) {
+        const cJSON *const lat = cJSON_GetObjectItem(circle, "lat"), *const lon = cJSON_GetObjectItem(circle, "lon");
+        const cJSON *const radius = cJSON_GetObjectItem(circle, "radius");
+        if (!cJSON_IsNumber(lat) || !cJSON_IsNumber(lon) || !cJSON_IsNumber(radius) || radius->valuedouble <= 0.0)
+            return false;
+        s->circle    = true;
+        s->lat       = lat->valuedouble;
+        s->lon       = lon->valuedouble;
+        s->radius_nm = radius->valuedouble;
+    }
+    if (polygon) {
+        const int count = cJSON_GetArraySize(polygon);
+        if (!cJSON_IsArray(polygon) || count < 3 || count > SUBSCRIBE_POLYGON_MAX)
+            return false;
+        for (int i = 0; i < count; i++) {
+            const cJSON *const point = cJSON_GetArrayItem(polygon, i);
+            const cJSON *const lat = cJSON_GetArrayItem(point, 0), *const lon = cJSON_GetArrayItem(point, 1);
+            if (!cJSON_IsNumber(lat) || !cJSON_IsNumber(lon))
+                return false;
+            airprox_project(lat->valuedouble, lon->valuedouble, &s->polygon_x[i], &s->polygon_y[i]);
+            if (!s->circle)
+                subscribe_bound(s, lat->valuedouble, lon->valuedouble);
+        }
+        s->polygon_count = count;
+    }
+    // with a polygon as well, the bounds are those of the circle, which the aircraft has to be inside anyway
+    if (s->circle)
+        subscribe_bound_circle(s);
+    if (altitude) {
+        const cJSON *const minimum = cJSON_GetArrayItem(altitude, 0), *const maximum = cJSON_GetArrayItem(altitude, 1);
+        if (!cJSON_IsNumber(minimum) || !cJSON_IsNumber(maximum) || minimum->valuedouble > maximum->valuedouble)
+            return false;
+        s->altitude_min = (int)minimum->valuedouble;
+        s->altitude_max = (int)maximum->valuedouble;
+    }
+    s->bounded = s->circle || s->polygon_count > 0;
+    return s->bounded || altitude;
+}
+
+// run on the mosquitto network thread
+bool subscribe_command(const cJSON *const command) {
+    const cJSON *const id = cJSON_GetObjectItem(command, "id");
+    if (!cJSON_IsString(id) || id->valuestring[0] == '\0' || strlen(id->valuestring) >= SUBSCRIBE_ID_MAX || strpbrk(id->valuestring, "/+#"))
+        return false;
+    subscription_t subscription = { 0 };
+    if (!subscribe_parse(&subscription, command))
+        return false;
+    snprintf(subscription.id, sizeof(subscription.id), "%s", id->valuestring);
+    snprintf(subscription.topic, sizeof(subscription.topic), "%s/%s", g_subscribe.topic, subscription.id);
+    subscription.expires = time(NULL) + SUBSCRIBE_LEASE;
+    pthread_mutex_lock(&g_subscribe.mutex);
+    subscription_t *s = subscribe_find(subscription.id);
+    if (s) {
+        subscription.published = s->published;
+        subscription.aircraft  = s->aircraft;
+        subscription.bytes     = s->bytes;
+    } else if (g_subscribe.count < SUBSCRIBE_MAX) {
+        s = &g_subscribe.subscriptions[g_subscribe.count++];
+        g_subscribe.subscribed++;
+    }
+    if (s)
+        *s = subscription;
+    pthread_mutex_unlock(&g_subscribe.mutex);
+    if (s)
+        printf("subscribe: %s (circle=%.1fnm, polygon=%d, altitude=%s)\n", subscription.id, subscription.radius_nm, subscription.polygon_count,
+               subscription.altitude_min == INT32_MIN ? "any" : "band");
+    return s != NULL;
+}
+
+bool unsubscribe_command(const cJSON *const command) {
+    const cJSON *const id = cJSON_GetObjectItem(command, "id");
+    if (!cJSON_IsString(id))
+        return false;
+    pthread_mutex_lock(&g_subscribe.mutex);
+    subscription_t *const s = subscribe_find(id->valuestring);
+    if (s) {
+        subscribe_remove(s);
+        g_subscribe.unsubscribed++;
+    }
+    pthread_mutex_unlock(&g_subscribe.mutex);
+    return s != NULL;
+}
+
+// called by the publish cycle with the aircraft it is about to publish, in the same order as their positions were recorded
+static void subscribe_publish(const cJSON *const aircraft_array, const int count, const time_t now) {
+    pthread_mutex_lock(&g_subscribe.mutex);
+    for (int i = g_subscribe.count; i > 0; i--)
+        if (g_subscribe.subscriptions[i - 1].expires < now) {
+            printf("subscribe: %s lapsed\n", g_subscribe.subscriptions[i - 1].id);
+            subscribe_remove(&g_subscribe.subscriptions[i - 1]);
+            g_subscribe.lapsed++;
+        }
+    if (g_subscribe.count == 0 || count == 0) {
+        pthread_mutex_unlock(&g_subscribe.mutex);
+        return;
+    }
+
+    for (int b = 0; b < SUBSCRIBE_GRID_BUCKETS; b++)
+        g_subscribe.buckets[b] = -1;
+    for (int k = 0; k < count; k++) {
+        subscribe_entry_t *const e  = &g_subscribe.entries[k];
+        const unsigned int bucket   = subscribe_bucket(e->cell_x, e->cell_y);
+        e->next                     = g_subscribe.buckets[bucket];
+        g_subscribe.buckets[bucket] = k;
+        g_subscribe.encoded[k]      = NULL;
+    }
+    const cJSON **const items = (const cJSON **)calloc((size_t)count, sizeof(cJSON *));
+    int *const matched        = (int *)malloc((size_t)count * sizeof(int));
+    if (!items || !matched) {
+        free(items);
+        free(matched);
+        pthread_mutex_unlock(&g_subscribe.mutex);
+        return;
+    }
+    int k = 0;
+    for (const cJSON *item = aircraft_array->child; item && k < count; item = item->next)
+        items[k++] = item;
+
+    for (int i = 0; i < g_subscribe.count; i++) {
+        subscription_t *const s = &g_subscribe.subscriptions[i];
+        int matched_count       = 0;
+        const int cx_min = subscribe_cell(s->x_min), cx_max = subscribe_cell(s->x_max), cy_min = subscribe_cell(s->y_min),
+                  cy_max = subscribe_cell(s->y_max);
+        // an unbounded subscription, or one covering more cells than there are aircraft, is cheaper as a scan
+        if (!s->bounded || ((double)(cx_max - cx_min) + 1.0) * ((double)(cy_max - cy_min) + 1.0) > (double)count) {
+            for (int e = 0; e < count; e++)
+                if (subscribe_inside(s, &g_subscribe.entries[e]))
+                    matched[matched_count++] = e;
+        } else
+            for (int cx = cx_min; cx <= cx_max; cx++)
+                for (int cy = cy_min; cy <= cy_max; cy++) {
+                    g_subscribe.cells_visited++;
+                    for (int e = g_subscribe.buckets[subscribe_bucket(cx, cy)]; e >= 0; e = g_subscribe.entries[e].next)
+                        if (g_subscribe.entries[e].cell_x == cx && g_subscribe.entries[e].cell_y == cy && subscribe_inside(s, &g_subscribe.entries[e]))
+                            matched[matched_count++] = e;
+                }
+        if (matched_count == 0)
+            continue;
+
+        char header[MAX_NAME_LENGTH];
+        const int header_length = snprintf(header, sizeof(header), "{\"timestamp\":%ld,\"subscription\":\"%s\",\"aircraft\":[", (long)now, s->id);
+        size_t length           = (size_t)header_length + 3;
+        for (int m = 0; m < matched_count; m++) {
+            const int e = matched[m];
+            if (!g_subscribe.encoded[e])
+                g_subscribe.encoded[e] = cJSON_PrintUnformatted(items[e]);
+            length += (g_subscribe.encoded[e] ? strlen(g_subscribe.encoded[e]) : 0) + 1;
+        }
+        char *const payload = (char *)malloc(length);
+        if (!payload)
+            continue;
+        size_t n = (size_t)header_length;
+        memcpy(payload, header, n);
+        int published = 0;
+        for (int m = 0; m < matched_count; m++) {
+            const char *const encoded = g_subscribe.encoded[matched[m]];
+            if (!encoded)
+                continue;
+            if (published++ > 0)
+                payload[n++] = ',';
+            const size_t encoded_length = strlen(encoded);
+            memcpy(payload + n, encoded, encoded_length);
+            n += encoded_length;
+        }
+        payload[n++] = ']';
+        payload[n++] = '}';
+        if (mqtt_publish_qos(s->topic, (const unsigned char *)payload, n, 0)) {
+            s->published++;
+            s->aircraft += (unsigned long)published;
+            s->bytes += n;
+        }
+        free(payload);
+    }
+    for (int e = 0; e < count; e++)
+        free(g_subscribe.encoded[e]);
+    pthread_mutex_unlock(&g_subscribe.mutex);
+    free(items);
+    free(matched);
+}
+
+// called under the table lock for each aircraft added to the cycle's array, in order
+static inline void subscribe_record(const int k, const aircraft_data_t *const aircraft) {
+    subscribe_entry_t *const e = &g_subscribe.entries[k];
+    e->lat                     = aircraft->pos.lat;
+    e->lon                     = aircraft->pos.lon;
+    airprox_project(aircraft->pos.lat, aircraft->pos.lon, &e->x, &e->y);
+    e->altitude_ft = aircraft->pos.altitude_ft;
+    e->cell_x      = subscribe_cell(e->x);
+    e->cell_y      = subscribe_cell(e->y);
+}
+
+bool subscribe_begin(void) {
+    snprintf(g_subscribe.topic, sizeof(g_subscribe.topic), "%s/subscription", g_config.mqtt_topic);
+    return mqtt_command_register("subscribe", subscribe_command) && mqtt_command_register("unsubscribe", unsubscribe_command);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void aircraft_publish_mqtt(void) {
+    const time_t now                          = time(NULL);
+    unsigned long published_cnt               = 0;
+    unsigned char published_set[MAX_AIRCRAFT] = { 0 };
+
+    timing_sample_always();
+    const unsigned long long t_encode = timing_start();
+
+    cJSON *root = cJSON_CreateObject();
+    if (!root)
+        return;
+
+    cJSON_AddNumberToObject(root, "timestamp", (double)now);
+    cJSON_AddNumberToObject(root, "position_lat", g_config.position_lat);
+    cJSON_AddNumberToObject(root, "position_lon", g_config.position_lon);
+
+    cJSON *aircraft_array = cJSON_CreateArray();
+    if (!aircraft_array) {
+        cJSON_Delete(root);
+        return;
+    }
+
+    pthread_mutex_lock(&g_subscribe.mutex);
+    const bool subscribed = g_subscribe.count > 0;
+    pthread_mutex_unlock(&g_subscribe.mutex);
+    int subscribe_count = 0;
+
+    PROBE1(publish_start, g_aircraft_list.count);
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    for (int i = 0; i < MAX_AIRCRAFT; i++) {
+        if (g_aircraft_list.entries[i].icao[0] != '\0')
+            if (g_aircraft_list.entries[i].published < g_aircraft_list.entries[i].pos.timestamp && g_aircraft_list.entries[i].bounds_initialised) {
+                cJSON *ac_json = aircraft_publish_encode_aircraft(&g_aircraft_list.entries[i], now);
+                if (ac_json) {
+                    cJSON_AddItemToArray(aircraft_array, ac_json);
+                    published_cnt++;
+                    published_set[i]++;
+                    if (subscribed)
+                        subscribe_record(subscribe_count++, &g_aircraft_list.entries[i]);
+                }
+            }
+    }
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+
+    if (subscribed)
+        subscribe_publish(aircraft_array, subscribe_count, now);
+
+    cJSON_AddItemToObject(root, "aircraft", aircraft_array);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    timing_stop(TIMING_STAGE_ENCODE, t_encode);
+
+    if (json_str && published_cnt > 0) {
+        const unsigned long long t_publish = timing_start();
+        const size_t json_len              = strlen(json_str);
+        const bool published               = sink_publish(g_config.mqtt_topic, (const unsigned char *)json_str, json_len);
+        timing_stop(TIMING_STAGE_PUBLISH, t_publish);
+        PROBE2(publish_end, json_len, published);
+        if (published) {
+            const unsigned long long now_ns = t_publish ? timing_now_ns() : 0;
+            g_aircraft_stat.published_mqtt += published_cnt;
             g_aircraft_global.published_mqtt += published_cnt;
             for (int i = 0; i < MAX_AIRCRAFT; i++)
-                if (published_set[i])
+                if (published_set[i]) {
                     g_aircraft_list.entries[i].published = now;
+                    if (now_ns && g_aircraft_list.entries[i].updated_ns && now_ns > g_aircraft_list.entries[i].updated_ns)
+                        timing_record(TIMING_STAGE_AGE, now_ns - g_aircraft_list.entries[i].updated_ns);
+                }
+        }
+    }
+
+    if (json_str)
+        free(json_str);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// queries: a client publishes {"id":ID,"query":NAME,...} to TOPIC/query and gets {"id":ID,"query":NAME,"status":"ok"|"error",...}
+// back on TOPIC/query/reply (or the request's "reply" topic), answered from memory rather than the next periodic publish:
+//   aircraft  "icao"                                            the aircraft
+//   radius    ["lat","lon"] (the station), "radius" (nm)        aircraft within it
+//   box       "lat_min","lat_max","lon_min","lon_max"           aircraft within it (lon_min > lon_max crosses the antimeridian)
+//   top       ["count"] (10), ["nearest"] (false)               the farthest (or nearest) aircraft
+//   voxels    "column":{"lat","lon"} or "region":{"lat_min","lat_max","lon_min","lon_max",["alt_min","alt_max"]}
+//             the counts by altitude layer up the column, or the sum over the region
+//   coverage  "bearing", ["alt_min","alt_max"]                  the farthest occupied voxel along the bearing, by altitude layer
+//   stats     ["from","to"] (the last hour)                     counter deltas and aircraft between the nearest minute samples
+// the mosquitto thread only queues the request; a worker answers it, the aircraft from a copy of the table taken at most once per
+// QUERY_SNAPSHOT_AGE (so queries never hold the table lock while they run) and the voxels read in place as the status does, and
+// accounts the latency from receipt to reply by query
+
+#define QUERY_QUEUE_MAX      64 // power of two
+#define QUERY_PAYLOAD_MAX    4096
+#define QUERY_RESULTS_MAX    500
+#define QUERY_TOP_DEFAULT    10
+#define QUERY_SNAPSHOT_AGE   1
+#define QUERY_HISTORY_PERIOD 60
+#define QUERY_HISTORY_MAX    (24 * 60)
+#define QUERY_STATS_DEFAULT  (60 * 60)
+#define QUERY_REGION_SAMPLES 4096
+
+typedef enum {
+    QUERY_AIRCRAFT = 0,
+    QUERY_RADIUS,
+    QUERY_BOX,
+    QUERY_TOP,
+    QUERY_VOXELS,
+    QUERY_COVERAGE,
+    QUERY_STATS,
+    QUERY_TYPES
+} query_type_t;
+
+static const char *const query_type_names[QUERY_TYPES] = { "aircraft", "radius", "box", "top", "voxels", "coverage", "stats" };
+
+typedef struct {
+    char *payload;
+    unsigned long long received_ns;
+} query_request_t;
+
+typedef struct {
+    unsigned long count, errors;
+    unsigned long long total_ns, max_ns;
+} query_latency_t;
+
+typedef struct {
+    time_t time;
+    unsigned long messages, positions, valid, invalid, published, seen;
+    int aircraft;
+} query_sample_t;
+
+typedef struct {
+    bool running, started;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    query_request_t queue[QUERY_QUEUE_MAX];
+    unsigned int head, count;
+    char topic[MAX_NAME_LENGTH + 16];
+    aircraft_data_t *snapshot;
+    int *order;
+    int snapshot_count;
+    time_t snapshot_time;
+    query_sample_t history[QUERY_HISTORY_MAX];
+    unsigned int history_head, history_count;
+    query_latency_t latency[QUERY_TYPES];
+    unsigned long requests, dropped, invalid, snapshots;
+} query_t;
+
+query_t g_query = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+// run on the mosquitto network thread
+void query_receive(const char *const payload, const size_t length) {
+    const unsigned long long received_ns = timing_now_ns();
+    if (length > QUERY_PAYLOAD_MAX) {
+        pthread_mutex_lock(&g_query.mutex);
+        g_query.invalid++;
+        pthread_mutex_unlock(&g_query.mutex);
+        return;
+    }
+    char *const copy = (char *)malloc(length + 1);
+    if (!copy)
+        return;
+    memcpy(copy, payload, length);
+    copy[length] = '\0';
+    pthread_mutex_lock(&g_query.mutex);
+    g_query.requests++;
+    if (g_query.count == QUERY_QUEUE_MAX) {
+        g_query.dropped++;
+        pthread_mutex_unlock(&g_query.mutex);
+        free(copy);
+        return;
+    }
+    query_request_t *const r = &g_query.queue[(g_query.head + g_query.count++) & (QUERY_QUEUE_MAX - 1)];
+    r->payload               = copy;
+    r->received_ns           = received_ns;
+    pthread_cond_signal(&g_query.cond);
+    pthread_mutex_unlock(&g_query.mutex);
+}
+
+static void query_snapshot(const time_t now) {
+    if (g_query.snapshot_count > 0 && difftime(now, g_query.snapshot_time) < QUERY_SNAPSHOT_AGE)
+        return;
+    int n = 0;
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    for (int i = 0; i < MAX_AIRCRAFT; i++)
+        if (g_aircraft_list.entries[i].icao[0] != '\0')
+            g_query.snapshot[n++] = g_aircraft_list.entries[i];
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    g_query.snapshot_count = n;
+    g_query.snapshot_time  = now;
+    g_query.snapshots++;
+}
+
+static void query_sample(query_sample_t *const sample, const time_t now) {
+    sample->time      = now;
+    sample->messages  = g_aircraft_global.messages_total;
+    sample->positions = g_aircraft_global.messages_position;
+    sample->valid     = g_aircraft_global.position_valid;
+    sample->invalid   = g_aircraft_global.position_invalid;
+    sample->published = g_aircraft_global.published_mqtt;
+    sample->seen      = g_aircraft_global.aircraft_seen;
+    sample->aircraft  = g_aircraft_list.count;
+}
+
+static void query_history(const time_t now) {
+    if (g_query.history_count > 0 &&
+        difftime(now, g_query.history[(g_query.history_head + g_query.history_count - 1) % QUERY_HISTORY_MAX].time) < QUERY_HISTORY_PERIOD)
+        return;
+    if (g_query.history_count == QUERY_HISTORY_MAX)
+        g_query.history_head = (g_query.history_head + 1) % QUERY_HISTORY_MAX;
+    else
+        g_query.history_count++;
+    query_sample(&g_query.history[(g_query.history_head + g_query.history_count - 1) % QUERY_HISTORY_MAX], now);
+}
+
+static cJSON *query_encode_aircraft(const aircraft_data_t *const ac) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddStringToObject(obj, "icao", ac->icao);
+    aircraft_publish_encode_state(obj, &ac->state);
+    aircraft_publish_encode_identity(obj, ac);
+    if (ac->bounds_initialised) {
+        cJSON *current = aircraft_publish_encode_position(&ac->pos);
+        if (current) {
+            cJSON_AddNumberToObject(current, "bearing", round(calculate_bearing_deg(g_config.position_lat, g_config.position_lon, ac->pos.lat, ac->pos.lon)));
+            cJSON_AddItemToObject(obj, "current", current);
+        }
+    }
+    return obj;
+}
+
+static bool query_number(const cJSON *const obj, const char *const name, double *const value) {
+    const cJSON *const item = cJSON_GetObjectItem(obj, name);
+    if (!cJSON_IsNumber(item))
+        return false;
+    *value = item->valuedouble;
+    return true;
+}
+
+static cJSON *query_encode_list(const int *const order, const int count, const int limit) {
+    cJSON *obj   = cJSON_CreateObject();
+    cJSON *array = cJSON_CreateArray();
+    if (!obj || !array) {
+        cJSON_Delete(obj);
+        cJSON_Delete(array);
+        return NULL;
+    }
+    for (int k = 0; k < count && k < limit; k++) {
+        cJSON *ac = query_encode_aircraft(&g_query.snapshot[order[k]]);
+        if (ac)
+            cJSON_AddItemToArray(array, ac);
+    }
+    cJSON_AddNumberToObject(obj, "count", count);
+    if (count > limit)
+        cJSON_AddBoolToObject(obj, "truncated", true);
+    cJSON_AddItemToObject(obj, "aircraft", array);
+    return obj;
+}
+
+static cJSON *query_aircraft(const cJSON *const request, const char **const error) {
+    const cJSON *const icao = cJSON_GetObjectItem(request, "icao");
+    if (!cJSON_IsString(icao)) {
+        *error = "no 'icao'";
+        return NULL;
+    }
+    char upper[sizeof(g_query.snapshot[0].icao)];
+    size_t length = 0;
+    for (const char *p = icao->valuestring; *p && length < sizeof(upper) - 1; p++)
+        upper[length++] = (*p >= 'a' && *p <= 'z') ? (char)(*p - 'a' + 'A') : *p;
+    upper[length] = '\0';
+    for (int k = 0; k < g_query.snapshot_count; k++)
+        if (strcmp(g_query.snapshot[k].icao, upper) == 0)
+            return query_encode_aircraft(&g_query.snapshot[k]);
+    *error = "not found";
+    return NULL;
+}
+
+static cJSON *query_radius(const cJSON *const request, const char **const error) {
+    double lat = g_config.position_lat, lon = g_config.position_lon, radius_nm;
+    query_number(request, "lat", &lat);
+    query_number(request, "lon", &lon);
+    if (!query_number(request, "radius", &radius_nm) || radius_nm <= 0.0 || !coordinates_are_valid(lat, lon)) {
+        *error = "invalid 'lat', 'lon' or 'radius'";
+        return NULL;
+    }
+    int count = 0;
+    for (int k = 0; k < g_query.snapshot_count; k++) {
+        const aircraft_data_t *const ac = &g_query.snapshot[k];
+        if (ac->bounds_initialised && calculate_distance_nm(lat, lon, ac->pos.lat, ac->pos.lon) <= radius_nm)
+            g_query.order[count++] = k;
+    }
+    return query_encode_list(g_query.order, count, QUERY_RESULTS_MAX);
+}
+
+static cJSON *query_box(const cJSON *const request, const char **const error) {
+    double lat_min, lat_max, lon_min, lon_max;
+    if (!query_number(request, "lat_min", &lat_min) || !query_number(request, "lat_max", &lat_max) || !query_number(request, "lon_min", &lon_min) ||
+        !query_number(request, "lon_max", &lon_max) || lat_min > lat_max) {
+        *error = "invalid 'lat_min', 'lat_max', 'lon_min' or 'lon_max'";
+        return NULL;
+    }
+    const bool wraps = lon_min > lon_max;
+    int count        = 0;
+    for (int k = 0; k < g_query.snapshot_count; k++) {
+        const aircraft_posn_t *const pos = &g_query.snapshot[k].pos;
+        if (g_query.snapshot[k].bounds_initialised && pos->lat >= lat_min && pos->lat <= lat_max &&
+            (wraps ? (pos->lon >= lon_min || pos->lon <= lon_max) : (pos->lon >= lon_min && pos->lon <= lon_max)))
+            g_query.order[count++] = k;
+    }
+    return query_encode_list(g_query.order, count, QUERY_RESULTS_MAX);
+}
+
+static int query_compare_farthest(const void *const a, const void *const b) {
+    const double da = g_query.snapshot[*(const int *)a].pos.distance_nm, db = g_query.snapshot[*(const int *)b].pos.distance_nm;
+    return (da < db) ? 1 : ((da > db) ? -1 : 0);
+}
+
+static int query_compare_nearest(const void *const a, const void *const b) { return query_compare_farthest(b, a); }
+
+static cJSON *query_top(const cJSON *const request, const char **const error) {
+    double limit = QUERY_TOP_DEFAULT;
+    query_number(request, "count", &limit);
+    if (limit < 1.0 || limit > QUERY_RESULTS_MAX) {
+        *error = "invalid 'count'";
+        return NULL;
+    }
+    int count = 0;
+    for (int k = 0; k < g_query.snapshot_count; k++)
+        if (g_query.snapshot[k].bounds_initialised)
+            g_query.order[count++] = k;
+    qsort(g_query.order, (size_t)count, sizeof(int), cJSON_IsTrue(cJSON_GetObjectItem(request, "nearest")) ? query_compare_nearest : query_compare_farthest);
+    return query_encode_list(g_query.order, count, (int)limit);
+}
+
+static void query_region_extend(const double lat, const double lon, int *const x_min, int *const x_max, int *const y_min, int *const y_max) {
+    int x, y, z;
+    voxel_coords_to_indices(lat, lon, 0.0, &x, &y, &z);
+    *x_min = MIN(*x_min, x);
+    *x_max = MAX(*x_max, x);
+    *y_min = MIN(*y_min, y);
+    *y_max = MAX(*y_max, y);
+}
+
+// the voxels under a lat/lon box: in the map's projection about the station an edge of the box bows, so its extremes can fall between
+// the corners (where it crosses the station's meridian or parallel, or the equator), and the edges are sampled at half a voxel apart
+// as well as at those crossings
+static void query_region_bounds(const double lat_min, const double lat_max, const double lon_min, const double lon_max, int *const x_min,
+                                int *const x_max, int *const y_min, int *const y_max) {
+    *x_min = g_voxel_map.size_x;
+    *y_min = g_voxel_map.size_y;
+    *x_max = *y_max = -1;
+    const double span_nm = MAX(fabs(lat_max - lat_min), fabs(lon_max - lon_min)) * 60.0;
+    const int samples    = constrain_int((int)ceil(2.0 * span_nm / g_voxel_map.horizontal_size_nm), 1, QUERY_REGION_SAMPLES);
+    for (int s = 0; s <= samples; s++) {
+        const double f = (double)s / samples, lat = lat_min + f * (lat_max - lat_min), lon = lon_min + f * (lon_max - lon_min);
+        query_region_extend(lat, lon_min, x_min, x_max, y_min, y_max);
+        query_region_extend(lat, lon_max, x_min, x_max, y_min, y_max);
+        query_region_extend(lat_min, lon, x_min, x_max, y_min, y_max);
+        query_region_extend(lat_max, lon, x_min, x_max, y_min, y_max);
+    }
+    if ((lon_min - g_voxel_map.origin_lon) * (lon_max - g_voxel_map.origin_lon) < 0.0) {
+        query_region_extend(lat_min, g_voxel_map.origin_lon, x_min, x_max, y_min, y_max);
+        query_region_extend(lat_max, g_voxel_map.origin_lon, x_min, x_max, y_min, y_max);
+    }
+    if ((lat_min - g_voxel_map.origin_lat) * (lat_max - g_voxel_map.origin_lat) < 0.0) {
+        query_region_extend(g_voxel_map.origin_lat, lon_min, x_min, x_max, y_min, y_max);
+        query_region_extend(g_voxel_map.origin_lat, lon_max, x_min, x_max, y_min, y_max);
+    }
+}
+
+static cJSON *query_voxels(const cJSON *const request, const char **const error) {
+    if (!g_voxel_map.data) {
+        *error = "voxel map unavailable";
+        return NULL;
+    }
+    const cJSON *const column = cJSON_GetObjectItem(request, "column"), *const region = cJSON_GetObjectItem(request, "region");
+    double lat, lon, lat_min, lat_max, lon_min, lon_max, alt_min = 0.0, alt_max = g_voxel_map.altitude_max_ft;
+    cJSON *obj = NULL;
+    if (column && query_number(column, "lat", &lat) && query_number(column, "lon", &lon) && coordinates_are_valid(lat, lon)) {
+        int x, y, z;
+        voxel_coords_to_indices(lat, lon, 0.0, &x, &y, &z);
+        cJSON *counts = cJSON_CreateArray();
+        if (!counts || !(obj = cJSON_CreateObject())) {
+            cJSON_Delete(counts);
+            return NULL;
+        }
+        unsigned long total = 0;
+        for (z = 0; z < g_voxel_map.size_z; z++) {
+            const voxel_data_t count = g_voxel_map.data[voxel_indices_to_index(x, y, z)];
+            cJSON_AddItemToArray(counts, cJSON_CreateNumber(count));
+            total += count;
+        }
+        cJSON_AddNumberToObject(obj, "vertical_size_ft", g_voxel_map.vertical_size_ft);
+        cJSON_AddNumberToObject(obj, "total", (double)total);
+        cJSON_AddItemToObject(obj, "counts", counts);
+    } else if (region && query_number(region, "lat_min", &lat_min) && query_number(region, "lat_max", &lat_max) &&
+               query_number(region, "lon_min", &lon_min) && query_number(region, "lon_max", &lon_max)) {
+        query_number(region, "alt_min", &alt_min);
+        query_number(region, "alt_max", &alt_max);
+        int x_min, x_max, y_min, y_max;
+        query_region_bounds(lat_min, lat_max, lon_min, lon_max, &x_min, &x_max, &y_min, &y_max);
+        const int z_min     = constrain_int((int)(alt_min / g_voxel_map.vertical_size_ft), 0, g_voxel_map.size_z - 1);
+        const int z_max     = constrain_int((int)(alt_max / g_voxel_map.vertical_size_ft), 0, g_voxel_map.size_z - 1);
+        unsigned long total = 0, occupied = 0, voxels = 0;
+        for (int z = z_min; z <= z_max; z++)
+            for (int j = y_min; j <= y_max; j++)
+                for (int i = x_min; i <= x_max; i++) {
+                    const voxel_data_t count = g_voxel_map.data[voxel_indices_to_index(i, j, z)];
+                    total += count;
+                    occupied += count > 0;
+                    voxels++;
+                }
+        if (!(obj = cJSON_CreateObject()))
+            return NULL;
+        cJSON_AddNumberToObject(obj, "voxels", (double)voxels);
+        cJSON_AddNumberToObject(obj, "occupied", (double)occupied);
+        cJSON_AddNumberToObject(obj, "total", (double)total);
+    } else
+        *error = "invalid 'column' or 'region'";
+    return obj;
+}
+
+static cJSON *query_coverage(const cJSON *const request, const char **const error) {
+    double bearing, alt_min = 0.0, alt_max = g_voxel_map.altitude_max_ft;
+    if (!g_voxel_map.data) {
+        *error = "voxel map unavailable";
+        return NULL;
+    }
+    if (!query_number(request, "bearing", &bearing) || bearing < 0.0 || bearing >= 360.0) {
+        *error = "invalid 'bearing'";
+        return NULL;
+    }
+    query_number(request, "alt_min", &alt_min);
+    query_number(request, "alt_max", &alt_max);
+    const int z_min        = constrain_int((int)(alt_min / g_voxel_map.vertical_size_ft), 0, g_voxel_map.size_z - 1);
+    const int z_max        = constrain_int((int)(alt_max / g_voxel_map.vertical_size_ft), 0, g_voxel_map.size_z - 1);
+    double *const envelope = (double *)malloc((size_t)g_voxel_map.size_z * sizeof(double));
+    cJSON *obj = cJSON_CreateObject(), *layers = cJSON_CreateArray();
+    if (!envelope || !obj || !layers) {
+        free(envelope);
+        cJSON_Delete(obj);
+        cJSON_Delete(layers);
+        return NULL;
+    }
+    const double distance_max_nm = voxel_coverage(bearing, z_min, z_max, envelope);
+    for (int z = z_min; z <= z_max; z++)
+        if (envelope[z] > 0.0) {
+            cJSON *layer = cJSON_CreateObject();
+            if (layer) {
+                cJSON_AddNumberToObject(layer, "alt", z * g_voxel_map.vertical_size_ft);
+                cJSON_AddNumberToObject(layer, "dist", envelope[z]);
+                cJSON_AddItemToArray(layers, layer);
+            }
+        }
+    free(envelope);
+    cJSON_AddNumberToObject(obj, "bearing", bearing);
+    cJSON_AddNumberToObject(obj, "dist", distance_max_nm);
+    cJSON_AddItemToObject(obj, "layers", layers);
+    return obj;
+}
+
+static cJSON *query_stats(const cJSON *const request, const time_t now, const char **const error) {
+    double from = (double)(now - QUERY_STATS_DEFAULT), to = (double)now;
+    query_number(request, "from", &from);
+    query_number(request, "to", &to);
+    query_sample_t current;
+    query_sample(&current, now);
+    const query_sample_t *first = NULL, *last = NULL;
+    int aircraft_min = INT32_MAX, aircraft_max = 0, samples = 0;
+    double aircraft_sum = 0.0;
+    for (unsigned int k = 0; k <= g_query.history_count; k++) {
+        const query_sample_t *const sample = k < g_query.history_count ? &g_query.history[(g_query.history_head + k) % QUERY_HISTORY_MAX] : &current;
+        if ((double)sample->time < from || (double)sample->time > to)
+            continue;
+        if (!first)
+            first = sample;
+        last         = sample;
+        aircraft_min = MIN(aircraft_min, sample->aircraft);
+        aircraft_max = MAX(aircraft_max, sample->aircraft);
+        aircraft_sum += sample->aircraft;
+        samples++;
+    }
+    if (samples < 2) {
+        *error = "no history in range";
+        return NULL;
+    }
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    const double seconds = (double)(last->time - first->time);
+    cJSON_AddNumberToObject(obj, "from", (double)first->time);
+    cJSON_AddNumberToObject(obj, "to", (double)last->time);
+    cJSON_AddNumberToObject(obj, "messages", (double)(last->messages - first->messages));
+    cJSON_AddNumberToObject(obj, "messages_per_second", seconds > 0.0 ? round((double)(last->messages - first->messages) / seconds * 10.0) / 10.0 : 0.0);
+    cJSON_AddNumberToObject(obj, "positions", (double)(last->positions - first->positions));
+    cJSON_AddNumberToObject(obj, "position_valid", (double)(last->valid - first->valid));
+    cJSON_AddNumberToObject(obj, "position_invalid", (double)(last->invalid - first->invalid));
+    cJSON_AddNumberToObject(obj, "published_mqtt", (double)(last->published - first->published));
+    cJSON_AddNumberToObject(obj, "aircraft_seen", (double)(last->seen - first->seen));
+    cJSON *aircraft = cJSON_CreateObject();
+    if (aircraft) {
+        cJSON_AddNumberToObject(aircraft, "min", aircraft_min);
+        cJSON_AddNumberToObject(aircraft, "max", aircraft_max);
+        cJSON_AddNumberToObject(aircraft, "mean", round(aircraft_sum / samples * 10.0) / 10.0);
+        cJSON_AddItemToObject(obj, "aircraft", aircraft);
+    }
+    return obj;
+}
+
+static void query_process(const query_request_t *const r) {
+    const time_t now        = time(NULL);
+    cJSON *const request    = cJSON_Parse(r->payload);
+    const cJSON *const name = cJSON_GetObjectItem(request, "query"), *const reply = cJSON_GetObjectItem(request, "reply");
+    int type = 0;
+    if (cJSON_IsString(name))
+        while (type < QUERY_TYPES && strcmp(query_type_names[type], name->valuestring) != 0)
+            type++;
+    if (!request || !cJSON_IsString(name) || type == QUERY_TYPES || (reply && (!cJSON_IsString(reply) || strpbrk(reply->valuestring, "+#")))) {
+        pthread_mutex_lock(&g_query.mutex);
+        g_query.invalid++;
+        pthread_mutex_unlock(&g_query.mutex);
+        cJSON_Delete(request);
+        return;
+    }
+
+    const char *error = NULL;
+    cJSON *result     = NULL;
+    if (type <= QUERY_TOP)
+        query_snapshot(now);
+    switch ((query_type_t)type) {
+    case QUERY_AIRCRAFT:
+        result = query_aircraft(request, &error);
+        break;
+    case QUERY_RADIUS:
+        result = query_radius(request, &error);
+        break;
+    case QUERY_BOX:
+        result = query_box(request, &error);
+        break;
+    case QUERY_TOP:
+        result = query_top(request, &error);
+        break;
+    case QUERY_VOXELS:
+        result = query_voxels(request, &error);
+        break;
+    case QUERY_COVERAGE:
+        result = query_coverage(request, &error);
+        break;
+    case QUERY_STATS:
+        result = query_stats(request, now, &error);
+        break;
+    case QUERY_TYPES:
+    default:
+        break;
+    }
+
+    cJSON *response = cJSON_CreateObject();
+    if (response) {
+        const cJSON *const id = cJSON_GetObjectItem(request, "id");
+        if (cJSON_IsString(id))
+            cJSON_AddStringToObject(response, "id", id->valuestring);
+        else if (cJSON_IsNumber(id))
+            cJSON_AddNumberToObject(response, "id", id->valuedouble);
+        cJSON_AddStringToObject(response, "query", query_type_names[type]);
+        cJSON_AddStringToObject(response, "status", result ? "ok" : "error");
+        if (!result)
+            cJSON_AddStringToObject(response, "error", error ? error : "failed");
+        if (type <= QUERY_TOP)
+            cJSON_AddNumberToObject(response, "snapshot", (double)g_query.snapshot_time);
+    }
+    query_latency_t *const latency = &g_query.latency[type];
+    const unsigned long long ns    = timing_now_ns() - r->received_ns;
+    latency->count++;
+    latency->errors += result ? 0 : 1;
+    latency->total_ns += ns;
+    latency->max_ns = MAX(latency->max_ns, ns);
+    if (response) {
+        cJSON_AddNumberToObject(response, "latency_us", (double)(ns / 1000));
+        if (result)
+            cJSON_AddItemToObject(response, "result", result);
+        char *const json_str = cJSON_PrintUnformatted(response);
+        if (json_str) {
+            mqtt_publish_qos(reply ? reply->valuestring : g_query.topic, (const unsigned char *)json_str, strlen(json_str), 0);
+            free(json_str);
+        }
+        cJSON_Delete(response);
+    } else
+        cJSON_Delete(result);
+    cJSON_Delete(request);
+}
+
+static void *query_thread(void *arg __attribute__((unused))) {
+    pthread_mutex_lock(&g_query.mutex);
+    while (g_query.running) {
+        if (g_query.count == 0) {
+            struct timespec deadline = { .tv_sec = time(NULL) + QUERY_HISTORY_PERIOD, .tv_nsec = 0 };
+            pthread_cond_timedwait(&g_query.cond, &g_query.mutex, &deadline);
+        }
+        query_request_t r = { .payload = NULL };
+        if (g_query.count > 0) {
+            r            = g_query.queue[g_query.head];
+            g_query.head = (g_query.head + 1) & (QUERY_QUEUE_MAX - 1);
+            g_query.count--;
+        }
+        pthread_mutex_unlock(&g_query.mutex);
+        query_history(time(NULL));
+        if (r.payload) {
+            query_process(&r);
+            free(r.payload);
+        }
+        pthread_mutex_lock(&g_query.mutex);
+    }
+    pthread_mutex_unlock(&g_query.mutex);
+    return NULL;
+}
+
+void query_end(void) {
+    if (g_query.started) {
+        pthread_mutex_lock(&g_query.mutex);
+        g_query.running = false;
+        pthread_cond_signal(&g_query.cond);
+        pthread_mutex_unlock(&g_query.mutex);
+        pthread_join(g_query.thread, NULL);
+        g_query.started = false;
+    }
+    for (; g_query.count > 0; g_query.count--, g_query.head = (g_query.head + 1) & (QUERY_QUEUE_MAX - 1))
+        free(g_query.queue[g_query.head].payload);
+    free(g_query.snapshot);
+    free(g_query.order);
+    g_query.snapshot = NULL;
+    g_query.order    = NULL;
+}
+
+bool query_begin(void) {
+    snprintf(g_query.topic, sizeof(g_query.topic), "%s/query/reply", g_config.mqtt_topic);
+    g_query.snapshot = (aircraft_data_t *)malloc(MAX_AIRCRAFT * sizeof(aircraft_data_t));
+    g_query.order    = (int *)malloc(MAX_AIRCRAFT * sizeof(int));
+    if (!g_query.snapshot || !g_query.order) {
+        printf("query: failed to allocate snapshot\n");
+        query_end();
+        return false;
+    }
+    query_history(time(NULL));
+    g_query.running = true;
+    if (pthread_create(&g_query.thread, NULL, query_thread, NULL) != 0) {
+        perror("pthread_create query thread");
+        g_query.running = false;
+        query_end();
+        return false;
+    }
+    g_query.started = true;
+    mqtt_query_register(query_receive);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// http: the current aircraft, their tracks and the coverage served over HTTP/1.1 for dashboards to poll directly:
+//   /aircraft.json      every aircraft with a position, as published to TOPIC
+//   /aircraft.geojson   a Point feature per aircraft
+//   /tracks.geojson     a LineString feature per aircraft, through its first, current and (if tracked) predicted positions
+//   /coverage.geojson   a Polygon feature through the farthest occupied voxel every HTTP_COVERAGE_STEP degrees
+// each resource is a snapshot, encoded when it is requested after its data has changed (the aircraft at most every refresh seconds,
+// the coverage at most every HTTP_COVERAGE_PERIOD) and compressed then, once, with gzip and brotli; every response shares the snapshot
+// by reference until it is replaced, and its ETag is a hash of the content, so a poll that already has it costs a 304 and no body;
+// one thread polls the listening socket and every (keep-alive) connection, and never blocks on a slow one
+
+#define HTTP_CLIENTS_MAX     64
+#define HTTP_REQUEST_MAX     8192
+#define HTTP_HEADER_MAX      512
+#define HTTP_IDLE_TIMEOUT    30
+#define HTTP_REFRESH_DEFAULT 5
+#define HTTP_COVERAGE_STEP   5
+#define HTTP_COVERAGE_PERIOD 60
+#define HTTP_GZIP_LEVEL      6
+#define HTTP_BROTLI_QUALITY  5
+
+typedef struct {
+    unsigned int refs;
+    size_t length;
+    unsigned char data[];
+} http_buffer_t;
+
+typedef enum {
+    HTTP_ENCODING_IDENTITY = 0,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_BROTLI,
+    HTTP_ENCODINGS
+} http_encoding_t;
+
+static const char *const http_encoding_names[HTTP_ENCODINGS] = { "identity", "gzip", "br" };
+
+typedef cJSON *(*http_build_fn)(const time_t now);
+
+typedef struct {
+    const char *path, *content_type;
+    http_build_fn build;
+    bool aircraft;
+    unsigned long version;
+    time_t built;
+    char etag[24];
+    http_buffer_t *encoded[HTTP_ENCODINGS];
+    unsigned long builds, requests;
+} http_resource_t;
+
+typedef struct {
+    int fd;
+    char address[INET_ADDRSTRLEN + 8];
+    char request[HTTP_REQUEST_MAX];
+    size_t request_length;
+    char header[HTTP_HEADER_MAX];
+    size_t header_length, sent;
+    http_buffer_t *body;
+    bool keep_alive;
+    time_t active;
+} http_client_t;
+
+typedef struct {
+    bool enabled, running, started;
+    unsigned short port;
+    struct in_addr bind_address;
+    time_t refresh;
+    int listen_fd;
+    pthread_t thread;
+    http_client_t clients[HTTP_CLIENTS_MAX];
+    int clients_count;
+    unsigned long connected, requests, not_modified, errors, bytes, bytes_saved;
+} http_t;
+
+http_t g_http = { .listen_fd = -1, .refresh = HTTP_REFRESH_DEFAULT };
+
+static http_buffer_t *http_buffer_create(const size_t length) {
+    http_buffer_t *const b = (http_buffer_t *)malloc(sizeof(http_buffer_t) + length);
+    if (b) {
+        b->refs   = 1;
+        b->length = length;
+    }
+    return b;
+}
+
+static void http_buffer_release(http_buffer_t *const b) {
+    if (b && --b->refs == 0)
+        free(b);
+}
+
+static http_buffer_t *http_compress_gzip(const http_buffer_t *const plain) {
+    z_stream z = { .zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL };
+    if (deflateInit2(&z, HTTP_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    http_buffer_t *b = http_buffer_create(deflateBound(&z, (uLong)plain->length));
+    if (b) {
+        z.next_in   = (Bytef *)(uintptr_t)plain->data;
+        z.avail_in  = (uInt)plain->length;
+        z.next_out  = b->data;
+        z.avail_out = (uInt)b->length;
+        if (deflate(&z, Z_FINISH) == Z_STREAM_END)
+            b->length = z.total_out;
+        else {
+            http_buffer_release(b);
+            b = NULL;
+        }
+    }
+    deflateEnd(&z);
+    return b;
+}
+
+static http_buffer_t *http_compress_brotli(const http_buffer_t *const plain) {
+    http_buffer_t *b = http_buffer_create(BrotliEncoderMaxCompressedSize(plain->length));
+    if (b && (b->length == 0 || !BrotliEncoderCompress(HTTP_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, plain->length, plain->data,
+                                                       &b->length, b->data))) {
+        http_buffer_release(b);
+        b = NULL;
+    }
+    return b;
+}
+
+static cJSON *http_build_aircraft(const time_t now) {
+    cJSON *root = cJSON_CreateObject(), *aircraft_array = cJSON_CreateArray();
+    if (!root || !aircraft_array) {
+        cJSON_Delete(root);
+        cJSON_Delete(aircraft_array);
+        return NULL;
+    }
+    cJSON_AddNumberToObject(root, "timestamp", (double)now);
+    cJSON_AddNumberToObject(root, "position_lat", g_config.position_lat);
+    cJSON_AddNumberToObject(root, "position_lon", g_config.position_lon);
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    for (int i = 0; i < MAX_AIRCRAFT; i++)
+        if (g_aircraft_list.entries[i].icao[0] != '\0' && g_aircraft_list.entries[i].bounds_initialised) {
+            cJSON *ac_json = aircraft_publish_encode_aircraft(&g_aircraft_list.entries[i], now);
+            if (ac_json)
+                cJSON_AddItemToArray(aircraft_array, ac_json);
+        }
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    cJSON_AddItemToObject(root, "aircraft", aircraft_array);
+    return root;
+}
+
+static cJSON *http_geojson_feature(cJSON *const features, const char *const type, cJSON *const coordinates) {
+    cJSON *feature = cJSON_CreateObject(), *geometry = cJSON_CreateObject(), *properties = cJSON_CreateObject();
+    if (!feature || !geometry || !properties || !coordinates) {
+        cJSON_Delete(feature);
+        cJSON_Delete(geometry);
+        cJSON_Delete(properties);
+        cJSON_Delete(coordinates);
+        return NULL;
+    }
+    cJSON_AddStringToObject(feature, "type", "Feature");
+    cJSON_AddStringToObject(geometry, "type", type);
+    cJSON_AddItemToObject(geometry, "coordinates", coordinates);
+    cJSON_AddItemToObject(feature, "geometry", geometry);
+    cJSON_AddItemToObject(feature, "properties", properties);
+    cJSON_AddItemToArray(features, feature);
+    return properties;
+}
+
+// GeoJSON positions are longitude first, with the altitude in metres
+static cJSON *http_geojson_position(const double lat, const double lon, const double altitude_ft) {
+    cJSON *position = cJSON_CreateArray();
+    if (position) {
+        cJSON_AddItemToArray(position, cJSON_CreateNumber(lon));
+        cJSON_AddItemToArray(position, cJSON_CreateNumber(lat));
+        if (!isnan(altitude_ft))
+            cJSON_AddItemToArray(position, cJSON_CreateNumber(round(altitude_ft * 0.3048)));
+    }
+    return position;
+}
+
+static cJSON *http_geojson_collection(const time_t now, cJSON **const features) {
+    cJSON *root = cJSON_CreateObject();
+    *features   = cJSON_CreateArray();
+    if (!root || !*features) {
+        cJSON_Delete(root);
+        cJSON_Delete(*features);
+        return NULL;
+    }
+    cJSON_AddStringToObject(root, "type", "FeatureCollection");
+    cJSON_AddNumberToObject(root, "timestamp", (double)now);
+    cJSON_AddItemToObject(root, "features", *features);
+    return root;
+}
+
+static cJSON *http_build_aircraft_geojson(const time_t now) {
+    cJSON *features, *root = http_geojson_collection(now, &features);
+    if (!root)
+        return NULL;
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    for (int i = 0; i < MAX_AIRCRAFT; i++) {
+        const aircraft_data_t *const ac = &g_aircraft_list.entries[i];
+        if (ac->icao[0] == '\0' || !ac->bounds_initialised)
+            continue;
+        cJSON *properties = http_geojson_feature(features, "Point", http_geojson_position(ac->pos.lat, ac->pos.lon, ac->pos.altitude_ft));
+        if (properties) {
+            cJSON_AddStringToObject(properties, "icao", ac->icao);
+            aircraft_publish_encode_state(properties, &ac->state);
+            cJSON_AddNumberToObject(properties, "alt", ac->pos.altitude_ft);
+            cJSON_AddNumberToObject(properties, "dist", round(ac->pos.distance_nm * 10.0) / 10.0);
+            cJSON_AddNumberToObject(properties, "time", (double)ac->pos.timestamp);
+        }
+    }
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    return root;
+}
+
+static cJSON *http_build_tracks_geojson(const time_t now) {
+    cJSON *features, *root = http_geojson_collection(now, &features);
+    if (!root)
+        return NULL;
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    for (int i = 0; i < MAX_AIRCRAFT; i++) {
+        const aircraft_data_t *const ac = &g_aircraft_list.entries[i];
+        if (ac->icao[0] == '\0' || !ac->bounds_initialised)
+            continue;
+        cJSON *line = cJSON_CreateArray();
+        if (!line)
+            continue;
+        cJSON_AddItemToArray(line, http_geojson_position(ac->pos_first.lat, ac->pos_first.lon, ac->pos_first.altitude_ft));
+        cJSON_AddItemToArray(line, http_geojson_position(ac->pos.lat, ac->pos.lon, ac->pos.altitude_ft));
+        cJSON *predicted       = track_encode(i, now);
+        const cJSON *const lat = cJSON_GetObjectItem(predicted, "lat"), *const lon = cJSON_GetObjectItem(predicted, "lon");
+        const cJSON *const alt = cJSON_GetObjectItem(predicted, "alt");
+        if (cJSON_IsNumber(lat) && cJSON_IsNumber(lon) && cJSON_IsNumber(alt))
+            cJSON_AddItemToArray(line, http_geojson_position(lat->valuedouble, lon->valuedouble, alt->valuedouble));
+        cJSON *properties = http_geojson_feature(features, "LineString", line);
+        if (properties) {
+            cJSON_AddStringToObject(properties, "icao", ac->icao);
+            aircraft_publish_encode_state(properties, &ac->state);
+            cJSON_AddNumberToObject(properties, "first", (double)ac->pos_first.timestamp);
+            cJSON_AddNumberToObject(properties, "time", (double)ac->pos.timestamp);
+            cJSON_AddBoolToObject(properties, "predicted", predicted != NULL);
+        }
+        cJSON_Delete(predicted);
+    }
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    return root;
+}
+
+static cJSON *http_build_coverage_geojson(const time_t now) {
+    cJSON *features, *root = http_geojson_collection(now, &features);
+    if (!root)
+        return NULL;
+    if (!g_voxel_map.data)
+        return root;
+    cJSON *rings = cJSON_CreateArray(), *ring = cJSON_CreateArray();
+    if (!rings || !ring) {
+        cJSON_Delete(rings);
+        cJSON_Delete(ring);
+        return root;
+    }
+    cJSON_AddItemToArray(rings, ring);
+    double distance_max_nm = 0.0, first_lat = 0.0, first_lon = 0.0;
+    for (int bearing = 0; bearing < 360; bearing += HTTP_COVERAGE_STEP) {
+        const double distance_nm = voxel_coverage(bearing, 0, g_voxel_map.size_z - 1, NULL);
+        const double b_rad = bearing * M_PI / 180.0, d_rad = distance_nm / 3440.065, lat1_rad = g_config.position_lat * M_PI / 180.0;
+        const double lat_rad = asin(sin(lat1_rad) * cos(d_rad) + cos(lat1_rad) * sin(d_rad) * cos(b_rad));
+        const double lon_rad = g_config.position_lon * M_PI / 180.0 + atan2(sin(b_rad) * sin(d_rad) * cos(lat1_rad), cos(d_rad) - sin(lat1_rad) * sin(lat_rad));
+        const double lat = lat_rad * 180.0 / M_PI, lon = fmod(lon_rad * 180.0 / M_PI + 540.0, 360.0) - 180.0;
+        if (bearing == 0) {
+            first_lat = lat;
+            first_lon = lon;
+        }
+        cJSON_AddItemToArray(ring, http_geojson_position(lat, lon, NAN));
+        distance_max_nm = MAX(distance_max_nm, distance_nm);
+    }
+    cJSON_AddItemToArray(ring, http_geojson_position(first_lat, first_lon, NAN));
+    cJSON *properties = http_geojson_feature(features, "Polygon", rings);
+    if (properties) {
+        cJSON_AddNumberToObject(properties, "step", HTTP_COVERAGE_STEP);
+        cJSON_AddNumberToObject(properties, "dist", distance_max_nm);
+    }
+    return root;
+}
+
+static http_resource_t http_resources[] = {
+    { .path = "/aircraft.json", .content_type = "application/json", .build = http_build_aircraft, .aircraft = true },
+    { .path = "/aircraft.geojson", .content_type = "application/geo+json", .build = http_build_aircraft_geojson, .aircraft = true },
+    { .path = "/tracks.geojson", .content_type = "application/geo+json", .build = http_build_tracks_geojson, .aircraft = true },
+    { .path = "/coverage.geojson", .content_type = "application/geo+json", .build = http_build_coverage_geojson, .aircraft = false },
+};
+#define HTTP_RESOURCES_COUNT (sizeof(http_resources) / sizeof(http_resources[0]))
+
+// the aircraft change with every accepted position, the coverage is only rebuilt every period and kept if it comes out the same
+static void http_resource_refresh(http_resource_t *const r, const time_t now) {
+    const unsigned long version = r->aircraft ? g_aircraft_global.position_valid : r->version + 1;
+    if (r->encoded[HTTP_ENCODING_IDENTITY] &&
+        (r->version == version || difftime(now, r->built) < (double)(r->aircraft ? g_http.refresh : HTTP_COVERAGE_PERIOD)))
+        return;
+    r->version  = version;
+    r->built    = now;
+    cJSON *root = r->build(now);
+    if (!root)
+        return;
+    char *const json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (!json_str)
+        return;
+    const size_t length = strlen(json_str);
+    uint64_t hash       = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (unsigned char)json_str[i]) * 0x100000001b3ULL;
+    char etag[sizeof(r->etag)];
+    snprintf(etag, sizeof(etag), "\"%016" PRIx64 "\"", hash);
+    http_buffer_t *const plain = strcmp(etag, r->etag) != 0 ? http_buffer_create(length) : NULL;
+    if (plain) {
+        memcpy(plain->data, json_str, length);
+        for (int e = 0; e < HTTP_ENCODINGS; e++)
+            http_buffer_release(r->encoded[e]);
+        r->encoded[HTTP_ENCODING_IDENTITY] = plain;
+        r->encoded[HTTP_ENCODING_GZIP]     = http_compress_gzip(plain);
+        r->encoded[HTTP_ENCODING_BROTLI]   = http_compress_brotli(plain);
+        memcpy(r->etag, etag, sizeof(r->etag));
+        r->builds++;
+    }
+    free(json_str);
+}
+
+static bool http_equal(const char *const a, const char *const b, const size_t length) {
+    for (size_t i = 0; i < length; i++)
+        if (a[i] == '\0' || (a[i] | 0x20) != (b[i] | 0x20))
+            return false;
+    return true;
+}
+
+// header names and the connection tokens are case insensitive
+static bool http_header_value(const char *const headers, const char *const name, char *const value, const size_t size) {
+    const size_t name_length = strlen(name);
+    for (const char *line = headers; line && *line != '\0';) {
+        const char *const end = strstr(line, "\r\n");
+        if (http_equal(line, name, name_length) && line[name_length] == ':') {
+            const char *start = line + name_length + 1;
+            while (*start == ' ' || *start == '\t')
+                start++;
+            snprintf(value, size, "%.*s", (int)(end ? (size_t)(end - start) : strlen(start)), start);
+            return true;
+        }
+        line = end ? end + 2 : NULL;
+    }
+    return false;
+}
+
+static void http_respond_status(http_client_t *const c, const int status, const char *const reason) {
+    c->header_length = (size_t)snprintf(c->header, sizeof(c->header),
+                                        "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n%s\n", status, reason,
+                                        strlen(reason) + 1, c->keep_alive ? "keep-alive" : "close", reason);
+    g_http.errors++;
+}
+
+static void http_handle(http_client_t *const c, char *const request, const time_t now) {
+    char *const line_end = strstr(request, "\r\n");
+    const char *headers  = "";
+    char method[8] = "", path[256] = "", version[16] = "";
+    if (line_end) {
+        *line_end = '\0';
+        headers   = line_end + 2;
+    }
+    g_http.requests++;
+    if (sscanf(request, "%7s %255s %15s", method, path, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0) {
+        c->keep_alive = false;
+        http_respond_status(c, 400, "Bad Request");
+        return;
+    }
+    char value[HTTP_HEADER_MAX];
+    const bool connection = http_header_value(headers, "Connection", value, sizeof(value));
+    if (strcmp(version, "HTTP/1.0") == 0)
+        c->keep_alive = connection && http_equal(value, "keep-alive", sizeof("keep-alive") - 1);
+    else
+        c->keep_alive = !(connection && http_equal(value, "close", sizeof("close") - 1));
+    char *const query = strchr(path, '?');
+    if (query)
+        *query = '\0';
+    const bool head = strcmp(method, "HEAD") == 0;
+    if (!head && strcmp(method, "GET") != 0) {
+        http_respond_status(c, 405, "Method Not Allowed");
+        return;
+    }
+    http_resource_t *r = NULL;
+    for (size_t i = 0; i < HTTP_RESOURCES_COUNT && !r; i++)
+        if (strcmp(http_resources[i].path, path) == 0)
+            r = &http_resources[i];
+    if (!r) {
+        http_respond_status(c, 404, "Not Found");
+        return;
+    }
+    http_resource_refresh(r, now);
+    if (!r->encoded[HTTP_ENCODING_IDENTITY]) {
+        http_respond_status(c, 503, "Service Unavailable");
+        return;
+    }
+    r->requests++;
+    const char *const keep_alive = c->keep_alive ? "keep-alive" : "close";
+    if (http_header_value(headers, "If-None-Match", value, sizeof(value)) && (strstr(value, r->etag) || strcmp(value, "*") == 0)) {
+        c->header_length = (size_t)snprintf(c->header, sizeof(c->header),
+                                            "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nVary: Accept-Encoding\r\nConnection: %s\r\n\r\n", r->etag, keep_alive);
+        g_http.not_modified++;
+        return;
+    }
+    http_encoding_t encoding = HTTP_ENCODING_IDENTITY;
+    if (http_header_value(headers, "Accept-Encoding", value, sizeof(value))) {
+        if (r->encoded[HTTP_ENCODING_BROTLI] && strstr(value, "br"))
+            encoding = HTTP_ENCODING_BROTLI;
+        else if (r->encoded[HTTP_ENCODING_GZIP] && strstr(value, "gzip"))
+            encoding = HTTP_ENCODING_GZIP;
+    }
+    http_buffer_t *const body = r->encoded[encoding];
+    char content_encoding[48] = "";
+    if (encoding != HTTP_ENCODING_IDENTITY)
+        snprintf(content_encoding, sizeof(content_encoding), "Content-Encoding: %s\r\n", http_encoding_names[encoding]);
+    c->header_length = (size_t)snprintf(c->header, sizeof(c->header),
+                                        "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%sETag: %s\r\nCache-Control: no-cache\r\n"
+                                        "Vary: Accept-Encoding\r\nAccess-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n",
+                                        r->content_type, body->length, content_encoding, r->etag, keep_alive);
+    if (!head) {
+        c->body = body;
+        body->refs++;
+        g_http.bytes_saved += (unsigned long)(r->encoded[HTTP_ENCODING_IDENTITY]->length - body->length);
+    }
+}
+
+static bool http_pending(const http_client_t *const c) { return c->sent < c->header_length + (c->body ? c->body->length : 0); }
+
+// takes the first complete request off the buffer, unless the response to the one before is still being sent
+static void http_next(http_client_t *const c, const time_t now) {
+    if (http_pending(c))
+        return;
+    char *const end = strstr(c->request, "\r\n\r\n");
+    if (!end)
+        return;
+    char request[HTTP_REQUEST_MAX];
+    const size_t used = (size_t)(end + 4 - c->request);
+    memcpy(request, c->request, used - 2);
+    request[used - 2] = '\0';
+    memmove(c->request, c->request + used, c->request_length - used + 1);
+    c->request_length -= used;
+    http_handle(c, request, now);
+}
+
+// sends what it can without blocking, moving on to the next pipelined request as each response completes; false once the
+// connection is to be closed
+static bool http_send(http_client_t *const c, const time_t now) {
+    http_next(c, now);
+    while (http_pending(c)) {
+        struct iovec iov[2];
+        int count = 0;
+        if (c->sent < c->header_length)
+            iov[count++] = (struct iovec) { .iov_base = c->header + c->sent, .iov_len = c->header_length - c->sent };
+        if (c->body) {
+            const size_t offset = c->sent > c->header_length ? c->sent - c->header_length : 0;
+            iov[count++]        = (struct iovec) { .iov_base = c->body->data + offset, .iov_len = c->body->length - offset };
+        }
+        const ssize_t sent = writev(c->fd, iov, count);
+        if (sent < 0)
+            return errno == EAGAIN;
+        c->sent += (size_t)sent;
+        g_http.bytes += (unsigned long)sent;
+        if (!http_pending(c)) {
+            http_buffer_release(c->body);
+            c->body          = NULL;
+            c->sent          = 0;
+            c->header_length = 0;
+            if (!c->keep_alive)
+                return false;
+            http_next(c, now);
+        }
+    }
+    return true;
+}
+
+static void http_disconnect(const int index) {
+    http_client_t *const c = &g_http.clients[index];
+    close(c->fd);
+    http_buffer_release(c->body);
+    g_http.clients[index] = g_http.clients[--g_http.clients_count];
+}
+
+static void http_accept(const time_t now) {
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    int fd;
+    while ((fd = accept(g_http.listen_fd, (struct sockaddr *)&address, &address_length)) >= 0) {
+        if (g_http.clients_count == HTTP_CLIENTS_MAX || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+            close(fd);
+            continue;
+        }
+        http_client_t *const c = &g_http.clients[g_http.clients_count++];
+        c->fd                  = fd;
+        c->request[0]          = '\0';
+        c->request_length      = 0;
+        c->header_length       = 0;
+        c->sent                = 0;
+        c->body                = NULL;
+        c->keep_alive          = true;
+        c->active              = now;
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        snprintf(c->address, sizeof(c->address), "%s:%u", host, ntohs(address.sin_port));
+        g_http.connected++;
+        address_length = sizeof(address);
+    }
+}
+
+static void *http_thread(void *arg __attribute__((unused))) {
+    struct pollfd fds[1 + HTTP_CLIENTS_MAX];
+    while (g_http.running) {
+        fds[0]          = (struct pollfd) { .fd = g_http.listen_fd, .events = POLLIN };
+        const int count = g_http.clients_count;
+        for (int i = 0; i < count; i++) {
+            const http_client_t *const c = &g_http.clients[i];
+            const int events             = (c->request_length < HTTP_REQUEST_MAX - 1 ? POLLIN : 0) | (http_pending(c) ? POLLOUT : 0);
+            fds[1 + i]                   = (struct pollfd) { .fd = c->fd, .events = (short)events };
+        }
+        if (poll(fds, (nfds_t)(1 + count), 1000) < 0 && errno != EINTR) {
+            printf("http: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        const time_t now = time(NULL);
+        for (int i = count; i > 0; i--) {
+            http_client_t *const c = &g_http.clients[i - 1];
+            const short revents    = fds[i].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                const ssize_t received = recv(c->fd, c->request + c->request_length, HTTP_REQUEST_MAX - 1 - c->request_length, 0);
+                if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    http_disconnect(i - 1);
+                    continue;
+                }
+                if (received > 0) {
+                    c->request_length += (size_t)received;
+                    c->request[c->request_length] = '\0';
+                    c->active                     = now;
+                    if (c->request_length == HTTP_REQUEST_MAX - 1 && !strstr(c->request, "\r\n\r\n") && !http_pending(c)) {
+                        c->keep_alive = false;
+                        http_respond_status(c, 431, "Request Header Fields Too Large");
+                    }
+                }
+            }
+            if (!http_send(c, now) || (!http_pending(c) && difftime(now, c->active) > HTTP_IDLE_TIMEOUT))
+                http_disconnect(i - 1);
+        }
+        if (fds[0].revents & POLLIN)
+            http_accept(now);
+    }
+    return NULL;
+}
+
+// [IPV4:]PORT[,refresh=SECONDS]
+static bool http_parse(const char *const spec) {
+    char buffer[MAX_NAME_LENGTH];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    char *option = strchr(buffer, ',');
+    if (option)
+        *option++ = '\0';
+    char *const colon          = strrchr(buffer, ':');
+    const int port             = atoi(colon ? colon + 1 : buffer);
+    g_http.bind_address.s_addr = htonl(INADDR_ANY);
+    if (port <= 0 || port > 65535)
+        return false;
+    g_http.port = (unsigned short)port;
+    if (colon) {
+        *colon = '\0';
+        if (inet_pton(AF_INET, buffer, &g_http.bind_address) != 1)
+            return false;
+    }
+    while (option) {
+        char *const next = strchr(option, ',');
+        if (next)
+            *next = '\0';
+        if (strncmp(option, "refresh=", 8) == 0 && atoi(option + 8) > 0)
+            g_http.refresh = atoi(option + 8);
+        else
+            return false;
+        option = next ? next + 1 : NULL;
+    }
+    return true;
+}
+
+void http_end(void) {
+    if (g_http.started) {
+        g_http.running = false;
+        pthread_join(g_http.thread, NULL);
+        g_http.started = false;
+    }
+    while (g_http.clients_count > 0)
+        http_disconnect(g_http.clients_count - 1);
+    for (size_t i = 0; i < HTTP_RESOURCES_COUNT; i++)
+        for (int e = 0; e < HTTP_ENCODINGS; e++) {
+            http_buffer_release(http_resources[i].encoded[e]);
+            http_resources[i].encoded[e] = NULL;
+        }
+    if (g_http.listen_fd >= 0) {
+        close(g_http.listen_fd);
+        g_http.listen_fd = -1;
+    }
+    g_http.enabled = false;
+}
+
+bool http_begin(void) {
+    if (g_config.http[0] == '\0')
+        return true;
+    if (!http_parse(g_config.http)) {
+        printf("http: invalid: %s\n", g_config.http);
+        return false;
+    }
+    const int reuse            = 1;
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(g_http.port), .sin_addr = g_http.bind_address };
+    if ((g_http.listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || setsockopt(g_http.listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        fcntl(g_http.listen_fd, F_SETFL, O_NONBLOCK) < 0 || bind(g_http.listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(g_http.listen_fd, HTTP_CLIENTS_MAX) < 0) {
+        printf("http: listen failed on port %u: %s\n", g_http.port, strerror(errno));
+        http_end();
+        return false;
+    }
+    g_http.enabled = true;
+    g_http.running = true;
+    if (pthread_create(&g_http.thread, NULL, http_thread, NULL) != 0) {
+        perror("pthread_create http thread");
+        g_http.running = false;
+        http_end();
+        return false;
+    }
+    g_http.started = true;
+    printf("http: listening on port %u (refresh=%lds)\n", g_http.port, (long)g_http.refresh);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// SBS (BaseStation) fields: 0 "MSG", 1 transmission type, 4 icao, 10 callsign, 11 altitude, 12 ground speed, 13 track, 14 lat, 15 lon,
+// 16 vertical rate, 17 squawk, 18 alert, 19 emergency, 20 spi, 21 on ground; each transmission type fills only the fields it carries
+// and leaves the rest empty, so one pass splits the line and every non-empty field is decoded whatever the type
+#define SBS_FIELDS_MAX 22
+#define SBS_FIELDS_MIN 5
+
+static bool sbs_field_int(const char *p, const char *const end, int *const value) {
+    const bool negative = p < end && *p == '-';
+    if (negative || (p < end && *p == '+'))
+        p++;
+    if (p == end)
+        return false;
+    int v = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9' || v > (INT32_MAX - 9) / 10)
+            return false;
+        v = v * 10 + (*p - '0');
+    }
+    *value = negative ? -v : v;
+    return true;
+}
+
+// "-1" (or any non zero) is set, "0" is clear
+static inline bool sbs_field_flag(const char *const p, const char *const end) { return !(end - p == 1 && *p == '0'); }
+
+bool adsb_parse_sbs(const char *const line, adsb_message_t *const msg) {
+    const char *fields[SBS_FIELDS_MAX], *fields_end[SBS_FIELDS_MAX];
+    unsigned int i = 0;
+
+    const char *p = line, *s = p;
+    while (*p && i < SBS_FIELDS_MAX) {
+        if (*p == ',' || *p == '\n' || *p == '\r') {
+            fields[i]     = s;
+            fields_end[i] = p;
+            i++;
+            s = p + 1;
+        }
+        p++;
+    }
+    if (i < SBS_FIELDS_MAX && *p == '\0') {
+        fields[i]     = s;
+        fields_end[i] = p;
+        i++;
+    }
+
+    if (i < SBS_FIELDS_MIN)
+        return false;
+    if (fields_end[0] - fields[0] != 3 || strncmp(fields[0], "MSG", 3) != 0)
+        return false;
+    if (fields_end[1] - fields[1] != 1 || *fields[1] < '1' || *fields[1] > '8')
+        return false;
+    const size_t icao_len = MIN((size_t)(fields_end[4] - fields[4]), sizeof(msg->icao) - 1);
+    if (icao_len == 0)
+        return false;
+
+    msg->type = *fields[1] - '0';
+    memcpy(msg->icao, fields[4], icao_len);
+    msg->icao[icao_len] = '\0';
+    msg->present        = 0;
+    msg->flags          = 0;
+    msg->altitude_ft    = 0;
+
+#define SBS_FIELD_PRESENT(n) ((n) < i && fields[n] < fields_end[n])
+    if (SBS_FIELD_PRESENT(10)) {
+        const size_t callsign_len = MIN((size_t)(fields_end[10] - fields[10]), sizeof(msg->callsign));
+        memset(msg->callsign, ' ', sizeof(msg->callsign));
+        memcpy(msg->callsign, fields[10], callsign_len);
+        msg->present |= AIRCRAFT_STATE_CALLSIGN;
+    }
+    if (SBS_FIELD_PRESENT(11) && sbs_field_int(fields[11], fields_end[11], &msg->altitude_ft))
+        msg->present |= AIRCRAFT_STATE_ALTITUDE;
+    if (SBS_FIELD_PRESENT(12)) {
+        msg->ground_speed = strtod(fields[12], NULL);
+        msg->present |= AIRCRAFT_STATE_SPEED;
+    }
+    if (SBS_FIELD_PRESENT(13)) {
+        msg->track = strtod(fields[13], NULL);
+        msg->present |= AIRCRAFT_STATE_TRACK;
+    }
+    if (SBS_FIELD_PRESENT(14) && SBS_FIELD_PRESENT(15)) {
+        msg->lat = strtod(fields[14], NULL);
+        msg->lon = strtod(fields[15], NULL);
+        msg->present |= AIRCRAFT_STATE_POSITION;
+    }
+    if (SBS_FIELD_PRESENT(16) && sbs_field_int(fields[16], fields_end[16], &msg->vertical_rate))
+        msg->present |= AIRCRAFT_STATE_VERTICAL_RATE;
+    if (SBS_FIELD_PRESENT(17) && fields_end[17] - fields[17] == 4) {
+        unsigned int squawk = 0;
+        const char *q       = fields[17];
+        while (q < fields_end[17] && *q >= '0' && *q <= '7')
+            squawk = (squawk << 3) | (unsigned int)(*q++ - '0');
+        if (q == fields_end[17]) {
+            msg->squawk = squawk;
+            msg->present |= AIRCRAFT_STATE_SQUAWK;
+        }
+    }
+    static const struct {
+        unsigned int field, present;
+        unsigned char flag;
+    } sbs_flags[] = {
+        { 18, AIRCRAFT_STATE_ALERT, AIRCRAFT_FLAG_ALERT },
+        { 19, AIRCRAFT_STATE_EMERGENCY, AIRCRAFT_FLAG_EMERGENCY },
+        { 20, AIRCRAFT_STATE_SPI, AIRCRAFT_FLAG_SPI },
+        { 21, AIRCRAFT_STATE_GROUND, AIRCRAFT_FLAG_GROUND },
+    };
+    for (size_t f = 0; f < sizeof(sbs_flags) / sizeof(sbs_flags[0]); f++)
+        if (SBS_FIELD_PRESENT(sbs_flags[f].field)) {
+            msg->present |= sbs_flags[f].present;
+            if (sbs_field_flag(fields[sbs_flags[f].field], fields_end[sbs_flags[f].field]))
+                msg->flags |= sbs_flags[f].flag;
+        }
+#undef SBS_FIELD_PRESENT
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// AVR (raw Mode S as hex, as dump1090 serves on port 30002): "*<hex>;" or "@<12 digit timestamp><hex>;" per line, 14 or 28 digits;
+// only DF17/18 extended squitter is decoded: its parity is a plain CRC-24 (no address overlay), so a frame is checked by one table
+// driven pass, and with --adsb-correct a single bit error is found from the syndrome; airborne positions are resolved by local CPR
+// decoding against --position, which is unambiguous while aircraft are within half a CPR zone of it (about 180nm)
+
+#define AVR_POLYNOMIAL       0xFFF409
+#define AVR_BYTES_LONG       14
+#define AVR_BYTES_SHORT      7
+#define AVR_BITS_LONG        (AVR_BYTES_LONG * 8)
+#define AVR_BITS_DF          5
+#define AVR_TIMESTAMP_DIGITS 12
+#define AVR_SYNDROME_BUCKETS 256
+#define AVR_CPR_SCALE        131072.0
+#define AVR_CPR_NZ           15
+
+typedef struct {
+    uint32_t crc[256];
+    uint32_t syndromes[AVR_SYNDROME_BUCKETS];
+    unsigned char syndrome_bits[AVR_SYNDROME_BUCKETS];
+    unsigned long frames, valid, corrected, crc_failed, malformed, unsupported;
+} avr_state_t;
+avr_state_t g_avr = { 0 };
+
+static uint32_t avr_crc(const unsigned char *const data, const size_t length) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+        crc = ((crc << 8) ^ g_avr.crc[((crc >> 16) ^ data[i]) & 0xFF]) & 0xFFFFFF;
+    return crc;
+}
+
+// zero for an intact long frame, otherwise depends only on which bits are in error
+static uint32_t avr_syndrome(const unsigned char *const frame) {
+    const uint32_t parity = ((uint32_t)frame[AVR_BYTES_LONG - 3] << 16) | ((uint32_t)frame[AVR_BYTES_LONG - 2] << 8) | frame[AVR_BYTES_LONG - 1];
+    return avr_crc(frame, AVR_BYTES_LONG - 3) ^ parity;
+}
+
+static inline unsigned int avr_syndrome_bucket(const uint32_t syndrome) { return (syndrome ^ (syndrome >> 8) ^ (syndrome >> 16)) & (AVR_SYNDROME_BUCKETS - 1); }
+
+// the bit in error for a single bit syndrome, -1 if the syndrome is not one (more bits are wrong)
+static int avr_syndrome_bit(const uint32_t syndrome) {
+    for (unsigned int b = avr_syndrome_bucket(syndrome); g_avr.syndromes[b] != 0; b = (b + 1) & (AVR_SYNDROME_BUCKETS - 1))
+        if (g_avr.syndromes[b] == syndrome)
+            return g_avr.syndrome_bits[b];
+    return -1;
+}
+
+// the value of a hex digit, 16 if it is not one
+static inline unsigned int avr_nibble(const char c) {
+    const unsigned int u = (unsigned char)c, l = u | 0x20;
+    if (u >= '0' && u <= '9')
+        return u - '0';
+    if (l >= 'a' && l <= 'f')
+        return l - 'a' + 10;
+    return 16;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// eight digits to four bytes in one 64 bit word: every byte is range checked against 0-9, A-F and a-f with adds that cannot carry
+// into the next byte (the word is checked to be ascii first), digits become (c & 0xF) + 9 for letters, and pairs are folded together
+static bool avr_hex8(const char *const hex, unsigned char *const out) {
+    const uint64_t ones = 0x0101010101010101ULL, high = 0x8080808080808080ULL;
+    uint64_t w;
+    memcpy(&w, hex, sizeof(w));
+    if (w & high)
+        return false;
+#define AVR_HEX_RANGE(lo, hi) ((w + ones * (uint64_t)(0x80 - (lo))) & ~(w + ones * (uint64_t)(0x7F - (hi))) & high)
+    if ((AVR_HEX_RANGE('0', '9') | AVR_HEX_RANGE('A', 'F') | AVR_HEX_RANGE('a', 'f')) != high)
+        return false;
+#undef AVR_HEX_RANGE
+    const uint64_t v     = (w & (ones * 0x0F)) + ((w >> 6) & ones) * 9;
+    uint64_t x           = ((v << 4) | (v >> 8)) & 0x00FF00FF00FF00FFULL;
+    x                    = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x                    = (x | (x >> 16)) & 0xFFFFFFFFULL;
+    const uint32_t bytes = (uint32_t)x;
+    memcpy(out, &bytes, sizeof(bytes));
+    return true;
+}
+#endif
+
+static bool avr_hex_decode(const char *const hex, const size_t bytes, unsigned char *const out) {
+    size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 4 <= bytes; i += 4)
+        if (!avr_hex8(hex + i * 2, out + i))
+            return false;
+#endif
+    for (; i < bytes; i++) {
+        const unsigned int hi = avr_nibble(hex[i * 2]), lo = avr_nibble(hex[i * 2 + 1]);
+        if (hi > 15 || lo > 15)
+            return false;
+        out[i] = (unsigned char)((hi << 4) | lo);
+    }
+    return true;
+}
+
+// the frame bytes of an AVR line, returns the length (short or long) or 0 if it is not a well formed frame
+static size_t avr_frame(const char *const line, unsigned char *const frame) {
+    const char *hex;
+    if (line[0] == '*')
+        hex = line + 1;
+    else if (line[0] == '@')
+        hex = line + 1 + AVR_TIMESTAMP_DIGITS;
+    else
+        return 0;
+    const char *const end = strchr(line, ';');
+    if (!end || end < hex)
+        return 0;
+    const size_t digits = (size_t)(end - hex);
+    if (digits != AVR_BYTES_LONG * 2 && digits != AVR_BYTES_SHORT * 2)
+        return 0;
+    return avr_hex_decode(hex, digits / 2, frame) ? digits / 2 : 0;
+}
+
+// count bits of the 56 bit ME field from first, numbered 1..56 as in DO-260
+static inline unsigned int avr_bits(const uint64_t me, const unsigned int first, const unsigned int count) {
+    return (unsigned int)((me >> (56 - first - count + 1)) & ((1ULL << count) - 1));
+}
+
+static int avr_cpr_nl(const double lat) {
+    const double a = fabs(lat);
+    if (a >= 87.0)
+        return a > 87.0 ? 1 : 2;
+    const double c = cos(a * M_PI / 180.0);
+    return (int)floor(2.0 * M_PI / acos(1.0 - (1.0 - cos(M_PI / (2.0 * AVR_CPR_NZ))) / (c * c)));
+}
+
+static inline double avr_cpr_mod(const double a, const double b) { return a - b * floor(a / b); }
+
+static bool avr_cpr_local(const unsigned int odd, const unsigned int lat_cpr, const unsigned int lon_cpr, double *const lat, double *const lon) {
+    const double ref_lat = g_config.position_lat, ref_lon = g_config.position_lon;
+    const double y = lat_cpr / AVR_CPR_SCALE, x = lon_cpr / AVR_CPR_SCALE;
+    const double d_lat = 360.0 / (4.0 * AVR_CPR_NZ - odd);
+    const double r_lat = d_lat * (floor(ref_lat / d_lat) + floor(0.5 + avr_cpr_mod(ref_lat, d_lat) / d_lat - y) + y);
+    if (r_lat < -90.0 || r_lat > 90.0)
+        return false;
+    const int zones    = avr_cpr_nl(r_lat) - (int)odd;
+    const double d_lon = 360.0 / (zones > 1 ? zones : 1);
+    const double r_lon = d_lon * (floor(ref_lon / d_lon) + floor(0.5 + avr_cpr_mod(ref_lon, d_lon) / d_lon - x) + x);
+    *lat               = r_lat;
+    *lon               = avr_cpr_mod(r_lon + 180.0, 360.0) - 180.0;
+    return true;
+}
+
+// 12 bit AC field with the Q bit set (25ft steps), Gillham coded (100ft) altitudes are not decoded
+static bool avr_altitude(const unsigned int ac, int *const altitude_ft) {
+    if (!(ac & 0x010))
+        return false;
+    *altitude_ft = (int)(((ac & 0xFE0) >> 1) | (ac & 0x00F)) * 25 - 1000;
+    return true;
+}
+
+// 13 bit identity (C1 A1 C2 A2 C4 A4 X B1 D1 B2 D2 B4 D4) to four octal digits in three bit groups, as squawks are stored
+static unsigned int avr_squawk(const unsigned int id) {
+    static const struct {
+        unsigned int mask, squawk;
+    } bits[] = {
+        { 0x0800, 01000 }, { 0x0200, 02000 }, { 0x0080, 04000 }, { 0x0020, 0100 }, { 0x0008, 0200 }, { 0x0002, 0400 },
+        { 0x1000, 010 },   { 0x0400, 020 },   { 0x0100, 040 },   { 0x0010, 01 },   { 0x0004, 02 },   { 0x0001, 04 },
+    };
+    unsigned int squawk = 0;
+    for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+        if (id & bits[i].mask)
+            squawk |= bits[i].squawk;
+    return squawk;
+}
+
+// surface movement field to knots, by its quantisation ranges, negative if not available
+static double avr_movement(const unsigned int movement) {
+    static const struct {
+        unsigned int from;
+        double knots, step;
+    } ranges[] = {
+        { 1, 0.0, 0.0 },    { 2, 0.125, 0.125 }, { 9, 1.0, 0.25 },     { 13, 2.0, 0.5 },
+        { 39, 15.0, 1.0 },  { 94, 70.0, 2.0 },   { 109, 100.0, 5.0 },  { 124, 175.0, 0.0 },
+    };
+    if (movement == 0 || movement > 124)
+        return -1.0;
+    size_t r = 0;
+    while (r + 1 < sizeof(ranges) / sizeof(ranges[0]) && movement >= ranges[r + 1].from)
+        r++;
+    return ranges[r].knots + (double)(movement - ranges[r].from) * ranges[r].step;
+}
+
+static const char avr_callsign_chars[64] = "#ABCDEFGHIJKLMNOPQRSTUVWXYZ##### ###############0123456789######";
+static const char avr_hex_digits[16]     = "0123456789ABCDEF";
+
+// the ME field of an intact DF17/18 frame as the SBS transmission type it corresponds to (1 identification, 2 surface, 3 airborne
+// position, 4 velocity, 6 squawk and emergency), false for type codes that carry nothing the aircraft state keeps
+static bool avr_decode(const unsigned char *const frame, adsb_message_t *const msg) {
+    uint64_t me = 0;
+    for (int i = 4; i < 11; i++)
+        me = (me << 8) | frame[i];
+    const unsigned int tc = avr_bits(me, 1, 5);
+
+    for (int i = 0; i < 3; i++) {
+        msg->icao[i * 2]     = avr_hex_digits[frame[1 + i] >> 4];
+        msg->icao[i * 2 + 1] = avr_hex_digits[frame[1 + i] & 0x0F];
+    }
+    msg->icao[6]     = '\0';
+    msg->present     = 0;
+    msg->flags       = 0;
+    msg->altitude_ft = 0;
+
+    if (tc >= 1 && tc <= 4) {
+        msg->type = 1;
+        for (unsigned int i = 0; i < sizeof(msg->callsign); i++)
+            if ((msg->callsign[i] = avr_callsign_chars[avr_bits(me, 9 + i * 6, 6)]) == '#')
+                return false;
+        msg->present |= AIRCRAFT_STATE_CALLSIGN;
+    } else if (tc >= 5 && tc <= 8) {
+        msg->type                 = 2;
+        const double ground_speed = avr_movement(avr_bits(me, 6, 7));
+        if (ground_speed >= 0.0) {
+            msg->ground_speed = ground_speed;
+            msg->present |= AIRCRAFT_STATE_SPEED;
+        }
+        if (avr_bits(me, 13, 1)) {
+            msg->track = avr_bits(me, 14, 7) * 360.0 / 128.0;
+            msg->present |= AIRCRAFT_STATE_TRACK;
+        }
+        msg->flags |= AIRCRAFT_FLAG_GROUND;
+        msg->present |= AIRCRAFT_STATE_GROUND;
+    } else if ((tc >= 9 && tc <= 18) || (tc >= 20 && tc <= 22)) {
+        msg->type                   = 3;
+        const unsigned int status   = avr_bits(me, 6, 2);
+        const unsigned int altitude = avr_bits(me, 9, 12);
+        if (tc <= 18 ? avr_altitude(altitude, &msg->altitude_ft) : altitude != 0) {
+            if (tc >= 20)
+                msg->altitude_ft = (int)lround(altitude * 3.28084);
+            msg->present |= AIRCRAFT_STATE_ALTITUDE;
+            if (avr_cpr_local(avr_bits(me, 22, 1), avr_bits(me, 23, 17), avr_bits(me, 40, 17), &msg->lat, &msg->lon))
+                msg->present |= AIRCRAFT_STATE_POSITION;
+        }
+        if (status == 1 || status == 2)
+            msg->flags |= AIRCRAFT_FLAG_ALERT;
+        else if (status == 3)
+            msg->flags |= AIRCRAFT_FLAG_SPI;
+        msg->present |= AIRCRAFT_STATE_ALERT | AIRCRAFT_STATE_SPI | AIRCRAFT_STATE_GROUND;
+    } else if (tc == 19) {
+        msg->type                  = 4;
+        const unsigned int subtype = avr_bits(me, 6, 3);
+        if (subtype < 1 || subtype > 4)
+            return false;
+        const unsigned int ew = avr_bits(me, 15, 10), ns = avr_bits(me, 26, 10), rate = avr_bits(me, 38, 9);
+        if (subtype <= 2 && ew != 0 && ns != 0) {
+            const double scale = subtype == 2 ? 4.0 : 1.0;
+            const double vx    = (ew - 1) * scale * (avr_bits(me, 14, 1) ? -1.0 : 1.0);
+            const double vy    = (ns - 1) * scale * (avr_bits(me, 25, 1) ? -1.0 : 1.0);
+            msg->ground_speed  = sqrt(vx * vx + vy * vy);
+            msg->track         = avr_cpr_mod(atan2(vx, vy) * 180.0 / M_PI, 360.0);
+            msg->present |= AIRCRAFT_STATE_SPEED | AIRCRAFT_STATE_TRACK;
+        }
+        if (rate != 0) {
+            msg->vertical_rate = (int)(rate - 1) * 64 * (avr_bits(me, 37, 1) ? -1 : 1);
+            msg->present |= AIRCRAFT_STATE_VERTICAL_RATE;
+        }
+    } else if (tc == 28 && avr_bits(me, 6, 3) == 1) {
+        msg->type   = 6;
+        msg->squawk = avr_squawk(avr_bits(me, 12, 13));
+        if (avr_bits(me, 9, 3) != 0)
+            msg->flags |= AIRCRAFT_FLAG_EMERGENCY;
+        msg->present |= AIRCRAFT_STATE_SQUAWK | AIRCRAFT_STATE_EMERGENCY;
+    } else
+        return false;
+    return msg->present != 0;
+}
+
+bool adsb_parse_avr(const char *const line, adsb_message_t *const msg) {
+    unsigned char frame[AVR_BYTES_LONG];
+    g_avr.frames++;
+    const size_t length = avr_frame(line, frame);
+    if (length == 0) {
+        g_avr.malformed++;
+        return false;
+    }
+    const unsigned int df = frame[0] >> 3;
+    if (df != 17 && df != 18) {
+        g_avr.unsupported++;
+        return false;
+    }
+    if (length != AVR_BYTES_LONG) {
+        g_avr.malformed++;
+        return false;
+    }
+    const uint32_t syndrome = avr_syndrome(frame);
+    if (syndrome != 0) {
+        // an error in the DF bits means the frame was never an extended squitter, so those are not corrected
+        const int bit = g_config.adsb_correct ? avr_syndrome_bit(syndrome) : -1;
+        if (bit < AVR_BITS_DF) {
+            g_avr.crc_failed++;
+            return false;
         }
+        frame[bit / 8] ^= (unsigned char)(0x80 >> (bit % 8));
+        g_avr.corrected++;
     }
+    // DF18 control field: 0 is ADS-B with an ICAO address, 6 is ADS-R; the rest are non ICAO addresses or TIS-B
+    if (df == 18 && (frame[0] & 0x07) != 0 && (frame[0] & 0x07) != 6) {
+        g_avr.unsupported++;
+        return false;
+    }
+    g_avr.valid++;
+    return avr_decode(frame, msg);
+}
 
-    if (json_str)
-        free(json_str);
+bool avr_begin(void) {
+    if (g_config.adsb_format != ADSB_FORMAT_AVR)
+        return true;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i << 16;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x800000) ? (crc << 1) ^ AVR_POLYNOMIAL : crc << 1;
+        g_avr.crc[i] = crc & 0xFFFFFF;
+    }
+    unsigned char frame[AVR_BYTES_LONG];
+    for (int bit = 0; bit < AVR_BITS_LONG; bit++) {
+        memset(frame, 0, sizeof(frame));
+        frame[bit / 8]          = (unsigned char)(0x80 >> (bit % 8));
+        const uint32_t syndrome = avr_syndrome(frame);
+        unsigned int b          = avr_syndrome_bucket(syndrome);
+        while (g_avr.syndromes[b] != 0)
+            b = (b + 1) & (AVR_SYNDROME_BUCKETS - 1);
+        g_avr.syndromes[b]     = syndrome;
+        g_avr.syndrome_bits[b] = (unsigned char)bit;
+    }
+    printf("avr: DF17/18 decoding, crc-24 check%s, cpr relative to %.4f,%.4f\n", g_config.adsb_correct ? " with 1-bit correction" : "",
+           g_config.position_lat, g_config.position_lon);
+    return true;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
-bool adsb_parse_sbs_position(const char *const line, char *const icao, double *const lat, double *const lon, int *const alt) {
-#define ADSB_MAX_FIELDS_DECODE   18
-#define ADSB_MIN_FIELDS_REQUIRED 16
-    const char *fields[ADSB_MAX_FIELDS_DECODE], *fields_end[ADSB_MAX_FIELDS_DECODE];
-    unsigned int i = 0;
-
-    const char *p = line, *s = p;
-    while (*p && i < ADSB_MAX_FIELDS_DECODE) {
-        if (*p == ',' || *p == '\n' || *p == '\r' || *p == '\0') {
-            fields[i]     = s;
-            fields_end[i] = p;
-            i++;
-            if (*p == '\0')
-                break;
-            s = p + 1;
-        }
-        p++;
-    }
-    if (i < ADSB_MAX_FIELDS_DECODE && s < p && p[-1] != ',') {
-        fields[i]     = s;
-        fields_end[i] = p;
-        i++;
+// one framed SBS or AVR line (without line ending) counted and decoded into msg, false if it is not a message
+bool adsb_parse_line(const char *const line, adsb_message_t *const msg) {
+    const bool avr = g_config.adsb_format == ADSB_FORMAT_AVR;
+    if (!avr && strncmp(line, "MSG,3", 5) == 0)
+        LOG(LOG_CATEGORY_ADSB, LOG_LEVEL_TRACE, "MSG,3: %s", line);
+    if (avr ? (line[0] == '*' || line[0] == '@') : strncmp(line, "MSG", 3) == 0) {
+        g_aircraft_stat.messages_total++;
+        g_aircraft_global.messages_total++;
     }
 
-    if (i < ADSB_MIN_FIELDS_REQUIRED)
-        return false;
-    if (fields_end[0] - fields[0] != 3 || strncmp(fields[0], "MSG", 3) != 0)
-        return false;
-    if (fields_end[1] - fields[1] != 1 || *fields[1] != '3')
+    const unsigned long long t_parse = timing_start();
+    const bool parsed                = avr ? adsb_parse_avr(line, msg) : adsb_parse_sbs(line, msg);
+    timing_stop(TIMING_STAGE_PARSE, t_parse);
+    PROBE2(message_parsed, line, parsed ? msg->type : 0);
+    if (!parsed)
         return false;
-    if (fields[14] == fields_end[14] || fields[15] == fields_end[15])
-        return false;
-
-    const size_t icao_len = MAX((size_t)fields_end[4] - (size_t)fields[4], 6);
-    memcpy(icao, fields[4], icao_len);
-    icao[icao_len] = '\0';
-    *lat           = strtod(fields[14], NULL);
-    *lon           = strtod(fields[15], NULL);
-    *alt           = (fields[11] < fields_end[11]) ? (int)strtol(fields[11], NULL, 10) : 0;
-
+    if (adsb_message_is_position(msg)) {
+        g_aircraft_stat.messages_position++;
+        g_aircraft_global.messages_position++;
+    }
     return true;
 }
 
+// one line decoded into the aircraft's state, and if it is a position applied to the aircraft table and voxel map; true if it was
+// a position that passed the bounds and the tracker
+bool adsb_process_line(const char *const line) {
+    adsb_message_t msg;
+    if (!adsb_parse_line(line, &msg))
+        return false;
+    const unsigned long long t_update = timing_start();
+    const bool accepted               = aircraft_message_update(&msg, time(NULL));
+    timing_stop(TIMING_STAGE_UPDATE, t_update);
+    return accepted;
+}
+
 int adsb_connect(void) {
     char adsb_host[MAX_NAME_LENGTH];
     if (!host_resolve(g_config.adsb_host, adsb_host, sizeof(adsb_host)))
@@ -1016,6 +8164,7 @@ int adsb_connect(void) {
     if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
         printf("adsb: warning: failed to set receive timeout: %s\n", strerror(errno));
     printf("adsb: connection succeeded to %s:%d\n", g_config.adsb_host, g_config.adsb_port);
+    PROBE1(adsb_connect, sockfd);
     return sockfd;
 }
 
@@ -1037,6 +8186,7 @@ void *adsb_processing_thread(void *arg __attribute__((unused))) {
 
         if (interval_past(&last_message_time, MESSAGE_TIMEOUT) && sockfd >= 0) {
             printf("adsb: no messages received for %d minutes, reconnecting...\n", MESSAGE_TIMEOUT / 60);
+            PROBE1(adsb_disconnect, 0);
             adsb_disconnect(sockfd);
             sockfd = -1;
         }
@@ -1051,10 +8201,14 @@ void *adsb_processing_thread(void *arg __attribute__((unused))) {
             line_pos           = 0;
         }
 
-        char buffer[MAX_LINE_LENGTH];
-        const ssize_t n = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
+        char buffer[RECV_BUFFER_LENGTH];
+        timing_sample();
+        const unsigned long long t_recv = timing_start();
+        const ssize_t n                 = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
+        timing_stop(TIMING_STAGE_RECV, t_recv);
         if (n == 0) {
             printf("adsb: connection closed by remote host\n");
+            PROBE1(adsb_disconnect, 1);
             adsb_disconnect(sockfd);
             sockfd = -1;
             continue;
@@ -1064,6 +8218,7 @@ void *adsb_processing_thread(void *arg __attribute__((unused))) {
             printf("adsb: recv error: %s\n", strerror(errno));
             if (++consecutive_errors >= MAX_CONSECUTIVE_ERRORS) {
                 printf("adsb: too many consecutive errors, reconnecting...\n");
+                PROBE1(adsb_disconnect, 2);
                 adsb_disconnect(sockfd);
                 sockfd             = -1;
                 consecutive_errors = 0;
@@ -1075,36 +8230,36 @@ void *adsb_processing_thread(void *arg __attribute__((unused))) {
 
         consecutive_errors = 0;
 
+        g_timing.recv_ns = timing_now_ns();
+        timing_sample();
+        unsigned long long t_frame = timing_start();
+
         buffer[n] = '\0';
         for (int i = 0; i < n; i++) {
             if (buffer[i] == '\n' || buffer[i] == '\r') {
                 if (line_pos > 0) {
                     line[line_pos] = '\0';
                     line_pos       = 0;
+                    timing_stop(TIMING_STAGE_FRAME, t_frame);
 
-                    if (g_config.debug && strncmp(line, "MSG,3", 5) == 0)
-                        printf("debug: adsb MSG,3: %s\n", line);
-                    if (strncmp(line, "MSG", 3) == 0) {
-                        g_aircraft_stat.messages_total++;
-                        g_aircraft_global.messages_total++;
-                    }
+                    adsb_process_line(line);
 
-                    char icao[7];
-                    double lat, lon;
-                    int altitude;
-                    if (adsb_parse_sbs_position(line, icao, &lat, &lon, &altitude)) {
-                        g_aircraft_stat.messages_position++;
-                        g_aircraft_global.messages_position++;
-                        aircraft_position_update(icao, lat, lon, altitude, time(NULL));
-                    }
+                    timing_sample();
+                    t_frame = timing_start();
                 }
             } else if (line_pos < MAX_LINE_LENGTH - 1)
                 line[line_pos++] = buffer[i];
         }
+        serve_wake();
 
         if (interval_past(&g_last_mqtt, g_config.interval_mqtt))
             aircraft_publish_mqtt();
+        shm_stats_update(false);
+        vicinity_expire();
+        airspace_expire();
+        emergency_expire();
     }
+    shm_stats_update(true);
 
     adsb_disconnect(sockfd);
 
@@ -1142,8 +8297,11 @@ persist_thread_args_t g_persist_args;
 
 static void persist_save_all(const persist_thread_args_t *const args) {
     for (size_t i = 0; i < args->num_fns; i++)
-        if (args->save_fns[i])
-            args->save_fns[i]();
+        if (args->save_fns[i]) {
+            PROBE1(persist_start, i);
+            const bool ok = args->save_fns[i]();
+            PROBE2(persist_end, i, ok);
+        }
 }
 
 void *persist_thread_func(void *arg) {
@@ -1181,12 +8339,183 @@ void persist_end(void) { pthread_join(g_persist_thread, NULL); }
 // -----------------------------------------------------------------------------------------------------------------------------------------
 
 void print_config(void) {
-    printf("config: adsb=%s:%d, mqtt=%s:%d, mqtt-topic=%s, mqtt-interval=%lds, status-interval=%lds, persist-interval=%lds, distance-max=%.0fnm, "
+    printf("config: adsb=%s:%d, adsb-format=%s%s, mqtt=%s:%d, mqtt-topic=%s, mqtt-interval=%lds, status-interval=%lds, persist-interval=%lds, "
+           "distance-max=%.0fnm, "
            "altitude-max=%dft, "
-           "voxel-grid-x=%.0fnm, voxel-grid-y=%.0fft, position=%.6f,%0.6f, debug=%s\n",
-           g_config.adsb_host, g_config.adsb_port, g_config.mqtt_host, g_config.mqtt_port, g_config.mqtt_topic, g_config.interval_mqtt,
+           "voxel-grid-x=%.0fnm, voxel-grid-y=%.0fft, position=%.6f,%0.6f, timing=%u, log=%s, log-sample=%u, log-rate=%u, shm=%s, "
+           "airprox=%.2fnm/%dft, loitering=%.2f, vicinity=%.1fnm/%dft, anomaly=%ds, track-gate=%.1f, icaodb=%s, icao-blocks=%s, "
+           "airports=%s, airport-range=%.1fnm/%dft, airspace=%s, sinks=%d, sbs-serve=%s, http=%s, position-altitude=%dft, debug=%s\n",
+           g_config.adsb_host, g_config.adsb_port, adsb_formats[g_config.adsb_format].name, g_config.adsb_correct ? " (correct)" : "", g_config.mqtt_host,
+           g_config.mqtt_port, g_config.mqtt_topic, g_config.interval_mqtt,
            g_config.interval_status, g_config.interval_persist, g_config.distance_max_nm, g_config.altitude_max_ft, g_config.voxel_size_horizontal_nm,
-           g_config.voxel_size_vertical_ft, g_config.position_lat, g_config.position_lon, g_config.debug ? "yes" : "no");
+           g_config.voxel_size_vertical_ft, g_config.position_lat, g_config.position_lon, g_config.timing_sample,
+           g_config.log_categories[0] != '\0' ? g_config.log_categories : "none", g_config.log_sample, g_config.log_rate,
+           g_config.shm_name[0] != '\0' ? g_config.shm_name : "none", g_config.airprox_horizontal_nm, g_config.airprox_vertical_ft,
+           g_config.loiter_score, g_config.vicinity_radius_nm, g_config.vicinity_altitude_ft, g_config.anomaly_window,
+           g_config.track_gate,
+           g_config.icaodb_path[0] != '\0' ? g_config.icaodb_path : "none", g_config.icao_blocks_path[0] != '\0' ? g_config.icao_blocks_path : "none",
+           g_config.airports_path[0] != '\0' ? g_config.airports_path : "none", g_config.airport_range_nm, g_config.airport_range_ft,
+           g_config.airspace_path[0] != '\0' ? g_config.airspace_path : "none", g_config.sinks_count,
+           g_config.serve[0] != '\0' ? g_config.serve : "none", g_config.http[0] != '\0' ? g_config.http : "none",
+           g_config.station_altitude_ft, g_config.debug ? "yes" : "no");
+}
+
+void print_timing(void) {
+    if (!g_timing.enabled) {
+        printf("timing: disabled\n");
+        return;
+    }
+    printf("timing: sample=1/%u, interval=%lds (p50/p99/p999/max us)", g_timing.sample_rate, (long)g_config.interval_status);
+    for (int stage = 0; stage < TIMING_STAGE_COUNT; stage++) {
+        const timing_histogram_t *const h = &g_timing.interval[stage];
+        printf(", %s=%.1f/%.1f/%.1f/%.1f", timing_stage_names[stage], (double)timing_histogram_percentile(h, 50.0) / 1000.0,
+               (double)timing_histogram_percentile(h, 99.0) / 1000.0, (double)timing_histogram_percentile(h, 99.9) / 1000.0, (double)h->max / 1000.0);
+    }
+    printf("\n");
+}
+
+void print_log(void) {
+    bool active = false;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        if (g_log.categories[i].level != LOG_LEVEL_OFF || g_log.categories[i].written > 0)
+            active = true;
+    if (!active)
+        return;
+    printf("log:");
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        const log_category_state_t *const c = &g_log.categories[i];
+        printf("%s %s=%s (sample=1/%u, rate=%u/s, written=%lu, sampled=%lu, limited=%lu, dropped=%lu)", i > 0 ? "," : "", log_category_names[i],
+               log_level_names[c->level], c->sample_rate, c->rate_limit, c->written, c->sampled_out, c->rate_limited, c->dropped);
+    }
+    printf("\n");
+}
+
+void print_airprox(void) {
+    if (!g_airprox.enabled)
+        return;
+    printf("airprox: alerts=%lu (", g_airprox.alerts);
+    for (int i = 0; i < AIRPROX_CATEGORY_COUNT; i++)
+        printf("%s%s=%lu", i > 0 ? ", " : "", airprox_categories[i].name, g_airprox.alerts_category[i]);
+    printf("), published=%lu, candidates=%lu, checks=%lu\n", g_airprox.published, g_airprox.candidates, g_airprox.checks);
+}
+
+void print_loiter(void) {
+    if (g_loiter.enabled)
+        printf("loitering: active=%lu, detected=%lu, published=%lu, episodes=%lu\n", g_loiter.active, g_loiter.detected, g_loiter.published,
+               g_loiter.episodes);
+}
+
+void print_vicinity(void) {
+    if (g_vicinity.enabled)
+        printf("vicinity: active=%lu, entered=%lu, overhead=%lu, left=%lu, published=%lu\n", g_vicinity.active, g_vicinity.entered, g_vicinity.overhead,
+               g_vicinity.left, g_vicinity.published);
+}
+
+void print_anomaly(void) {
+    if (g_anomaly.enabled)
+        printf("anomaly: active=%lu, raised=%lu/%lu/%lu/%lu (speed-altitude/vertical-rate/oscillation/speed-change), escalated=%lu, cleared=%lu, "
+               "published=%lu\n",
+               g_anomaly.active, g_anomaly.raised[ANOMALY_HIGH_SPEED_LOW_ALTITUDE], g_anomaly.raised[ANOMALY_EXTREME_VERTICAL_RATE],
+               g_anomaly.raised[ANOMALY_ALTITUDE_OSCILLATION], g_anomaly.raised[ANOMALY_RAPID_SPEED_CHANGE], g_anomaly.escalated, g_anomaly.cleared,
+               g_anomaly.published);
+}
+
+void print_track(void) {
+    if (g_track.enabled)
+        printf("track: updates=%lu, starts=%lu, rejected-speed=%lu, rejected-gate=%lu\n", g_track.updates, g_track.starts, g_track.rejected_speed,
+               g_track.rejected_gate);
+}
+
+void print_icaodb(void) {
+    if (g_icaodb.header)
+        printf("icaodb: aircraft=%u, hits=%lu, misses=%lu\n", g_icaodb.header->count, g_icaodb.hits, g_icaodb.misses);
+}
+
+void print_icao_blocks(void) {
+    if (g_icao_blocks.nodes)
+        printf("icao-blocks: military-seen=%lu [%lu]\n", g_aircraft_stat.military_seen, g_aircraft_global.military_seen);
+}
+
+void print_airports(void) {
+    if (g_airports.header)
+        printf("airports: lookups=%lu, attributed=%lu, cells-visited=%lu\n", g_airports.lookups, g_airports.attributed, g_airports.cells_visited);
+}
+
+void print_airspace(void) {
+    if (g_airspace.enabled)
+        printf("airspace: active=%lu, entered=%lu, left=%lu, published=%lu, checks=%lu, tests=%lu\n", g_airspace.active, g_airspace.entered,
+               g_airspace.left, g_airspace.published, g_airspace.checks, g_airspace.tests);
+}
+
+void print_events(void) {
+    if (g_events.queued > 0 || g_events.dropped > 0)
+        printf("events: queued=%lu, dropped=%lu, peak=%u/%d\n", g_events.queued, g_events.dropped, g_events.peak, EVENT_QUEUE_MAX);
+}
+
+void print_emergency(void) {
+    if (g_emergency.declared > 0)
+        printf("emergency: active=%d, declared=%lu, changed=%lu, cleared=%lu, dropped=%lu, published=%lu\n", g_emergency.count, g_emergency.declared,
+               g_emergency.changed, g_emergency.cleared, g_emergency.dropped, g_emergency.published);
+}
+
+void print_sinks(void) {
+    for (int i = 0; i < g_sinks.count; i++) {
+        const sink_t *const s = &g_sinks.sinks[i];
+        printf("sink: %s:%s queued=%lu, written=%lu, dropped=%lu, failed=%lu, bytes=%lu", sink_type_names[s->type], s->path, s->queued, s->written,
+               s->dropped, s->failed, s->bytes);
+        if (s->type == SINK_UNIX)
+            printf(", clients=%d", s->clients_count);
+        printf("\n");
+    }
+}
+
+void print_serve(void) {
+    if (g_serve.enabled)
+        printf("serve: clients=%d, connected=%lu, disconnected=%lu (lagged=%lu), lines=%lu, duplicates=%lu, bytes=%lu\n", g_serve.clients_count,
+               g_serve.connected, g_serve.disconnected, g_serve.lagged, g_serve.lines, g_serve.duplicates, g_serve.bytes);
+}
+
+void print_subscriptions(void) {
+    pthread_mutex_lock(&g_subscribe.mutex);
+    if (g_subscribe.subscribed > 0) {
+        printf("subscriptions: active=%d, subscribed=%lu, unsubscribed=%lu, lapsed=%lu, cells-visited=%lu\n", g_subscribe.count, g_subscribe.subscribed,
+               g_subscribe.unsubscribed, g_subscribe.lapsed, g_subscribe.cells_visited);
+        for (int i = 0; i < g_subscribe.count; i++)
+            printf("subscriptions: %s: published=%lu, aircraft=%lu, bytes=%lu, lease=%lds\n", g_subscribe.subscriptions[i].id,
+                   g_subscribe.subscriptions[i].published, g_subscribe.subscriptions[i].aircraft, g_subscribe.subscriptions[i].bytes,
+                   (long)(g_subscribe.subscriptions[i].expires - time(NULL)));
+    }
+    pthread_mutex_unlock(&g_subscribe.mutex);
+}
+
+void print_queries(void) {
+    if (g_query.requests == 0)
+        return;
+    printf("query: requests=%lu, dropped=%lu, invalid=%lu, snapshots=%lu\n", g_query.requests, g_query.dropped, g_query.invalid, g_query.snapshots);
+    for (int type = 0; type < QUERY_TYPES; type++)
+        if (g_query.latency[type].count > 0)
+            printf("query: %s: count=%lu, errors=%lu, latency-avg=%.0fus, latency-max=%.0fus\n", query_type_names[type], g_query.latency[type].count,
+                   g_query.latency[type].errors, (double)g_query.latency[type].total_ns / (double)g_query.latency[type].count / 1000.0,
+                   (double)g_query.latency[type].max_ns / 1000.0);
+}
+
+void print_http(void) {
+    if (!g_http.enabled)
+        return;
+    printf("http: clients=%d, connected=%lu, requests=%lu, not-modified=%lu, errors=%lu, bytes=%lu, bytes-saved=%lu\n", g_http.clients_count,
+           g_http.connected, g_http.requests, g_http.not_modified, g_http.errors, g_http.bytes, g_http.bytes_saved);
+    for (size_t i = 0; i < HTTP_RESOURCES_COUNT; i++)
+        if (http_resources[i].requests > 0)
+            printf("http: %s: requests=%lu, builds=%lu, size=%zu (gzip=%zu, br=%zu)\n", http_resources[i].path, http_resources[i].requests,
+                   http_resources[i].builds, http_resources[i].encoded[HTTP_ENCODING_IDENTITY] ? http_resources[i].encoded[HTTP_ENCODING_IDENTITY]->length : 0,
+                   http_resources[i].encoded[HTTP_ENCODING_GZIP] ? http_resources[i].encoded[HTTP_ENCODING_GZIP]->length : 0,
+                   http_resources[i].encoded[HTTP_ENCODING_BROTLI] ? http_resources[i].encoded[HTTP_ENCODING_BROTLI]->length : 0);
+}
+
+void print_avr(void) {
+    if (g_config.adsb_format == ADSB_FORMAT_AVR)
+        printf("avr: frames=%lu, valid=%lu, corrected=%lu, crc-failed=%lu, malformed=%lu, unsupported=%lu\n", g_avr.frames, g_avr.valid, g_avr.corrected,
+               g_avr.crc_failed, g_avr.malformed, g_avr.unsupported);
 }
 
 void print_status(void) {
@@ -1204,6 +8533,71 @@ void print_status(void) {
     if (voxel_get_stats(&voxel_occupied, &voxel_total, &voxel_occupancy))
         printf(", voxels=%.0fK/%.0fK (%.1f%%)", (double)voxel_occupied / (double)(1024 * 1024), (double)voxel_total / (double)(1024 * 1024), voxel_occupancy);
     printf("\n");
+    print_avr();
+    print_timing();
+    print_log();
+    print_airprox();
+    print_loiter();
+    print_vicinity();
+    print_anomaly();
+    print_track();
+    print_icaodb();
+    print_icao_blocks();
+    print_airports();
+    print_airspace();
+    print_events();
+    print_emergency();
+    print_sinks();
+    print_serve();
+    print_subscriptions();
+    print_queries();
+    print_http();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static cJSON *timing_encode_histogram(const timing_histogram_t *const h) {
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj)
+        return NULL;
+    cJSON_AddNumberToObject(obj, "count", (double)h->count);
+    cJSON_AddNumberToObject(obj, "mean_ns", h->count ? (double)h->sum / (double)h->count : 0.0);
+    cJSON_AddNumberToObject(obj, "p50_ns", (double)timing_histogram_percentile(h, 50.0));
+    cJSON_AddNumberToObject(obj, "p99_ns", (double)timing_histogram_percentile(h, 99.0));
+    cJSON_AddNumberToObject(obj, "p999_ns", (double)timing_histogram_percentile(h, 99.9));
+    cJSON_AddNumberToObject(obj, "max_ns", (double)h->max);
+    return obj;
+}
+
+void timing_publish_mqtt(void) {
+    if (!g_timing.enabled)
+        return;
+
+    cJSON *root = cJSON_CreateObject();
+    if (!root)
+        return;
+    cJSON_AddNumberToObject(root, "timestamp", (double)time(NULL));
+    cJSON_AddNumberToObject(root, "sample_rate", g_timing.sample_rate);
+    cJSON_AddNumberToObject(root, "interval", (double)g_config.interval_status);
+    cJSON *stages = cJSON_CreateObject();
+    if (stages) {
+        for (int stage = 0; stage < TIMING_STAGE_COUNT; stage++) {
+            cJSON *histogram = timing_encode_histogram(&g_timing.interval[stage]);
+            if (histogram)
+                cJSON_AddItemToObject(stages, timing_stage_names[stage], histogram);
+        }
+        cJSON_AddItemToObject(root, "stages", stages);
+    }
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    if (json_str) {
+        char topic[MAX_NAME_LENGTH + 16];
+        snprintf(topic, sizeof(topic), "%s/timing", g_config.mqtt_topic);
+        mqtt_publish_qos(topic, (const unsigned char *)json_str, strlen(json_str), 0);
+        free(json_str);
+    }
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
@@ -1213,9 +8607,11 @@ void print_help(const char *const prog_name) {
     printf("usage: %s [options]\n", prog_name);
     printf("options:\n");
     printf("  --help                  Show this help message\n");
-    printf("  --debug                 Enable debug output\n");
+    printf("  --debug                 Enable debug output (all log categories at trace)\n");
     printf("  --directory=PATH        Storage directory for voxel and data files (default: %s)\n", DEFAULT_DIRECTORY);
-    printf("  --adsb=HOST[:PORT]      ADS-B server (default: %s:%d)\n", DEFAULT_ADSB_HOST, DEFAULT_ADSB_PORT);
+    printf("  --adsb=HOST[:PORT]      ADS-B server (default: %s:%d, or %d for avr)\n", DEFAULT_ADSB_HOST, DEFAULT_ADSB_PORT, DEFAULT_ADSB_PORT_AVR);
+    printf("  --adsb-format=FORMAT    ADS-B input format, sbs (BaseStation) or avr (raw Mode S hex, DF17/18 decoded) (default: sbs)\n");
+    printf("  --adsb-correct          Correct single bit errors in avr frames by CRC syndrome\n");
     printf("  --mqtt=HOST[:PORT]      MQTT broker (default: %s:%d)\n", DEFAULT_MQTT_HOST, DEFAULT_MQTT_PORT);
     printf("  --mqtt-topic=TOPIC      MQTT topic (default: %s)\n", DEFAULT_MQTT_TOPIC);
     printf("  --mqtt-interval=SEC     MQTT update interval in seconds (default: %d)\n", DEFAULT_MQTT_INTERVAL);
@@ -1226,6 +8622,48 @@ void print_help(const char *const prog_name) {
     printf("  --voxel-grid-x=NM       Voxel horizontal grid size in nautical miles (default: %.0f)\n", DEFAULT_VOXEL_SIZE_HORIZONTAL_NM);
     printf("  --voxel-grid-y=FT       Voxel vertical grid size in feet (default: %.0f)\n", DEFAULT_VOXEL_SIZE_VERTICAL_FT);
     printf("  --position=LAT,LON      Reference position (default: %.4f,%.4f)\n", DEFAULT_POSITION_LAT, DEFAULT_POSITION_LON);
+    printf("  --position-altitude=FT  Reference position altitude above sea level, for elevation and slant range (default: 0)\n");
+    printf("  --timing=N              Stage latency sampling, 1 in N, 0 to disable, SIGUSR1 toggles (default: %d)\n", DEFAULT_TIMING_SAMPLE);
+    printf("  --log=CAT[:LEVEL],...   Log categories (adsb, position, aircraft, voxel, airprox, loitering, vicinity, airspace,\n");
+    printf("                          anomaly, all)\n");
+    printf("                          at LEVEL (off, info, debug, trace; default: debug), SIGUSR2 toggles,\n");
+    printf("                          or publish {\"command\":\"log\",\"category\":..,\"level\":..} to TOPIC/command\n");
+    printf("  --log-sample=N          Log 1 in N records per category (default: %d)\n", DEFAULT_LOG_SAMPLE);
+    printf("  --log-rate=N            Log at most N records per second per category, 0 for unlimited (default: %d)\n", DEFAULT_LOG_RATE);
+    printf("  --shm=NAME              Export the live aircraft table and stats as POSIX shared memory /NAME (see adsb_shm.h)\n");
+    printf("  --airprox=NM,FT         Airprox separation thresholds, alerts published to TOPIC/airprox, 0 to disable (default: %.0f,%d)\n",
+           DEFAULT_AIRPROX_HORIZONTAL_NM, DEFAULT_AIRPROX_VERTICAL_FT);
+    printf("  --loitering=SCORE       Loitering score threshold 0..1, events published to TOPIC/loitering, 0 to disable (default: %.1f)\n",
+           DEFAULT_LOITER_SCORE);
+    printf("  --vicinity=NM,FT        Station radius and altitude ceiling for entering/overhead/leaving events published to TOPIC/vicinity,\n");
+    printf("                          0 to disable (default: %.0f,%d)\n", DEFAULT_VICINITY_RADIUS_NM, DEFAULT_VICINITY_ALTITUDE_FT);
+    printf("  --anomaly=SECONDS       Window for the speed, altitude and vertical rate anomaly detectors, raised/escalated/cleared events\n");
+    printf("                          published to TOPIC/anomaly, 0 to disable (default: %d, at most %d)\n", DEFAULT_ANOMALY_WINDOW,
+           ANOMALY_WINDOW_MAX);
+    printf("  --track-gate=SIGMA      Reject positions further than SIGMA from the kinematic track and publish its prediction,\n");
+    printf("                          0 to disable (default: %.0f)\n", DEFAULT_TRACK_GATE);
+    printf("  --icaodb=FILE           Aircraft identity database to add registration, type and operator to published aircraft,\n");
+    printf("                          built by '%s icaodb-build SOURCE.csv|SOURCE.json FILE'\n", prog_name);
+    printf("  --icao-blocks=FILE      ICAO address allocations by country (content/D008.dat) to attribute country and military\n");
+    printf("  --airports=FILE         Airport index to attribute the nearest airport to low aircraft, built by\n");
+    printf("                          '%s airports-build airports-data.HOST.js|airports-data.json FILE'\n", prog_name);
+    printf("  --airport-range=NM,FT   Nearest airport distance and altitude ceiling for attribution (default: %.0f,%d)\n", DEFAULT_AIRPORT_RANGE_NM,
+           DEFAULT_AIRPORT_RANGE_FT);
+    printf("  --airspace=FILE         OpenAir areas (class, name, limits, outline) for entering/leaving events published to TOPIC/airspace\n");
+    printf("  --sink=TYPE:TARGET,...  Also write every publish as a 'TOPIC PAYLOAD' line to unix:PATH (a socket that local\n");
+    printf("                          clients connect to), udp:IPV4:PORT (unicast or multicast, one datagram each) or file:PATH,\n");
+    printf("                          with queue=N (default %d, at most %d), drop=oldest|newest (default oldest), size=MB for a file\n",
+           SINK_QUEUE_DEFAULT, SINK_QUEUE_MAX);
+    printf("                          before it is rotated to PATH.1 (default %d) and ttl=N for multicast (default 1); up to %d sinks\n",
+           SINK_FILE_SIZE_MB, SINKS_MAX);
+    printf("  --sbs-serve=PORT,...    Re-serve decoded messages as SBS to TCP clients on [IPV4:]PORT, with accepted for only\n");
+    printf("                          positions the tracker accepted, radius=NM for only aircraft within NM of the station and\n");
+    printf("                          types=DIGITS for only those SBS message types (e.g. types=134); clients a ring (%uMB) behind\n",
+           SERVE_RING_SIZE >> 20);
+    printf("                          are dropped\n");
+    printf("  --http=PORT,...         Serve /aircraft.json, /aircraft.geojson, /tracks.geojson and /coverage.geojson over HTTP on\n");
+    printf("                          [IPV4:]PORT, with refresh=SECONDS for how often the aircraft are re-encoded at most (default %d)\n",
+           HTTP_REFRESH_DEFAULT);
     printf("examples:\n");
     printf("  %s --adsb=192.168.1.100:30003 --mqtt=broker.local\n", prog_name);
     printf("  %s --debug --mqtt-interval=60 --distance-max=500\n", prog_name);
@@ -1235,6 +8673,8 @@ const struct option long_options[] = { { "help", no_argument, 0, 'h' },
                                        { "debug", no_argument, 0, 'd' },
                                        { "directory", required_argument, 0, 'l' },
                                        { "adsb", required_argument, 0, 'a' },
+                                       { "adsb-format", required_argument, 0, 'F' },
+                                       { "adsb-correct", no_argument, 0, 'C' },
                                        { "mqtt", required_argument, 0, 'm' },
                                        { "mqtt-topic", required_argument, 0, 't' },
                                        { "mqtt-interval", required_argument, 0, 'i' },
@@ -1245,6 +8685,25 @@ const struct option long_options[] = { { "help", no_argument, 0, 'h' },
                                        { "voxel-grid-x", required_argument, 0, 'X' },
                                        { "voxel-grid-y", required_argument, 0, 'Y' },
                                        { "position", required_argument, 0, 'p' },
+                                       { "position-altitude", required_argument, 0, 'H' },
+                                       { "timing", required_argument, 0, 'T' },
+                                       { "log", required_argument, 0, 'L' },
+                                       { "log-sample", required_argument, 0, 'S' },
+                                       { "log-rate", required_argument, 0, 'R' },
+                                       { "shm", required_argument, 0, 'M' },
+                                       { "airprox", required_argument, 0, 'x' },
+                                       { "loitering", required_argument, 0, 'o' },
+                                       { "vicinity", required_argument, 0, 'v' },
+                                       { "anomaly", required_argument, 0, 'W' },
+                                       { "track-gate", required_argument, 0, 'g' },
+                                       { "icaodb", required_argument, 0, 'I' },
+                                       { "icao-blocks", required_argument, 0, 'B' },
+                                       { "airports", required_argument, 0, 'E' },
+                                       { "airport-range", required_argument, 0, 'r' },
+                                       { "airspace", required_argument, 0, 'G' },
+                                       { "sink", required_argument, 0, 'k' },
+                                       { "sbs-serve", required_argument, 0, 'j' },
+                                       { "http", required_argument, 0, 'w' },
                                        { 0, 0, 0, 0 } };
 
 int parse_options(const int argc, char *const argv[]) {
@@ -1262,8 +8721,22 @@ int parse_options(const int argc, char *const argv[]) {
             g_config.directory[sizeof(g_config.directory) - 1] = '\0';
             break;
         case 'a':
-            if (!host_parse(optarg, g_config.adsb_host, sizeof(g_config.adsb_host), &g_config.adsb_port, DEFAULT_ADSB_PORT))
+            if (!host_parse(optarg, g_config.adsb_host, sizeof(g_config.adsb_host), &g_config.adsb_port, 0))
+                return -1;
+            break;
+        case 'F': {
+            int format = 0;
+            while (format < ADSB_FORMAT_COUNT && strcmp(optarg, adsb_formats[format].name) != 0)
+                format++;
+            if (format == ADSB_FORMAT_COUNT) {
+                fprintf(stderr, "invalid adsb format (sbs, avr): %s\n", optarg);
                 return -1;
+            }
+            g_config.adsb_format = (adsb_format_t)format;
+            break;
+        }
+        case 'C':
+            g_config.adsb_correct = true;
             break;
         case 'm':
             if (!host_parse(optarg, g_config.mqtt_host, sizeof(g_config.mqtt_host), &g_config.mqtt_port, DEFAULT_MQTT_PORT))
@@ -1339,11 +8812,138 @@ int parse_options(const int argc, char *const argv[]) {
             g_config.position_lon = lon;
             break;
         }
+        case 'H':
+            g_config.station_altitude_ft = atoi(optarg);
+            break;
+        case 'T':
+            if (atoi(optarg) < 0) {
+                fprintf(stderr, "invalid timing sample rate: %s\n", optarg);
+                return -1;
+            }
+            g_config.timing_sample = (unsigned int)atoi(optarg);
+            break;
+        case 'L':
+            if (!log_categories_parse(optarg) || strlen(optarg) >= sizeof(g_config.log_categories)) {
+                fprintf(stderr, "invalid log categories (category[:level],...): %s\n", optarg);
+                return -1;
+            }
+            strncpy(g_config.log_categories, optarg, sizeof(g_config.log_categories) - 1);
+            break;
+        case 'S':
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "invalid log sample rate: %s\n", optarg);
+                return -1;
+            }
+            g_config.log_sample = (unsigned int)atoi(optarg);
+            break;
+        case 'R':
+            if (atoi(optarg) < 0) {
+                fprintf(stderr, "invalid log rate limit: %s\n", optarg);
+                return -1;
+            }
+            g_config.log_rate = (unsigned int)atoi(optarg);
+            break;
+        case 'M':
+            if (optarg[0] == '\0' || strchr(optarg + 1, '/') || strlen(optarg) >= sizeof(g_config.shm_name)) {
+                fprintf(stderr, "invalid shm name: %s\n", optarg);
+                return -1;
+            }
+            strncpy(g_config.shm_name, optarg, sizeof(g_config.shm_name) - 1);
+            break;
+        case 'x': {
+            const char *const comma    = strchr(optarg, ',');
+            const double horizontal_nm = atof(optarg);
+            const int vertical_ft      = comma ? atoi(comma + 1) : g_config.airprox_vertical_ft;
+            if (horizontal_nm < 0 || vertical_ft < 0) {
+                fprintf(stderr, "invalid airprox thresholds (nm, ft): %s\n", optarg);
+                return -1;
+            }
+            g_config.airprox_horizontal_nm = horizontal_nm;
+            g_config.airprox_vertical_ft   = vertical_ft;
+            break;
+        }
+        case 'o':
+            g_config.loiter_score = atof(optarg);
+            if (g_config.loiter_score < 0 || g_config.loiter_score > 1) {
+                fprintf(stderr, "invalid loitering score (0..1): %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'v': {
+            const char *const comma = strchr(optarg, ',');
+            const double radius_nm  = atof(optarg);
+            const int altitude_ft   = comma ? atoi(comma + 1) : g_config.vicinity_altitude_ft;
+            if (radius_nm < 0 || altitude_ft < 0) {
+                fprintf(stderr, "invalid vicinity radius and altitude (nm, ft): %s\n", optarg);
+                return -1;
+            }
+            g_config.vicinity_radius_nm   = radius_nm;
+            g_config.vicinity_altitude_ft = altitude_ft;
+            break;
+        }
+        case 'W':
+            g_config.anomaly_window = atoi(optarg);
+            if (g_config.anomaly_window < 0 || g_config.anomaly_window > ANOMALY_WINDOW_MAX) {
+                fprintf(stderr, "invalid anomaly window (0..%d seconds): %s\n", ANOMALY_WINDOW_MAX, optarg);
+                return -1;
+            }
+            break;
+        case 'I':
+            strncpy(g_config.icaodb_path, optarg, sizeof(g_config.icaodb_path) - 1);
+            g_config.icaodb_path[sizeof(g_config.icaodb_path) - 1] = '\0';
+            break;
+        case 'B':
+            strncpy(g_config.icao_blocks_path, optarg, sizeof(g_config.icao_blocks_path) - 1);
+            g_config.icao_blocks_path[sizeof(g_config.icao_blocks_path) - 1] = '\0';
+            break;
+        case 'E':
+            strncpy(g_config.airports_path, optarg, sizeof(g_config.airports_path) - 1);
+            g_config.airports_path[sizeof(g_config.airports_path) - 1] = '\0';
+            break;
+        case 'G':
+            strncpy(g_config.airspace_path, optarg, sizeof(g_config.airspace_path) - 1);
+            g_config.airspace_path[sizeof(g_config.airspace_path) - 1] = '\0';
+            break;
+        case 'k':
+            if (g_config.sinks_count == SINKS_MAX) {
+                fprintf(stderr, "too many sinks (at most %d): %s\n", SINKS_MAX, optarg);
+                return -1;
+            }
+            snprintf(g_config.sinks[g_config.sinks_count], sizeof(g_config.sinks[0]), "%.*s", (int)sizeof(g_config.sinks[0]) - 1, optarg);
+            g_config.sinks_count++;
+            break;
+        case 'j':
+            snprintf(g_config.serve, sizeof(g_config.serve), "%.*s", (int)sizeof(g_config.serve) - 1, optarg);
+            break;
+        case 'w':
+            snprintf(g_config.http, sizeof(g_config.http), "%.*s", (int)sizeof(g_config.http) - 1, optarg);
+            break;
+        case 'r': {
+            const char *const comma = strchr(optarg, ',');
+            const double range_nm   = atof(optarg);
+            const int altitude_ft   = comma ? atoi(comma + 1) : g_config.airport_range_ft;
+            if (range_nm <= 0 || altitude_ft < 0) {
+                fprintf(stderr, "invalid airport range and altitude (nm, ft): %s\n", optarg);
+                return -1;
+            }
+            g_config.airport_range_nm = range_nm;
+            g_config.airport_range_ft = altitude_ft;
+            break;
+        }
+        case 'g':
+            g_config.track_gate = atof(optarg);
+            if (g_config.track_gate < 0) {
+                fprintf(stderr, "invalid track gate (sigma): %s\n", optarg);
+                return -1;
+            }
+            break;
         default:
         case '?':
             return -1;
         }
     }
+    if (g_config.adsb_port == 0)
+        g_config.adsb_port = adsb_formats[g_config.adsb_format].port;
     return 0;
 }
 
@@ -1354,21 +8954,72 @@ void signal_handler(const int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
         printf("\nsignal received (%s): shutting down\n", sig == SIGINT ? "SIGINT" : "SIGTERM");
         g_running = false;
-    }
+    } else if (sig == SIGUSR1)
+        g_timing.enabled = !g_timing.enabled;
+    else if (sig == SIGUSR2)
+        log_toggle();
+}
+
+void timing_begin(void) {
+    g_timing.enabled     = g_config.timing_sample > 0;
+    g_timing.sample_rate = g_config.timing_sample > 0 ? g_config.timing_sample : DEFAULT_TIMING_SAMPLE;
 }
 
+#ifndef ADSB_ANALYSER_NO_MAIN
 int main(const int argc, char *const argv[]) {
+    if (argc > 1 && strcmp(argv[1], "icaodb-build") == 0)
+        return icaodb_build_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "airports-build") == 0)
+        return airports_build_main(argc - 1, argv + 1);
     const int r = parse_options(argc, argv);
     if (r != 0)
         return r;
     print_config();
 
+    timing_begin();
+    if (!log_begin())
+        return EXIT_FAILURE;
+    mqtt_command_register("log", log_command);
     if (!voxel_map_begin())
         return EXIT_FAILURE;
     if (!aircraft_begin())
         return EXIT_FAILURE;
+    if (!shm_begin())
+        return EXIT_FAILURE;
+    if (!avr_begin())
+        return EXIT_FAILURE;
+    if (!airprox_begin())
+        return EXIT_FAILURE;
+    if (!loiter_begin())
+        return EXIT_FAILURE;
+    if (!vicinity_begin())
+        return EXIT_FAILURE;
+    if (!anomaly_begin())
+        return EXIT_FAILURE;
+    if (!track_begin())
+        return EXIT_FAILURE;
+    if (!icaodb_begin())
+        return EXIT_FAILURE;
+    if (!icao_blocks_begin())
+        return EXIT_FAILURE;
+    if (!airports_begin())
+        return EXIT_FAILURE;
+    if (!airspace_begin())
+        return EXIT_FAILURE;
+    if (!emergency_begin())
+        return EXIT_FAILURE;
+    if (!subscribe_begin())
+        return EXIT_FAILURE;
+    if (!query_begin())
+        return EXIT_FAILURE;
     if (!mqtt_begin(g_config.mqtt_host, g_config.mqtt_port))
         return EXIT_FAILURE;
+    if (!sink_begin())
+        return EXIT_FAILURE;
+    if (!serve_begin())
+        return EXIT_FAILURE;
+    if (!http_begin())
+        return EXIT_FAILURE;
 
     static persist_save_fn save_functions[] = { voxel_map_save, aircraft_stats_save };
     if (!persist_begin(save_functions, sizeof(save_functions) / sizeof(save_functions[0]), g_config.interval_persist, &g_running))
@@ -1379,19 +9030,249 @@ int main(const int argc, char *const argv[]) {
 
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, signal_handler);
+    signal(SIGUSR2, signal_handler);
     signal(SIGPIPE, SIG_IGN);
-    while (interval_wait(&g_last_status, g_config.interval_status, &g_running))
+    while (interval_wait(&g_last_status, g_config.interval_status, &g_running)) {
+        timing_rotate();
         print_status();
+        timing_publish_mqtt();
+    }
+    timing_rotate();
     print_status();
 
     adsb_processing_end();
+    serve_end();
+    http_end();
+    query_end();
     persist_end();
     mqtt_end();
+    sink_end();
+    shm_end();
+    icaodb_end();
+    icao_blocks_end();
+    airports_end();
+    airspace_end();
     aircraft_end();
     voxel_map_end();
+    log_end();
 
     return EXIT_SUCCESS;
 }
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef ADSB_ANALYSER_LIBRARY
+
+#include "adsb_analyser.h"
+
+// the engine drives the same aircraft table, voxel map and counters as the daemon, without its threads, MQTT or signal handling
+
+typedef struct {
+    char line[MAX_LINE_LENGTH];
+    int line_pos;
+    bool initialised;
+} engine_t;
+
+engine_t g_engine = { 0 };
+
+static void engine_position_set(adsb_position_t *const r, const aircraft_posn_t *const pos) {
+    r->lat         = pos->lat;
+    r->lon         = pos->lon;
+    r->altitude_ft = pos->altitude_ft;
+    r->distance_nm = pos->distance_nm;
+    r->timestamp   = (int64_t)pos->timestamp;
+}
+
+static void engine_aircraft_set(adsb_aircraft_t *const r, const aircraft_data_t *const aircraft) {
+    r->bounds_valid = aircraft->bounds_initialised ? 1 : 0;
+    memcpy(r->icao, aircraft->icao, sizeof(aircraft->icao));
+    r->icao[sizeof(aircraft->icao)] = '\0';
+    engine_position_set(&r->current, &aircraft->pos);
+    engine_position_set(&r->first, &aircraft->pos_first);
+    engine_position_set(&r->min_lat, &aircraft->min_lat_pos);
+    engine_position_set(&r->max_lat, &aircraft->max_lat_pos);
+    engine_position_set(&r->min_lon, &aircraft->min_lon_pos);
+    engine_position_set(&r->max_lon, &aircraft->max_lon_pos);
+    engine_position_set(&r->min_alt, &aircraft->min_alt_pos);
+    engine_position_set(&r->max_alt, &aircraft->max_alt_pos);
+    engine_position_set(&r->min_dist, &aircraft->min_dist_pos);
+    engine_position_set(&r->max_dist, &aircraft->max_dist_pos);
+}
+
+static void engine_stats_set(adsb_stats_t *const r, const aircraft_stat_t *const stat) {
+    r->messages_total    = stat->messages_total;
+    r->messages_position = stat->messages_position;
+    r->position_valid    = stat->position_valid;
+    r->position_invalid  = stat->position_invalid;
+    r->published_mqtt    = stat->published_mqtt;
+    r->aircraft_seen     = stat->aircraft_seen;
+    memcpy(r->distance_max_icao, stat->distance_max.icao, sizeof(stat->distance_max.icao));
+    r->distance_max_icao[sizeof(stat->distance_max.icao)] = '\0';
+    engine_position_set(&r->distance_max, &stat->distance_max.pos);
+    memcpy(r->altitude_max_icao, stat->altitude_max.icao, sizeof(stat->altitude_max.icao));
+    r->altitude_max_icao[sizeof(stat->altitude_max.icao)] = '\0';
+    engine_position_set(&r->altitude_max, &stat->altitude_max.pos);
+}
+
+int adsb_api_version(void) { return ADSB_API_VERSION; }
+
+void adsb_engine_config_default(adsb_engine_config_t *const config) {
+    config->position_lat             = DEFAULT_POSITION_LAT;
+    config->position_lon             = DEFAULT_POSITION_LON;
+    config->distance_max_nm          = DEFAULT_DISTANCE_MAX_NM;
+    config->altitude_max_ft          = DEFAULT_ALTITUDE_MAX_FT;
+    config->voxel_size_horizontal_nm = DEFAULT_VOXEL_SIZE_HORIZONTAL_NM;
+    config->voxel_size_vertical_ft   = DEFAULT_VOXEL_SIZE_VERTICAL_FT;
+    config->directory                = NULL;
+}
+
+int adsb_engine_init(const adsb_engine_config_t *const config) {
+    if (g_engine.initialised || !config || !coordinates_are_valid(config->position_lat, config->position_lon) || config->distance_max_nm <= 0 ||
+        config->altitude_max_ft <= 0 || config->voxel_size_horizontal_nm <= 0 || config->voxel_size_vertical_ft <= 0)
+        return -1;
+    if (config->directory && strlen(config->directory) >= sizeof(g_config.directory))
+        return -1;
+    snprintf(g_config.directory, sizeof(g_config.directory), "%s", config->directory ? config->directory : "");
+    g_config.position_lat             = config->position_lat;
+    g_config.position_lon             = config->position_lon;
+    g_config.distance_max_nm          = config->distance_max_nm;
+    g_config.altitude_max_ft          = config->altitude_max_ft;
+    g_config.voxel_size_horizontal_nm = config->voxel_size_horizontal_nm;
+    g_config.voxel_size_vertical_ft   = config->voxel_size_vertical_ft;
+    g_timing.enabled                  = false;
+    if (!track_begin() || !voxel_map_begin())
+        return -1;
+    if (!aircraft_begin()) {
+        voxel_map_end();
+        return -1;
+    }
+    g_engine.line_pos    = 0;
+    g_engine.initialised = true;
+    return 0;
+}
+
+int adsb_engine_save(void) {
+    if (!g_engine.initialised || g_config.directory[0] == '\0')
+        return -1;
+    const bool voxels = voxel_map_save(), stats = aircraft_stats_save();
+    return voxels && stats ? 0 : -1;
+}
+
+void adsb_engine_shutdown(void) {
+    if (!g_engine.initialised)
+        return;
+    aircraft_end();
+    voxel_map_end();
+    memset(g_aircraft_list.entries, 0, sizeof(g_aircraft_list.entries));
+    g_aircraft_list.count = 0;
+    memset(&g_aircraft_stat, 0, sizeof(g_aircraft_stat));
+    memset(&g_aircraft_global, 0, sizeof(g_aircraft_global));
+    g_engine.initialised = false;
+}
+
+int adsb_ingest_line(const char *const line) { return g_engine.initialised && adsb_process_line(line) ? 1 : 0; }
+
+size_t adsb_ingest_buffer(const char *const data, const size_t length) {
+    size_t positions = 0;
+    if (!g_engine.initialised)
+        return 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == '\n' || data[i] == '\r') {
+            if (g_engine.line_pos > 0) {
+                g_engine.line[g_engine.line_pos] = '\0';
+                g_engine.line_pos                = 0;
+                if (adsb_process_line(g_engine.line))
+                    positions++;
+            }
+        } else if (g_engine.line_pos < MAX_LINE_LENGTH - 1)
+            g_engine.line[g_engine.line_pos++] = data[i];
+    }
+    return positions;
+}
+
+size_t adsb_aircraft_count(void) { return g_aircraft_list.count > 0 ? (size_t)g_aircraft_list.count : 0; }
+
+int adsb_aircraft_get(const char *const icao, adsb_aircraft_t *const aircraft) {
+    if (!icao || icao[0] == '\0')
+        return 0;
+    int found = 0;
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    unsigned int index = hash_icao(icao), index_original = index;
+    while (g_aircraft_list.entries[index].icao[0] != '\0') {
+        if (strcmp(g_aircraft_list.entries[index].icao, icao) == 0) {
+            engine_aircraft_set(aircraft, &g_aircraft_list.entries[index]);
+            found = 1;
+            break;
+        }
+        if ((index = (index + 1) & HASH_MASK) == index_original)
+            break;
+    }
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    return found;
+}
+
+size_t adsb_aircraft_list(adsb_aircraft_t *const aircraft, const size_t capacity) {
+    size_t filled = 0;
+    pthread_mutex_lock(&g_aircraft_list.mutex);
+    for (int i = 0; i < MAX_AIRCRAFT && filled < capacity; i++)
+        if (g_aircraft_list.entries[i].icao[0] != '\0')
+            engine_aircraft_set(&aircraft[filled++], &g_aircraft_list.entries[i]);
+    pthread_mutex_unlock(&g_aircraft_list.mutex);
+    return filled;
+}
+
+void adsb_stats_get(adsb_stats_t *const session, adsb_stats_t *const global) {
+    if (session)
+        engine_stats_set(session, &g_aircraft_stat);
+    if (global)
+        engine_stats_set(global, &g_aircraft_global);
+}
+
+int adsb_coverage_info(adsb_coverage_info_t *const info) {
+    double occupancy;
+    if (!voxel_get_stats(&info->occupied, &info->total, &occupancy))
+        return -1;
+    info->size_x             = g_voxel_map.size_x;
+    info->size_y             = g_voxel_map.size_y;
+    info->size_z             = g_voxel_map.size_z;
+    info->horizontal_size_nm = g_voxel_map.horizontal_size_nm;
+    info->vertical_size_ft   = g_voxel_map.vertical_size_ft;
+    return 0;
+}
+
+unsigned int adsb_coverage_at(const double lat, const double lon, const int altitude_ft) {
+    if (!g_voxel_map.data || !coordinates_are_valid(lat, lon))
+        return 0;
+    int x, y, z;
+    voxel_coords_to_indices(lat, lon, altitude_ft, &x, &y, &z);
+    return g_voxel_map.data[voxel_indices_to_index(x, y, z)];
+}
+
+size_t adsb_coverage_layer(const int z, uint16_t *const counts, const size_t capacity) {
+    const size_t layer = (size_t)g_voxel_map.size_x * (size_t)g_voxel_map.size_y;
+    if (!g_voxel_map.data || z < 0 || z >= g_voxel_map.size_z || capacity < layer)
+        return 0;
+    memcpy(counts, &g_voxel_map.data[voxel_indices_to_index(0, 0, z)], layer * sizeof(voxel_data_t));
+    return layer;
+}
+
+double adsb_distance_nm(const double lat1, const double lon1, const double lat2, const double lon2) { return calculate_distance_nm(lat1, lon1, lat2, lon2); }
+
+double adsb_bearing_deg(const double lat1, const double lon1, const double lat2, const double lon2) { return calculate_bearing_deg(lat1, lon1, lat2, lon2); }
+
+void adsb_distance_batch(const double lat, const double lon, const double *const lats, const double *const lons, const size_t count,
+                         double *const distances_nm, double *const bearings_deg) {
+    for (size_t i = 0; i < count; i++) {
+        distances_nm[i] = calculate_distance_nm(lat, lon, lats[i], lons[i]);
+        if (bearings_deg)
+            bearings_deg[i] = adsb_bearing_deg(lat, lon, lats[i], lons[i]);
+    }
+}
+
+#endif
 
 // -----------------------------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------------------------
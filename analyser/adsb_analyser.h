@@ -0,0 +1,111 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// libadsbanalyser: the analyser's ingest, aircraft table, voxel coverage and geodesy as an in-process engine (make lib builds
+// libadsbanalyser.a/.so from adsb_analyser.c with ADSB_ANALYSER_LIBRARY, link with -lm -lpthread -lrt -lmosquitto -lcjson -lz -lbrotlienc)
+//
+// there is one engine per process and no threads are started: the caller feeds SBS text with adsb_ingest_*() from one thread at a time,
+// queries may come from any thread (the aircraft table is locked, counters are read without locking); the API is versioned by
+// ADSB_API_VERSION and only ever extended, structures are passed by caller owned storage
+
+#ifndef ADSB_ANALYSER_H
+#define ADSB_ANALYSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ADSB_API_VERSION 1
+#define ADSB_API         __attribute__((visibility("default")))
+
+typedef struct {
+    double lat;
+    double lon;
+    int altitude_ft;
+    double distance_nm;
+    int64_t timestamp;
+} adsb_position_t;
+
+typedef struct {
+    char icao[8];
+    int bounds_valid;
+    adsb_position_t current, first;
+    adsb_position_t min_lat, max_lat, min_lon, max_lon, min_alt, max_alt, min_dist, max_dist;
+} adsb_aircraft_t;
+
+typedef struct {
+    uint64_t messages_total;
+    uint64_t messages_position;
+    uint64_t position_valid;
+    uint64_t position_invalid;
+    uint64_t published_mqtt;
+    uint64_t aircraft_seen;
+    char distance_max_icao[8];
+    adsb_position_t distance_max;
+    char altitude_max_icao[8];
+    adsb_position_t altitude_max;
+} adsb_stats_t;
+
+// directory: where the voxel map and stats are loaded from and saved to by adsb_engine_save(), NULL or "" for none
+typedef struct {
+    double position_lat;
+    double position_lon;
+    double distance_max_nm;
+    int altitude_max_ft;
+    double voxel_size_horizontal_nm;
+    double voxel_size_vertical_ft;
+    const char *directory;
+} adsb_engine_config_t;
+
+typedef struct {
+    int size_x, size_y, size_z;
+    double horizontal_size_nm;
+    double vertical_size_ft;
+    size_t occupied, total;
+} adsb_coverage_info_t;
+
+ADSB_API int adsb_api_version(void);
+
+ADSB_API void adsb_engine_config_default(adsb_engine_config_t *config);
+ADSB_API int adsb_engine_init(const adsb_engine_config_t *config);
+ADSB_API int adsb_engine_save(void);
+ADSB_API void adsb_engine_shutdown(void);
+
+// a single line without its line ending, returns 1 if it was a position accepted into the aircraft table (within the configured range
+// and altitude, and consistent with the aircraft's track), 0 for anything else including rejected positions
+ADSB_API int adsb_ingest_line(const char *line);
+// a stream chunk, split on CR/LF with any partial line carried to the next call, returns the number of positions accepted as
+// adsb_ingest_line counts them
+ADSB_API size_t adsb_ingest_buffer(const char *data, size_t length);
+
+ADSB_API size_t adsb_aircraft_count(void);
+// 1 and *aircraft filled if known, 0 otherwise
+ADSB_API int adsb_aircraft_get(const char *icao, adsb_aircraft_t *aircraft);
+// fills up to capacity entries, returns how many were filled
+ADSB_API size_t adsb_aircraft_list(adsb_aircraft_t *aircraft, size_t capacity);
+// either pointer may be NULL
+ADSB_API void adsb_stats_get(adsb_stats_t *session, adsb_stats_t *global);
+
+ADSB_API int adsb_coverage_info(adsb_coverage_info_t *info);
+// hit count of the voxel containing the position
+ADSB_API unsigned int adsb_coverage_at(double lat, double lon, int altitude_ft);
+// the size_x * size_y counts of altitude layer z (row major, y north), returns the number written or 0 if z or capacity is out of range
+ADSB_API size_t adsb_coverage_layer(int z, uint16_t *counts, size_t capacity);
+
+// great circle distance in nautical miles and initial bearing in degrees 0..360
+ADSB_API double adsb_distance_nm(double lat1, double lon1, double lat2, double lon2);
+ADSB_API double adsb_bearing_deg(double lat1, double lon1, double lat2, double lon2);
+// from (lat, lon) to each of count points, bearings may be NULL
+ADSB_API void adsb_distance_batch(double lat, double lon, const double *lats, const double *lons, size_t count, double *distances_nm, double *bearings_deg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
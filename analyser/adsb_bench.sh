@@ -0,0 +1,101 @@
+#!/bin/bash
+# run the analyser against the synthetic feed from adsb_generator and report sustained messages/sec, cpu per message, rss and the
+# publish latency histograms: usage: adsb_bench.sh [--aircraft=N] [--rate=N] [--duration=SEC] [--seed=N] [--mqtt=HOST[:PORT]]
+
+set -eu
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+ANALYSER="$DIR/adsb_analyser"
+GENERATOR="$DIR/adsb_generator"
+
+AIRCRAFT=1000
+RATE=0
+DURATION=30
+SEED=1
+PORT=30903
+MQTT=""
+MQTT_PORT=18830
+
+for arg in "$@"; do
+    case "$arg" in
+    --aircraft=*) AIRCRAFT="${arg#*=}" ;;
+    --rate=*) RATE="${arg#*=}" ;;
+    --duration=*) DURATION="${arg#*=}" ;;
+    --seed=*) SEED="${arg#*=}" ;;
+    --mqtt=*) MQTT="${arg#*=}" ;;
+    *)
+        echo "usage: $0 [--aircraft=N] [--rate=N] [--duration=SEC] [--seed=N] [--mqtt=HOST[:PORT]]"
+        exit 1
+        ;;
+    esac
+done
+
+WORK=$(mktemp -d)
+PIDS=""
+cleanup() {
+    for pid in $PIDS; do kill "$pid" 2>/dev/null || true; done
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# a private broker keeps the run independent of whatever is on 1883, when mosquitto is installed
+if [ -z "$MQTT" ]; then
+    if command -v mosquitto >/dev/null 2>&1; then
+        mosquitto -p "$MQTT_PORT" >"$WORK/mosquitto.log" 2>&1 &
+        PIDS="$PIDS $!"
+        MQTT="127.0.0.1:$MQTT_PORT"
+        sleep 0.5
+    else
+        MQTT="127.0.0.1:1883"
+    fi
+fi
+
+if [ "$RATE" -gt 0 ]; then
+    GENERATOR_LIMIT="--duration=$((DURATION * 2))"
+else
+    # unthrottled: loop a preformatted stream so the generator is never the bottleneck; each loop sends every aircraft back to its first
+    # position, which the tracker rejects as a jump, so this measures throughput rather than position or tracker results
+    GENERATOR_LIMIT="--messages=1000000 --preload --repeat"
+fi
+"$GENERATOR" --aircraft="$AIRCRAFT" --seed="$SEED" --rate="$RATE" $GENERATOR_LIMIT --port="$PORT" 2>"$WORK/generator.log" &
+PIDS="$PIDS $!"
+for _ in $(seq 1 300); do
+    grep -q 'listening' "$WORK/generator.log" && break
+    sleep 0.1
+done
+
+START=$(date +%s.%N)
+"$ANALYSER" --adsb="127.0.0.1:$PORT" --mqtt="$MQTT" --directory="$WORK" --mqtt-interval=5 --status-interval=3600 --persist-interval=3600 \
+    >"$WORK/analyser.log" 2>&1 &
+ANALYSER_PID=$!
+PIDS="$PIDS $ANALYSER_PID"
+
+sleep "$DURATION"
+
+if ! kill -0 "$ANALYSER_PID" 2>/dev/null; then
+    echo "bench: analyser exited early:"
+    cat "$WORK/analyser.log"
+    exit 1
+fi
+CLK_TCK=$(getconf CLK_TCK)
+CPU_TICKS=$(awk '{ print $14 + $15 }' "/proc/$ANALYSER_PID/stat")
+RSS_KB=$(awk '/^VmRSS:/ { print $2 }' "/proc/$ANALYSER_PID/status")
+HWM_KB=$(awk '/^VmHWM:/ { print $2 }' "/proc/$ANALYSER_PID/status")
+END=$(date +%s.%N)
+kill -INT "$ANALYSER_PID"
+wait "$ANALYSER_PID" || true
+
+STATUS=$(grep '^status:' "$WORK/analyser.log" | tail -1)
+TIMING=$(grep '^timing:' "$WORK/analyser.log" | tail -1)
+MESSAGES=$(echo "$STATUS" | sed -n 's/^status: messages=\([0-9]*\) .*/\1/p')
+MESSAGES=${MESSAGES:-0}
+
+awk -v messages="$MESSAGES" -v start="$START" -v end="$END" -v ticks="$CPU_TICKS" -v tck="$CLK_TCK" -v rss="$RSS_KB" -v hwm="$HWM_KB" \
+    -v aircraft="$AIRCRAFT" -v rate="$RATE" -v seed="$SEED" 'BEGIN {
+    elapsed = end - start; cpu = ticks / tck;
+    printf("bench: aircraft=%d rate=%s seed=%d elapsed=%.1fs\n", aircraft, rate > 0 ? rate "/s" : "unthrottled", seed, elapsed);
+    printf("bench: messages=%d (%.0f msgs/sec sustained)\n", messages, elapsed > 0 ? messages / elapsed : 0);
+    printf("bench: cpu=%.2fs (%.1f%% of one core, %.0f ns/message)\n", cpu, elapsed > 0 ? cpu * 100 / elapsed : 0, messages > 0 ? cpu * 1e9 / messages : 0);
+    printf("bench: rss=%.1fMB (peak %.1fMB)\n", rss / 1024, hwm / 1024);
+}'
+echo "bench: $TIMING"
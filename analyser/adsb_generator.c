@@ -0,0 +1,571 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// deterministic synthetic SBS (port 30003 format) traffic generator: N aircraft flying great circle legs between random points around
+// a reference position, emitting MSG,1-8 in roughly the proportions dump1090 produces; identical options give an identical stream
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define DEFAULT_AIRCRAFT     500
+#define DEFAULT_SEED         1
+#define DEFAULT_RATE         0
+#define DEFAULT_MESSAGES     0
+#define DEFAULT_DURATION     60
+#define DEFAULT_POSITION_LAT 51.501126
+#define DEFAULT_POSITION_LON -0.14239
+#define DEFAULT_RADIUS_NM    250.0
+
+#define NOMINAL_RATE         10000 // simulated messages/sec used to advance the clock when unthrottled
+#define ADVANCE_INTERVAL     0.5 // seconds between kinematic updates of an aircraft, keeps trig off the per message path
+#define SIMULATION_EPOCH     1704067200 // 2024-01-01T00:00:00Z, fixed so output is reproducible
+#define OUTPUT_BUFFER_SIZE   (64 * 1024)
+#define MAX_LINE_LENGTH      512
+#define MAX_NAME_LENGTH      256
+#define EARTH_RADIUS_NM      3440.065
+
+#define MAX(a, b)            ((a) > (b) ? (a) : (b))
+#define MIN(a, b)            ((a) < (b) ? (a) : (b))
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    unsigned int aircraft;
+    uint64_t seed;
+    unsigned long rate;
+    unsigned long messages;
+    unsigned long duration;
+    double position_lat, position_lon;
+    double radius_nm;
+    unsigned short port;
+    char output[MAX_NAME_LENGTH];
+    bool preload, repeat;
+} config_t;
+
+typedef struct {
+    unsigned int icao;
+    char callsign[9];
+    unsigned int squawk;
+    double lat, lon;
+    double dest_lat, dest_lon;
+    double altitude_ft, altitude_target_ft, vertical_rate_fpm;
+    double speed_kts, track_deg;
+    double updated;
+    bool on_ground;
+} sim_aircraft_t;
+
+typedef struct {
+    int type;
+    unsigned int weight; // per 1000 messages
+} sim_message_ratio_t;
+
+typedef struct {
+    char *data;
+    size_t used, size;
+} sim_buffer_t;
+
+// approximate mix observed from dump1090 SBS output: airborne position and velocity dominate, identity and squawk are rare
+const sim_message_ratio_t sim_message_ratios[] = {
+    { 3, 350 }, { 4, 250 }, { 5, 150 }, { 7, 120 }, { 8, 80 }, { 6, 25 }, { 1, 20 }, { 2, 5 },
+};
+
+config_t g_config = {
+    .aircraft     = DEFAULT_AIRCRAFT,
+    .seed         = DEFAULT_SEED,
+    .rate         = DEFAULT_RATE,
+    .messages     = DEFAULT_MESSAGES,
+    .duration     = DEFAULT_DURATION,
+    .position_lat = DEFAULT_POSITION_LAT,
+    .position_lon = DEFAULT_POSITION_LON,
+    .radius_nm    = DEFAULT_RADIUS_NM,
+    .port         = 0,
+    .output       = "",
+    .preload      = false,
+    .repeat       = false,
+};
+sim_aircraft_t *g_aircraft = NULL;
+sim_buffer_t g_preload     = { 0 };
+uint64_t g_random_state    = 0;
+volatile bool g_running    = true;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t random_next(void) { // splitmix64
+    uint64_t z = (g_random_state += 0x9E3779B97F4A7C15ULL);
+    z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z          = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double random_uniform(const double lo, const double hi) { return lo + (hi - lo) * ((double)(random_next() >> 11) / (double)(1ULL << 53)); }
+
+static unsigned int random_below(const unsigned int n) { return (unsigned int)(random_next() % n); }
+
+static double deg2rad(const double d) { return d * M_PI / 180.0; }
+static double rad2deg(const double r) { return r * 180.0 / M_PI; }
+
+static double geodesy_distance_nm(const double lat1, const double lon1, const double lat2, const double lon2) {
+    const double dlat = deg2rad(lat2 - lat1), dlon = deg2rad(lon2 - lon1);
+    const double a = sin(dlat / 2) * sin(dlat / 2) + cos(deg2rad(lat1)) * cos(deg2rad(lat2)) * sin(dlon / 2) * sin(dlon / 2);
+    return EARTH_RADIUS_NM * 2 * atan2(sqrt(a), sqrt(1 - a));
+}
+
+static double geodesy_bearing_deg(const double lat1, const double lon1, const double lat2, const double lon2) {
+    const double p1 = deg2rad(lat1), p2 = deg2rad(lat2), dl = deg2rad(lon2 - lon1);
+    return fmod(rad2deg(atan2(sin(dl) * cos(p2), cos(p1) * sin(p2) - sin(p1) * cos(p2) * cos(dl))) + 360.0, 360.0);
+}
+
+static void geodesy_destination(const double lat, const double lon, const double bearing_deg, const double distance_nm, double *const lat_out,
+                                double *const lon_out) {
+    const double d = distance_nm / EARTH_RADIUS_NM, b = deg2rad(bearing_deg), p1 = deg2rad(lat), l1 = deg2rad(lon);
+    const double p2 = asin(sin(p1) * cos(d) + cos(p1) * sin(d) * cos(b));
+    const double l2 = l1 + atan2(sin(b) * sin(d) * cos(p1), cos(d) - sin(p1) * sin(p2));
+    *lat_out        = rad2deg(p2);
+    *lon_out        = fmod(rad2deg(l2) + 540.0, 360.0) - 180.0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void sim_aircraft_random_point(double *const lat, double *const lon) {
+    // uniform over the disc: sqrt of uniform radius
+    geodesy_destination(g_config.position_lat, g_config.position_lon, random_uniform(0.0, 360.0), g_config.radius_nm * sqrt(random_uniform(0.0, 1.0)), lat,
+                        lon);
+}
+
+static void sim_aircraft_spawn(sim_aircraft_t *const a, const unsigned int index, const double now) {
+    static const char *const operators[] = { "BAW", "EZY", "RYR", "VIR", "DLH", "AFR", "KLM", "UAE", "SAS", "TOM" };
+    a->icao                              = (0x400000u + index * 7919u + (unsigned int)random_below(7919)) & 0xFFFFFFu;
+    snprintf(a->callsign, sizeof(a->callsign), "%s%u", operators[random_below(sizeof(operators) / sizeof(operators[0]))], 100 + random_below(9000));
+    a->squawk = (random_below(8) << 9) | (random_below(8) << 6) | (random_below(8) << 3) | random_below(8);
+    sim_aircraft_random_point(&a->lat, &a->lon);
+    sim_aircraft_random_point(&a->dest_lat, &a->dest_lon);
+    a->on_ground          = random_below(50) == 0;
+    a->altitude_ft        = a->on_ground ? 0.0 : random_uniform(1000.0, 41000.0);
+    a->altitude_target_ft = a->on_ground ? 0.0 : 1000.0 * (double)(5 + random_below(36));
+    a->vertical_rate_fpm  = 0.0;
+    a->speed_kts          = a->on_ground ? random_uniform(5.0, 25.0) : random_uniform(180.0, 520.0);
+    a->track_deg          = geodesy_bearing_deg(a->lat, a->lon, a->dest_lat, a->dest_lon);
+    a->updated            = now;
+}
+
+static void sim_aircraft_advance(sim_aircraft_t *const a, const unsigned int index, const double now) {
+    const double dt = now - a->updated;
+    if (dt < ADVANCE_INTERVAL)
+        return;
+    a->updated = now;
+
+    const double step_nm = a->speed_kts * dt / 3600.0, remaining_nm = geodesy_distance_nm(a->lat, a->lon, a->dest_lat, a->dest_lon);
+    if (remaining_nm <= step_nm) {
+        sim_aircraft_spawn(a, index, now);
+        return;
+    }
+    // follow the great circle by re-deriving the initial bearing to the destination at each step
+    a->track_deg = geodesy_bearing_deg(a->lat, a->lon, a->dest_lat, a->dest_lon);
+    geodesy_destination(a->lat, a->lon, a->track_deg, step_nm, &a->lat, &a->lon);
+
+    if (!a->on_ground) {
+        const double delta_ft = a->altitude_target_ft - a->altitude_ft;
+        a->vertical_rate_fpm  = fabs(delta_ft) < 50.0 ? 0.0 : (delta_ft > 0 ? 1.0 : -1.0) * fmin(2000.0, fabs(delta_ft) * 6.0);
+        a->altitude_ft += a->vertical_rate_fpm * dt / 60.0;
+    }
+}
+
+typedef struct {
+    long long millis;
+    char date[16], clock[16];
+} sim_clock_t;
+
+sim_clock_t g_clock = { .millis = -1 };
+
+// many consecutive messages share a millisecond, so the date and time fields are formatted once per tick
+static const sim_clock_t *sim_format_time(const double t) {
+    const long long millis = (long long)(t * 1000.0);
+    if (millis != g_clock.millis) {
+        const time_t seconds = (time_t)SIMULATION_EPOCH + (time_t)(millis / 1000);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        strftime(g_clock.date, sizeof(g_clock.date), "%Y/%m/%d", &tm);
+        snprintf(g_clock.clock, sizeof(g_clock.clock), "%02d:%02d:%02d.%03d", tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(millis % 1000));
+        g_clock.millis = millis;
+    }
+    return &g_clock;
+}
+
+static int sim_message_type(void) {
+    unsigned int pick = random_below(1000);
+    for (size_t i = 0; i < sizeof(sim_message_ratios) / sizeof(sim_message_ratios[0]); i++) {
+        if (pick < sim_message_ratios[i].weight)
+            return sim_message_ratios[i].type;
+        pick -= sim_message_ratios[i].weight;
+    }
+    return 3;
+}
+
+static int sim_message_format(const sim_aircraft_t *const a, const int type, const double t, char *const line, const size_t line_size) {
+    const sim_clock_t *const clock = sim_format_time(t);
+    const int altitude = (int)(a->altitude_ft / 25.0) * 25, ground = a->on_ground ? -1 : 0;
+    const int n = snprintf(line, line_size, "MSG,%d,1,1,%06X,1,%s,%s,%s,%s,", type, a->icao, clock->date, clock->clock, clock->date, clock->clock);
+    if (n < 0 || (size_t)n >= line_size)
+        return -1;
+    char *const p  = line + n;
+    const size_t r = line_size - (size_t)n;
+    int m          = -1;
+    switch (type) {
+    case 1:
+        m = snprintf(p, r, "%s,,,,,,,,,,,0\r\n", a->callsign);
+        break;
+    case 2:
+        m = snprintf(p, r, ",%d,%.0f,%.0f,%.5f,%.5f,,,,,,-1\r\n", 0, a->speed_kts, a->track_deg, a->lat, a->lon);
+        break;
+    case 3:
+        m = snprintf(p, r, ",%d,,,%.5f,%.5f,,,0,0,0,%d\r\n", altitude, a->lat, a->lon, ground);
+        break;
+    case 4:
+        m = snprintf(p, r, ",,%.0f,%.0f,,,%.0f,,,,,%d\r\n", a->speed_kts, a->track_deg, a->vertical_rate_fpm, ground);
+        break;
+    case 5:
+        m = snprintf(p, r, ",%d,,,,,,,0,,0,%d\r\n", altitude, ground);
+        break;
+    case 6:
+        m = snprintf(p, r, ",%d,,,,,,%04o,0,0,0,%d\r\n", altitude, a->squawk, ground);
+        break;
+    case 7:
+        m = snprintf(p, r, ",%d,,,,,,,,,,%d\r\n", altitude, ground);
+        break;
+    case 8:
+        m = snprintf(p, r, ",,,,,,,,,,,%d\r\n", ground);
+        break;
+    default:
+        break;
+    }
+    if (m < 0 || (size_t)m >= r)
+        return -1;
+    return n + m;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// the number of bytes written, less than length if the write failed
+static size_t output_write(const int fd, const char *const data, const size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        const ssize_t n = write(fd, data + written, length - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EPIPE && errno != ECONNRESET)
+                fprintf(stderr, "generator: write failed: %s\n", strerror(errno));
+            break;
+        }
+        written += (size_t)n;
+    }
+    return written;
+}
+
+static int output_open_socket(const unsigned short port) {
+    const int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) {
+        fprintf(stderr, "generator: socket failed: %s\n", strerror(errno));
+        return -1;
+    }
+    const int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 1) < 0) {
+        fprintf(stderr, "generator: bind/listen on port %d failed: %s\n", port, strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+    fprintf(stderr, "generator: listening on 127.0.0.1:%d\n", port);
+    const int fd = accept(listenfd, NULL, NULL);
+    close(listenfd);
+    if (fd < 0) {
+        fprintf(stderr, "generator: accept failed: %s\n", strerror(errno));
+        return -1;
+    }
+    fprintf(stderr, "generator: client connected\n");
+    return fd;
+}
+
+static bool sim_buffer_append(sim_buffer_t *const b, const char *const data, const size_t length) {
+    if (b->used + length > b->size) {
+        const size_t size = MAX(b->size * 2, b->used + length + OUTPUT_BUFFER_SIZE);
+        char *const grown = (char *)realloc(b->data, size);
+        if (!grown) {
+            fprintf(stderr, "generator: failed to allocate %zu bytes for preload\n", size);
+            return false;
+        }
+        b->data = grown;
+        b->size = size;
+    }
+    memcpy(b->data + b->used, data, length);
+    b->used += length;
+    return true;
+}
+
+// preloaded output takes formatting off the send path, so an unthrottled run measures the consumer rather than the generator; every
+// repeat replays the same aircraft from the same positions, so to a consumer each pass jumps every aircraft back to where it started
+// and a repeated run is for throughput, not for what the consumer makes of the positions; a pass cut short counts the whole messages
+// it wrote
+static unsigned long output_preloaded(const int fd, const sim_buffer_t *const b, const unsigned long messages) {
+    unsigned long sent = 0;
+    do {
+        size_t offset = 0;
+        while (offset < b->used && g_running) {
+            const size_t length = MIN((size_t)OUTPUT_BUFFER_SIZE, b->used - offset), written = output_write(fd, b->data + offset, length);
+            offset += written;
+            if (written < length)
+                break;
+        }
+        if (offset < b->used) {
+            for (const char *p = b->data; (p = (const char *)memchr(p, '\n', (size_t)(b->data + offset - p))) != NULL; p++)
+                sent++;
+            return sent;
+        }
+        sent += messages;
+    } while (g_config.repeat && g_running);
+    return sent;
+}
+
+static void pace_wait(const struct timespec *const start, const double simulated) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+    if (simulated > elapsed) {
+        const double wait        = simulated - elapsed;
+        const struct timespec ts = { .tv_sec = (time_t)wait, .tv_nsec = (long)((wait - floor(wait)) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// generates the stream to fd, or into g_preload when fd < 0, returning the number of messages
+unsigned long generate(const int fd) {
+    g_random_state = g_config.seed;
+    for (unsigned int i = 0; i < g_config.aircraft; i++)
+        sim_aircraft_spawn(&g_aircraft[i], i, 0.0);
+
+    const double clock_rate      = (double)(g_config.rate > 0 ? g_config.rate : NOMINAL_RATE);
+    const unsigned long messages = g_config.messages > 0 ? g_config.messages : (unsigned long)(clock_rate * (double)g_config.duration);
+    static char buffer[OUTPUT_BUFFER_SIZE];
+    size_t buffer_used = 0;
+    unsigned long sent = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (g_running && sent < messages) {
+        const double t           = (double)sent / clock_rate;
+        const unsigned int index = random_below(g_config.aircraft);
+        sim_aircraft_t *const a  = &g_aircraft[index];
+        sim_aircraft_advance(a, index, t);
+        char line[MAX_LINE_LENGTH];
+        const int n = sim_message_format(a, sim_message_type(), t, line, sizeof(line));
+        if (n <= 0)
+            continue;
+        if (fd < 0) {
+            if (!sim_buffer_append(&g_preload, line, (size_t)n))
+                break;
+            sent++;
+            continue;
+        }
+        if (buffer_used + (size_t)n > sizeof(buffer)) {
+            if (g_config.rate > 0)
+                pace_wait(&start, t);
+            if (output_write(fd, buffer, buffer_used) < buffer_used)
+                break;
+            buffer_used = 0;
+        }
+        memcpy(buffer + buffer_used, line, (size_t)n);
+        buffer_used += (size_t)n;
+        sent++;
+    }
+    if (buffer_used > 0)
+        output_write(fd, buffer, buffer_used);
+    return sent;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+void print_help(const char *const prog_name) {
+    printf("usage: %s [options]\n", prog_name);
+    printf("options:\n");
+    printf("  --help                  Show this help message\n");
+    printf("  --aircraft=N            Number of simulated aircraft (default: %d)\n", DEFAULT_AIRCRAFT);
+    printf("  --seed=N                Random seed (default: %d)\n", DEFAULT_SEED);
+    printf("  --rate=N                Messages per second, 0 for unthrottled (default: %d)\n", DEFAULT_RATE);
+    printf("  --messages=N            Number of messages, overrides duration (default: %d)\n", DEFAULT_MESSAGES);
+    printf("  --duration=SEC          Simulated duration in seconds (default: %d)\n", DEFAULT_DURATION);
+    printf("  --position=LAT,LON      Centre of the traffic area (default: %.4f,%.4f)\n", DEFAULT_POSITION_LAT, DEFAULT_POSITION_LON);
+    printf("  --radius=NM             Radius of the traffic area in nautical miles (default: %.0f)\n", DEFAULT_RADIUS_NM);
+    printf("  --port=PORT             Serve on 127.0.0.1:PORT to the first client, instead of writing\n");
+    printf("  --output=FILE           Write to FILE (default: stdout)\n");
+    printf("  --preload               Format all messages before sending (unthrottled only)\n");
+    printf("  --repeat                Send the preloaded messages repeatedly until interrupted, for throughput only as every\n");
+    printf("                          pass replays the same positions\n");
+    printf("examples:\n");
+    printf("  %s --aircraft=2000 --rate=20000 --port=30003\n", prog_name);
+    printf("  %s --messages=1000000 --output=feed.sbs\n", prog_name);
+}
+
+const struct option long_options[] = { { "help", no_argument, 0, 'h' },
+                                       { "aircraft", required_argument, 0, 'n' },
+                                       { "seed", required_argument, 0, 's' },
+                                       { "rate", required_argument, 0, 'r' },
+                                       { "messages", required_argument, 0, 'm' },
+                                       { "duration", required_argument, 0, 'd' },
+                                       { "position", required_argument, 0, 'p' },
+                                       { "radius", required_argument, 0, 'R' },
+                                       { "port", required_argument, 0, 'P' },
+                                       { "output", required_argument, 0, 'o' },
+                                       { "preload", no_argument, 0, 'L' },
+                                       { "repeat", no_argument, 0, 'E' },
+                                       { 0, 0, 0, 0 } };
+
+int parse_options(const int argc, char *const argv[]) {
+    int option_index = 0, c;
+    while ((c = getopt_long(argc, argv, "h", long_options, &option_index)) != -1) {
+        switch (c) {
+        case 'h':
+            print_help(argv[0]);
+            return 1;
+        case 'n':
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "invalid aircraft count: %s\n", optarg);
+                return -1;
+            }
+            g_config.aircraft = (unsigned int)atoi(optarg);
+            break;
+        case 's':
+            g_config.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            g_config.rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            g_config.messages = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            g_config.duration = strtoul(optarg, NULL, 10);
+            break;
+        case 'p': {
+            char *const comma = strchr(optarg, ',');
+            if (!comma) {
+                fprintf(stderr, "invalid position format (lat, lon): %s\n", optarg);
+                return -1;
+            }
+            g_config.position_lat = atof(optarg);
+            g_config.position_lon = atof(comma + 1);
+            break;
+        }
+        case 'R':
+            g_config.radius_nm = atof(optarg);
+            if (g_config.radius_nm <= 0) {
+                fprintf(stderr, "invalid radius (nm): %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'P':
+            if (atoi(optarg) <= 0 || atoi(optarg) > 65535) {
+                fprintf(stderr, "invalid port number: %s\n", optarg);
+                return -1;
+            }
+            g_config.port = (unsigned short)atoi(optarg);
+            break;
+        case 'o':
+            strncpy(g_config.output, optarg, sizeof(g_config.output) - 1);
+            g_config.output[sizeof(g_config.output) - 1] = '\0';
+            break;
+        case 'L':
+            g_config.preload = true;
+            break;
+        case 'E':
+            g_config.repeat = true;
+            break;
+        default:
+        case '?':
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void signal_handler(const int sig) {
+    if (sig == SIGINT || sig == SIGTERM)
+        g_running = false;
+}
+
+int main(const int argc, char *const argv[]) {
+    const int r = parse_options(argc, argv);
+    if (r != 0)
+        return r;
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    g_aircraft = (sim_aircraft_t *)calloc(g_config.aircraft, sizeof(sim_aircraft_t));
+    if (!g_aircraft) {
+        fprintf(stderr, "generator: failed to allocate %u aircraft\n", g_config.aircraft);
+        return EXIT_FAILURE;
+    }
+    const bool preloading = g_config.preload && g_config.rate == 0;
+    if (preloading) {
+        const unsigned long preloaded = generate(-1);
+        fprintf(stderr, "generator: preloaded %lu messages (%.1f MB)\n", preloaded, (double)g_preload.used / (double)(1024 * 1024));
+        g_config.messages = preloaded;
+    }
+
+    int fd = STDOUT_FILENO;
+    if (g_config.port > 0) {
+        if ((fd = output_open_socket(g_config.port)) < 0)
+            return EXIT_FAILURE;
+    } else if (g_config.output[0] != '\0') {
+        FILE *const fp = fopen(g_config.output, "wb");
+        if (!fp) {
+            fprintf(stderr, "generator: failed to open output: %s\n", g_config.output);
+            return EXIT_FAILURE;
+        }
+        fd = dup(fileno(fp));
+        fclose(fp);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const unsigned long sent = preloading ? output_preloaded(fd, &g_preload, g_config.messages) : generate(fd);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "generator: sent %lu messages from %u aircraft in %.2fs (%.0f msgs/sec)\n", sent, g_config.aircraft, elapsed,
+            elapsed > 0 ? (double)sent / elapsed : 0.0);
+
+    if (fd != STDOUT_FILENO)
+        close(fd);
+    free(g_preload.data);
+    free(g_aircraft);
+    return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,410 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// component microbenchmarks for the analyser hot paths: the analyser is compiled into this binary (without its main) so each function
+// is measured as built, inputs come from fixed seeds so numbers are comparable between commits, and hardware counters are read through
+// perf_event_open when the kernel allows it (see /proc/sys/kernel/perf_event_paranoid)
+
+#define ADSB_ANALYSER_NO_MAIN
+#include "adsb_analyser.c"
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_SEED        0x5EED5EEDULL
+#define BENCH_REPEATS     5
+#define BENCH_CORPUS_SIZE 4096
+#define BENCH_CORPUS_MASK (BENCH_CORPUS_SIZE - 1)
+#define BENCH_RADIUS_NM   300.0
+
+typedef struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_counter_def_t;
+
+const perf_counter_def_t perf_counter_defs[] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+};
+#define PERF_COUNTERS (sizeof(perf_counter_defs) / sizeof(perf_counter_defs[0]))
+
+typedef struct {
+    int fds[PERF_COUNTERS];
+    bool available;
+} perf_counters_t;
+
+typedef struct {
+    double ns_per_op;
+    double counters[PERF_COUNTERS]; // per op
+    bool counters_valid;
+} bench_result_t;
+
+typedef struct {
+    char lines[BENCH_CORPUS_SIZE][MAX_LINE_LENGTH];
+    char icaos[BENCH_CORPUS_SIZE][7];
+    double lats[BENCH_CORPUS_SIZE], lons[BENCH_CORPUS_SIZE];
+    int altitudes[BENCH_CORPUS_SIZE];
+} bench_corpus_t;
+
+perf_counters_t g_perf    = { 0 };
+bench_corpus_t g_corpus   = { 0 };
+uint64_t g_bench_random   = BENCH_SEED;
+const char *g_bench_match = NULL;
+volatile double g_bench_sink;
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static bool perf_begin(void) {
+    for (size_t i = 0; i < PERF_COUNTERS; i++)
+        g_perf.fds[i] = -1;
+    for (size_t i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr = { 0 };
+        attr.size                   = sizeof(attr);
+        attr.type                   = perf_counter_defs[i].type;
+        attr.config                 = perf_counter_defs[i].config;
+        attr.disabled               = i == 0;
+        attr.exclude_kernel         = 1;
+        attr.exclude_hv             = 1;
+        attr.read_format            = PERF_FORMAT_GROUP;
+        g_perf.fds[i]               = (int)syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : g_perf.fds[0], 0);
+        if (g_perf.fds[i] < 0) {
+            printf("microbench: perf counter '%s' unavailable (%s), reporting time only\n", perf_counter_defs[i].name, strerror(errno));
+            for (size_t j = 0; j < i; j++)
+                close(g_perf.fds[j]);
+            return (g_perf.available = false);
+        }
+    }
+    return (g_perf.available = true);
+}
+
+static void perf_end(void) {
+    if (g_perf.available)
+        for (size_t i = 0; i < PERF_COUNTERS; i++)
+            close(g_perf.fds[i]);
+}
+
+static void perf_start(void) {
+    if (g_perf.available) {
+        ioctl(g_perf.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(g_perf.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static bool perf_stop(uint64_t values[PERF_COUNTERS]) {
+    if (!g_perf.available)
+        return false;
+    ioctl(g_perf.fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t buffer[1 + PERF_COUNTERS];
+    if (read(g_perf.fds[0], buffer, sizeof(buffer)) != (ssize_t)sizeof(buffer) || buffer[0] != PERF_COUNTERS)
+        return false;
+    memcpy(values, &buffer[1], sizeof(uint64_t) * PERF_COUNTERS);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t bench_random_next(void) { // splitmix64
+    uint64_t z = (g_bench_random += 0x9E3779B97F4A7C15ULL);
+    z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z          = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double bench_random_uniform(const double lo, const double hi) {
+    return lo + (hi - lo) * ((double)(bench_random_next() >> 11) / (double)(1ULL << 53));
+}
+
+static void bench_corpus_begin(void) {
+    // message mix as emitted by dump1090: every type is decoded, only MSG,3 carries an airborne position
+    static const int types[] = { 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 5, 5, 5, 7, 7, 8, 6, 1 };
+    g_bench_random           = BENCH_SEED;
+    for (int i = 0; i < BENCH_CORPUS_SIZE; i++) {
+        snprintf(g_corpus.icaos[i], sizeof(g_corpus.icaos[i]), "%06X", (unsigned int)(bench_random_next() & 0xFFFFFF));
+        const double bearing = bench_random_uniform(0.0, 2.0 * M_PI), range = BENCH_RADIUS_NM * sqrt(bench_random_uniform(0.0, 1.0));
+        g_corpus.lats[i]      = g_config.position_lat + range * cos(bearing) / 60.0;
+        g_corpus.lons[i]      = g_config.position_lon + range * sin(bearing) / (60.0 * cos(g_config.position_lat * M_PI / 180.0));
+        g_corpus.altitudes[i] = (int)bench_random_uniform(0.0, 45000.0);
+        const int type        = types[bench_random_next() % (sizeof(types) / sizeof(types[0]))];
+        if (type == 3)
+            snprintf(g_corpus.lines[i], MAX_LINE_LENGTH, "MSG,3,1,1,%s,1,2024/01/01,12:00:00.000,2024/01/01,12:00:00.000,,%d,,,%.5f,%.5f,,,0,0,0,0",
+                     g_corpus.icaos[i], g_corpus.altitudes[i], g_corpus.lats[i], g_corpus.lons[i]);
+        else
+            snprintf(g_corpus.lines[i], MAX_LINE_LENGTH, "MSG,%d,1,1,%s,1,2024/01/01,12:00:00.000,2024/01/01,12:00:00.000,,%d,451,270,,,-64,,0,0,0,0",
+                     type, g_corpus.icaos[i], g_corpus.altitudes[i]);
+    }
+}
+
+static bool bench_selected(const char *const name) { return !g_bench_match || strstr(name, g_bench_match) != NULL; }
+
+static bench_result_t bench_measure(void (*const fn)(const size_t), const size_t iterations) {
+    bench_result_t best = { .ns_per_op = 0 };
+    fn(iterations / 10 + 1); // warm caches and branch predictors
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        uint64_t values[PERF_COUNTERS];
+        const unsigned long long start = timing_now_ns();
+        perf_start();
+        fn(iterations);
+        const bool counters_valid         = perf_stop(values);
+        const unsigned long long duration = timing_now_ns() - start;
+        const double ns_per_op            = (double)duration / (double)iterations;
+        if (repeat == 0 || ns_per_op < best.ns_per_op) {
+            best.ns_per_op      = ns_per_op;
+            best.counters_valid = counters_valid;
+            for (size_t i = 0; counters_valid && i < PERF_COUNTERS; i++)
+                best.counters[i] = (double)values[i] / (double)iterations;
+        }
+    }
+    return best;
+}
+
+static void bench_report(const char *const name, const bench_result_t *const result) {
+    printf("%-36s %12.1f ns/op %14.0f ops/s", name, result->ns_per_op, result->ns_per_op > 0 ? 1e9 / result->ns_per_op : 0.0);
+    if (result->counters_valid) {
+        printf("  cycles=%.1f insns=%.1f ipc=%.2f cache-misses=%.3f branch-misses=%.3f", result->counters[0], result->counters[1],
+               result->counters[0] > 0 ? result->counters[1] / result->counters[0] : 0.0, result->counters[2], result->counters[3]);
+    }
+    printf("\n");
+}
+
+static void bench_run(const char *const name, void (*const setup)(void), void (*const fn)(const size_t), const size_t iterations) {
+    if (!bench_selected(name))
+        return;
+    if (setup)
+        setup();
+    const bench_result_t result = bench_measure(fn, iterations);
+    bench_report(name, &result);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void bench_parse_sbs(const size_t iterations) {
+    adsb_message_t msg;
+    int parsed = 0;
+    for (size_t i = 0; i < iterations; i++)
+        parsed += adsb_parse_sbs(g_corpus.lines[i & BENCH_CORPUS_MASK], &msg);
+    g_bench_sink = (double)parsed;
+}
+
+// identification, even and odd airborne position, velocity, and the identification with a single bit error
+static const char *const bench_avr_frames[] = {
+    "*8D4840D6202CC371C32CE0576098;", "*8D40621D58C382D690C8AC2863A7;", "*8D40621D58C386435CC412692AD6;",
+    "*8D485020994409940838175B284F;", "*8D4840D6202CC371C33CE0576098;",
+};
+#define BENCH_AVR_FRAMES (sizeof(bench_avr_frames) / sizeof(bench_avr_frames[0]))
+
+static void bench_avr_setup(void) {
+    g_config.adsb_format  = ADSB_FORMAT_AVR;
+    g_config.adsb_correct = true;
+    avr_begin();
+}
+
+static void bench_parse_avr(const size_t iterations) {
+    adsb_message_t msg;
+    int parsed = 0;
+    for (size_t i = 0; i < iterations; i++)
+        parsed += adsb_parse_avr(bench_avr_frames[i % BENCH_AVR_FRAMES], &msg);
+    g_bench_sink = (double)parsed;
+}
+
+static void bench_distance(const size_t iterations) {
+    double total = 0.0;
+    for (size_t i = 0; i < iterations; i++)
+        total += calculate_distance_nm(g_config.position_lat, g_config.position_lon, g_corpus.lats[i & BENCH_CORPUS_MASK],
+                                       g_corpus.lons[i & BENCH_CORPUS_MASK]);
+    g_bench_sink = total;
+}
+
+static void bench_voxel_indices(const size_t iterations) {
+    int x, y, z, total = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        voxel_coords_to_indices(g_corpus.lats[i & BENCH_CORPUS_MASK], g_corpus.lons[i & BENCH_CORPUS_MASK], g_corpus.altitudes[i & BENCH_CORPUS_MASK], &x,
+                                &y, &z);
+        total += x + y + z;
+    }
+    g_bench_sink = total;
+}
+
+static void bench_voxel_update(const size_t iterations) {
+    for (size_t i = 0; i < iterations; i++)
+        voxel_map_update(g_corpus.lats[i & BENCH_CORPUS_MASK], g_corpus.lons[i & BENCH_CORPUS_MASK], g_corpus.altitudes[i & BENCH_CORPUS_MASK]);
+}
+
+static void bench_position_update(const size_t iterations) {
+    for (size_t i = 0; i < iterations; i++)
+        aircraft_position_update(g_corpus.icaos[i & 255], g_corpus.lats[i & BENCH_CORPUS_MASK], g_corpus.lons[i & BENCH_CORPUS_MASK],
+                                 g_corpus.altitudes[i & BENCH_CORPUS_MASK], (time_t)i);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define BENCH_AIRCRAFT_KEYS MAX_AIRCRAFT
+
+char g_bench_keys[BENCH_AIRCRAFT_KEYS][7];
+int g_bench_keys_loaded = 0;
+
+static void bench_aircraft_reset(void) {
+    memset(g_aircraft_list.entries, 0, sizeof(g_aircraft_list.entries));
+    g_aircraft_list.count = 0;
+}
+
+static void bench_aircraft_fill(const int count) {
+    bench_aircraft_reset();
+    // multiplying by an odd constant is a bijection mod 2^24, so the keys are scattered but never collide
+    for (int i = 0; i < BENCH_AIRCRAFT_KEYS; i++)
+        snprintf(g_bench_keys[i], sizeof(g_bench_keys[i]), "%06X", ((unsigned int)(i + 1) * 0x9E3779u ^ (unsigned int)BENCH_SEED) & 0xFFFFFFu);
+    for (int i = 0; i < count; i++) {
+        aircraft_data_t *const aircraft = aircraft_find_or_create(g_bench_keys[i]);
+        if (aircraft)
+            aircraft->pos.timestamp = (time_t)(i + 1);
+    }
+    g_bench_keys_loaded = count;
+}
+
+static void bench_aircraft_fill_25(void) { bench_aircraft_fill(MAX_AIRCRAFT / 4); }
+static void bench_aircraft_fill_50(void) { bench_aircraft_fill(MAX_AIRCRAFT / 2); }
+static void bench_aircraft_fill_75(void) { bench_aircraft_fill(MAX_AIRCRAFT * 3 / 4); }
+static void bench_aircraft_fill_90(void) { bench_aircraft_fill(MAX_AIRCRAFT * 9 / 10); }
+
+static void bench_aircraft_lookup(const size_t iterations) {
+    size_t found = 0;
+    for (size_t i = 0; i < iterations; i++)
+        found += aircraft_find_or_create(g_bench_keys[(i * 7919) % (size_t)g_bench_keys_loaded]) != NULL;
+    g_bench_sink = (double)found;
+}
+
+static void bench_aircraft_prune(void) {
+    // a create at the prune threshold evicts PRUNE_RATIO of the table: timed one call at a time, with the refill untimed
+    const char *const name = "aircraft_find_or_create/prune";
+    if (!bench_selected(name))
+        return;
+    const int threshold = (int)(MAX_AIRCRAFT * PRUNE_THRESHOLD);
+    bench_result_t best = { .ns_per_op = 0 };
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        bench_aircraft_fill(threshold);
+        uint64_t values[PERF_COUNTERS];
+        const unsigned long long start = timing_now_ns();
+        perf_start();
+        aircraft_find_or_create(g_bench_keys[BENCH_AIRCRAFT_KEYS - 1]);
+        const bool counters_valid         = perf_stop(values);
+        const unsigned long long duration = timing_now_ns() - start;
+        if (repeat == 0 || (double)duration < best.ns_per_op) {
+            best.ns_per_op      = (double)duration;
+            best.counters_valid = counters_valid;
+            for (size_t i = 0; counters_valid && i < PERF_COUNTERS; i++)
+                best.counters[i] = (double)values[i];
+        }
+    }
+    bench_report(name, &best);
+}
+
+adsb_message_t g_bench_messages[BENCH_CORPUS_SIZE];
+
+static void bench_messages_setup(void) {
+    g_config.adsb_format = ADSB_FORMAT_SBS;
+    for (int i = 0; i < BENCH_CORPUS_SIZE; i++)
+        adsb_parse_sbs(g_corpus.lines[i], &g_bench_messages[i]);
+    bench_aircraft_reset();
+}
+
+static void bench_message_update(const size_t iterations) {
+    for (size_t i = 0; i < iterations; i++)
+        aircraft_message_update(&g_bench_messages[i & BENCH_CORPUS_MASK], (time_t)(i >> 12));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+aircraft_data_t g_bench_aircraft;
+
+static void bench_encode_setup(void) {
+    bench_aircraft_reset();
+    for (int i = 0; i < 64; i++)
+        aircraft_position_update("4CA2D6", g_corpus.lats[i], g_corpus.lons[i], g_corpus.altitudes[i], (time_t)(1704067200 + i));
+    g_bench_aircraft = *aircraft_find_or_create("4CA2D6");
+}
+
+static void bench_encode_aircraft(const size_t iterations) {
+    size_t total = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        cJSON *const obj = aircraft_publish_encode_aircraft(&g_bench_aircraft, g_bench_aircraft.pos.timestamp);
+        total += obj != NULL;
+        cJSON_Delete(obj);
+    }
+    g_bench_sink = (double)total;
+}
+
+static void bench_encode_print(const size_t iterations) {
+    cJSON *const obj = aircraft_publish_encode_aircraft(&g_bench_aircraft, g_bench_aircraft.pos.timestamp);
+    size_t total     = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        char *const str = cJSON_PrintUnformatted(obj);
+        total += str ? strlen(str) : 0;
+        free(str);
+    }
+    cJSON_Delete(obj);
+    g_bench_sink = (double)total;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void bench_voxel_setup(void) {
+    if (!g_voxel_map.data) {
+        snprintf(g_config.directory, sizeof(g_config.directory), "%s", "/nonexistent");
+        voxel_map_begin();
+    }
+}
+
+int main(const int argc, char *const argv[]) {
+    if (argc > 1 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) {
+        printf("usage: %s [NAME]\n  runs the benchmarks whose name contains NAME (default: all)\n", argv[0]);
+        return EXIT_SUCCESS;
+    }
+    g_bench_match    = argc > 1 ? argv[1] : NULL;
+    g_timing.enabled = false;
+
+    if (pthread_mutex_init(&g_aircraft_list.mutex, NULL) != 0) {
+        perror("pthread_mutex_init");
+        return EXIT_FAILURE;
+    }
+    perf_begin();
+    bench_corpus_begin();
+    bench_voxel_setup();
+    track_begin();
+
+    printf("microbench: seed=%#llx repeats=%d (best of)\n", (unsigned long long)BENCH_SEED, BENCH_REPEATS);
+    bench_run("adsb_parse_sbs", NULL, bench_parse_sbs, 4000000);
+    bench_run("adsb_parse_avr", bench_avr_setup, bench_parse_avr, 4000000);
+    bench_run("calculate_distance_nm", NULL, bench_distance, 4000000);
+    bench_run("voxel_coords_to_indices", NULL, bench_voxel_indices, 2000000);
+    bench_run("voxel_map_update", NULL, bench_voxel_update, 2000000);
+    bench_run("aircraft_find_or_create/load=25%", bench_aircraft_fill_25, bench_aircraft_lookup, 4000000);
+    bench_run("aircraft_find_or_create/load=50%", bench_aircraft_fill_50, bench_aircraft_lookup, 4000000);
+    bench_run("aircraft_find_or_create/load=75%", bench_aircraft_fill_75, bench_aircraft_lookup, 4000000);
+    bench_run("aircraft_find_or_create/load=90%", bench_aircraft_fill_90, bench_aircraft_lookup, 4000000);
+    bench_aircraft_prune();
+    bench_run("aircraft_position_update", bench_aircraft_reset, bench_position_update, 2000000);
+    bench_run("aircraft_message_update", bench_messages_setup, bench_message_update, 2000000);
+    bench_run("aircraft_publish_encode_aircraft", bench_encode_setup, bench_encode_aircraft, 200000);
+    bench_run("cJSON_PrintUnformatted/aircraft", bench_encode_setup, bench_encode_print, 200000);
+
+    perf_end();
+    voxel_map_end();
+    pthread_mutex_destroy(&g_aircraft_list.mutex);
+    return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
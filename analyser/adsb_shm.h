@@ -0,0 +1,176 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// shared memory export of the analyser's live aircraft table (adsb_analyser --shm=NAME): a fixed header, a stats block and one fixed
+// size record per aircraft table slot, written only by the analyser's processing thread; every record and the stats block carry their
+// own seqlock (odd while being written), so readers copy out a consistent record without locks, syscalls or serialisation, retrying if
+// the writer was mid update; header.generation advances after every record write, so a reader can cheaply poll for change
+//
+// the reader side is header only: adsb_shm_open(), then adsb_shm_read_record() over 0..capacity-1 (empty slots have icao[0] == 0) and
+// adsb_shm_read_stats(), then adsb_shm_close(); link with -lrt on older glibc
+
+#ifndef ADSB_SHM_H
+#define ADSB_SHM_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ADSB_SHM_MAGIC          0x48534441 // "ADSH" in hex
+#define ADSB_SHM_VERSION        1
+#define ADSB_SHM_READ_RETRIES   64
+#define ADSB_SHM_FLAG_BOUNDS    0x01
+
+// positions are fixed point to keep a record at four cache lines: degrees * 1e6, feet, nautical miles * 100, unix seconds
+typedef struct {
+    int32_t lat_e6;
+    int32_t lon_e6;
+    int32_t altitude_ft;
+    uint32_t distance_cnm;
+    int64_t timestamp;
+} adsb_shm_posn_t;
+
+typedef struct {
+    uint32_t sequence;
+    char icao[8];
+    uint32_t flags;
+    adsb_shm_posn_t pos, pos_first;
+    adsb_shm_posn_t min_lat_pos, max_lat_pos, min_lon_pos, max_lon_pos, min_alt_pos, max_alt_pos, min_dist_pos, max_dist_pos;
+} adsb_shm_record_t;
+
+typedef struct {
+    char icao[8];
+    adsb_shm_posn_t pos;
+} adsb_shm_stat_posn_t;
+
+typedef struct {
+    uint64_t messages_total;
+    uint64_t messages_position;
+    uint64_t position_valid;
+    uint64_t position_invalid;
+    uint64_t published_mqtt;
+    uint64_t aircraft_seen;
+    adsb_shm_stat_posn_t distance_max;
+    adsb_shm_stat_posn_t altitude_max;
+} adsb_shm_counters_t;
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t aircraft_count;
+    int64_t updated;
+    adsb_shm_counters_t session, global;
+} adsb_shm_stats_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t pid;
+    int64_t started;
+    int32_t position_lat_e6;
+    int32_t position_lon_e6;
+    uint64_t generation;
+    adsb_shm_stats_t stats;
+} adsb_shm_header_t;
+
+typedef struct {
+    adsb_shm_header_t *header;
+    adsb_shm_record_t *records;
+    size_t size;
+    int fd;
+} adsb_shm_t;
+
+static inline size_t adsb_shm_size(const uint32_t capacity) {
+    return ((sizeof(adsb_shm_header_t) + 63) & ~(size_t)63) + (size_t)capacity * sizeof(adsb_shm_record_t);
+}
+
+static inline adsb_shm_record_t *adsb_shm_records(adsb_shm_header_t *const header) {
+    return (adsb_shm_record_t *)((char *)header + ((sizeof(adsb_shm_header_t) + 63) & ~(size_t)63));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static inline void adsb_shm_write_begin(uint32_t *const sequence) {
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void adsb_shm_write_end(uint32_t *const sequence) { __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE); }
+
+// copies size bytes following the sequence word at source into destination, false if the writer kept it busy for every retry
+static inline bool adsb_shm_read_consistent(const uint32_t *const sequence, const void *const source, void *const destination, const size_t size) {
+    for (int retry = 0; retry < ADSB_SHM_READ_RETRIES; retry++) {
+        const uint32_t before = __atomic_load_n(sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue;
+        memcpy(destination, source, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(sequence, __ATOMIC_RELAXED) == before)
+            return true;
+    }
+    return false;
+}
+
+static inline bool adsb_shm_read_record(const adsb_shm_t *const shm, const uint32_t index, adsb_shm_record_t *const record) {
+    if (index >= shm->header->capacity)
+        return false;
+    const adsb_shm_record_t *const source = &shm->records[index];
+    return adsb_shm_read_consistent(&source->sequence, source, record, sizeof(*record));
+}
+
+static inline bool adsb_shm_read_stats(const adsb_shm_t *const shm, adsb_shm_stats_t *const stats) {
+    return adsb_shm_read_consistent(&shm->header->stats.sequence, &shm->header->stats, stats, sizeof(*stats));
+}
+
+static inline uint64_t adsb_shm_generation(const adsb_shm_t *const shm) { return __atomic_load_n(&shm->header->generation, __ATOMIC_ACQUIRE); }
+
+// name as given to --shm (a leading '/' is optional), read only mapping
+static inline bool adsb_shm_open(adsb_shm_t *const shm, const char *const name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    memset(shm, 0, sizeof(*shm));
+    shm->fd = shm_open(path, O_RDONLY, 0);
+    if (shm->fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(shm->fd, &st) < 0 || (size_t)st.st_size < sizeof(adsb_shm_header_t)) {
+        close(shm->fd);
+        return false;
+    }
+    void *const base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, shm->fd, 0);
+    if (base == MAP_FAILED) {
+        close(shm->fd);
+        return false;
+    }
+    shm->header  = (adsb_shm_header_t *)base;
+    shm->records = adsb_shm_records(shm->header);
+    shm->size    = (size_t)st.st_size;
+    if (__atomic_load_n(&shm->header->magic, __ATOMIC_ACQUIRE) != ADSB_SHM_MAGIC || shm->header->version != ADSB_SHM_VERSION ||
+        shm->header->record_size != sizeof(adsb_shm_record_t) || adsb_shm_size(shm->header->capacity) > shm->size) {
+        munmap(base, shm->size);
+        close(shm->fd);
+        return false;
+    }
+    return true;
+}
+
+static inline void adsb_shm_close(adsb_shm_t *const shm) {
+    if (shm->header) {
+        munmap(shm->header, shm->size);
+        close(shm->fd);
+        shm->header = NULL;
+    }
+}
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,354 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// N-API binding over adsb_analyser.h: runs the analyser engine inside the node process, fed by ingest() with SBS text, and exposes its
+// aircraft table, stats, voxel coverage and batch geodesy directly
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../adsb_analyser.h"
+#include "adsb_node.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void set_position(napi_env env, napi_value obj, const char *const name, const adsb_position_t *const pos) {
+    adsb_node_set_position(env, obj, name, pos->lat, pos->lon, pos->altitude_ft, pos->distance_nm, (double)pos->timestamp);
+}
+
+static napi_value encode_aircraft(napi_env env, const adsb_aircraft_t *const a) {
+    napi_value obj, bounds;
+    if (napi_create_object(env, &obj) != napi_ok)
+        return NULL;
+    adsb_node_set_string(env, obj, "icao", a->icao);
+    set_position(env, obj, "current", &a->current);
+    if (a->bounds_valid) {
+        set_position(env, obj, "first", &a->first);
+        if (napi_create_object(env, &bounds) == napi_ok) {
+            set_position(env, bounds, "min_lat", &a->min_lat);
+            set_position(env, bounds, "max_lat", &a->max_lat);
+            set_position(env, bounds, "min_lon", &a->min_lon);
+            set_position(env, bounds, "max_lon", &a->max_lon);
+            set_position(env, bounds, "min_alt", &a->min_alt);
+            set_position(env, bounds, "max_alt", &a->max_alt);
+            set_position(env, bounds, "min_dist", &a->min_dist);
+            set_position(env, bounds, "max_dist", &a->max_dist);
+            napi_set_named_property(env, obj, "bounds", bounds);
+        }
+    }
+    return obj;
+}
+
+static napi_value encode_stats(napi_env env, const adsb_stats_t *const s) {
+    napi_value obj, distance_max, altitude_max;
+    if (napi_create_object(env, &obj) != napi_ok)
+        return NULL;
+    adsb_node_set_number(env, obj, "messages_total", (double)s->messages_total);
+    adsb_node_set_number(env, obj, "messages_position", (double)s->messages_position);
+    adsb_node_set_number(env, obj, "position_valid", (double)s->position_valid);
+    adsb_node_set_number(env, obj, "position_invalid", (double)s->position_invalid);
+    adsb_node_set_number(env, obj, "published_mqtt", (double)s->published_mqtt);
+    adsb_node_set_number(env, obj, "aircraft_seen", (double)s->aircraft_seen);
+    if (napi_create_object(env, &distance_max) == napi_ok) {
+        adsb_node_set_string(env, distance_max, "icao", s->distance_max_icao);
+        set_position(env, distance_max, "pos", &s->distance_max);
+        napi_set_named_property(env, obj, "distance_max", distance_max);
+    }
+    if (napi_create_object(env, &altitude_max) == napi_ok) {
+        adsb_node_set_string(env, altitude_max, "icao", s->altitude_max_icao);
+        set_position(env, altitude_max, "pos", &s->altitude_max);
+        napi_set_named_property(env, obj, "altitude_max", altitude_max);
+    }
+    return obj;
+}
+
+static void get_named_double(napi_env env, napi_value obj, const char *const name, double *const value) {
+    bool has = false;
+    napi_value v;
+    if (napi_has_named_property(env, obj, name, &has) == napi_ok && has && napi_get_named_property(env, obj, name, &v) == napi_ok)
+        adsb_node_get_double(env, v, value);
+}
+
+// the Float64Array argument at index, NULL (and a thrown TypeError) otherwise
+static double *get_float64_array(napi_env env, napi_value value, size_t *const length) {
+    bool is_typedarray = false;
+    napi_typedarray_type type;
+    void *data;
+    if (napi_is_typedarray(env, value, &is_typedarray) != napi_ok || !is_typedarray ||
+        napi_get_typedarray_info(env, value, &type, length, &data, NULL, NULL) != napi_ok || type != napi_float64_array) {
+        napi_throw_type_error(env, NULL, "adsb: expected a Float64Array");
+        return NULL;
+    }
+    return (double *)data;
+}
+
+static napi_value create_float64_array(napi_env env, const size_t length, double **const data) {
+    napi_value buffer, array;
+    if (napi_create_arraybuffer(env, length * sizeof(double), (void **)data, &buffer) != napi_ok ||
+        napi_create_typedarray(env, napi_float64_array, length, buffer, 0, &array) != napi_ok)
+        return NULL;
+    return array;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// init({ position_lat, position_lon, distance_max_nm, altitude_max_ft, voxel_size_horizontal_nm, voxel_size_vertical_ft, directory })
+static napi_value js_init(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1], v;
+    char directory[256] = { 0 };
+    size_t length;
+    bool has = false;
+    adsb_engine_config_t config;
+    adsb_engine_config_default(&config);
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc > 0) {
+        double altitude_max_ft = config.altitude_max_ft;
+        get_named_double(env, args[0], "position_lat", &config.position_lat);
+        get_named_double(env, args[0], "position_lon", &config.position_lon);
+        get_named_double(env, args[0], "distance_max_nm", &config.distance_max_nm);
+        get_named_double(env, args[0], "altitude_max_ft", &altitude_max_ft);
+        get_named_double(env, args[0], "voxel_size_horizontal_nm", &config.voxel_size_horizontal_nm);
+        get_named_double(env, args[0], "voxel_size_vertical_ft", &config.voxel_size_vertical_ft);
+        config.altitude_max_ft = (int)altitude_max_ft;
+        if (napi_has_named_property(env, args[0], "directory", &has) == napi_ok && has && napi_get_named_property(env, args[0], "directory", &v) == napi_ok &&
+            napi_get_value_string_utf8(env, v, directory, sizeof(directory), &length) == napi_ok)
+            config.directory = directory;
+    }
+    if (adsb_engine_init(&config) != 0) {
+        napi_throw_error(env, NULL, "adsb: engine init failed (already initialised, or invalid configuration)");
+        return NULL;
+    }
+    return NULL;
+}
+
+static napi_value js_shutdown(napi_env env __attribute__((unused)), napi_callback_info info __attribute__((unused))) {
+    adsb_engine_shutdown();
+    return NULL;
+}
+
+static napi_value js_save(napi_env env, napi_callback_info info __attribute__((unused))) {
+    napi_value result;
+    NAPI_CALL(env, napi_get_boolean(env, adsb_engine_save() == 0, &result));
+    return result;
+}
+
+// ingest(string | Buffer): returns the number of positions accepted (in range and by the tracker), rejected ones are not counted
+static napi_value js_ingest(napi_env env, napi_callback_info info) {
+    size_t argc = 1, length = 0, positions = 0;
+    napi_value args[1], result;
+    bool is_buffer = false;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc < 1) {
+        napi_throw_type_error(env, NULL, "adsb: ingest(data) expects a string or Buffer");
+        return NULL;
+    }
+    NAPI_CALL(env, napi_is_buffer(env, args[0], &is_buffer));
+    if (is_buffer) {
+        void *data;
+        NAPI_CALL(env, napi_get_buffer_info(env, args[0], &data, &length));
+        positions = adsb_ingest_buffer((const char *)data, length);
+    } else {
+        if (napi_get_value_string_utf8(env, args[0], NULL, 0, &length) != napi_ok) {
+            napi_throw_type_error(env, NULL, "adsb: ingest(data) expects a string or Buffer");
+            return NULL;
+        }
+        char *const data = (char *)malloc(length + 1);
+        if (!data) {
+            napi_throw_error(env, NULL, "adsb: out of memory");
+            return NULL;
+        }
+        napi_get_value_string_utf8(env, args[0], data, length + 1, &length);
+        positions = adsb_ingest_buffer(data, length);
+        free(data);
+    }
+    NAPI_CALL(env, napi_create_double(env, (double)positions, &result));
+    return result;
+}
+
+static napi_value js_count(napi_env env, napi_callback_info info __attribute__((unused))) {
+    napi_value result;
+    NAPI_CALL(env, napi_create_double(env, (double)adsb_aircraft_count(), &result));
+    return result;
+}
+
+// aircraft([icao]): every aircraft, or just the named one (undefined if absent)
+static napi_value js_aircraft(napi_env env, napi_callback_info info) {
+    size_t argc = 1, length;
+    napi_value args[1], result, obj;
+    char icao[8];
+    adsb_aircraft_t aircraft;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc > 0 && napi_get_value_string_utf8(env, args[0], icao, sizeof(icao), &length) == napi_ok) {
+        if (adsb_aircraft_get(icao, &aircraft))
+            return encode_aircraft(env, &aircraft);
+        NAPI_CALL(env, napi_get_undefined(env, &result));
+        return result;
+    }
+    const size_t capacity = adsb_aircraft_count() + 16;
+    adsb_aircraft_t *const list = (adsb_aircraft_t *)malloc(capacity * sizeof(adsb_aircraft_t));
+    if (!list) {
+        napi_throw_error(env, NULL, "adsb: out of memory");
+        return NULL;
+    }
+    const size_t count = adsb_aircraft_list(list, capacity);
+    if (napi_create_array_with_length(env, count, &result) == napi_ok)
+        for (size_t i = 0; i < count; i++)
+            if ((obj = encode_aircraft(env, &list[i])))
+                napi_set_element(env, result, (uint32_t)i, obj);
+    free(list);
+    return result;
+}
+
+static napi_value js_stats(napi_env env, napi_callback_info info __attribute__((unused))) {
+    napi_value obj, session, global;
+    adsb_stats_t stats_session, stats_global;
+    adsb_stats_get(&stats_session, &stats_global);
+    NAPI_CALL(env, napi_create_object(env, &obj));
+    adsb_node_set_number(env, obj, "aircraft_count", (double)adsb_aircraft_count());
+    if ((session = encode_stats(env, &stats_session)))
+        napi_set_named_property(env, obj, "session", session);
+    if ((global = encode_stats(env, &stats_global)))
+        napi_set_named_property(env, obj, "global", global);
+    return obj;
+}
+
+static napi_value js_coverage(napi_env env, napi_callback_info info __attribute__((unused))) {
+    napi_value obj;
+    adsb_coverage_info_t coverage;
+    if (adsb_coverage_info(&coverage) != 0) {
+        NAPI_CALL(env, napi_get_null(env, &obj));
+        return obj;
+    }
+    NAPI_CALL(env, napi_create_object(env, &obj));
+    adsb_node_set_number(env, obj, "size_x", coverage.size_x);
+    adsb_node_set_number(env, obj, "size_y", coverage.size_y);
+    adsb_node_set_number(env, obj, "size_z", coverage.size_z);
+    adsb_node_set_number(env, obj, "horizontal_size_nm", coverage.horizontal_size_nm);
+    adsb_node_set_number(env, obj, "vertical_size_ft", coverage.vertical_size_ft);
+    adsb_node_set_number(env, obj, "occupied", (double)coverage.occupied);
+    adsb_node_set_number(env, obj, "total", (double)coverage.total);
+    return obj;
+}
+
+// coverageAt(lat, lon, altitude_ft): hit count of the containing voxel
+static napi_value js_coverage_at(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value args[3], result;
+    double lat, lon, altitude_ft;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc < 3 || !adsb_node_get_double(env, args[0], &lat) || !adsb_node_get_double(env, args[1], &lon) ||
+        !adsb_node_get_double(env, args[2], &altitude_ft)) {
+        napi_throw_type_error(env, NULL, "adsb: coverageAt(lat, lon, altitude_ft) expects numbers");
+        return NULL;
+    }
+    NAPI_CALL(env, napi_create_uint32(env, adsb_coverage_at(lat, lon, (int)altitude_ft), &result));
+    return result;
+}
+
+// coverageLayer(z): Uint16Array of size_x * size_y counts, row major with y north
+static napi_value js_coverage_layer(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1], buffer, result;
+    double z;
+    adsb_coverage_info_t coverage;
+    void *data;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc < 1 || !adsb_node_get_double(env, args[0], &z) || adsb_coverage_info(&coverage) != 0) {
+        napi_throw_type_error(env, NULL, "adsb: coverageLayer(z) expects a layer number, after init()");
+        return NULL;
+    }
+    const size_t length = (size_t)coverage.size_x * (size_t)coverage.size_y;
+    NAPI_CALL(env, napi_create_arraybuffer(env, length * sizeof(uint16_t), &data, &buffer));
+    if (adsb_coverage_layer((int)z, (uint16_t *)data, length) != length) {
+        napi_throw_range_error(env, NULL, "adsb: coverageLayer(z) layer out of range");
+        return NULL;
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint16_array, length, buffer, 0, &result));
+    return result;
+}
+
+static napi_value js_geodesy(napi_env env, napi_callback_info info, double (*fn)(double, double, double, double)) {
+    size_t argc = 4;
+    napi_value args[4], result;
+    double v[4];
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc < 4 || !adsb_node_get_double(env, args[0], &v[0]) || !adsb_node_get_double(env, args[1], &v[1]) || !adsb_node_get_double(env, args[2], &v[2]) ||
+        !adsb_node_get_double(env, args[3], &v[3])) {
+        napi_throw_type_error(env, NULL, "adsb: expected (lat1, lon1, lat2, lon2)");
+        return NULL;
+    }
+    NAPI_CALL(env, napi_create_double(env, fn(v[0], v[1], v[2], v[3]), &result));
+    return result;
+}
+
+static napi_value js_distance(napi_env env, napi_callback_info info) { return js_geodesy(env, info, adsb_distance_nm); }
+
+static napi_value js_bearing(napi_env env, napi_callback_info info) { return js_geodesy(env, info, adsb_bearing_deg); }
+
+// distanceBatch(lat, lon, lats, lons[, bearings]): { distance: Float64Array nm[, bearing: Float64Array deg] } from one point to many
+static napi_value js_distance_batch(napi_env env, napi_callback_info info) {
+    size_t argc = 5, count_lats = 0, count_lons = 0;
+    napi_value args[5], result, distances, bearings = NULL;
+    double lat, lon, *distances_data, *bearings_data = NULL;
+    bool with_bearings = false;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc < 4 || !adsb_node_get_double(env, args[0], &lat) || !adsb_node_get_double(env, args[1], &lon)) {
+        napi_throw_type_error(env, NULL, "adsb: distanceBatch(lat, lon, lats, lons[, bearings]) expects numbers and Float64Arrays");
+        return NULL;
+    }
+    const double *const lats = get_float64_array(env, args[2], &count_lats);
+    if (!lats)
+        return NULL;
+    const double *const lons = get_float64_array(env, args[3], &count_lons);
+    if (!lons)
+        return NULL;
+    if (count_lats != count_lons) {
+        napi_throw_range_error(env, NULL, "adsb: distanceBatch lats and lons differ in length");
+        return NULL;
+    }
+    if (argc > 4)
+        napi_get_value_bool(env, args[4], &with_bearings);
+    if (!(distances = create_float64_array(env, count_lats, &distances_data)) ||
+        (with_bearings && !(bearings = create_float64_array(env, count_lats, &bearings_data)))) {
+        napi_throw_error(env, NULL, "adsb: out of memory");
+        return NULL;
+    }
+    adsb_distance_batch(lat, lon, lats, lons, count_lats, distances_data, bearings_data);
+    NAPI_CALL(env, napi_create_object(env, &result));
+    napi_set_named_property(env, result, "distance", distances);
+    if (bearings)
+        napi_set_named_property(env, result, "bearing", bearings);
+    return result;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static napi_value init(napi_env env, napi_value exports) {
+    const napi_property_descriptor properties[] = {
+        NAPI_FUNCTION("init", js_init),
+        NAPI_FUNCTION("shutdown", js_shutdown),
+        NAPI_FUNCTION("save", js_save),
+        NAPI_FUNCTION("ingest", js_ingest),
+        NAPI_FUNCTION("count", js_count),
+        NAPI_FUNCTION("aircraft", js_aircraft),
+        NAPI_FUNCTION("stats", js_stats),
+        NAPI_FUNCTION("coverage", js_coverage),
+        NAPI_FUNCTION("coverageAt", js_coverage_at),
+        NAPI_FUNCTION("coverageLayer", js_coverage_layer),
+        NAPI_FUNCTION("distance", js_distance),
+        NAPI_FUNCTION("bearing", js_bearing),
+        NAPI_FUNCTION("distanceBatch", js_distance_batch),
+    };
+    NAPI_CALL(env, napi_define_properties(env, exports, sizeof(properties) / sizeof(properties[0]), properties));
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,54 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// helpers shared by the N-API bindings, objects are shaped like the analyser's MQTT JSON (positions as lat, lon, alt, dist, time)
+
+#ifndef ADSB_NODE_H
+#define ADSB_NODE_H
+
+#include <node_api.h>
+#include <stdbool.h>
+
+#define NAPI_CALL(env, call)                                                                                                                                   \
+    do {                                                                                                                                                       \
+        if ((call) != napi_ok) {                                                                                                                               \
+            napi_throw_error((env), NULL, "adsb: " #call " failed");                                                                                           \
+            return NULL;                                                                                                                                       \
+        }                                                                                                                                                      \
+    } while (0)
+
+#define NAPI_FUNCTION(name, fn) { name, NULL, fn, NULL, NULL, NULL, napi_default, NULL }
+
+static inline void adsb_node_set_number(napi_env env, napi_value obj, const char *const name, const double value) {
+    napi_value v;
+    if (napi_create_double(env, value, &v) == napi_ok)
+        napi_set_named_property(env, obj, name, v);
+}
+
+static inline void adsb_node_set_string(napi_env env, napi_value obj, const char *const name, const char *const value) {
+    napi_value v;
+    if (napi_create_string_utf8(env, value, NAPI_AUTO_LENGTH, &v) == napi_ok)
+        napi_set_named_property(env, obj, name, v);
+}
+
+static inline void adsb_node_set_position(napi_env env, napi_value obj, const char *const name, const double lat, const double lon, const double altitude_ft,
+                                          const double distance_nm, const double timestamp) {
+    napi_value v;
+    if (napi_create_object(env, &v) != napi_ok)
+        return;
+    adsb_node_set_number(env, v, "lat", lat);
+    adsb_node_set_number(env, v, "lon", lon);
+    adsb_node_set_number(env, v, "alt", altitude_ft);
+    adsb_node_set_number(env, v, "dist", distance_nm);
+    adsb_node_set_number(env, v, "time", timestamp);
+    napi_set_named_property(env, obj, name, v);
+}
+
+static inline bool adsb_node_get_double(napi_env env, napi_value value, double *const result) {
+    return napi_get_value_double(env, value, result) == napi_ok;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
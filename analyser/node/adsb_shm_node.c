@@ -0,0 +1,222 @@
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+// N-API binding over adsb_shm.h: read the analyser's live aircraft table and stats from shared memory of a running adsb_analyser --shm
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../adsb_shm.h"
+#include "adsb_node.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void set_position(napi_env env, napi_value obj, const char *const name, const adsb_shm_posn_t *const pos) {
+    adsb_node_set_position(env, obj, name, pos->lat_e6 / 1e6, pos->lon_e6 / 1e6, pos->altitude_ft, pos->distance_cnm / 100.0, (double)pos->timestamp);
+}
+
+static napi_value encode_record(napi_env env, const adsb_shm_record_t *const r) {
+    napi_value obj, bounds;
+    if (napi_create_object(env, &obj) != napi_ok)
+        return NULL;
+    adsb_node_set_string(env, obj, "icao", r->icao);
+    set_position(env, obj, "current", &r->pos);
+    if (r->flags & ADSB_SHM_FLAG_BOUNDS) {
+        set_position(env, obj, "first", &r->pos_first);
+        if (napi_create_object(env, &bounds) == napi_ok) {
+            set_position(env, bounds, "min_lat", &r->min_lat_pos);
+            set_position(env, bounds, "max_lat", &r->max_lat_pos);
+            set_position(env, bounds, "min_lon", &r->min_lon_pos);
+            set_position(env, bounds, "max_lon", &r->max_lon_pos);
+            set_position(env, bounds, "min_alt", &r->min_alt_pos);
+            set_position(env, bounds, "max_alt", &r->max_alt_pos);
+            set_position(env, bounds, "min_dist", &r->min_dist_pos);
+            set_position(env, bounds, "max_dist", &r->max_dist_pos);
+            napi_set_named_property(env, obj, "bounds", bounds);
+        }
+    }
+    return obj;
+}
+
+static napi_value encode_counters(napi_env env, const adsb_shm_counters_t *const c) {
+    napi_value obj, distance_max, altitude_max;
+    if (napi_create_object(env, &obj) != napi_ok)
+        return NULL;
+    adsb_node_set_number(env, obj, "messages_total", (double)c->messages_total);
+    adsb_node_set_number(env, obj, "messages_position", (double)c->messages_position);
+    adsb_node_set_number(env, obj, "position_valid", (double)c->position_valid);
+    adsb_node_set_number(env, obj, "position_invalid", (double)c->position_invalid);
+    adsb_node_set_number(env, obj, "published_mqtt", (double)c->published_mqtt);
+    adsb_node_set_number(env, obj, "aircraft_seen", (double)c->aircraft_seen);
+    if (napi_create_object(env, &distance_max) == napi_ok) {
+        adsb_node_set_string(env, distance_max, "icao", c->distance_max.icao);
+        set_position(env, distance_max, "pos", &c->distance_max.pos);
+        napi_set_named_property(env, obj, "distance_max", distance_max);
+    }
+    if (napi_create_object(env, &altitude_max) == napi_ok) {
+        adsb_node_set_string(env, altitude_max, "icao", c->altitude_max.icao);
+        set_position(env, altitude_max, "pos", &c->altitude_max.pos);
+        napi_set_named_property(env, obj, "altitude_max", altitude_max);
+    }
+    return obj;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static void shm_finalize(napi_env env __attribute__((unused)), void *data, void *hint __attribute__((unused))) {
+    adsb_shm_t *const shm = (adsb_shm_t *)data;
+    adsb_shm_close(shm);
+    free(shm);
+}
+
+// the first argument as an open mapping, throws if it is not a handle or has been closed
+static adsb_shm_t *shm_argument(napi_env env, napi_callback_info info, napi_value *const args, size_t *const argc) {
+    void *data = NULL;
+    if (napi_get_cb_info(env, info, argc, args, NULL, NULL) != napi_ok || *argc < 1 || napi_get_value_external(env, args[0], &data) != napi_ok) {
+        napi_throw_type_error(env, NULL, "adsb_shm: expected a handle from open()");
+        return NULL;
+    }
+    adsb_shm_t *const shm = (adsb_shm_t *)data;
+    if (!shm->header) {
+        napi_throw_error(env, NULL, "adsb_shm: handle is closed");
+        return NULL;
+    }
+    return shm;
+}
+
+static napi_value js_open(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1], handle;
+    char name[256];
+    size_t length;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, args, NULL, NULL));
+    if (argc < 1 || napi_get_value_string_utf8(env, args[0], name, sizeof(name), &length) != napi_ok) {
+        napi_throw_type_error(env, NULL, "adsb_shm: open(name) expects a string");
+        return NULL;
+    }
+    adsb_shm_t *const shm = (adsb_shm_t *)malloc(sizeof(adsb_shm_t));
+    if (!shm || !adsb_shm_open(shm, name)) {
+        free(shm);
+        napi_throw_error(env, NULL, "adsb_shm: open failed (analyser not running with --shm, or version mismatch)");
+        return NULL;
+    }
+    if (napi_create_external(env, shm, shm_finalize, NULL, &handle) != napi_ok) {
+        adsb_shm_close(shm);
+        free(shm);
+        napi_throw_error(env, NULL, "adsb_shm: napi_create_external failed");
+        return NULL;
+    }
+    return handle;
+}
+
+static napi_value js_close(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1];
+    adsb_shm_t *const shm = shm_argument(env, info, args, &argc);
+    if (shm)
+        adsb_shm_close(shm);
+    return NULL;
+}
+
+static napi_value js_header(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1], obj;
+    const adsb_shm_t *const shm = shm_argument(env, info, args, &argc);
+    if (!shm)
+        return NULL;
+    NAPI_CALL(env, napi_create_object(env, &obj));
+    adsb_node_set_number(env, obj, "version", shm->header->version);
+    adsb_node_set_number(env, obj, "capacity", shm->header->capacity);
+    adsb_node_set_number(env, obj, "pid", shm->header->pid);
+    adsb_node_set_number(env, obj, "started", (double)shm->header->started);
+    adsb_node_set_number(env, obj, "position_lat", shm->header->position_lat_e6 / 1e6);
+    adsb_node_set_number(env, obj, "position_lon", shm->header->position_lon_e6 / 1e6);
+    adsb_node_set_number(env, obj, "generation", (double)adsb_shm_generation(shm));
+    return obj;
+}
+
+static napi_value js_generation(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1], result;
+    const adsb_shm_t *const shm = shm_argument(env, info, args, &argc);
+    if (!shm)
+        return NULL;
+    NAPI_CALL(env, napi_create_double(env, (double)adsb_shm_generation(shm), &result));
+    return result;
+}
+
+static napi_value js_stats(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value args[1], obj, session, global;
+    adsb_shm_stats_t stats;
+    const adsb_shm_t *const shm = shm_argument(env, info, args, &argc);
+    if (!shm)
+        return NULL;
+    if (!adsb_shm_read_stats(shm, &stats)) {
+        napi_get_null(env, &obj);
+        return obj;
+    }
+    NAPI_CALL(env, napi_create_object(env, &obj));
+    adsb_node_set_number(env, obj, "aircraft_count", stats.aircraft_count);
+    adsb_node_set_number(env, obj, "updated", (double)stats.updated);
+    if ((session = encode_counters(env, &stats.session)))
+        napi_set_named_property(env, obj, "session", session);
+    if ((global = encode_counters(env, &stats.global)))
+        napi_set_named_property(env, obj, "global", global);
+    return obj;
+}
+
+// aircraft(handle[, icao]): every occupied slot, or just the named aircraft (undefined if absent); slots are peeked before the
+// consistent copy so a scan of a mostly empty table stays cheap
+static napi_value js_aircraft(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value args[2], result, obj;
+    char icao[8] = { 0 };
+    size_t length;
+    const adsb_shm_t *const shm = shm_argument(env, info, args, &argc);
+    if (!shm)
+        return NULL;
+    const bool single = argc > 1 && napi_get_value_string_utf8(env, args[1], icao, sizeof(icao), &length) == napi_ok;
+    if (!single)
+        NAPI_CALL(env, napi_create_array(env, &result));
+    uint32_t count = 0;
+    adsb_shm_record_t record;
+    for (uint32_t i = 0; i < shm->header->capacity; i++) {
+        const char peek = __atomic_load_n(&shm->records[i].icao[0], __ATOMIC_RELAXED);
+        if (peek == '\0' || (single && peek != icao[0]))
+            continue;
+        if (!adsb_shm_read_record(shm, i, &record) || record.icao[0] == '\0')
+            continue;
+        if (single) {
+            if (strcmp(record.icao, icao) == 0)
+                return encode_record(env, &record);
+        } else if ((obj = encode_record(env, &record)))
+            napi_set_element(env, result, count++, obj);
+    }
+    if (single)
+        napi_get_undefined(env, &result);
+    return result;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
+
+static napi_value init(napi_env env, napi_value exports) {
+    const napi_property_descriptor properties[] = {
+        NAPI_FUNCTION("open", js_open),
+        NAPI_FUNCTION("close", js_close),
+        NAPI_FUNCTION("header", js_header),
+        NAPI_FUNCTION("generation", js_generation),
+        NAPI_FUNCTION("stats", js_stats),
+        NAPI_FUNCTION("aircraft", js_aircraft),
+    };
+    NAPI_CALL(env, napi_define_properties(env, exports, sizeof(properties) / sizeof(properties[0]), properties));
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
+
+// -----------------------------------------------------------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,17 @@
+{
+    "targets": [
+        {
+            "target_name": "adsb_shm",
+            "sources": ["adsb_shm_node.c"],
+            "cflags": ["-O2", "-Wall", "-Wextra"],
+            "libraries": ["-lrt"]
+        },
+        {
+            "target_name": "adsb_engine",
+            "sources": ["adsb_engine_node.c", "../adsb_analyser.c"],
+            "defines": ["ADSB_ANALYSER_NO_MAIN", "ADSB_ANALYSER_LIBRARY"],
+            "cflags": ["-O3", "-Wall", "-Wextra", "-fvisibility=hidden"],
+            "libraries": ["-lm", "-lpthread", "-lrt", "-lmosquitto", "-lcjson", "-lz", "-lbrotlienc"]
+        }
+    ]
+}
@@ -0,0 +1,23 @@
+// ------------------------------------------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+// shm: reader for a running 'adsb_analyser --shm=NAME'
+//     const { shm } = require('.../analyser/node');
+//     const handle = shm.open('adsb');
+//     shm.aircraft(handle) -> [{ icao, current, first, bounds }], shm.aircraft(handle, 'ABC123'), shm.stats(handle), shm.generation(handle)
+//     shm.close(handle);
+//
+// engine: the analyser core in process (libadsbanalyser), fed with SBS text
+//     const { engine } = require('.../analyser/node');
+//     engine.init({ position_lat, position_lon, distance_max_nm, directory });
+//     engine.ingest(chunk) -> positions accepted; engine.aircraft(), engine.aircraft('ABC123'), engine.stats(), engine.count()
+//     engine.coverage(), engine.coverageAt(lat, lon, alt), engine.coverageLayer(z) -> Uint16Array
+//     engine.distance(lat1, lon1, lat2, lon2), engine.bearing(...), engine.distanceBatch(lat, lon, lats, lons, true) -> { distance, bearing }
+
+module.exports = {
+    shm: require('./build/Release/adsb_shm.node'),
+    engine: require('./build/Release/adsb_engine.node'),
+};
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------------------------------------------